@@ -44,6 +44,7 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <netdb.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -289,6 +290,7 @@ fetch_connect(struct url *cache_url, struct url *url, int af, int verbose)
 	return (conn);
 }
 
+static pthread_mutex_t connection_cache_lock = PTHREAD_MUTEX_INITIALIZER;
 static conn_t *connection_cache;
 static int cache_global_limit = 0;
 static int cache_per_host_limit = 0;
@@ -320,10 +322,12 @@ fetchConnectionCacheClose(void)
 {
 	conn_t *conn;
 
+	pthread_mutex_lock(&connection_cache_lock);
 	while ((conn = connection_cache) != NULL) {
 		connection_cache = conn->next_cached;
 		(*conn->cache_close)(conn);
 	}
+	pthread_mutex_unlock(&connection_cache_lock);
 }
 
 /*
@@ -335,6 +339,7 @@ fetch_cache_get(const struct url *url, int af)
 {
 	conn_t *conn, *last_conn = NULL;
 
+	pthread_mutex_lock(&connection_cache_lock);
 	for (conn = connection_cache; conn; conn = conn->next_cached) {
 		if (conn->cache_url->port == url->port &&
 		    strcmp(conn->cache_url->scheme, url->scheme) == 0 &&
@@ -347,9 +352,11 @@ fetch_cache_get(const struct url *url, int af)
 				last_conn->next_cached = conn->next_cached;
 			else
 				connection_cache = conn->next_cached;
+			pthread_mutex_unlock(&connection_cache_lock);
 			return conn;
 		}
 	}
+	pthread_mutex_unlock(&connection_cache_lock);
 
 	return NULL;
 }
@@ -370,6 +377,7 @@ fetch_cache_put(conn_t *conn, int (*closecb)(conn_t *))
 		return;
 	}
 
+	pthread_mutex_lock(&connection_cache_lock);
 	global_count = host_count = 0;
 	last = NULL;
 	for (iter = connection_cache; iter; last = iter, iter = next_cached) {
@@ -391,6 +399,7 @@ fetch_cache_put(conn_t *conn, int (*closecb)(conn_t *))
 	conn->cache_close = closecb;
 	conn->next_cached = connection_cache;
 	connection_cache = conn;
+	pthread_mutex_unlock(&connection_cache_lock);
 }
 
 /*
@@ -952,7 +961,7 @@ fetchFreeURLList(struct url_list *ue)
 static const char *
 fetch_read_word(FILE *f)
 {
-	static char word[1024];
+	static _Thread_local char word[1024];
 
 	if (fscanf(f, " %1023s ", word) != 1)
 		return (NULL);
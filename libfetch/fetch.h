@@ -168,7 +168,7 @@ typedef int (*auth_t)(struct url *);
 extern auth_t		 fetchAuthMethod;
 
 /* Last error code */
-extern struct fetch_error fetchLastErrCode;
+extern _Thread_local struct fetch_error fetchLastErrCode;
 
 /* I/O timeout */
 extern int		 fetchTimeout;
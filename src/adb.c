@@ -1357,12 +1357,29 @@ err:
 	return r;
 }
 
+static void adb_signature_id(struct adb *db, apk_blob_t md, apk_blob_t sigb, struct apk_digest *id)
+{
+	struct apk_digest_ctx dctx;
+	uint32_t schema = htole32(db->schema);
+
+	apk_digest_set(id, APK_DIGEST_NONE);
+	if (apk_digest_ctx_init(&dctx, APK_DIGEST_SHA256) != 0) return;
+	if (apk_digest_ctx_update(&dctx, &schema, sizeof schema) == 0 &&
+	    apk_digest_ctx_update(&dctx, md.ptr, md.len) == 0 &&
+	    apk_digest_ctx_update(&dctx, sigb.ptr, sigb.len) == 0)
+		apk_digest_ctx_final(&dctx, id);
+	apk_digest_ctx_free(&dctx);
+}
+
 int adb_trust_verify_signature(struct apk_trust *trust, struct adb *db, struct adb_verify_ctx *vfy, apk_blob_t sigb)
 {
+	struct apk_digest id;
+	struct apk_digest_ctx dctx;
 	struct apk_trust_key *tkey;
 	struct adb_sign_hdr *sig;
 	struct adb_sign_v0 *sig0;
 	apk_blob_t md;
+	int r = -APKE_SIGNATURE_UNTRUSTED;
 
 	if (APK_BLOB_IS_NULL(db->adb)) return -APKE_ADB_BLOCK;
 	if (sigb.len < sizeof(struct adb_sign_hdr)) return -APKE_ADB_SIGNATURE;
@@ -1372,17 +1389,29 @@ int adb_trust_verify_signature(struct apk_trust *trust, struct adb *db, struct a
 	if (sigb.len < sizeof(struct adb_sign_v0)) return -APKE_ADB_SIGNATURE;
 	sig0 = (struct adb_sign_v0 *) sigb.ptr;
 
+	// Use a private digest context so indexes can be verified concurrently
+	apk_digest_ctx_init(&dctx, APK_DIGEST_NONE);
 	list_for_each_entry(tkey, &trust->trusted_key_list, key_node) {
 		if (memcmp(sig0->id, tkey->key.id, sizeof sig0->id) != 0) continue;
 		if (adb_digest_adb(vfy, sig->hash_alg, db->adb, &md) != 0) continue;
 
-		if (apk_verify_start(&trust->dctx, APK_DIGEST_SHA512, &tkey->key) != 0 ||
-		    adb_digest_v0_signature(&trust->dctx, db->schema, sig0, md) != 0 ||
-		    apk_verify(&trust->dctx, sig0->sig, sigb.len - sizeof *sig0) != 0)
+		// A signature verified earlier with the same trusted keys is
+		// identified by the digest of the signed data and signature
+		adb_signature_id(db, md, sigb, &id);
+		if (apk_trust_verified_lookup(trust, &id)) {
+			r = 0;
+			break;
+		}
+		if (apk_verify_start(&dctx, APK_DIGEST_SHA512, &tkey->key) != 0 ||
+		    adb_digest_v0_signature(&dctx, db->schema, sig0, md) != 0 ||
+		    apk_verify(&dctx, sig0->sig, sigb.len - sizeof *sig0) != 0)
 			continue;
 
-		return 0;
+		apk_trust_verified_add(trust, &id);
+		r = 0;
+		break;
 	}
+	apk_digest_ctx_free(&dctx);
 
-	return -APKE_SIGNATURE_UNTRUSTED;
+	return r;
 }
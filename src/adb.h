@@ -301,7 +301,11 @@ int adb_walk_adb(struct apk_istream *is, struct apk_ostream *os, const struct ap
 struct adb_compression_spec {
 	uint8_t alg;
 	uint8_t level;
+	// fields below are not stored in the file
+	uint8_t window;
+	apk_blob_t dict;
 };
+#define ADB_COMP_SPEC_SIZE	offsetof(struct adb_compression_spec, window)
 
 // Internally, "none" compression is treated specially:
 // none/0 means "default compression"
@@ -313,3 +317,5 @@ struct adb_compression_spec {
 int adb_parse_compression(const char *spec_string, struct adb_compression_spec *spec);
 struct apk_istream *adb_decompress(struct apk_istream *is, struct adb_compression_spec *spec);
 struct apk_ostream *adb_compress(struct apk_ostream *os, struct adb_compression_spec *spec);
+int adb_load_compression_dict(apk_blob_t dict);
+int adb_train_compression_dict(apk_blob_t samples, const size_t *sample_sizes, unsigned int num_samples, apk_blob_t *dict);
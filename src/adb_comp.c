@@ -12,26 +12,40 @@
 struct compression_info {
 	const char *name;
 	uint8_t min_level, max_level;
-	struct apk_ostream *(*compress)(struct apk_ostream *, uint8_t);
+	uint8_t min_window, max_window;
+	struct apk_ostream *(*compress)(struct apk_ostream *, const struct adb_compression_spec *);
 	struct apk_istream *(*decompress)(struct apk_istream *);
 };
 
+static struct apk_ostream *compress_deflate(struct apk_ostream *os, const struct adb_compression_spec *spec)
+{
+	return apk_ostream_deflate(os, spec->level);
+}
+
+#ifdef HAVE_ZSTD
+static struct apk_ostream *compress_zstd(struct apk_ostream *os, const struct adb_compression_spec *spec)
+{
+	return apk_ostream_zstd(os, spec->level, spec->window, spec->dict);
+}
+#endif
+
 static const struct compression_info compression_infos[] = {
 	[ADB_COMP_NONE] = {
 		.name = "none",
 	},
 	[ADB_COMP_DEFLATE] = {
 		.name = "deflate",
-		.compress = apk_ostream_deflate,
+		.compress = compress_deflate,
 		.decompress = apk_istream_deflate,
 		.min_level = 0, .max_level = 9,
 	},
 #ifdef HAVE_ZSTD
 	[ADB_COMP_ZSTD] = {
 		.name = "zstd",
-		.compress = apk_ostream_zstd,
+		.compress = compress_zstd,
 		.decompress = apk_istream_zstd,
 		.min_level = 0, .max_level = 22,
+		.min_window = APK_ZSTD_WINDOWLOG_MIN, .max_window = APK_ZSTD_WINDOWLOG_MAX,
 	},
 #endif
 };
@@ -59,7 +73,7 @@ int adb_parse_compression(const char *spec_string, struct adb_compression_spec *
 	const struct compression_info *ci;
 	const char *delim = strchrnul(spec_string, ':');
 	char *end;
-	long level = 0;
+	long level = 0, window = 0;
 
 	ci = compression_info_by_name(spec_string, delim - spec_string, &spec->alg);
 	if (!ci) goto err;
@@ -68,11 +82,18 @@ int adb_parse_compression(const char *spec_string, struct adb_compression_spec *
 		if (ci->max_level == 0) goto err;
 
 		level = strtol(delim+1, &end, 0);
-		if (*end != 0) goto err;
+		if (*end != 0 && *end != ':') goto err;
 		if (level < ci->min_level || level > ci->max_level) goto err;
+		if (*end == ':') {
+			if (ci->max_window == 0) goto err;
+			window = strtol(end+1, &end, 0);
+			if (*end != 0) goto err;
+			if (window < ci->min_window || window > ci->max_window) goto err;
+		}
 	}
 	if (spec->alg == ADB_COMP_NONE) level = 1;
 	spec->level = level;
+	spec->window = window;
 	return 0;
 err:
 	*spec = (struct adb_compression_spec) { .alg = ADB_COMP_NONE };
@@ -99,7 +120,7 @@ struct apk_istream *adb_decompress(struct apk_istream *is, struct adb_compressio
 		break;
 	case 'c':
 		apk_istream_get(is, 4);
-		apk_istream_read(is, &spec, sizeof spec);
+		apk_istream_read(is, &spec, ADB_COMP_SPEC_SIZE);
 		break;
 	default:
 		goto err;
@@ -143,10 +164,30 @@ struct apk_ostream *adb_compress(struct apk_ostream *os, struct adb_compression_
 	if (spec->level < ci->min_level || spec->level > ci->max_level) goto err;
 
 	if (apk_ostream_write(os, "ADBc", 4) < 0) goto err;
-	if (apk_ostream_write(os, spec, sizeof *spec) < 0) goto err;
-	return ci->compress(os, spec->level);
+	if (apk_ostream_write(os, spec, ADB_COMP_SPEC_SIZE) < 0) goto err;
+	return ci->compress(os, spec);
 
 err:
 	apk_ostream_cancel(os, -APKE_ADB_COMPRESSION);
 	return ERR_PTR(apk_ostream_close(os));
 }
+
+/* Makes the dictionary available to decompress the files that were
+ * compressed with it. Currently only zstd supports dictionaries. */
+int adb_load_compression_dict(apk_blob_t dict)
+{
+#ifdef HAVE_ZSTD
+	return apk_zstd_dict_load(dict);
+#else
+	return -APKE_ADB_COMPRESSION;
+#endif
+}
+
+int adb_train_compression_dict(apk_blob_t samples, const size_t *sample_sizes, unsigned int num_samples, apk_blob_t *dict)
+{
+#ifdef HAVE_ZSTD
+	return apk_zstd_dict_train(samples, sample_sizes, num_samples, dict);
+#else
+	return -APKE_ADB_COMPRESSION;
+#endif
+}
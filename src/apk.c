@@ -31,6 +31,7 @@
 #include "apk_fs.h"
 #include "apk_shim.h"
 #include "apk_process.h"
+#include "apk_query.h"
 
 char **apk_argv;
 
@@ -46,6 +47,7 @@ static void version(struct apk_out *out, const char *prefix)
 	OPT(OPT_GLOBAL_cache_max_age,		APK_OPT_ARG "cache-max-age") \
 	OPT(OPT_GLOBAL_cache_packages,		APK_OPT_BOOL "cache-packages") \
 	OPT(OPT_GLOBAL_cache_predownload,	APK_OPT_BOOL "cache-predownload") \
+	OPT(OPT_GLOBAL_db_snapshot,		APK_OPT_BOOL "db-snapshot") \
 	OPT(OPT_GLOBAL_force,			APK_OPT_SH("f") "force") \
 	OPT(OPT_GLOBAL_force_binary_stdout,	"force-binary-stdout") \
 	OPT(OPT_GLOBAL_force_broken_world,	"force-broken-world") \
@@ -64,6 +66,9 @@ static void version(struct apk_out *out, const char *prefix)
 	OPT(OPT_GLOBAL_no_interactive,		"no-interactive") \
 	OPT(OPT_GLOBAL_no_logfile,		"no-logfile") \
 	OPT(OPT_GLOBAL_no_network,		"no-network") \
+	OPT(OPT_GLOBAL_object_cache,		APK_OPT_ARG "object-cache") \
+	OPT(OPT_GLOBAL_object_cache_link,	APK_OPT_BOOL "object-cache-link") \
+	OPT(OPT_GLOBAL_parallel_downloads,	APK_OPT_ARG "parallel-downloads") \
 	OPT(OPT_GLOBAL_preserve_env,		"preserve-env") \
 	OPT(OPT_GLOBAL_print_arch,		"print-arch") \
 	OPT(OPT_GLOBAL_progress,		APK_OPT_BOOL "progress") \
@@ -74,6 +79,9 @@ static void version(struct apk_out *out, const char *prefix)
 	OPT(OPT_GLOBAL_repository,		APK_OPT_ARG APK_OPT_SH("X") "repository") \
 	OPT(OPT_GLOBAL_repository_config,	APK_OPT_ARG "repository-config") \
 	OPT(OPT_GLOBAL_root,			APK_OPT_ARG APK_OPT_SH("p") "root") \
+	OPT(OPT_GLOBAL_solver_cache,		APK_OPT_BOOL "solver-cache") \
+	OPT(OPT_GLOBAL_sync,			APK_OPT_BOOL "sync") \
+	OPT(OPT_GLOBAL_threaded_inflate,	APK_OPT_BOOL "threaded-inflate") \
 	OPT(OPT_GLOBAL_timeout,			APK_OPT_ARG "timeout") \
 	OPT(OPT_GLOBAL_update_cache,		APK_OPT_SH("U") "update-cache") \
 	OPT(OPT_GLOBAL_uvol_manager,		APK_OPT_ARG "uvol-manager") \
@@ -87,6 +95,9 @@ APK_OPTIONS(optgroup_global_desc, GLOBAL_OPTIONS);
 static int optgroup_global_parse(struct apk_ctx *ac, int opt, const char *optarg)
 {
 	struct apk_out *out = &ac->out;
+	char *end;
+	long n;
+
 	switch (opt) {
 	case OPT_GLOBAL_help:
 		return -ENOTSUP;
@@ -172,6 +183,20 @@ static int optgroup_global_parse(struct apk_ctx *ac, int opt, const char *optarg
 	case OPT_GLOBAL_no_network:
 		ac->flags |= APK_NO_NETWORK;
 		break;
+	case OPT_GLOBAL_object_cache:
+		ac->object_cache_dir = optarg;
+		break;
+	case OPT_GLOBAL_object_cache_link:
+		ac->object_cache_link = APK_OPT_BOOL_VAL(optarg);
+		break;
+	case OPT_GLOBAL_parallel_downloads:
+		n = strtol(optarg, &end, 10);
+		if (end == optarg || *end || n < 0 || n > APK_MAX_PARALLEL_DOWNLOADS) {
+			apk_err(out, "invalid number of parallel downloads: %s", optarg);
+			return -EINVAL;
+		}
+		ac->parallel_downloads = n;
+		break;
 	case OPT_GLOBAL_no_cache:
 		ac->flags |= APK_NO_CACHE;
 		break;
@@ -196,6 +221,18 @@ static int optgroup_global_parse(struct apk_ctx *ac, int opt, const char *optarg
 	case OPT_GLOBAL_cache_predownload:
 		ac->cache_predownload = APK_OPT_BOOL_VAL(optarg);
 		break;
+	case OPT_GLOBAL_db_snapshot:
+		ac->db_snapshot = APK_OPT_BOOL_VAL(optarg);
+		break;
+	case OPT_GLOBAL_solver_cache:
+		ac->solver_cache = APK_OPT_BOOL_VAL(optarg);
+		break;
+	case OPT_GLOBAL_sync:
+		ac->fs_sync = APK_OPT_BOOL_VAL(optarg);
+		break;
+	case OPT_GLOBAL_threaded_inflate:
+		ac->threaded_inflate = APK_OPT_BOOL_VAL(optarg);
+		break;
 	case OPT_GLOBAL_timeout:
 		apk_io_url_set_timeout(atoi(optarg));
 		break;
@@ -256,6 +293,7 @@ static int optgroup_commit_parse(struct apk_ctx *ac, int opt, const char *optarg
 
 #define GENERATION_OPTIONS(OPT) \
 	OPT(OPT_GENERATION_compression,	APK_OPT_ARG APK_OPT_SH("c") "compression") \
+	OPT(OPT_GENERATION_compression_dict, APK_OPT_ARG "compression-dict") \
 	OPT(OPT_GENERATION_sign_key,	APK_OPT_ARG "sign-key")
 
 APK_OPTIONS(optgroup_generation_desc, GENERATION_OPTIONS);
@@ -265,12 +303,26 @@ int optgroup_generation_parse(struct apk_ctx *ac, int optch, const char *optarg)
 	struct apk_trust *trust = &ac->trust;
 	struct apk_out *out = &ac->out;
 	struct apk_trust_key *key;
+	apk_blob_t dict = APK_BLOB_NULL;
+	int r;
 
 	switch (optch) {
 	case OPT_GENERATION_compression:
 		if (adb_parse_compression(optarg, &ac->compspec) != 0)
 			return -EINVAL;
 		break;
+	case OPT_GENERATION_compression_dict:
+		r = apk_blob_from_file(AT_FDCWD, optarg, &dict);
+		if (r == 0) r = adb_load_compression_dict(dict);
+		if (r < 0) {
+			apk_err(out, "Failed to load compression dictionary: %s: %s",
+				optarg, apk_error_str(r));
+			free(dict.ptr);
+			return r;
+		}
+		free(ac->compspec.dict.ptr);
+		ac->compspec.dict = dict;
+		break;
 	case OPT_GENERATION_sign_key:
 		key = apk_trust_load_key(AT_FDCWD, optarg, 1);
 		if (IS_ERR(key)) {
@@ -333,7 +385,7 @@ void *apk_optval_arg(int val, void *optarg)
 }
 
 struct apk_options {
-	struct option options[80];
+	struct option options[96];
 	unsigned short short_option_val[64];
 	char short_options[256];
 	int num_opts, num_sopts;
@@ -634,6 +686,16 @@ int main(int argc, char **argv)
 	apk_out_log_argv(&ctx.out, apk_argv);
 	version(&ctx.out, APK_OUT_LOG_ONLY);
 
+	apk_string_array_resize(&args, 0, argc);
+	for (r = 0; r < argc; r++) apk_string_array_add(&args, argv[r]);
+	if (applet->optgroup_query && ctx.query.mode.args_from_stdin) {
+		r = apk_query_args_from_stdin(&ctx, &args);
+		if (r < 0) {
+			apk_err(out, "reading arguments: %s", apk_error_str(r));
+			goto err;
+		}
+	}
+
 	if (ctx.open_flags) {
 		r = apk_db_open(&db);
 		if (r != 0) {
@@ -642,8 +704,6 @@ int main(int argc, char **argv)
 		}
 	}
 
-	apk_string_array_resize(&args, 0, argc);
-	for (r = 0; r < argc; r++) apk_string_array_add(&args, argv[r]);
 	apk_io_url_set_redirect_callback(NULL);
 
 	r = applet->main(applet_ctx, &ctx, args);
@@ -451,6 +451,7 @@ const struct adb_object_schema schema_index = {
 		ADB_FIELD(ADBI_NDX_DESCRIPTION,	"description",	scalar_string),
 		ADB_FIELD(ADBI_NDX_PACKAGES,	"packages",	schema_pkginfo_array),
 		ADB_FIELD(ADBI_NDX_PKGNAME_SPEC,"pkgname-spec",	scalar_string),
+		ADB_FIELD(ADBI_NDX_COMP_DICT,	"compression-dict", scalar_hexblob),
 	},
 };
 
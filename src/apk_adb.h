@@ -85,7 +85,8 @@ struct adb_data_package {
 #define ADBI_NDX_DESCRIPTION	0x01
 #define ADBI_NDX_PACKAGES	0x02
 #define ADBI_NDX_PKGNAME_SPEC	0x03
-#define ADBI_NDX_MAX		0x04
+#define ADBI_NDX_COMP_DICT	0x04
+#define ADBI_NDX_MAX		0x05
 
 /* Installed DB */
 #define ADBI_IDB_PACKAGES	0x01
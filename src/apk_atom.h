@@ -12,7 +12,14 @@
 #include "apk_blob.h"
 #include "apk_balloc.h"
 
-extern apk_blob_t apk_atom_null;
+struct apk_atom_hashnode {
+	struct hlist_node hash_node;
+	apk_blob_t version_key;
+	apk_blob_t blob;
+};
+
+extern struct apk_atom_hashnode apk_atom_null_node;
+#define apk_atom_null (apk_atom_null_node.blob)
 
 struct apk_atom_pool {
 	struct apk_balloc *ba;
@@ -22,3 +29,11 @@ struct apk_atom_pool {
 void apk_atom_init(struct apk_atom_pool *, struct apk_balloc *ba);
 void apk_atom_free(struct apk_atom_pool *);
 apk_blob_t *apk_atomize_dup(struct apk_atom_pool *atoms, apk_blob_t blob);
+apk_blob_t *apk_atomize_version(struct apk_atom_pool *atoms, apk_blob_t blob);
+
+/* The version sort key of an atom from apk_atomize_version(), or
+ * APK_BLOB_NULL if it has none. */
+static inline apk_blob_t apk_atom_version_key(const apk_blob_t *atom)
+{
+	return container_of(atom, struct apk_atom_hashnode, blob)->version_key;
+}
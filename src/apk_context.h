@@ -39,6 +39,8 @@
 #define APK_FORCE_BINARY_STDOUT		BIT(5)
 #define APK_FORCE_MISSING_REPOSITORIES	BIT(6)
 
+#define APK_MAX_PARALLEL_DOWNLOADS	64
+
 #define APK_OPENF_READ			0x0001
 #define APK_OPENF_WRITE			0x0002
 #define APK_OPENF_CREATE		0x0004
@@ -52,6 +54,7 @@
 #define APK_OPENF_NO_CMDLINE_REPOS	0x1000
 #define APK_OPENF_USERMODE		0x2000
 #define APK_OPENF_ALLOW_ARCH		0x4000
+#define APK_OPENF_LAZY_INDEX		0x8000
 
 #define APK_OPENF_NO_REPOS	(APK_OPENF_NO_SYS_REPOS |	\
 				 APK_OPENF_NO_CMDLINE_REPOS |	\
@@ -65,12 +68,13 @@ struct apk_database;
 struct apk_ctx {
 	struct apk_balloc ba;
 	unsigned int flags, force, open_flags;
-	unsigned int lock_wait, cache_max_age;
+	unsigned int lock_wait, cache_max_age, parallel_downloads;
 	struct apk_out out;
 	struct adb_compression_spec compspec;
 	const char *root;
 	const char *keys_dir;
 	const char *cache_dir;
+	const char *object_cache_dir;
 	const char *repositories_file;
 	const char *uvol;
 	const char *apknew_suffix;
@@ -88,11 +92,16 @@ struct apk_ctx {
 	struct apk_id_cache id_cache;
 	struct apk_database *db;
 	struct apk_query_spec query;
-	int root_fd, dest_fd;
+	int root_fd, dest_fd, object_cache_fd;
 	unsigned int root_set : 1;
 	unsigned int cache_dir_set : 1;
 	unsigned int cache_packages : 1;
 	unsigned int cache_predownload : 1;
+	unsigned int db_snapshot : 1;
+	unsigned int solver_cache : 1;
+	unsigned int fs_sync : 1;
+	unsigned int object_cache_link : 1;
+	unsigned int threaded_inflate : 1;
 	unsigned int keys_loaded : 1;
 	unsigned int legacy_info : 1;
 	unsigned int shim_dirty : 1;
@@ -79,6 +79,7 @@ static inline void apk_digest_push_hex(apk_blob_t *to, struct apk_digest *digest
 struct apk_digest_ctx {
 	uint8_t alg;
 	void *priv;
+	void *accel;
 };
 
 int apk_digest_ctx_init(struct apk_digest_ctx *dctx, uint8_t alg);
@@ -88,6 +89,20 @@ void apk_digest_ctx_free(struct apk_digest_ctx *dctx);
 int apk_digest_ctx_update(struct apk_digest_ctx *dctx, const void *ptr, size_t sz);
 int apk_digest_ctx_final(struct apk_digest_ctx *dctx, struct apk_digest *d);
 
+// Built-in SHA-1 and SHA-256 with CPU specific acceleration, used by
+// the backends for the plain digests when selected
+
+void apk_digest_impl_setup(bool backend_accelerated);
+int apk_digest_impl_select(const char *name);
+const char *apk_digest_impl_name(void);
+
+bool apk_digest_accel_calc(struct apk_digest *d, uint8_t alg, const void *ptr, size_t sz);
+bool apk_digest_accel_init(struct apk_digest_ctx *dctx, uint8_t alg);
+void apk_digest_accel_reset(struct apk_digest_ctx *dctx);
+void apk_digest_accel_free(struct apk_digest_ctx *dctx);
+void apk_digest_accel_update(struct apk_digest_ctx *dctx, const void *ptr, size_t sz);
+void apk_digest_accel_final(struct apk_digest_ctx *dctx, struct apk_digest *d);
+
 // Asymmetric keys
 
 struct apk_pkey {
@@ -9,6 +9,8 @@
 
 #pragma once
 
+#include <sys/stat.h>
+
 #include "apk_version.h"
 #include "apk_hash.h"
 #include "apk_atom.h"
@@ -118,15 +120,37 @@ struct apk_db_dir_instance {
 };
 APK_ARRAY(apk_db_dir_instance_array, struct apk_db_dir_instance *);
 
+/* Stat fingerprint of an installed file whose contents were known to
+ * match the digest. While the fingerprint stays the same, the file is
+ * assumed to be unmodified. */
+struct apk_db_fingerprint {
+	uint64_t dev, ino, size;
+	int64_t mtime_ns, ctime_ns;
+	uint8_t digest_alg;
+	uint8_t reserved[3];
+	uint8_t digest[20];
+};
+APK_ARRAY(apk_db_fingerprint_array, struct apk_db_fingerprint);
+
+/* Reference to a not yet loaded package of a lazily loaded index */
+struct apk_lazy_pkg {
+	unsigned int repo : 5;		/* see APK_MAX_REPOS */
+	unsigned int index : 27;
+};
+APK_ARRAY(apk_lazy_pkg_array, struct apk_lazy_pkg);
+
 struct apk_name {
 	apk_hash_node hash_node;
 	struct apk_provider_array *providers;
 	struct apk_name_array *rdepends;
 	struct apk_name_array *rinstall_if;
+	struct apk_lazy_pkg_array *lazy_pkgs;
 	unsigned is_dependency : 1;
 	unsigned solver_flags_set : 1;
 	unsigned providers_sorted : 1;
 	unsigned has_repository_providers : 1;
+	unsigned lazy_seen : 1;
+	unsigned search_selected : 1;
 	unsigned int foreach_genid;
 	union {
 		struct apk_solver_name_state ss;
@@ -152,6 +176,10 @@ struct apk_repository {
 	apk_blob_t url_index;
 	apk_blob_t url_index_printable;
 	apk_blob_t pkgname_spec;
+
+	struct adb lazy_ndx;
+	struct adb_obj lazy_pkgs;
+	unsigned char *lazy_loaded;
 };
 
 #define APK_DB_LAYER_ROOT		0
@@ -205,12 +233,14 @@ struct apk_database {
 	unsigned int write_arch : 1;
 	unsigned int script_dirs_checked : 1;
 	unsigned int open_complete : 1;
+	unsigned int lazy_index : 1;
 	unsigned int compat_newfeatures : 1;
 	unsigned int compat_notinstallable : 1;
 	unsigned int compat_depversions : 1;
 	unsigned int sorted_names : 1;
 	unsigned int sorted_installed_packages : 1;
 	unsigned int scripts_tar : 1;
+	unsigned int fingerprint_journal : 1;
 
 	struct apk_dependency_array *world;
 	struct apk_id_cache *id_cache;
@@ -225,6 +255,10 @@ struct apk_database {
 	struct apk_string_array *filename_array;
 	struct apk_package_tmpl overlay_tmpl;
 	struct apk_ipkg_creator ic;
+	struct apk_solver_stats *solver_stats;
+	struct apk_solver_cache *solver_cache;
+	struct apk_prefetch *prefetch;
+	struct apk_db_fingerprint_array *fingerprints;
 
 	struct {
 		unsigned stale, updated, unavailable;
@@ -234,6 +268,7 @@ struct apk_database {
 		struct apk_name_array *sorted_names;
 		struct apk_hash names;
 		struct apk_hash packages;
+		struct apk_hash lazy_ids;
 	} available;
 
 	struct {
@@ -276,11 +311,17 @@ struct apk_db_dir *apk_db_dir_query(struct apk_database *db, apk_blob_t name);
 struct apk_db_file *apk_db_file_query(struct apk_database *db,
 				      apk_blob_t dir, apk_blob_t name);
 
+void apk_db_fingerprint_set(struct apk_db_fingerprint *fp, const struct stat *st, struct apk_db_file *dbf);
+bool apk_db_fingerprint_match(struct apk_db_fingerprint_array *fps, const struct apk_db_fingerprint *fp);
+int apk_db_fingerprints_read(struct apk_database *db, struct apk_db_fingerprint_array **fps);
+int apk_db_fingerprints_merge(struct apk_database *db, struct apk_db_fingerprint_array *fps);
+
 const char *apk_db_layer_name(int layer);
 void apk_db_init(struct apk_database *db, struct apk_ctx *ctx);
 int apk_db_open(struct apk_database *db);
 void apk_db_close(struct apk_database *db);
 int apk_db_write_config(struct apk_database *db);
+int apk_db_sync(struct apk_database *db, bool files);
 int apk_db_permanent(struct apk_database *db);
 int apk_db_check_world(struct apk_database *db, struct apk_dependency_array *world);
 int apk_db_fire_triggers(struct apk_database *db);
@@ -303,12 +344,15 @@ struct apk_package *apk_db_get_file_owner(struct apk_database *db, apk_blob_t fi
 
 int apk_db_index_read(struct apk_database *db, struct apk_istream *is, int repo);
 int apk_db_index_read_file(struct apk_database *db, const char *file, int repo);
+void apk_db_name_load_lazy(struct apk_database *db, struct apk_name *name);
+void apk_db_deps_load_lazy(struct apk_database *db, struct apk_dependency_array *deps);
 
 int apk_db_repository_check(struct apk_database *db);
 unsigned int apk_db_get_pinning_mask_repos(struct apk_database *db, unsigned short pinning_mask);
 struct apk_repository *apk_db_select_repo(struct apk_database *db, struct apk_package *pkg);
 
 int apk_repo_index_cache_url(struct apk_database *db, struct apk_repository *repo, int *fd, char *buf, size_t len);
+int apk_repo_owners_cache_url(struct apk_database *db, struct apk_repository *repo, int *fd, char *buf, size_t len);
 int apk_repo_package_url(struct apk_database *db, struct apk_repository *repo, struct apk_package *pkg, int *fd, char *buf, size_t len);
 
 int apk_cache_download(struct apk_database *db, struct apk_repository *repo, struct apk_package *pkg, struct apk_progress *prog);
@@ -320,6 +364,10 @@ int apk_db_cache_foreach_item(struct apk_database *db, apk_cache_item_cb cb);
 
 int apk_db_install_pkg(struct apk_database *db, struct apk_package *oldpkg, struct apk_package *newpkg, struct apk_progress *prog);
 
+struct apk_prefetch *apk_prefetch_start(struct apk_database *db, struct apk_package_array *pkgs, unsigned int depth);
+struct apk_istream *apk_prefetch_take(struct apk_prefetch *pf, struct apk_package *pkg);
+void apk_prefetch_stop(struct apk_prefetch *pf);
+
 struct apk_name_array *apk_db_sorted_names(struct apk_database *db);
 struct apk_package_array *apk_db_sorted_installed_packages(struct apk_database *db);
 
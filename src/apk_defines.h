@@ -80,6 +80,7 @@ enum {
 	APKE_ADB_NO_FROMSTRING,
 	APKE_ADB_LIMIT,
 	APKE_ADB_PACKAGE_FORMAT,
+	APKE_ADB_DICTIONARY,
 	APKE_V2DB_FORMAT,
 	APKE_V2PKG_FORMAT,
 	APKE_V2PKG_INTEGRITY,
@@ -20,6 +20,7 @@ struct apk_extract_ctx;
 struct apk_extract_ops {
 	int (*v2index)(struct apk_extract_ctx *, apk_blob_t *desc, struct apk_istream *is);
 	int (*v2meta)(struct apk_extract_ctx *, struct apk_istream *is);
+	// v3index may keep the index by moving *obj->db out and leaving it adb_init'ed
 	int (*v3index)(struct apk_extract_ctx *, struct adb_obj *);
 	int (*v3meta)(struct apk_extract_ctx *, struct adb_obj *);
 	int (*script)(struct apk_extract_ctx *, unsigned int script, uint64_t size, struct apk_istream *is);
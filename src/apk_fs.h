@@ -50,9 +50,20 @@ struct apk_fsdir_ops {
 #define APK_FSEXTRACTF_NO_OVERWRITE	0x0002
 #define APK_FSEXTRACTF_NO_SYS_XATTRS	0x0004
 #define APK_FSEXTRACTF_NO_DEVICES	0x0008
+#define APK_FSEXTRACTF_LINK_OBJECTS	0x0010
 
 int apk_fs_extract(struct apk_ctx *, const struct apk_file_info *, struct apk_istream *, unsigned int, apk_blob_t);
 
+struct apk_fs_writer;
+typedef void (*apk_fs_writer_cb)(void *ctx, void *cookie, const char *name, int r);
+
+struct apk_fs_writer *apk_fs_writer_create(struct apk_ctx *ac, apk_fs_writer_cb cb, void *cb_ctx);
+int apk_fs_writer_extract(struct apk_fs_writer *w, const struct apk_file_info *fi, struct apk_istream *is, unsigned int extract_flags, apk_blob_t pkgctx, void *cookie);
+void apk_fs_writer_flush(struct apk_fs_writer *w);
+void apk_fs_writer_free(struct apk_fs_writer *w);
+
+int apk_fs_object_store(struct apk_fsdir *d, apk_blob_t filename, uint8_t alg, const uint8_t *digest, bool link);
+
 void apk_fsdir_get(struct apk_fsdir *, apk_blob_t dir, unsigned int extract_flags, struct apk_ctx *ac, apk_blob_t pkgctx);
 
 static inline uint8_t apk_fsdir_priority(struct apk_fsdir *fs) {
@@ -10,6 +10,7 @@
 #pragma once
 #include <stdlib.h>
 #include <stddef.h>
+#include <stdint.h>
 #include "apk_defines.h"
 #include "apk_blob.h"
 
@@ -34,14 +35,34 @@ struct apk_hash_ops {
 typedef struct hlist_node apk_hash_node;
 APK_ARRAY(apk_hash_array, struct hlist_head);
 
+struct apk_hash_slot {
+	uint32_t hash;
+	apk_hash_item item;
+};
+
+struct apk_hash_table {
+	unsigned int mask, shift, used;
+	struct apk_hash_table *next_retired;
+	struct apk_hash_slot slot[];
+};
+
 struct apk_hash {
 	const struct apk_hash_ops *ops;
 	struct apk_hash_array *buckets;
+	/* open addressing mode: 'table' is current, 'old' is being migrated,
+	 * 'retired' were replaced during foreach and are freed after it */
+	struct apk_hash_table *table, *old, *retired;
+	unsigned int migrate_pos, iterating;
 	int num_items;
 };
 
+/* Chained hash with 'num_buckets' fixed buckets */
 void apk_hash_init(struct apk_hash *h, const struct apk_hash_ops *ops,
 		   int num_buckets);
+/* Open addressing hash with incremental resizing, 'size_hint' is the expected
+ * number of items. The item hash_node is not used in this mode. */
+void apk_hash_init_open(struct apk_hash *h, const struct apk_hash_ops *ops,
+			int size_hint);
 void apk_hash_free(struct apk_hash *h);
 
 int apk_hash_foreach(struct apk_hash *h, apk_hash_enumerator_f e, void *ctx);
@@ -62,6 +62,7 @@ struct apk_file_info {
 };
 
 extern size_t apk_io_bufsize;
+extern bool apk_io_threaded_decompress;
 
 struct apk_progress;
 struct apk_istream;
@@ -244,6 +245,7 @@ static inline struct apk_istream *apk_istream_gunzip(struct apk_istream *is) {
 static inline struct apk_istream *apk_istream_deflate(struct apk_istream *is) {
 	return apk_istream_zlib(is, 1, NULL, NULL);
 }
+void apk_istream_gunzip_readahead(struct apk_istream *is);
 
 struct apk_ostream *apk_ostream_zlib(struct apk_ostream *, int, uint8_t);
 static inline struct apk_ostream *apk_ostream_gzip(struct apk_ostream *os) {
@@ -253,5 +255,10 @@ static inline struct apk_ostream *apk_ostream_deflate(struct apk_ostream *os, ui
 	return apk_ostream_zlib(os, 1, level);
 }
 
+#define APK_ZSTD_WINDOWLOG_MIN	10
+#define APK_ZSTD_WINDOWLOG_MAX	30	/* also the largest window accepted when decompressing */
+
 struct apk_istream *apk_istream_zstd(struct apk_istream *);
-struct apk_ostream *apk_ostream_zstd(struct apk_ostream *, uint8_t);
+struct apk_ostream *apk_ostream_zstd(struct apk_ostream *, uint8_t level, uint8_t window, apk_blob_t dict);
+int apk_zstd_dict_load(apk_blob_t dict);
+int apk_zstd_dict_train(apk_blob_t samples, const size_t *sample_sizes, unsigned int num_samples, apk_blob_t *dict);
@@ -0,0 +1,23 @@
+/* apk_io_uring.h - Alpine Package Keeper (APK)
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#pragma once
+#include <stdint.h>
+#include <sys/types.h>
+
+#define APK_IO_URING_LINK	0x01	/* next request runs only if this one succeeds */
+#define APK_IO_URING_HARDLINK	0x02	/* next request runs after this one regardless */
+
+struct apk_io_uring;
+typedef void (*apk_io_uring_cb)(void *ctx, uint64_t user_data, int res);
+
+struct apk_io_uring *apk_io_uring_create(unsigned int entries);
+void apk_io_uring_free(struct apk_io_uring *ring);
+
+int apk_io_uring_unlinkat(struct apk_io_uring *ring, int dirfd, const char *path, int flags, unsigned int sqe_flags, uint64_t user_data);
+int apk_io_uring_openat(struct apk_io_uring *ring, int dirfd, const char *path, int flags, mode_t mode, unsigned int sqe_flags, uint64_t user_data);
+int apk_io_uring_write(struct apk_io_uring *ring, int fd, const void *buf, size_t len, unsigned int sqe_flags, uint64_t user_data);
+int apk_io_uring_close(struct apk_io_uring *ring, int fd, unsigned int sqe_flags, uint64_t user_data);
+int apk_io_uring_run(struct apk_io_uring *ring, apk_io_uring_cb cb, void *ctx);
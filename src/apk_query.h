@@ -8,6 +8,7 @@
 
 #pragma once
 #include "apk_defines.h"
+#include "apk_balloc.h"
 
 struct apk_query_spec;
 struct apk_ostream;
@@ -16,6 +17,7 @@ struct apk_string_array;
 struct apk_package_array;
 struct apk_ctx;
 struct apk_database;
+struct apk_package;
 
 enum {
 	APK_Q_FIELD_QUERY = 0,
@@ -94,6 +96,7 @@ struct apk_query_spec {
 		uint8_t search : 1;
 		uint8_t empty_matches_all : 1;
 		uint8_t summarize : 1;
+		uint8_t args_from_stdin : 1;
 	} mode;
 	struct {
 		uint8_t all_matches : 1;
@@ -129,7 +132,44 @@ int apk_package_serialize(struct apk_package *pkg, struct apk_database *db, stru
 int apk_query_match_serialize(struct apk_query_match *qm, struct apk_database *db, struct apk_query_spec *qs, struct apk_serializer *ser);
 
 int apk_query_who_owns(struct apk_database *db, const char *path, struct apk_query_match *qm, char *buf, size_t bufsz);
+int apk_query_who_owns_batch(struct apk_database *db, struct apk_string_array *paths, apk_query_match_cb match, void *pctx);
+int apk_query_args_from_stdin(struct apk_ctx *ac, struct apk_string_array **args);
 int apk_query_matches(struct apk_ctx *ac, struct apk_query_spec *qs, struct apk_string_array *args, apk_query_match_cb match, void *pctx);
 int apk_query_packages(struct apk_ctx *ac, struct apk_query_spec *qs, struct apk_string_array *args, struct apk_package_array **pkgs);
 int apk_query_run(struct apk_ctx *ac, struct apk_query_spec *q, struct apk_string_array *args, struct apk_serializer *ser);
 int apk_query_main(struct apk_ctx *ac, struct apk_string_array *args);
+
+#define APK_Q_FIELDS_SEARCH_INDEX \
+	(BIT(APK_Q_FIELD_NAME) | BIT(APK_Q_FIELD_PROVIDES) | BIT(APK_Q_FIELD_DESCRIPTION))
+
+struct apk_search_index;
+int apk_search_index_write(struct apk_database *db);
+struct apk_search_index *apk_search_index_open(struct apk_database *db);
+int apk_search_index_select(struct apk_search_index *si, const char *pattern);
+void apk_search_index_reset(struct apk_search_index *si);
+void apk_search_index_close(struct apk_search_index *si);
+
+struct apk_owners_path {
+	apk_blob_t path;
+	uint32_t pkg;
+};
+APK_ARRAY(apk_owners_path_array, struct apk_owners_path);
+
+struct apk_owners_builder {
+	struct apk_balloc ba;
+	struct apk_owners_path_array *paths;
+	uint8_t *ids;
+	uint32_t num_packages;
+};
+
+void apk_owners_builder_init(struct apk_owners_builder *ob);
+void apk_owners_builder_free(struct apk_owners_builder *ob);
+int apk_owners_builder_package(struct apk_owners_builder *ob, apk_blob_t id);
+void apk_owners_builder_path(struct apk_owners_builder *ob, apk_blob_t dir, apk_blob_t name);
+int apk_owners_builder_write(struct apk_owners_builder *ob, struct apk_ostream *os);
+
+struct apk_owners_index;
+struct apk_owners_index *apk_owners_index_open(struct apk_database *db);
+int apk_owners_index_foreach(struct apk_owners_index *oi, apk_blob_t path,
+			     int (*cb)(void *ctx, struct apk_package *pkg), void *ctx);
+void apk_owners_index_close(struct apk_owners_index *oi);
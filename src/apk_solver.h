@@ -54,3 +54,5 @@ void apk_solver_print_errors(struct apk_database *db,
 
 int apk_solver_commit(struct apk_database *db, unsigned short solver_flags,
 		      struct apk_dependency_array *world);
+
+void apk_solver_cache_free(struct apk_database *db);
@@ -25,6 +25,7 @@ struct apk_solver_name_state {
 		};
 	};
 	int order_id;
+	unsigned int cache_id;
 	unsigned short requirers;
 	unsigned short merge_depends;
 	unsigned short merge_provides;
@@ -42,12 +43,14 @@ struct apk_solver_name_state {
 	unsigned has_auto_selectable : 1;
 	unsigned iif_needed : 1;
 	unsigned resolvenow : 1;
+	unsigned reused : 1;
 };
 
 struct apk_solver_package_state {
 	unsigned int conflicts;
 	unsigned short pinning_allowed;
 	unsigned short pinning_preferred;
+	unsigned short tag_mask;
 	unsigned short solver_flags;
 	unsigned short solver_flags_inheritable;
 	unsigned char seen : 1;
@@ -62,3 +65,9 @@ struct apk_solver_package_state {
 	unsigned char iif_failed : 1;
 	unsigned char error : 1;
 };
+
+/* Cumulative solver phase timings, collected when db->solver_stats is set */
+struct apk_solver_stats {
+	uint64_t discover_ns, resolve_ns, changeset_ns;
+	unsigned int solves, restarts;
+};
@@ -7,6 +7,7 @@
  */
 
 #pragma once
+#include <pthread.h>
 #include "apk_blob.h"
 #include "apk_crypto.h"
 
@@ -17,14 +18,30 @@ struct apk_trust_key {
 
 };
 
+struct apk_trust_verified {
+	uint8_t id[APK_DIGEST_LENGTH_SHA256];
+	bool used;
+};
+APK_ARRAY(apk_trust_verified_array, struct apk_trust_verified);
+
 struct apk_trust {
 	struct apk_digest_ctx dctx;
 	struct list_head trusted_key_list;
 	struct list_head private_key_list;
 	unsigned int allow_untrusted : 1;
+
+	pthread_mutex_t verified_lock;
+	struct apk_trust_verified_array *verified;
+	struct apk_digest keyset;
+	bool verified_enabled, verified_dirty;
 };
 
 void apk_trust_init(struct apk_trust *trust);
 void apk_trust_free(struct apk_trust *trust);
 struct apk_trust_key *apk_trust_load_key(int dirfd, const char *filename, int priv);
 struct apk_pkey *apk_trust_key_by_name(struct apk_trust *trust, const char *filename);
+
+void apk_trust_verified_load(struct apk_trust *trust, int dirfd, const char *file);
+int apk_trust_verified_save(struct apk_trust *trust, int dirfd, const char *file);
+bool apk_trust_verified_lookup(struct apk_trust *trust, const struct apk_digest *id);
+void apk_trust_verified_add(struct apk_trust *trust, const struct apk_digest *id);
@@ -21,9 +21,15 @@
 				 APK_VERSION_GREATER)
 #define APK_DEPMASK_CHECKSUM	(APK_VERSION_LESS|APK_VERSION_GREATER)
 
+#define APK_VERSION_KEY_MAX	256
+
 const char *apk_version_op_string(int op);
 int apk_version_result_mask(const char *op);
 int apk_version_result_mask_blob(apk_blob_t op);
 int apk_version_validate(apk_blob_t ver);
 int apk_version_compare(apk_blob_t a, apk_blob_t b);
 int apk_version_match(apk_blob_t a, int op, apk_blob_t b);
+
+bool apk_version_key(apk_blob_t ver, apk_blob_t *to);
+int apk_version_compare_atom(const apk_blob_t *a, const apk_blob_t *b);
+int apk_version_match_atom(const apk_blob_t *a, int op, const apk_blob_t *b);
@@ -101,7 +101,7 @@ static apk_blob_t *generate_version(struct apk_database *db)
 
 	gmtime_r(&now, &tm);
 	strftime(ver, sizeof ver, "%Y%m%d.%H%M%S", &tm);
-	return apk_atomize_dup(&db->atoms, APK_BLOB_STR(ver));
+	return apk_atomize_version(&db->atoms, APK_BLOB_STR(ver));
 }
 
 static int add_main(void *ctx, struct apk_ctx *ac, struct apk_string_array *args)
@@ -175,6 +175,7 @@ static int add_main(void *ctx, struct apk_ctx *ac, struct apk_string_array *args
 			apk_deps_add(&virtpkg.pkg.depends, &dep);
 		} else {
 			apk_deps_add(&world, &dep);
+			apk_db_name_load_lazy(db, dep.name);
 			apk_solver_set_name_flags(dep.name,
 						  actx->solver_flags,
 						  actx->solver_flags);
@@ -183,6 +184,7 @@ static int add_main(void *ctx, struct apk_ctx *ac, struct apk_string_array *args
 	if (actx->virtpkg) {
 		apk_db_pkg_add(db, &virtpkg);
 		apk_deps_add(&world, &virtdep);
+		apk_db_name_load_lazy(db, virtdep.name);
 		apk_solver_set_name_flags(virtdep.name,
 					  actx->solver_flags,
 					  actx->solver_flags);
@@ -199,7 +201,7 @@ static struct apk_applet apk_add = {
 	.name = "add",
 	.options_desc = add_options_desc,
 	.optgroup_commit = 1,
-	.open_flags = APK_OPENF_WRITE,
+	.open_flags = APK_OPENF_WRITE | APK_OPENF_LAZY_INDEX,
 	.remove_empty_arguments = 1,
 	.context_size = sizeof(struct add_ctx),
 	.parse = add_parse_option,
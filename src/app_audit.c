@@ -13,10 +13,15 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <fnmatch.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include "apk_applet.h"
 #include "apk_database.h"
 #include "apk_print.h"
+#include "apk_nproc.h"
+
+#define AUDIT_MAX_JOBS		64
+#define AUDIT_QUEUE_SIZE	1024
 
 enum {
 	MODE_BACKUP = 0,
@@ -26,13 +31,16 @@ enum {
 
 struct audit_ctx {
 	struct apk_istream blob_istream;
-	int verbosity;
+	struct apk_db_fingerprint_array *fingerprints, *journal;
+	int verbosity, jobs;
 	unsigned mode : 2;
 	unsigned recursive : 1;
 	unsigned check_permissions : 1;
 	unsigned packages_only : 1;
 	unsigned ignore_busybox_symlinks : 1;
 	unsigned details : 1;
+	unsigned paranoid : 1;
+	unsigned update_journal : 1;
 };
 
 #define AUDIT_OPTIONS(OPT) \
@@ -41,7 +49,10 @@ struct audit_ctx {
 	OPT(OPT_AUDIT_details,			"details") \
 	OPT(OPT_AUDIT_full,			"full") \
 	OPT(OPT_AUDIT_ignore_busybox_symlinks,	"ignore-busybox-symlinks") \
+	OPT(OPT_AUDIT_jobs,			APK_OPT_ARG APK_OPT_SH("j") "jobs") \
+	OPT(OPT_AUDIT_journal,			"journal") \
 	OPT(OPT_AUDIT_packages,			"packages") \
+	OPT(OPT_AUDIT_paranoid,			"paranoid") \
 	OPT(OPT_AUDIT_protected_paths,		APK_OPT_ARG "protected-paths") \
 	OPT(OPT_AUDIT_recursive,		APK_OPT_SH("r") "recursive") \
 	OPT(OPT_AUDIT_system,			"system")
@@ -100,9 +111,22 @@ static int audit_option_parse(void *applet_ctx, struct apk_ctx *ac, int opt, con
 	case OPT_AUDIT_ignore_busybox_symlinks:
 		actx->ignore_busybox_symlinks = 1;
 		break;
+	case OPT_AUDIT_jobs:
+		actx->jobs = atoi(optarg);
+		if (actx->jobs < 1 || actx->jobs > AUDIT_MAX_JOBS) {
+			apk_err(out, "invalid number of jobs: %s", optarg);
+			return -EINVAL;
+		}
+		break;
+	case OPT_AUDIT_journal:
+		actx->update_journal = 1;
+		break;
 	case OPT_AUDIT_packages:
 		actx->packages_only = 1;
 		break;
+	case OPT_AUDIT_paranoid:
+		actx->paranoid = 1;
+		break;
 	case OPT_AUDIT_protected_paths:
 		r = protected_paths_istream(ac, apk_istream_from_file(AT_FDCWD, optarg));
 		if (r) {
@@ -119,23 +143,54 @@ static int audit_option_parse(void *applet_ctx, struct apk_ctx *ac, int opt, con
 	return 0;
 }
 
+/* An audit result waiting to be reported. The file content checks are
+ * done by the worker threads, and the results are reported in the order
+ * the entries were queued so the output does not depend on the number
+ * of jobs. */
+struct audit_entry {
+	struct apk_db_file *dbf;
+	struct apk_db_acl *dir_acl;
+	struct apk_file_info fi;
+	struct apk_db_fingerprint fp;
+	int reason;
+	bool has_fi, has_fp, pending;
+	unsigned int pathlen;
+	char path[];
+};
+
+struct audit_queue {
+	struct audit_ctx *actx;
+	int root_fd;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond, done_cond;
+	unsigned int head, next, tail;
+	bool stop;
+	unsigned int num_threads;
+	pthread_t threads[AUDIT_MAX_JOBS];
+	struct audit_entry *entries[AUDIT_QUEUE_SIZE];
+};
+
 struct audit_tree_ctx {
 	struct audit_ctx *actx;
 	struct apk_database *db;
 	struct apk_db_dir *dir;
+	struct audit_queue *queue;
 	apk_blob_t apknew_suffix;
 	size_t pathlen;
 	char path[PATH_MAX];
 };
 
 static int audit_file(struct audit_ctx *actx,
-		      struct apk_database *db,
 		      struct apk_db_file *dbf,
 		      int dirfd, const char *name,
-		      struct apk_file_info *fi)
+		      struct audit_entry *e,
+		      struct apk_atom_pool *atoms)
 {
+	struct apk_file_info *fi = &e->fi;
+	struct stat st;
 	int digest_type = APK_DIGEST_SHA256;
 	int xattr_type = APK_DIGEST_SHA1;
+	bool unchanged = false;
 	int rv = 0;
 
 	if (dbf) {
@@ -145,15 +200,30 @@ static int audit_file(struct audit_ctx *actx,
 		if (!actx->details) return 'A';
 	}
 
+	// The stat is taken before hashing, so a concurrent modification
+	// changes the fingerprint and the file is hashed on the next run
+	if (dbf && dbf->digest_alg != APK_DIGEST_NONE &&
+	    (apk_array_len(actx->fingerprints) || actx->update_journal) &&
+	    fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(st.st_mode)) {
+		apk_db_fingerprint_set(&e->fp, &st, dbf);
+		e->has_fp = true;
+		unchanged = apk_db_fingerprint_match(actx->fingerprints, &e->fp);
+	}
+
 	if (apk_fileinfo_get(dirfd, name,
 				APK_FI_NOFOLLOW |
 				APK_FI_XATTR_DIGEST(xattr_type ?: APK_DIGEST_SHA1) |
-				APK_FI_DIGEST(digest_type ?: APK_DIGEST_SHA256),
-				fi, &db->atoms) != 0)
+				APK_FI_DIGEST(unchanged ? APK_DIGEST_NONE : (digest_type ?: APK_DIGEST_SHA256)),
+				fi, atoms) != 0)
 		return 'e';
 
 	if (!dbf) return 'A';
 
+	if (unchanged) {
+		apk_digest_set(&fi->digest, dbf->digest_alg);
+		memcpy(fi->digest.data, dbf->digest, fi->digest.len);
+	}
+
 	if (apk_digest_cmp_blob(&fi->digest, dbf->digest_alg, apk_dbf_digest_blob(dbf)) != 0)
 		rv = 'U';
 	else if (!S_ISLNK(fi->mode) && !dbf->diri->pkg->ipkg->broken_xattr &&
@@ -202,16 +272,20 @@ static const char *format_checksum(const apk_blob_t csum, apk_blob_t b)
 	return ret;
 }
 
-static void report_audit(struct audit_ctx *actx,
-			 char reason, apk_blob_t bfull,
-			 struct apk_db_dir *dir,
-			 struct apk_db_file *file,
-			 struct apk_file_info *fi)
+static void report_audit(struct audit_ctx *actx, struct audit_entry *e)
 {
+	struct apk_db_file *file = e->dbf;
+	struct apk_file_info *fi = e->has_fi ? &e->fi : NULL;
 	struct apk_package *pkg = file ? file->diri->pkg : NULL;
+	apk_blob_t bfull = APK_BLOB_PTR_LEN(e->path, e->pathlen);
 	char csum_buf[8+2*APK_DIGEST_LENGTH_MAX];
-	int verbosity = actx->verbosity;
+	int verbosity = actx->verbosity, reason = e->reason;
 
+	if (actx->update_journal && e->has_fp) {
+		// a record without digest drops the file from the journal
+		if (reason) e->fp.digest_alg = APK_DIGEST_NONE;
+		apk_db_fingerprint_array_add(&actx->journal, e->fp);
+	}
 	if (!reason) return;
 
 	if (actx->packages_only) {
@@ -225,9 +299,7 @@ static void report_audit(struct audit_ctx *actx,
 		printf(BLOB_FMT "\n", BLOB_PRINTF(bfull));
 	} else {
 		if (actx->details) {
-			struct apk_db_acl *acl = NULL;
-			if (file) acl = file->acl;
-			else if (dir && reason != 'D' && reason != 'd') acl = dir->owner->acl;
+			struct apk_db_acl *acl = file ? file->acl : e->dir_acl;
 			if (acl) printf("- mode=%o uid=%d gid=%d%s\n",
 				acl->mode & 07777, acl->uid, acl->gid,
 				file ? format_checksum(apk_dbf_digest_blob(file), APK_BLOB_BUF(csum_buf)) : "");
@@ -239,6 +311,138 @@ static void report_audit(struct audit_ctx *actx,
 	}
 }
 
+static void *audit_worker(void *ctx)
+{
+	struct audit_queue *q = ctx;
+	struct audit_entry *e;
+	struct apk_balloc ba;
+	struct apk_atom_pool atoms;
+
+	apk_balloc_init(&ba, 64*1024);
+	apk_atom_init(&atoms, &ba);
+
+	pthread_mutex_lock(&q->mutex);
+	for (;;) {
+		while (q->next == q->tail && !q->stop)
+			pthread_cond_wait(&q->work_cond, &q->mutex);
+		if (q->next == q->tail) break;
+		e = q->entries[q->next++ % AUDIT_QUEUE_SIZE];
+		if (!e->pending) continue;
+		pthread_mutex_unlock(&q->mutex);
+
+		e->reason = audit_file(q->actx, e->dbf, q->root_fd, e->path, e, &atoms);
+
+		pthread_mutex_lock(&q->mutex);
+		e->pending = false;
+		pthread_cond_signal(&q->done_cond);
+	}
+	pthread_mutex_unlock(&q->mutex);
+
+	apk_atom_free(&atoms);
+	apk_balloc_destroy(&ba);
+	return NULL;
+}
+
+static struct audit_queue *audit_queue_create(struct audit_ctx *actx, int root_fd, int jobs)
+{
+	struct audit_queue *q;
+
+	if (jobs < 2) return NULL;
+	q = calloc(1, sizeof *q);
+	if (!q) return NULL;
+	q->actx = actx;
+	q->root_fd = root_fd;
+	pthread_mutex_init(&q->mutex, NULL);
+	pthread_cond_init(&q->work_cond, NULL);
+	pthread_cond_init(&q->done_cond, NULL);
+	for (int i = 0; i < jobs; i++) {
+		if (pthread_create(&q->threads[q->num_threads], NULL, audit_worker, q) != 0) break;
+		q->num_threads++;
+	}
+	return q;
+}
+
+/* Report the completed entries at the head of the queue, waiting until
+ * at most 'keep' entries remain queued. */
+static void audit_queue_flush(struct audit_queue *q, unsigned int keep)
+{
+	struct audit_entry *e;
+
+	pthread_mutex_lock(&q->mutex);
+	for (;;) {
+		while (q->head != q->tail && !q->entries[q->head % AUDIT_QUEUE_SIZE]->pending) {
+			// workers must not pick up an entry after it is freed
+			if (q->next == q->head) q->next++;
+			e = q->entries[q->head++ % AUDIT_QUEUE_SIZE];
+			pthread_mutex_unlock(&q->mutex);
+			report_audit(q->actx, e);
+			free(e);
+			pthread_mutex_lock(&q->mutex);
+		}
+		if (q->tail - q->head <= keep) break;
+		pthread_cond_wait(&q->done_cond, &q->mutex);
+	}
+	pthread_mutex_unlock(&q->mutex);
+}
+
+static void audit_queue_free(struct audit_queue *q)
+{
+	if (!q) return;
+
+	audit_queue_flush(q, 0);
+	pthread_mutex_lock(&q->mutex);
+	q->stop = true;
+	pthread_cond_broadcast(&q->work_cond);
+	pthread_mutex_unlock(&q->mutex);
+	for (unsigned int i = 0; i < q->num_threads; i++)
+		pthread_join(q->threads[i], NULL);
+	pthread_cond_destroy(&q->done_cond);
+	pthread_cond_destroy(&q->work_cond);
+	pthread_mutex_destroy(&q->mutex);
+	free(q);
+}
+
+/* Queue a result for reporting. With 'pending' set, the file content is
+ * checked first, by a worker thread or directly if there are none. */
+static void audit_submit(struct audit_tree_ctx *atctx, int reason, bool pending, apk_blob_t bfull,
+			 struct apk_db_dir *dir, struct apk_db_file *dbf, struct apk_file_info *fi,
+			 int dirfd, const char *name)
+{
+	struct audit_ctx *actx = atctx->actx;
+	struct audit_queue *q = atctx->queue;
+	struct audit_entry *e;
+
+	if (!reason && !pending) return;
+
+	e = malloc(sizeof *e + bfull.len + 1);
+	if (!e) return;
+	*e = (struct audit_entry) {
+		.dbf = dbf,
+		.reason = reason,
+		.has_fi = fi != NULL,
+		.pending = pending,
+		.pathlen = bfull.len,
+	};
+	if (fi) e->fi = *fi;
+	if (dir && actx->details && reason && reason != 'D' && reason != 'd') e->dir_acl = dir->owner->acl;
+	memcpy(e->path, bfull.ptr, bfull.len);
+	e->path[bfull.len] = 0;
+
+	if (!q || !q->num_threads) {
+		if (e->pending) e->reason = audit_file(actx, dbf, dirfd, name, e, &atctx->db->atoms);
+		report_audit(actx, e);
+		free(e);
+		return;
+	}
+
+	audit_queue_flush(q, AUDIT_QUEUE_SIZE - 1);
+	pthread_mutex_lock(&q->mutex);
+	if (!e->pending && q->next == q->tail) q->next++;
+	q->entries[q->tail++ % AUDIT_QUEUE_SIZE] = e;
+	if (e->pending) pthread_cond_signal(&q->work_cond);
+	pthread_mutex_unlock(&q->mutex);
+}
+
 static int determine_file_protect_mode(struct apk_db_dir *dir, const char *name)
 {
 	int protect_mode = dir->protect_mode;
@@ -277,7 +481,7 @@ static int audit_directory_tree_item(void *ctx, int dirfd, const char *path, con
 	if (apk_fileinfo_get(dirfd, name, APK_FI_NOFOLLOW, &fi, &db->atoms) < 0) {
 		dbf = apk_db_file_query(db, bdir, bent);
 		if (dbf) dbf->audited = 1;
-		report_audit(actx, 'e', bfull, NULL, dbf, NULL);
+		audit_submit(atctx, 'e', false, bfull, NULL, dbf, NULL, dirfd, name);
 		goto done;
 	}
 
@@ -307,7 +511,7 @@ static int audit_directory_tree_item(void *ctx, int dirfd, const char *path, con
 recurse_check:
 		atctx->path[atctx->pathlen++] = '/';
 		bfull.len++;
-		report_audit(actx, reason, bfull, child, NULL, &fi);
+		audit_submit(atctx, reason, false, bfull, child, NULL, &fi, dirfd, name);
 		if (reason != 'D' && recurse) {
 			atctx->dir = child;
 			apk_dir_foreach_file(dirfd, name, audit_directory_tree_item, atctx, NULL);
@@ -369,8 +573,8 @@ recurse_check:
 			if (n == 19 && memcmp(target, "/bin/busybox-extras", 19) == 0)
 				goto done;
 		}
-		if (!reason) reason = audit_file(actx, db, dbf, dirfd, name, &fi);
-		report_audit(actx, reason, bfull, NULL, dbf, &fi);
+		if (!reason && !dbf && !actx->details) reason = 'A';
+		audit_submit(atctx, reason, !reason, bfull, NULL, dbf, &fi, dirfd, name);
 	}
 
 done:
@@ -401,7 +605,11 @@ static int audit_missing_files(apk_hash_item item, void *pctx)
 	struct audit_ctx *actx = pctx;
 	struct apk_db_file *file = item;
 	struct apk_db_dir *dir;
-	char path[PATH_MAX];
+	union {
+		struct audit_entry e;
+		char buf[sizeof(struct audit_entry) + PATH_MAX];
+	} u;
+	apk_blob_t bpath;
 
 	if (file->audited) return 0;
 
@@ -409,9 +617,13 @@ static int audit_missing_files(apk_hash_item item, void *pctx)
 	if (!dir->modified) return 0;
 	if (determine_file_protect_mode(dir, file->name) == APK_PROTECT_IGNORE) return 0;
 
-	report_audit(actx, 'X',
-		apk_blob_fmt(path, sizeof path, DIR_FILE_FMT, DIR_FILE_PRINTF(dir, file)),
-		NULL, file, NULL);
+	u.e = (struct audit_entry) {
+		.dbf = file,
+		.reason = 'X',
+	};
+	bpath = apk_blob_fmt(u.e.path, PATH_MAX, DIR_FILE_FMT, DIR_FILE_PRINTF(dir, file));
+	u.e.pathlen = bpath.len;
+	report_audit(actx, &u.e);
 	return 0;
 }
 
@@ -434,6 +646,16 @@ static int audit_main(void *ctx, struct apk_ctx *ac, struct apk_string_array *ar
 	atctx.actx = actx;
 	atctx.pathlen = 0;
 	atctx.path[0] = 0;
+	if (!actx->jobs) actx->jobs = min(apk_get_nproc(), AUDIT_MAX_JOBS);
+	apk_db_fingerprint_array_init(&actx->fingerprints);
+	apk_db_fingerprint_array_init(&actx->journal);
+	if (!actx->paranoid) {
+		r = apk_db_fingerprints_read(db, &actx->fingerprints);
+		if (r < 0 && r != -ENOENT)
+			apk_warn(out, "fingerprint journal ignored: %s", apk_error_str(r));
+		r = 0;
+	}
+	atctx.queue = audit_queue_create(actx, db->root_fd, actx->jobs);
 
 	if (apk_array_len(args) == 0) {
 		r |= audit_directory_tree(&atctx, db->root_fd, NULL);
@@ -452,9 +674,20 @@ static int audit_main(void *ctx, struct apk_ctx *ac, struct apk_string_array *ar
 			r |= audit_directory_tree(&atctx, db->root_fd, arg);
 		}
 	}
+	audit_queue_free(atctx.queue);
 	if (actx->mode == MODE_SYSTEM || actx->mode == MODE_FULL)
 		apk_hash_foreach(&db->installed.files, audit_missing_files, ctx);
 
+	if (actx->update_journal && !(ac->flags & APK_SIMULATE)) {
+		int rr = apk_db_fingerprints_merge(db, actx->journal);
+		if (rr < 0) {
+			apk_err(out, "unable to write fingerprint journal: %s", apk_error_str(rr));
+			r = rr;
+		}
+	}
+	apk_db_fingerprint_array_free(&actx->journal);
+	apk_db_fingerprint_array_free(&actx->fingerprints);
+
 	return r;
 }
 
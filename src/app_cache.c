@@ -105,7 +105,8 @@ static void cache_clean_item(struct apk_database *db, int static_cache, int dirf
 {
 	struct apk_out *out = &db->ctx->out;
 
-	if (strcmp(name, "installed") == 0) return;
+	if (strcmp(name, "installed") == 0 || strcmp(name, "verified") == 0 ||
+	    strcmp(name, "search.idx") == 0) return;
 	if (pkg) {
 		if (db->ctx->flags & APK_PURGE) {
 			if (db->permanent || !pkg->ipkg) goto delete;
@@ -120,6 +121,8 @@ static void cache_clean_item(struct apk_database *db, int static_cache, int dirf
 		char index_url[PATH_MAX];
 		if (apk_repo_index_cache_url(db, repo, NULL, index_url, sizeof index_url) >= 0 &&
 		    strcmp(name, index_url) == 0) return;
+		if (apk_repo_owners_cache_url(db, repo, NULL, index_url, sizeof index_url) >= 0 &&
+		    strcmp(name, index_url) == 0) return;
 	}
 delete:
 	apk_dbg(out, "deleting %s", name);
@@ -61,57 +61,78 @@ static int info_exists(struct info_ctx *ctx, struct apk_database *db, struct apk
 	return errors;
 }
 
-static int info_who_owns(struct info_ctx *ctx, struct apk_database *db, struct apk_string_array *args)
+struct who_owns_ctx {
+	struct apk_database *db;
+	struct apk_serializer *ser;
+	struct apk_package_array *pkgs;
+	int errors;
+};
+
+static int info_who_owns_match(void *pctx, struct apk_query_match *qm)
+{
+	struct who_owns_ctx *wctx = pctx;
+	struct apk_database *db = wctx->db;
+
+	if (wctx->ser) {
+		apk_ser_start_object(wctx->ser);
+		apk_query_match_serialize(qm, db, &db->ctx->query, wctx->ser);
+		apk_ser_end(wctx->ser);
+		return 0;
+	}
+	if (!qm->pkg) {
+		apk_err(&db->ctx->out, BLOB_FMT ": Could not find owner package", BLOB_PRINTF(qm->query));
+		wctx->errors++;
+		return 0;
+	}
+	if (verbosity >= 1) {
+		printf(BLOB_FMT " %sis owned by " PKG_VER_FMT "\n",
+		       BLOB_PRINTF(qm->query), qm->path_target.ptr ? "symlink target " : "",
+		       PKG_VER_PRINTF(qm->pkg));
+	} else if (!qm->pkg->marked) {
+		qm->pkg->marked = 1;
+		apk_package_array_add(&wctx->pkgs, qm->pkg);
+	}
+	return 0;
+}
+
+static int info_who_owns(struct info_ctx *ctx, struct apk_database *db, struct apk_string_array *args, bool batch)
 {
-	struct apk_out *out = &db->ctx->out;
 	struct apk_query_spec *qs = &db->ctx->query;
-	struct apk_package_array *pkgs;
-	struct apk_serializer *ser = NULL;
+	struct who_owns_ctx wctx = { .db = db };
 	struct apk_query_match qm;
 	char fnbuf[PATH_MAX], buf[PATH_MAX];
-	int errors = 0;
 
 	if (qs->ser != &apk_serializer_query) {
 		if (!qs->fields) qs->fields = BIT(APK_Q_FIELD_QUERY) | BIT(APK_Q_FIELD_PATH_TARGET) | BIT(APK_Q_FIELD_ERROR) | BIT(APK_Q_FIELD_NAME);
-		ser = apk_serializer_init_alloca(qs->ser, apk_ostream_to_fd(STDOUT_FILENO));
-		if (IS_ERR(ser)) return PTR_ERR(ser);
-		apk_ser_start_array(ser, apk_array_len(args));
+		wctx.ser = apk_serializer_init_alloca(qs->ser, apk_ostream_to_fd(STDOUT_FILENO));
+		if (IS_ERR(wctx.ser)) return PTR_ERR(wctx.ser);
+		apk_ser_start_array(wctx.ser, apk_array_len(args));
 	}
-	apk_package_array_init(&pkgs);
-	apk_array_foreach_item(arg, args) {
-		char *fn = arg;
-		if (arg[0] != '/' && realpath(arg, fnbuf)) fn = fnbuf;
-		apk_query_who_owns(db, fn, &qm, buf, sizeof buf);
-		if (ser) {
-			apk_ser_start_object(ser);
-			apk_query_match_serialize(&qm, db, qs, ser);
-			apk_ser_end(ser);
-			continue;
+	apk_package_array_init(&wctx.pkgs);
+	if (batch) {
+		apk_array_foreach(arg, args) {
+			if ((*arg)[0] != '/' && realpath(*arg, fnbuf))
+				*arg = apk_balloc_cstr(&db->ctx->ba, APK_BLOB_STR(fnbuf));
 		}
-		if (!qm.pkg) {
-			apk_err(out, "%s: Could not find owner package", fn);
-			errors++;
-			continue;
-		}
-		if (verbosity >= 1) {
-			printf("%s %sis owned by " PKG_VER_FMT "\n",
-			       fn, qm.path_target.ptr ? "symlink target " : "",
-			       PKG_VER_PRINTF(qm.pkg));
-		} else if (!qm.pkg->marked) {
-			qm.pkg->marked = 1;
-			apk_package_array_add(&pkgs, qm.pkg);
+		apk_query_who_owns_batch(db, args, info_who_owns_match, &wctx);
+	} else {
+		apk_array_foreach_item(arg, args) {
+			char *fn = arg;
+			if (arg[0] != '/' && realpath(arg, fnbuf)) fn = fnbuf;
+			apk_query_who_owns(db, fn, &qm, buf, sizeof buf);
+			info_who_owns_match(&wctx, &qm);
 		}
 	}
-	if (apk_array_len(pkgs) != 0) {
-		apk_array_qsort(pkgs, apk_package_array_qsort);
-		apk_array_foreach_item(pkg, pkgs) printf("%s\n", pkg->name->name);
+	if (apk_array_len(wctx.pkgs) != 0) {
+		apk_array_qsort(wctx.pkgs, apk_package_array_qsort);
+		apk_array_foreach_item(pkg, wctx.pkgs) printf("%s\n", pkg->name->name);
 	}
-	apk_package_array_free(&pkgs);
-	if (ser) {
-		apk_ser_end(ser);
-		apk_serializer_cleanup(ser);
+	apk_package_array_free(&wctx.pkgs);
+	if (wctx.ser) {
+		apk_ser_end(wctx.ser);
+		apk_serializer_cleanup(wctx.ser);
 	}
-	return errors;
+	return wctx.errors;
 }
 
 static void info_print_blob(struct apk_database *db, struct apk_package *pkg, const char *field, apk_blob_t value)
@@ -328,22 +349,15 @@ static int info_parse_option(void *pctx, struct apk_ctx *ac, int opt, const char
 	return 0;
 }
 
-static int info_main(void *ctx, struct apk_ctx *ac, struct apk_string_array *args)
+static int info_run(struct info_ctx *ctx, struct apk_ctx *ac, struct apk_string_array *args, bool from_stdin)
 {
-	struct apk_out *out = &ac->out;
 	struct apk_database *db = ac->db;
 	struct apk_query_spec *qs = &ac->query;
-	struct info_ctx *ictx = (struct info_ctx *) ctx;
 	struct apk_package_array *pkgs;
 	int oneline = 0;
 
-	verbosity = apk_out_verbosity(out);
-	ictx->db = db;
-	qs->filter.revdeps_installed = 1;
-	qs->revdeps_field = APK_Q_FIELD_PACKAGE;
-
-	if (ictx->who_owns) return info_who_owns(ctx, db, args);
-	if (ictx->exists_test) return info_exists(ctx, db, args);
+	if (ctx->who_owns) return info_who_owns(ctx, db, args, from_stdin);
+	if (ctx->exists_test) return info_exists(ctx, db, args);
 
 	qs->filter.all_matches = 1;
 	if (apk_array_len(args) == 0) {
@@ -364,13 +378,28 @@ static int info_main(void *ctx, struct apk_ctx *ac, struct apk_string_array *arg
 			apk_array_foreach_item(pkg, pkgs) info_subactions(ctx, pkg);
 		}
 		apk_package_array_free(&pkgs);
-		if (errors == 0 && ictx->partial_result && qs->fields == APK_Q_FIELDS_ALL)
+		if (errors == 0 && ctx->partial_result && qs->fields == APK_Q_FIELDS_ALL)
 			return 1;
 		return errors;
 	}
 	return apk_query_main(ac, args);
 }
 
+static int info_main(void *ctx, struct apk_ctx *ac, struct apk_string_array *args)
+{
+	struct apk_out *out = &ac->out;
+	struct apk_database *db = ac->db;
+	struct apk_query_spec *qs = &ac->query;
+	struct info_ctx *ictx = (struct info_ctx *) ctx;
+
+	verbosity = apk_out_verbosity(out);
+	ictx->db = db;
+	qs->filter.revdeps_installed = 1;
+	qs->revdeps_field = APK_Q_FIELD_PACKAGE;
+
+	return info_run(ictx, ac, args, qs->mode.args_from_stdin);
+}
+
 static struct apk_applet apk_info = {
 	.name = "info",
 	.options_desc = info_options_desc,
@@ -20,11 +20,14 @@
 #include "apk_database.h"
 #include "apk_extract.h"
 #include "apk_print.h"
+#include "apk_query.h"
 
 struct mkndx_ctx {
 	const char *index;
 	const char *output;
 	const char *description;
+	const char *train_dict;
+	const char *owners;
 	apk_blob_t pkgname_spec;
 	apk_blob_t filter_spec;
 
@@ -35,8 +38,10 @@ struct mkndx_ctx {
 	uint8_t hash_alg;
 	uint8_t pkgname_spec_set : 1;
 	uint8_t filter_spec_set : 1;
+	uint8_t owners_only : 1;
 
 	struct apk_extract_ctx ectx;
+	struct apk_owners_builder ob;
 };
 
 #define ALLOWED_HASH (BIT(APK_DIGEST_SHA256)|BIT(APK_DIGEST_SHA256_160))
@@ -47,8 +52,10 @@ struct mkndx_ctx {
 	OPT(OPT_MKNDX_filter_spec,	APK_OPT_ARG "filter-spec") \
 	OPT(OPT_MKNDX_index,		APK_OPT_ARG APK_OPT_SH("x") "index") \
 	OPT(OPT_MKNDX_output,		APK_OPT_ARG APK_OPT_SH("o") "output") \
+	OPT(OPT_MKNDX_owners,		APK_OPT_ARG "owners") \
 	OPT(OPT_MKNDX_pkgname_spec,	APK_OPT_ARG "pkgname-spec") \
-	OPT(OPT_MKNDX_rewrite_arch,	APK_OPT_ARG "rewrite-arch")
+	OPT(OPT_MKNDX_rewrite_arch,	APK_OPT_ARG "rewrite-arch") \
+	OPT(OPT_MKNDX_train_dict,	APK_OPT_ARG "train-dict")
 
 APK_OPTIONS(mkndx_options_desc, MKNDX_OPTIONS);
 
@@ -82,6 +89,9 @@ static int mkndx_parse_option(void *ctx, struct apk_ctx *ac, int optch, const ch
 	case OPT_MKNDX_output:
 		ictx->output = optarg;
 		break;
+	case OPT_MKNDX_owners:
+		ictx->owners = optarg;
+		break;
 	case OPT_MKNDX_pkgname_spec:
 		ictx->pkgname_spec = APK_BLOB_STR(optarg);
 		ictx->pkgname_spec_set = 1;
@@ -89,6 +99,9 @@ static int mkndx_parse_option(void *ctx, struct apk_ctx *ac, int optch, const ch
 	case OPT_MKNDX_rewrite_arch:
 		apk_err(out, "--rewrite-arch is removed, use instead: --pkgspec-name '%s/${name}-${package}.apk'", optarg);
 		return -ENOTSUP;
+	case OPT_MKNDX_train_dict:
+		ictx->train_dict = optarg;
+		break;
 	default:
 		return -ENOTSUP;
 	}
@@ -146,6 +159,7 @@ static int mkndx_parse_v2meta(struct apk_extract_ctx *ectx, struct apk_istream *
 		if (line.len < 1 || line.ptr[0] == '#') continue;
 		if (!apk_blob_split(line, APK_BLOB_STR(" = "), &k, &v)) continue;
 		apk_extract_v2_control(ectx, k, v);
+		if (ctx->owners_only) continue;
 
 		key.str = k;
 		f = bsearch(&key, fields, ARRAY_SIZE(fields), sizeof(fields[0]), cmpfield);
@@ -173,6 +187,7 @@ static int mkndx_parse_v2meta(struct apk_extract_ctx *ectx, struct apk_istream *
 		adb_wo_pkginfo(&ctx->pkginfo, f->ndx, v);
 	}
 	if (r != -APKE_EOF) return r;
+	if (ctx->owners_only) return 0;
 
 	adb_wo_arr(&ctx->pkginfo, ADBI_PI_DEPENDS, &deps[0]);
 	adb_wo_arr(&ctx->pkginfo, ADBI_PI_PROVIDES, &deps[1]);
@@ -188,11 +203,33 @@ static int mkndx_parse_v2meta(struct apk_extract_ctx *ectx, struct apk_istream *
 static int mkndx_parse_v3meta(struct apk_extract_ctx *ectx, struct adb_obj *pkg)
 {
 	struct mkndx_ctx *ctx = container_of(ectx, struct mkndx_ctx, ectx);
-	struct adb_obj pkginfo;
+	struct adb_obj pkginfo, paths, path, files, file;
 
-	adb_ro_obj(pkg, ADBI_PKG_PKGINFO, &pkginfo);
-	adb_wo_copyobj(&ctx->pkginfo, &pkginfo);
+	if (!ctx->owners_only) {
+		adb_ro_obj(pkg, ADBI_PKG_PKGINFO, &pkginfo);
+		adb_wo_copyobj(&ctx->pkginfo, &pkginfo);
+	}
+	if (!ctx->owners) return 0;
+
+	// the file list is in the metadata, so the file data is not needed
+	adb_ro_obj(pkg, ADBI_PKG_PATHS, &paths);
+	for (int i = ADBI_FIRST; i <= adb_ra_num(&paths); i++) {
+		adb_ro_obj(&paths, i, &path);
+		adb_ro_obj(&path, ADBI_DI_FILES, &files);
+		for (int j = ADBI_FIRST; j <= adb_ra_num(&files); j++) {
+			adb_ro_obj(&files, j, &file);
+			apk_owners_builder_path(&ctx->ob, adb_ro_blob(&path, ADBI_DI_NAME), adb_ro_blob(&file, ADBI_FI_NAME));
+		}
+	}
+	return -ECANCELED;
+}
 
+static int mkndx_parse_file(struct apk_extract_ctx *ectx, const struct apk_file_info *fi, struct apk_istream *is)
+{
+	struct mkndx_ctx *ctx = container_of(ectx, struct mkndx_ctx, ectx);
+
+	if (!S_ISDIR(fi->mode))
+		apk_owners_builder_path(&ctx->ob, APK_BLOB_NULL, APK_BLOB_STR(fi->name));
 	return 0;
 }
 
@@ -201,6 +238,12 @@ static const struct apk_extract_ops extract_ndxinfo_ops = {
 	.v3meta = mkndx_parse_v3meta,
 };
 
+static const struct apk_extract_ops extract_ndxinfo_owners_ops = {
+	.v2meta = mkndx_parse_v2meta,
+	.v3meta = mkndx_parse_v3meta,
+	.file = mkndx_parse_file,
+};
+
 static int find_package(struct adb_obj *pkgs, apk_blob_t path, int64_t filesize, apk_blob_t pkgname_spec)
 {
 	char buf[NAME_MAX], split_char;
@@ -249,6 +292,61 @@ static int find_package(struct adb_obj *pkgs, apk_blob_t path, int64_t filesize,
 	return -APKE_PACKAGE_NOT_FOUND;
 }
 
+/* The samples are the uncompressed ADB streams of the packages, of which
+ * the beginning matters most for small packages. */
+#define TRAIN_SAMPLE_MAX	(128*1024)
+
+static int mkndx_train_dict(struct mkndx_ctx *ctx, struct apk_ctx *ac, struct apk_string_array *args)
+{
+	struct apk_out *out = &ac->out;
+	struct apk_istream *is;
+	struct apk_ostream *os;
+	apk_blob_t dict = APK_BLOB_NULL;
+	uint8_t *samples = NULL, *p;
+	size_t *sizes = NULL, len = 0;
+	unsigned int num = 0;
+	ssize_t n;
+	int r = -ENOMEM;
+
+	sizes = malloc(apk_array_len(args) * sizeof *sizes + 1);
+	if (!sizes) goto err;
+	apk_array_foreach_item(arg, args) {
+		is = adb_decompress(apk_istream_from_file(AT_FDCWD, arg), NULL);
+		if (IS_ERR(is)) {
+			apk_warn(out, "%s: %s, not used for training", arg, apk_error_str(PTR_ERR(is)));
+			continue;
+		}
+		p = realloc(samples, len + TRAIN_SAMPLE_MAX);
+		if (!p) {
+			apk_istream_close(is);
+			goto err;
+		}
+		samples = p;
+		n = apk_istream_read_max(is, &samples[len], TRAIN_SAMPLE_MAX);
+		apk_istream_close(is);
+		if (n <= 0) {
+			apk_warn(out, "%s: %s, not used for training", arg, apk_error_str(n ?: -APKE_EOF));
+			continue;
+		}
+		sizes[num++] = n;
+		len += n;
+	}
+
+	r = adb_train_compression_dict(APK_BLOB_PTR_LEN((char *) samples, len), sizes, num, &dict);
+	if (r < 0) goto err;
+	os = apk_ostream_to_file(AT_FDCWD, ctx->train_dict, 0644);
+	apk_ostream_write_blob(os, dict);
+	r = apk_ostream_close(os);
+	if (r < 0) goto err;
+	apk_msg(out, "Dictionary of %zu bytes trained from %u packages", dict.len, num);
+err:
+	if (r < 0) apk_err(out, "%s: %s", ctx->train_dict, apk_error_str(r));
+	free(dict.ptr);
+	free(samples);
+	free(sizes);
+	return r;
+}
+
 static int mkndx_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *args)
 {
 	struct mkndx_ctx *ctx = pctx;
@@ -262,6 +360,19 @@ static int mkndx_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *a
 	int r, errors = 0, newpkgs = 0, numpkgs;
 	char buf[NAME_MAX];
 	time_t index_mtime = 0;
+	struct adb_compression_spec compspec = ac->compspec;
+
+	if (ctx->train_dict) {
+		r = mkndx_train_dict(ctx, ac, args);
+		if (r < 0 || !ctx->output) return r;
+	}
+
+	adb_init(&odb);
+	adb_w_init_alloca(&ctx->db, ADB_SCHEMA_INDEX, 8000);
+	adb_wo_alloca(&ndx, &schema_index, &ctx->db);
+	adb_wo_alloca(&ctx->pkgs, &schema_pkginfo_array, &ctx->db);
+	adb_wo_alloca(&ctx->pkginfo, &schema_pkginfo, &ctx->db);
+	apk_owners_builder_init(&ctx->ob);
 
 	r = -1;
 	if (!ctx->output) {
@@ -273,16 +384,14 @@ static int mkndx_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *a
 			apk_err(out, "--filter-spec requires --index");
 			goto done;
 		}
+		if (ctx->owners) {
+			apk_err(out, "--owners can not be used with --filter-spec");
+			goto done;
+		}
 		lookup_spec = ctx->filter_spec;
 	}
 
-	apk_extract_init(&ctx->ectx, ac, &extract_ndxinfo_ops);
-
-	adb_init(&odb);
-	adb_w_init_alloca(&ctx->db, ADB_SCHEMA_INDEX, 8000);
-	adb_wo_alloca(&ndx, &schema_index, &ctx->db);
-	adb_wo_alloca(&ctx->pkgs, &schema_pkginfo_array, &ctx->db);
-	adb_wo_alloca(&ctx->pkginfo, &schema_pkginfo, &ctx->db);
+	apk_extract_init(&ctx->ectx, ac, ctx->owners ? &extract_ndxinfo_owners_ops : &extract_ndxinfo_ops);
 
 	if (ctx->index) {
 		apk_fileinfo_get(AT_FDCWD, ctx->index, 0, &fi, 0);
@@ -313,6 +422,18 @@ static int mkndx_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *a
 		if (use_previous && (r = find_package(&opkgs, APK_BLOB_STR(arg), file_size, lookup_spec)) > 0) {
 			apk_dbg(out, "%s: indexed from old index", arg);
 			val = adb_wa_append(&ctx->pkgs, adb_w_copy(&ctx->db, &odb, adb_ro_val(&opkgs, r)));
+			if (ctx->owners) {
+				// the old index has no file lists
+				struct adb_obj opkg;
+				adb_ro_obj(&opkgs, r, &opkg);
+				apk_extract_reset(&ctx->ectx);
+				ctx->owners_only = 1;
+				r = apk_extract(&ctx->ectx, apk_istream_from_file(AT_FDCWD, arg));
+				ctx->owners_only = 0;
+				if (r >= 0 || r == -ECANCELED)
+					r = apk_owners_builder_package(&ctx->ob, adb_ro_blob(&opkg, ADBI_PI_HASHES));
+				if (r < 0) goto err_pkg;
+			}
 		}
 		if (val == ADB_VAL_NULL && !ctx->filter_spec_set) {
 			apk_digest_reset(&digest);
@@ -326,6 +447,10 @@ static int mkndx_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *a
 
 			adb_wo_int(&ctx->pkginfo, ADBI_PI_FILE_SIZE, file_size);
 			adb_wo_blob(&ctx->pkginfo, ADBI_PI_HASHES, APK_DIGEST_BLOB(digest));
+			if (ctx->owners && (r = apk_owners_builder_package(&ctx->ob, APK_DIGEST_BLOB(digest))) < 0) {
+				adb_wo_reset(&ctx->pkginfo);
+				goto err_pkg;
+			}
 
 			if (ctx->pkgname_spec_set &&
 			    (apk_blob_subst(buf, sizeof buf, ctx->pkgname_spec, adb_s_field_subst, &ctx->pkginfo) < 0 ||
@@ -353,11 +478,15 @@ static int mkndx_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *a
 	numpkgs = adb_ra_num(&ctx->pkgs);
 	adb_wo_blob(&ndx, ADBI_NDX_DESCRIPTION, APK_BLOB_STR(ctx->description));
 	if (ctx->pkgname_spec_set) adb_wo_blob(&ndx, ADBI_NDX_PKGNAME_SPEC, ctx->pkgname_spec);
+	// The dictionary of the packages is embedded, so the index itself
+	// is compressed without it
+	if (compspec.dict.len) adb_wo_blob(&ndx, ADBI_NDX_COMP_DICT, compspec.dict);
+	compspec.dict = APK_BLOB_NULL;
 	adb_wo_obj(&ndx, ADBI_NDX_PACKAGES, &ctx->pkgs);
 	adb_w_rootobj(&ndx);
 
 	r = adb_c_create(
-		adb_compress(apk_ostream_to_file(AT_FDCWD, ctx->output, 0644), &ac->compspec),
+		adb_compress(apk_ostream_to_file(AT_FDCWD, ctx->output, 0644), &compspec),
 		&ctx->db, trust);
 
 	if (r == 0)
@@ -365,10 +494,16 @@ static int mkndx_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *a
 	else
 		apk_err(out, "Index creation failed: %s", apk_error_str(r));
 
+	if (r == 0 && ctx->owners) {
+		r = apk_owners_builder_write(&ctx->ob, apk_ostream_to_file(AT_FDCWD, ctx->owners, 0644));
+		if (r < 0) apk_err(out, "%s: %s", ctx->owners, apk_error_str(r));
+	}
+
 done:
 	adb_wo_free(&ctx->pkgs);
 	adb_free(&ctx->db);
 	adb_free(&odb);
+	apk_owners_builder_free(&ctx->ob);
 
 #if 0
 	apk_hash_foreach(&db->available.names, warn_if_no_providers, &counts);
@@ -13,6 +13,7 @@
 #include "apk_database.h"
 #include "apk_version.h"
 #include "apk_print.h"
+#include "apk_query.h"
 
 static int update_parse_options(void *ctx, struct apk_ctx *ac, int opt, const char *optarg)
 {
@@ -32,6 +33,12 @@ static int update_main(void *ctx, struct apk_ctx *ac, struct apk_string_array *a
 	struct apk_database *db = ac->db;
 	const char *msg = "OK:";
 	char buf[64];
+	int r;
+
+	if (db->cache_fd >= 0 && !(ac->flags & APK_SIMULATE)) {
+		r = apk_search_index_write(db);
+		if (r < 0) apk_warn(out, "unable to write search index: %s", apk_error_str(r));
+	}
 
 	if (apk_out_verbosity(out) < 1)
 		return db->repositories.unavailable + db->repositories.stale;
@@ -8,13 +8,9 @@
  */
 
 #include "apk_atom.h"
+#include "apk_version.h"
 
-apk_blob_t apk_atom_null = {0,""};
-
-struct apk_atom_hashnode {
-	struct hlist_node hash_node;
-	apk_blob_t blob;
-};
+struct apk_atom_hashnode apk_atom_null_node = { .blob = {0,""} };
 
 static apk_blob_t atom_hash_get_key(apk_hash_item item)
 {
@@ -31,7 +27,7 @@ static struct apk_hash_ops atom_ops = {
 void apk_atom_init(struct apk_atom_pool *atoms, struct apk_balloc *ba)
 {
 	atoms->ba = ba;
-	apk_hash_init(&atoms->hash, &atom_ops, 10000);
+	apk_hash_init_open(&atoms->hash, &atom_ops, 10000);
 }
 
 void apk_atom_free(struct apk_atom_pool *atoms)
@@ -54,6 +50,22 @@ apk_blob_t *apk_atomize_dup(struct apk_atom_pool *atoms, apk_blob_t blob)
 	ptr = (char*) (atom + 1);
 	memcpy(ptr, blob.ptr, blob.len);
 	atom->blob = APK_BLOB_PTR_LEN(ptr, blob.len);
+	atom->version_key = APK_BLOB_NULL;
 	apk_hash_insert_hashed(&atoms->hash, atom, hash);
 	return &atom->blob;
 }
+
+apk_blob_t *apk_atomize_version(struct apk_atom_pool *atoms, apk_blob_t blob)
+{
+	struct apk_atom_hashnode *atom;
+	apk_blob_t *b = apk_atomize_dup(atoms, blob);
+	char buf[APK_VERSION_KEY_MAX];
+	apk_blob_t key = APK_BLOB_BUF(buf);
+
+	if (b == &apk_atom_null) return b;
+	atom = container_of(b, struct apk_atom_hashnode, blob);
+	if (!APK_BLOB_IS_NULL(atom->version_key)) return b;
+	if (apk_version_key(*b, &key))
+		atom->version_key = apk_balloc_dup(atoms->ba, apk_blob_pushed(APK_BLOB_BUF(buf), key));
+	return b;
+}
@@ -7,6 +7,8 @@
  * SPDX-License-Identifier: GPL-2.0-only
  */
 
+#include <pthread.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include "apk_defines.h"
 #include "apk_database.h"
@@ -288,57 +290,164 @@ static int calc_precision(unsigned int num)
 	return precision;
 }
 
+#define PRECACHE_MAX_THREADS 16
+
+struct precache_job {
+	struct apk_package *pkg;
+	struct apk_repository *repo;
+	unsigned int order;
+};
+
+struct precache_pool {
+	struct apk_database *db;
+	struct progress *prog;
+	struct precache_job *jobs;
+	unsigned int num_jobs, next_job, num_threads;
+	int errors;
+	pthread_mutex_t mutex;
+};
+
+static int cmp_precache_job(const void *p1, const void *p2)
+{
+	const struct precache_job *j1 = p1, *j2 = p2;
+	if (j1->pkg->size != j2->pkg->size) return j1->pkg->size > j2->pkg->size ? -1 : 1;
+	return (int)j1->order - (int)j2->order;
+}
+
+/* All output and progress accounting happens with the pool mutex held,
+ * only the transfer itself runs unlocked. With a single thread the byte
+ * level progress of the current package is reported, otherwise progress
+ * advances per completed package. */
+static void *precache_worker(void *ctx)
+{
+	struct precache_pool *pp = ctx;
+	struct progress *prog = pp->prog;
+	struct apk_out *out = &pp->db->ctx->out;
+	struct apk_progress *item_prog = pp->num_threads == 1 ? &prog->prog : NULL;
+	struct precache_job *job;
+	struct apk_package *pkg;
+	int r;
+
+	pthread_mutex_lock(&pp->mutex);
+	while (pp->next_job < pp->num_jobs) {
+		job = &pp->jobs[pp->next_job++];
+		pkg = job->pkg;
+		apk_msg(out, "(%*i/%i) Downloading " PKG_VER_FMT,
+			prog->total_changes_digits, pp->next_job,
+			prog->total.packages,
+			PKG_VER_PRINTF(pkg));
+		if (item_prog) apk_progress_item_start(item_prog, apk_progress_weight(prog->done.bytes, prog->done.packages), pkg->size);
+		pthread_mutex_unlock(&pp->mutex);
+
+		r = apk_cache_download(pp->db, job->repo, pkg, item_prog);
+
+		pthread_mutex_lock(&pp->mutex);
+		if (r && r != -APKE_FILE_UNCHANGED) {
+			apk_err(out, PKG_VER_FMT ": %s", PKG_VER_PRINTF(pkg), apk_error_str(r));
+			pp->errors++;
+		}
+		if (item_prog) apk_progress_item_end(item_prog);
+		prog->done.bytes += pkg->size;
+		prog->done.packages++;
+		prog->done.changes++;
+		if (!item_prog) apk_progress_update(&prog->prog, apk_progress_weight(prog->done.bytes, prog->done.packages));
+	}
+	pthread_mutex_unlock(&pp->mutex);
+	return NULL;
+}
+
 int apk_solver_precache_changeset(struct apk_database *db, struct apk_changeset *changeset, bool changes_only)
 {
 	struct progress prog = { 0 };
 	struct apk_out *out = &db->ctx->out;
+	struct precache_pool pp = { .db = db, .prog = &prog };
+	pthread_t threads[PRECACHE_MAX_THREADS];
 	struct apk_package *pkg;
 	struct apk_repository *repo;
-	int r, errors = 0;
+	unsigned int i, num_threads, started = 0;
+
+	pp.jobs = malloc(apk_array_len(changeset->changes) * sizeof *pp.jobs);
+	if (!pp.jobs && apk_array_len(changeset->changes)) return -ENOMEM;
 
 	apk_array_foreach(change, changeset->changes) {
 		pkg = change->new_pkg;
 		if (changes_only && pkg == change->old_pkg) continue;
 		if (!pkg || pkg->cached || (pkg->repos & db->local_repos) || !pkg->installed_size) continue;
-		if (!apk_db_select_repo(db, pkg)) continue;
+		if (!(repo = apk_db_select_repo(db, pkg))) continue;
+		pp.jobs[pp.num_jobs] = (struct precache_job) {
+			.pkg = pkg,
+			.repo = repo,
+			.order = pp.num_jobs,
+		};
+		pp.num_jobs++;
 		prog.total.bytes += pkg->size;
 		prog.total.packages++;
 		prog.total.changes++;
 	}
-	if (!prog.total.packages) return 0;
+	if (!prog.total.packages) {
+		free(pp.jobs);
+		return 0;
+	}
+
+	num_threads = db->ctx->parallel_downloads;
+	if (num_threads > PRECACHE_MAX_THREADS) num_threads = PRECACHE_MAX_THREADS;
+	if (num_threads > pp.num_jobs) num_threads = pp.num_jobs;
+	if (num_threads < 1) num_threads = 1;
+	pp.num_threads = num_threads;
+	if (num_threads > 1) {
+		/* Start the largest transfers first so they do not end up
+		 * as the tail of the download. */
+		qsort(pp.jobs, pp.num_jobs, sizeof *pp.jobs, cmp_precache_job);
+		/* Trust and the id cache used by the package extraction are
+		 * loaded lazily, do it before the workers need them */
+		apk_ctx_get_trust(db->ctx);
+		apk_id_cache_resolve_uid(apk_ctx_get_id_cache(db->ctx), APK_BLOB_STRLIT("root"), 0);
+		apk_id_cache_resolve_gid(apk_ctx_get_id_cache(db->ctx), APK_BLOB_STRLIT("root"), 0);
+	}
 
 	prog.total_changes_digits = calc_precision(prog.total.packages);
 	apk_msg(out, "Downloading %d packages...", prog.total.packages);
 
 	apk_progress_start(&prog.prog, out, "download", apk_progress_weight(prog.total.bytes, prog.total.packages));
-	apk_array_foreach(change, changeset->changes) {
-		pkg = change->new_pkg;
-		if (changes_only && pkg == change->old_pkg) continue;
-		if (!pkg || pkg->cached || (pkg->repos & db->local_repos) || !pkg->installed_size) continue;
-		if (!(repo = apk_db_select_repo(db, pkg))) continue;
 
-		apk_msg(out, "(%*i/%i) Downloading " PKG_VER_FMT,
-			prog.total_changes_digits, prog.done.packages+1,
-			prog.total.packages,
-			PKG_VER_PRINTF(pkg));
+	pthread_mutex_init(&pp.mutex, NULL);
+	for (i = 1; i < num_threads; i++)
+		if (pthread_create(&threads[started], NULL, precache_worker, &pp) == 0) started++;
+	precache_worker(&pp);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&pp.mutex);
 
-		apk_progress_item_start(&prog.prog, apk_progress_weight(prog.done.bytes, prog.done.packages), pkg->size);
-		r = apk_cache_download(db, repo, pkg, &prog.prog);
-		if (r && r != -APKE_FILE_UNCHANGED) {
-			apk_err(out, PKG_VER_FMT ": %s", PKG_VER_PRINTF(pkg), apk_error_str(r));
-			errors++;
-		}
-		apk_progress_item_end(&prog.prog);
-		prog.done.bytes += pkg->size;
-		prog.done.packages++;
-		prog.done.changes++;
-	}
 	apk_progress_end(&prog.prog);
+	free(pp.jobs);
 
-	if (errors) return -errors;
+	if (pp.errors) return -pp.errors;
 	return prog.done.packages;
 }
 
+/* Remote packages are downloaded ahead in the background while the
+ * previous ones are extracted. Installation still consumes them in
+ * changeset order and verifies them as usual. */
+static struct apk_prefetch *prefetch_changeset(struct apk_database *db, struct apk_changeset *changeset)
+{
+	struct apk_package_array *pkgs;
+	struct apk_prefetch *pf;
+
+	if (db->ctx->flags & APK_SIMULATE) return NULL;
+
+	apk_package_array_init(&pkgs);
+	apk_array_foreach(change, changeset->changes) {
+		struct apk_package *pkg = change->new_pkg;
+		if (!pkg || !pkg->installed_size || pkg->cached || pkg->filename_ndx) continue;
+		if (pkg->repos & db->local_repos) continue;
+		if (pkg == change->old_pkg && !change->reinstall) continue;
+		apk_package_array_add(&pkgs, pkg);
+	}
+	pf = apk_prefetch_start(db, pkgs, db->ctx->parallel_downloads);
+	apk_package_array_free(&pkgs);
+	return pf;
+}
+
 int apk_solver_commit_changeset(struct apk_database *db,
 				struct apk_changeset *changeset,
 				struct apk_dependency_array *world)
@@ -433,6 +542,7 @@ int apk_solver_commit_changeset(struct apk_database *db,
 		return -1;
 
 	/* Go through changes */
+	db->prefetch = prefetch_changeset(db, changeset);
 	apk_progress_start(&prog.prog, out, "install", apk_progress_weight(prog.total.bytes, prog.total.packages));
 	apk_array_foreach(change, changeset->changes) {
 		r = change->old_pkg &&
@@ -453,9 +563,12 @@ int apk_solver_commit_changeset(struct apk_database *db,
 		count_change(change, &prog.done);
 	}
 	apk_progress_end(&prog.prog);
+	apk_prefetch_stop(db->prefetch);
+	db->prefetch = NULL;
 
 	errors += db->num_dir_update_errors;
 	errors += run_triggers(db, changeset);
+	if (apk_db_sync(db, true) != 0) errors++;
 
 all_done:
 	apk_dependency_array_copy(&db->world, world);
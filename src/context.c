@@ -16,6 +16,7 @@
 #include <sys/stat.h>
 #include "apk_context.h"
 #include "apk_fs.h"
+#include "apk_nproc.h"
 
 static const char *apk_default_root(void)
 {
@@ -63,8 +64,11 @@ void apk_ctx_init(struct apk_ctx *ac)
 	ac->out.verbosity = 1;
 	ac->out.progress_char = "#";
 	ac->cache_max_age = 4*60*60; /* 4 hours default */
+	ac->parallel_downloads = 4;
+	ac->threaded_inflate = apk_get_nproc() > 1;
 	apk_id_cache_init(&ac->id_cache, -1);
 	ac->root_fd = -1;
+	ac->object_cache_fd = -1;
 	ac->legacy_info = 1;
 	ac->apknew_suffix = ".apk-new";
 	ac->default_pkgname_spec = APK_BLOB_STRLIT("${name}-${version}.apk");
@@ -77,6 +81,7 @@ void apk_ctx_free(struct apk_ctx *ac)
 {
 	if (ac->protected_paths) apk_istream_close(ac->protected_paths);
 	apk_digest_ctx_free(&ac->dctx);
+	free(ac->compspec.dict.ptr);
 	apk_id_cache_free(&ac->id_cache);
 	apk_trust_free(&ac->trust);
 	apk_string_array_free(&ac->repository_config_list);
@@ -84,6 +89,7 @@ void apk_ctx_free(struct apk_ctx *ac)
 	apk_string_array_free(&ac->arch_list);
 	apk_string_array_free(&ac->script_environment);
 	if (ac->root_fd >= 0) close(ac->root_fd);
+	if (ac->object_cache_fd >= 0) close(ac->object_cache_fd);
 	if (ac->out.log) fclose(ac->out.log);
 	apk_balloc_destroy(&ac->ba);
 }
@@ -100,6 +106,7 @@ int apk_ctx_prepare(struct apk_ctx *ac)
 	else ac->cache_dir_set = 1;
 	if (!ac->root) ac->root = apk_default_root();
 	if (ac->cache_predownload) ac->cache_packages = 1;
+	apk_io_threaded_decompress = ac->threaded_inflate;
 
 	if (!strcmp(ac->root, "/")) {
 		// No chroot needed if using system root
@@ -158,6 +165,19 @@ int apk_ctx_prepare(struct apk_ctx *ac)
 		ac->out.log = fdopen(fd, "a");
 	}
 
+	if ((ac->open_flags & APK_OPENF_WRITE) && ac->object_cache_dir) {
+		const int oflags = O_DIRECTORY | O_RDONLY | O_CLOEXEC;
+		ac->object_cache_fd = openat(AT_FDCWD, ac->object_cache_dir, oflags);
+		if (ac->object_cache_fd < 0) {
+			mkdirat(AT_FDCWD, ac->object_cache_dir, 0755);
+			ac->object_cache_fd = openat(AT_FDCWD, ac->object_cache_dir, oflags);
+		}
+		if (ac->object_cache_fd < 0) {
+			apk_err(&ac->out, "Unable to open object cache: %s", apk_error_str(errno));
+			return -errno;
+		}
+	}
+
 	if (ac->flags & APK_PRESERVE_ENV) {
 		for (int i = 0; environ[i]; i++)
 			if (strncmp(environ[i], "APK_", 4) != 0)
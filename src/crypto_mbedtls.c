@@ -65,6 +65,7 @@ static inline const mbedtls_md_info_t *apk_digest_alg_to_mdinfo(uint8_t alg)
 
 int apk_digest_calc(struct apk_digest *d, uint8_t alg, const void *ptr, size_t sz)
 {
+	if (apk_digest_accel_calc(d, alg, ptr, sz)) return 0;
 	if (mbedtls_md(apk_digest_alg_to_mdinfo(alg), ptr, sz, d->data))
 		return -APKE_CRYPTO_ERROR;
 
@@ -77,11 +78,13 @@ int apk_digest_ctx_init(struct apk_digest_ctx *dctx, uint8_t alg)
 	struct apk_mbed_digest *md;
 
 	dctx->alg = alg;
+	dctx->accel = NULL;
 	dctx->priv = md = calloc(1, sizeof *md);
 	if (!dctx->priv) return -ENOMEM;
 
 	mbedtls_md_init(&md->md);
 	if (alg == APK_DIGEST_NONE) return 0;
+	if (apk_digest_accel_init(dctx, alg)) return 0;
 	if (mbedtls_md_setup(&md->md, apk_digest_alg_to_mdinfo(alg), 0) ||
 		mbedtls_md_starts(&md->md))
 		return -APKE_CRYPTO_ERROR;
@@ -94,6 +97,10 @@ int apk_digest_ctx_reset(struct apk_digest_ctx *dctx)
 	struct apk_mbed_digest *md = mbed_digest(dctx);
 
 	if (dctx->alg == APK_DIGEST_NONE) return 0;
+	if (dctx->accel) {
+		apk_digest_accel_reset(dctx);
+		return 0;
+	}
 	if (mbedtls_md_starts(&md->md)) return -APKE_CRYPTO_ERROR;
 	return 0;
 }
@@ -104,9 +111,10 @@ int apk_digest_ctx_reset_alg(struct apk_digest_ctx *dctx, uint8_t alg)
 
 	assert(alg != APK_DIGEST_NONE);
 
+	md->sigver_key = NULL;
+	if (apk_digest_accel_init(dctx, alg)) return 0;
 	mbedtls_md_free(&md->md);
 	dctx->alg = alg;
-	md->sigver_key = NULL;
 	if (mbedtls_md_setup(&md->md, apk_digest_alg_to_mdinfo(alg), 0) ||
 	    mbedtls_md_starts(&md->md))
 		return -APKE_CRYPTO_ERROR;
@@ -118,6 +126,7 @@ void apk_digest_ctx_free(struct apk_digest_ctx *dctx)
 {
 	struct apk_mbed_digest *md = mbed_digest(dctx);
 
+	apk_digest_accel_free(dctx);
 	if (md != NULL) {
 		mbedtls_md_free(&md->md);
 		free(md);
@@ -130,6 +139,10 @@ int apk_digest_ctx_update(struct apk_digest_ctx *dctx, const void *ptr, size_t s
 	struct apk_mbed_digest *md = mbed_digest(dctx);
 
 	assert(dctx->alg != APK_DIGEST_NONE);
+	if (dctx->accel) {
+		apk_digest_accel_update(dctx, ptr, sz);
+		return 0;
+	}
 	return mbedtls_md_update(&md->md, ptr, sz) == 0 ? 0 : -APKE_CRYPTO_ERROR;
 }
 
@@ -138,6 +151,10 @@ int apk_digest_ctx_final(struct apk_digest_ctx *dctx, struct apk_digest *d)
 	struct apk_mbed_digest *md = mbed_digest(dctx);
 
 	assert(dctx->alg != APK_DIGEST_NONE);
+	if (dctx->accel) {
+		apk_digest_accel_final(dctx, d);
+		return 0;
+	}
 	if (mbedtls_md_finish(&md->md, d->data)) {
 		apk_digest_reset(d);
 		return -APKE_CRYPTO_ERROR;
@@ -368,4 +385,5 @@ void apk_crypto_init(void)
 #ifdef MBEDTLS_PSA_CRYPTO_C
 	psa_crypto_init();
 #endif
+	apk_digest_impl_setup(false);
 }
@@ -99,6 +99,7 @@ static inline const EVP_MD *apk_digest_alg_to_evp(uint8_t alg) {
 int apk_digest_calc(struct apk_digest *d, uint8_t alg, const void *ptr, size_t sz)
 {
 	unsigned int md_sz = sizeof d->data;
+	if (apk_digest_accel_calc(d, alg, ptr, sz)) return 0;
 	if (EVP_Digest(ptr, sz, d->data, &md_sz, apk_digest_alg_to_evp(alg), 0) != 1)
 		return -APKE_CRYPTO_ERROR;
 	apk_digest_set(d, alg);
@@ -109,6 +110,7 @@ int apk_digest_ctx_init(struct apk_digest_ctx *dctx, uint8_t alg)
 {
 	dctx->alg = alg;
 	dctx->priv = NULL;
+	dctx->accel = NULL;
 
 	apk_digest_set_mdctx(dctx, EVP_MD_CTX_new());
 	if (!ossl_mdctx(dctx)) return -ENOMEM;
@@ -116,6 +118,7 @@ int apk_digest_ctx_init(struct apk_digest_ctx *dctx, uint8_t alg)
 	EVP_MD_CTX_set_flags(ossl_mdctx(dctx), EVP_MD_CTX_FLAG_FINALISE);
 #endif
 	if (dctx->alg == APK_DIGEST_NONE) return 0;
+	if (apk_digest_accel_init(dctx, alg)) return 0;
 	if (EVP_DigestInit_ex(ossl_mdctx(dctx), apk_digest_alg_to_evp(alg), 0) != 1)
 		return -APKE_CRYPTO_ERROR;
 	return 0;
@@ -124,6 +127,10 @@ int apk_digest_ctx_init(struct apk_digest_ctx *dctx, uint8_t alg)
 int apk_digest_ctx_reset(struct apk_digest_ctx *dctx)
 {
 	if (dctx->alg == APK_DIGEST_NONE) return 0;
+	if (dctx->accel) {
+		apk_digest_accel_reset(dctx);
+		return 0;
+	}
 	if (EVP_DigestInit_ex(ossl_mdctx(dctx), NULL, 0) != 1) return -APKE_CRYPTO_ERROR;
 	return 0;
 }
@@ -131,6 +138,7 @@ int apk_digest_ctx_reset(struct apk_digest_ctx *dctx)
 int apk_digest_ctx_reset_alg(struct apk_digest_ctx *dctx, uint8_t alg)
 {
 	assert(alg != APK_DIGEST_NONE);
+	if (apk_digest_accel_init(dctx, alg)) return 0;
 	if (EVP_MD_CTX_reset(ossl_mdctx(dctx)) != 1 ||
 	    EVP_DigestInit_ex(ossl_mdctx(dctx), apk_digest_alg_to_evp(alg), 0) != 1)
 		return -APKE_CRYPTO_ERROR;
@@ -140,12 +148,17 @@ int apk_digest_ctx_reset_alg(struct apk_digest_ctx *dctx, uint8_t alg)
 
 void apk_digest_ctx_free(struct apk_digest_ctx *dctx)
 {
+	apk_digest_accel_free(dctx);
 	apk_digest_set_mdctx(dctx, NULL);
 }
 
 int apk_digest_ctx_update(struct apk_digest_ctx *dctx, const void *ptr, size_t sz)
 {
 	assert(dctx->alg != APK_DIGEST_NONE);
+	if (dctx->accel) {
+		apk_digest_accel_update(dctx, ptr, sz);
+		return 0;
+	}
 	return EVP_DigestUpdate(ossl_mdctx(dctx), ptr, sz) == 1 ? 0 : -APKE_CRYPTO_ERROR;
 }
 
@@ -154,6 +167,10 @@ int apk_digest_ctx_final(struct apk_digest_ctx *dctx, struct apk_digest *d)
 	unsigned int mdlen = sizeof d->data;
 
 	assert(dctx->alg != APK_DIGEST_NONE);
+	if (dctx->accel) {
+		apk_digest_accel_final(dctx, d);
+		return 0;
+	}
 
 	if (EVP_DigestFinal_ex(ossl_mdctx(dctx), d->data, &mdlen) != 1) {
 		apk_digest_reset(d);
@@ -210,6 +227,7 @@ int apk_pkey_load(struct apk_pkey *pkey, int dirfd, const char *fn, int priv)
 
 int apk_sign_start(struct apk_digest_ctx *dctx, uint8_t alg, struct apk_pkey *pkey)
 {
+	apk_digest_accel_free(dctx);
 	if (EVP_MD_CTX_reset(ossl_mdctx(dctx)) != 1 ||
 	    EVP_DigestSignInit(ossl_mdctx(dctx), NULL, apk_digest_alg_to_evp(alg), NULL, ossl_pkey(pkey)) != 1)
 		return -APKE_CRYPTO_ERROR;
@@ -226,6 +244,7 @@ int apk_sign(struct apk_digest_ctx *dctx, void *sig, size_t *len)
 
 int apk_verify_start(struct apk_digest_ctx *dctx, uint8_t alg, struct apk_pkey *pkey)
 {
+	apk_digest_accel_free(dctx);
 	if (EVP_MD_CTX_reset(ossl_mdctx(dctx)) != 1 ||
 	    EVP_DigestVerifyInit(ossl_mdctx(dctx), NULL, apk_digest_alg_to_evp(alg), NULL, ossl_pkey(pkey)) != 1)
 		return -APKE_CRYPTO_ERROR;
@@ -266,4 +285,5 @@ void apk_crypto_init(void)
 #endif
 
 	lookup_algorithms();
+	apk_digest_impl_setup(true);
 }
@@ -0,0 +1,446 @@
+/* crypto_sha.c - Alpine Package Keeper (APK)
+ *
+ * Built-in SHA-1 and SHA-256 with the block function selected at runtime
+ * from the instruction set extensions available. The crypto backends without
+ * their own acceleration use it for plain digests when the CPU supports it.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apk_crypto.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#define SHA_ARM
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <arm_neon.h>
+#if defined(__clang__)
+#define SHA_ARM_TARGET __attribute__((target("crypto")))
+#else
+#define SHA_ARM_TARGET __attribute__((target("+crypto")))
+#endif
+#endif
+
+typedef void (*sha_blocks_fn)(uint32_t *h, const uint8_t *p, size_t nblocks);
+
+struct sha_impl {
+	const char *name;
+	bool (*supported)(void);
+	sha_blocks_fn sha1, sha256;
+};
+
+struct apk_sha_ctx {
+	sha_blocks_fn blocks;
+	uint32_t h[8];
+	uint64_t len;
+	uint8_t buf[64];
+};
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t sha1_k[4] = { 0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6 };
+
+static inline uint32_t rol32(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+static inline uint32_t ror32(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+static inline uint32_t get_be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline void put_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+// Portable implementations
+
+static void sha256_blocks_generic(uint32_t *h, const uint8_t *p, size_t nblocks)
+{
+	uint32_t w[64], a, b, c, d, e, f, g, hh, t1, t2;
+
+	for (; nblocks; nblocks--, p += 64) {
+		for (int i = 0; i < 16; i++) w[i] = get_be32(&p[4*i]);
+		for (int i = 16; i < 64; i++) {
+			uint32_t s0 = ror32(w[i-15], 7) ^ ror32(w[i-15], 18) ^ (w[i-15] >> 3);
+			uint32_t s1 = ror32(w[i-2], 17) ^ ror32(w[i-2], 19) ^ (w[i-2] >> 10);
+			w[i] = w[i-16] + s0 + w[i-7] + s1;
+		}
+		a = h[0]; b = h[1]; c = h[2]; d = h[3];
+		e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+		for (int i = 0; i < 64; i++) {
+			t1 = hh + (ror32(e, 6) ^ ror32(e, 11) ^ ror32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+			t2 = (ror32(a, 2) ^ ror32(a, 13) ^ ror32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			hh = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+		h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+		h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+	}
+}
+
+static void sha1_blocks_generic(uint32_t *h, const uint8_t *p, size_t nblocks)
+{
+	uint32_t w[80], a, b, c, d, e, t;
+
+	for (; nblocks; nblocks--, p += 64) {
+		for (int i = 0; i < 16; i++) w[i] = get_be32(&p[4*i]);
+		for (int i = 16; i < 80; i++) w[i] = rol32(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+		a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+		for (int i = 0; i < 20; i++) {
+			t = rol32(a, 5) + ((b & c) | (~b & d)) + e + sha1_k[0] + w[i];
+			e = d; d = c; c = rol32(b, 30); b = a; a = t;
+		}
+		for (int i = 20; i < 40; i++) {
+			t = rol32(a, 5) + (b ^ c ^ d) + e + sha1_k[1] + w[i];
+			e = d; d = c; c = rol32(b, 30); b = a; a = t;
+		}
+		for (int i = 40; i < 60; i++) {
+			t = rol32(a, 5) + ((b & c) | (b & d) | (c & d)) + e + sha1_k[2] + w[i];
+			e = d; d = c; c = rol32(b, 30); b = a; a = t;
+		}
+		for (int i = 60; i < 80; i++) {
+			t = rol32(a, 5) + (b ^ c ^ d) + e + sha1_k[3] + w[i];
+			e = d; d = c; c = rol32(b, 30); b = a; a = t;
+		}
+		h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+	}
+}
+
+#ifdef SHA_X86
+
+// Intel SHA extensions
+
+static bool x86_has_sha(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+	if (!(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1)) return false;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return false;
+	return (ebx & (1 << 29)) != 0;
+}
+
+#define SHA256NI_ROUNDS(i) do { \
+		if (i < 4) { \
+			m[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) &p[16*i]), mask); \
+		} else { \
+			t = _mm_sha256msg1_epu32(m[i&3], m[(i+1)&3]); \
+			t = _mm_add_epi32(t, _mm_alignr_epi8(m[(i+3)&3], m[(i+2)&3], 4)); \
+			m[i&3] = _mm_sha256msg2_epu32(t, m[(i+3)&3]); \
+		} \
+		t = _mm_add_epi32(m[i&3], _mm_loadu_si128((const __m128i *) &sha256_k[4*i])); \
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, t); \
+		abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(t, 0x0e)); \
+	} while (0)
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_blocks_shani(uint32_t *h, const uint8_t *p, size_t nblocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i abef, cdgh, abef0, cdgh0, m[4], t;
+
+	t = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &h[0]), 0xb1);
+	cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &h[4]), 0x1b);
+	abef = _mm_alignr_epi8(t, cdgh, 8);
+	cdgh = _mm_blend_epi16(cdgh, t, 0xf0);
+
+	for (; nblocks; nblocks--, p += 64) {
+		abef0 = abef;
+		cdgh0 = cdgh;
+		SHA256NI_ROUNDS(0); SHA256NI_ROUNDS(1); SHA256NI_ROUNDS(2); SHA256NI_ROUNDS(3);
+		SHA256NI_ROUNDS(4); SHA256NI_ROUNDS(5); SHA256NI_ROUNDS(6); SHA256NI_ROUNDS(7);
+		SHA256NI_ROUNDS(8); SHA256NI_ROUNDS(9); SHA256NI_ROUNDS(10); SHA256NI_ROUNDS(11);
+		SHA256NI_ROUNDS(12); SHA256NI_ROUNDS(13); SHA256NI_ROUNDS(14); SHA256NI_ROUNDS(15);
+		abef = _mm_add_epi32(abef, abef0);
+		cdgh = _mm_add_epi32(cdgh, cdgh0);
+	}
+
+	t = _mm_shuffle_epi32(abef, 0x1b);
+	cdgh = _mm_shuffle_epi32(cdgh, 0xb1);
+	_mm_storeu_si128((__m128i *) &h[0], _mm_blend_epi16(t, cdgh, 0xf0));
+	_mm_storeu_si128((__m128i *) &h[4], _mm_alignr_epi8(cdgh, t, 8));
+}
+
+/* Each group of four rounds completes the message schedule of the next
+ * groups: sha1msg1 for group i+3, the xor for i+2 and sha1msg2 for i+1. */
+#define SHA1NI_ROUNDS(i) do { \
+		if (i < 4) m[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) &p[16*i]), mask); \
+		if (i == 0) e = _mm_add_epi32(e, m[0]); \
+		else e = _mm_sha1nexte_epu32(prev, m[i&3]); \
+		prev = abcd; \
+		abcd = _mm_sha1rnds4_epu32(abcd, e, i / 5); \
+		if (i >= 1 && i <= 16) m[(i+3)&3] = _mm_sha1msg1_epu32(m[(i+3)&3], m[i&3]); \
+		if (i >= 2 && i <= 17) m[(i+2)&3] = _mm_xor_si128(m[(i+2)&3], m[i&3]); \
+		if (i >= 3 && i <= 18) m[(i+1)&3] = _mm_sha1msg2_epu32(m[(i+1)&3], m[i&3]); \
+	} while (0)
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha1_blocks_shani(uint32_t *h, const uint8_t *p, size_t nblocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd0, e, e0, prev, m[4];
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) h), 0x1b);
+	e0 = _mm_set_epi32(h[4], 0, 0, 0);
+
+	for (; nblocks; nblocks--, p += 64) {
+		abcd0 = abcd;
+		e = e0;
+		SHA1NI_ROUNDS(0); SHA1NI_ROUNDS(1); SHA1NI_ROUNDS(2); SHA1NI_ROUNDS(3);
+		SHA1NI_ROUNDS(4); SHA1NI_ROUNDS(5); SHA1NI_ROUNDS(6); SHA1NI_ROUNDS(7);
+		SHA1NI_ROUNDS(8); SHA1NI_ROUNDS(9); SHA1NI_ROUNDS(10); SHA1NI_ROUNDS(11);
+		SHA1NI_ROUNDS(12); SHA1NI_ROUNDS(13); SHA1NI_ROUNDS(14); SHA1NI_ROUNDS(15);
+		SHA1NI_ROUNDS(16); SHA1NI_ROUNDS(17); SHA1NI_ROUNDS(18); SHA1NI_ROUNDS(19);
+		e0 = _mm_sha1nexte_epu32(prev, e0);
+		abcd = _mm_add_epi32(abcd, abcd0);
+	}
+
+	_mm_storeu_si128((__m128i *) h, _mm_shuffle_epi32(abcd, 0x1b));
+	h[4] = _mm_extract_epi32(e0, 3);
+}
+
+#endif
+
+#ifdef SHA_ARM
+
+// ARMv8 cryptography extensions
+
+static bool arm_has_sha(void)
+{
+	unsigned long hwcap = getauxval(AT_HWCAP);
+	return (hwcap & HWCAP_SHA1) && (hwcap & HWCAP_SHA2);
+}
+
+SHA_ARM_TARGET
+static void sha256_blocks_armce(uint32_t *h, const uint8_t *p, size_t nblocks)
+{
+	uint32x4_t abcd = vld1q_u32(&h[0]), efgh = vld1q_u32(&h[4]);
+	uint32x4_t abcd0, efgh0, m[4], t, tmp;
+
+	for (; nblocks; nblocks--, p += 64) {
+		abcd0 = abcd;
+		efgh0 = efgh;
+		for (int i = 0; i < 4; i++)
+			m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(&p[16*i])));
+		for (int i = 0; i < 16; i++) {
+			if (i >= 4) m[i&3] = vsha256su1q_u32(vsha256su0q_u32(m[i&3], m[(i+1)&3]), m[(i+2)&3], m[(i+3)&3]);
+			t = vaddq_u32(m[i&3], vld1q_u32(&sha256_k[4*i]));
+			tmp = abcd;
+			abcd = vsha256hq_u32(abcd, efgh, t);
+			efgh = vsha256h2q_u32(efgh, tmp, t);
+		}
+		abcd = vaddq_u32(abcd, abcd0);
+		efgh = vaddq_u32(efgh, efgh0);
+	}
+	vst1q_u32(&h[0], abcd);
+	vst1q_u32(&h[4], efgh);
+}
+
+SHA_ARM_TARGET
+static void sha1_blocks_armce(uint32_t *h, const uint8_t *p, size_t nblocks)
+{
+	uint32x4_t abcd = vld1q_u32(h), abcd0, m[4], t;
+	uint32_t e = h[4], e0, e1;
+
+	for (; nblocks; nblocks--, p += 64) {
+		abcd0 = abcd;
+		e0 = e;
+		for (int i = 0; i < 4; i++)
+			m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(&p[16*i])));
+		for (int i = 0; i < 20; i++) {
+			if (i >= 4) m[i&3] = vsha1su1q_u32(vsha1su0q_u32(m[i&3], m[(i+1)&3], m[(i+2)&3]), m[(i+3)&3]);
+			t = vaddq_u32(m[i&3], vdupq_n_u32(sha1_k[i / 5]));
+			e1 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+			if (i < 5) abcd = vsha1cq_u32(abcd, e, t);
+			else if (i < 10 || i >= 15) abcd = vsha1pq_u32(abcd, e, t);
+			else abcd = vsha1mq_u32(abcd, e, t);
+			e = e1;
+		}
+		abcd = vaddq_u32(abcd, abcd0);
+		e += e0;
+	}
+	vst1q_u32(h, abcd);
+	h[4] = e;
+}
+
+#endif
+
+static const struct sha_impl sha_impls[] = {
+#ifdef SHA_X86
+	{ "sha-ni", x86_has_sha, sha1_blocks_shani, sha256_blocks_shani },
+#endif
+#ifdef SHA_ARM
+	{ "armv8-ce", arm_has_sha, sha1_blocks_armce, sha256_blocks_armce },
+#endif
+	{ "generic", NULL, sha1_blocks_generic, sha256_blocks_generic },
+	{ "backend", NULL, NULL, NULL },
+};
+
+#define SHA_IMPL_GENERIC	(ARRAY_SIZE(sha_impls) - 2)
+#define SHA_IMPL_BACKEND	(ARRAY_SIZE(sha_impls) - 1)
+
+static const struct sha_impl *sha_impl = &sha_impls[SHA_IMPL_BACKEND];
+
+/* Use the first hardware accelerated implementation the CPU supports, but
+ * only if the backend does not accelerate the digests itself (OpenSSL does,
+ * and is faster at SHA-1). The portable one is never preferred over the
+ * backend. apk_digest_impl_select() overrides the choice. */
+void apk_digest_impl_setup(bool backend_accelerated)
+{
+	sha_impl = &sha_impls[SHA_IMPL_BACKEND];
+	if (backend_accelerated) return;
+	for (size_t i = 0; i < SHA_IMPL_GENERIC; i++) {
+		if (!sha_impls[i].supported()) continue;
+		sha_impl = &sha_impls[i];
+		break;
+	}
+}
+
+int apk_digest_impl_select(const char *name)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(sha_impls); i++) {
+		if (strcmp(sha_impls[i].name, name) != 0) continue;
+		if (sha_impls[i].supported && !sha_impls[i].supported()) return -ENOTSUP;
+		sha_impl = &sha_impls[i];
+		return 0;
+	}
+	return -ENOENT;
+}
+
+const char *apk_digest_impl_name(void)
+{
+	return sha_impl->name;
+}
+
+static sha_blocks_fn sha_blocks(uint8_t alg)
+{
+	switch (alg) {
+	case APK_DIGEST_SHA1:		return sha_impl->sha1;
+	case APK_DIGEST_SHA256:
+	case APK_DIGEST_SHA256_160:	return sha_impl->sha256;
+	default:			return NULL;
+	}
+}
+
+static void sha_init(struct apk_sha_ctx *sha, uint8_t alg, sha_blocks_fn blocks)
+{
+	static const uint32_t sha1_iv[5] = {
+		0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+	};
+	static const uint32_t sha256_iv[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+
+	sha->blocks = blocks;
+	sha->len = 0;
+	if (alg == APK_DIGEST_SHA1) memcpy(sha->h, sha1_iv, sizeof sha1_iv);
+	else memcpy(sha->h, sha256_iv, sizeof sha256_iv);
+}
+
+static void sha_update(struct apk_sha_ctx *sha, const uint8_t *p, size_t sz)
+{
+	size_t used = sha->len % sizeof sha->buf, n;
+
+	sha->len += sz;
+	if (used) {
+		n = min(sz, sizeof sha->buf - used);
+		memcpy(&sha->buf[used], p, n);
+		p += n, sz -= n, used += n;
+		if (used < sizeof sha->buf) return;
+		sha->blocks(sha->h, sha->buf, 1);
+	}
+	if (sz >= sizeof sha->buf) {
+		n = sz / sizeof sha->buf;
+		sha->blocks(sha->h, p, n);
+		p += n * sizeof sha->buf, sz -= n * sizeof sha->buf;
+	}
+	if (sz) memcpy(sha->buf, p, sz);
+}
+
+static void sha_final(struct apk_sha_ctx *sha, uint8_t alg, struct apk_digest *d)
+{
+	size_t used = sha->len % sizeof sha->buf;
+	uint64_t bits = sha->len * 8;
+	int nwords = alg == APK_DIGEST_SHA1 ? 5 : 8;
+
+	sha->buf[used++] = 0x80;
+	if (used > sizeof sha->buf - 8) {
+		memset(&sha->buf[used], 0, sizeof sha->buf - used);
+		sha->blocks(sha->h, sha->buf, 1);
+		used = 0;
+	}
+	memset(&sha->buf[used], 0, sizeof sha->buf - 8 - used);
+	put_be32(&sha->buf[56], bits >> 32);
+	put_be32(&sha->buf[60], bits);
+	sha->blocks(sha->h, sha->buf, 1);
+
+	for (int i = 0; i < nwords; i++) put_be32(&d->data[4*i], sha->h[i]);
+	apk_digest_set(d, alg);
+}
+
+bool apk_digest_accel_calc(struct apk_digest *d, uint8_t alg, const void *ptr, size_t sz)
+{
+	struct apk_sha_ctx sha;
+	sha_blocks_fn blocks = sha_blocks(alg);
+
+	if (!blocks) return false;
+	sha_init(&sha, alg, blocks);
+	sha_update(&sha, ptr, sz);
+	sha_final(&sha, alg, d);
+	return true;
+}
+
+bool apk_digest_accel_init(struct apk_digest_ctx *dctx, uint8_t alg)
+{
+	sha_blocks_fn blocks = sha_blocks(alg);
+
+	if (!blocks) goto no_accel;
+	if (!dctx->accel) dctx->accel = malloc(sizeof(struct apk_sha_ctx));
+	if (!dctx->accel) goto no_accel;
+	sha_init(dctx->accel, alg, blocks);
+	dctx->alg = alg;
+	return true;
+no_accel:
+	apk_digest_accel_free(dctx);
+	return false;
+}
+
+void apk_digest_accel_reset(struct apk_digest_ctx *dctx)
+{
+	struct apk_sha_ctx *sha = dctx->accel;
+	sha_init(sha, dctx->alg, sha->blocks);
+}
+
+void apk_digest_accel_free(struct apk_digest_ctx *dctx)
+{
+	free(dctx->accel);
+	dctx->accel = NULL;
+}
+
+void apk_digest_accel_update(struct apk_digest_ctx *dctx, const void *ptr, size_t sz)
+{
+	sha_update(dctx->accel, ptr, sz);
+}
+
+void apk_digest_accel_final(struct apk_digest_ctx *dctx, struct apk_digest *d)
+{
+	sha_final(dctx->accel, dctx->alg, d);
+}
@@ -17,6 +17,7 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <fnmatch.h>
+#include <pthread.h>
 #include <sys/file.h>
 #include <sys/stat.h>
 
@@ -33,6 +34,7 @@
 #include "apk_arch.h"
 #include "apk_package.h"
 #include "apk_database.h"
+#include "apk_solver.h"
 #include "apk_ctype.h"
 #include "apk_extract.h"
 #include "apk_process.h"
@@ -40,11 +42,14 @@
 #include "apk_tar.h"
 #include "apk_adb.h"
 #include "apk_fs.h"
+#include "apk_nproc.h"
 
 static const char * const apk_static_cache_dir = "var/cache/apk";
 static const char * const apk_world_file = "etc/apk/world";
 static const char * const apk_arch_file = "etc/apk/arch";
 static const char * const apk_lock_file = "lib/apk/db/lock";
+static const char * const apk_fingerprints_file = "lib/apk/db/fingerprints";
+static const char * const apk_db_snapshot_file = "installed.snapshot";
 
 static struct apk_db_acl *apk_default_acl_dir, *apk_default_acl_file;
 
@@ -70,6 +75,7 @@ static void pkg_name_free(struct apk_name *name)
 	apk_provider_array_free(&name->providers);
 	apk_name_array_free(&name->rdepends);
 	apk_name_array_free(&name->rinstall_if);
+	apk_lazy_pkg_array_free(&name->lazy_pkgs);
 }
 
 static const struct apk_hash_ops pkg_name_hash_ops = {
@@ -101,6 +107,25 @@ static const struct apk_hash_ops pkg_info_hash_ops = {
 	.compare = apk_blob_compare,
 };
 
+struct apk_lazy_id {
+	apk_hash_node hash_node;
+	apk_blob_t id;
+	struct apk_name *name;
+};
+
+static apk_blob_t lazy_id_get_key(apk_hash_item item)
+{
+	return ((struct apk_lazy_id *) item)->id;
+}
+
+static const struct apk_hash_ops lazy_id_hash_ops = {
+	.node_offset = offsetof(struct apk_lazy_id, hash_node),
+	.get_key = lazy_id_get_key,
+	.hash_key = csum_hash,
+	.compare = apk_blob_compare,
+	.delete_item = free,
+};
+
 static apk_blob_t apk_db_dir_get_key(apk_hash_item item)
 {
 	struct apk_db_dir *dir = (struct apk_db_dir *) item;
@@ -181,6 +206,7 @@ struct apk_name *apk_db_get_name(struct apk_database *db, apk_blob_t name)
 	apk_provider_array_init(&pn->providers);
 	apk_name_array_init(&pn->rdepends);
 	apk_name_array_init(&pn->rinstall_if);
+	apk_lazy_pkg_array_init(&pn->lazy_pkgs);
 	apk_hash_insert_hashed(&db->available.names, pn, hash);
 	db->sorted_names = 0;
 
@@ -647,6 +673,13 @@ int apk_repo_index_cache_url(struct apk_database *db, struct apk_repository *rep
 	return apk_blob_subst(buf, len, APK_BLOB_STRLIT("APKINDEX.${hash:8}.tar.gz"), apk_repo_subst, repo);
 }
 
+int apk_repo_owners_cache_url(struct apk_database *db, struct apk_repository *repo, int *fd, char *buf, size_t len)
+{
+	int r = apk_repo_fd(db, &db->cache_repository, fd);
+	if (r < 0) return r;
+	return apk_blob_subst(buf, len, APK_BLOB_STRLIT("OWNERS.${hash:8}"), apk_repo_subst, repo);
+}
+
 int apk_repo_package_url(struct apk_database *db, struct apk_repository *repo, struct apk_package *pkg,
 			 int *fd, char *buf, size_t len)
 {
@@ -900,153 +933,187 @@ err:
 	return apk_istream_close(is);
 }
 
-static int apk_db_fdb_read(struct apk_database *db, struct apk_istream *is, int repo, unsigned layer)
+struct apk_db_fdb_reader {
+	struct apk_database *db;
+	struct apk_package_tmpl tmpl;
+	struct apk_installed_package *ipkg;
+	struct apk_db_dir_instance *diri;
+	struct apk_db_file *file;
+	int repo, lineno;
+	unsigned layer;
+};
+
+static void apk_db_fdb_reader_init(struct apk_db_fdb_reader *rd, struct apk_database *db, int repo, unsigned layer)
 {
+	*rd = (struct apk_db_fdb_reader) {
+		.db = db,
+		.repo = repo,
+		.layer = layer,
+	};
+	apk_pkgtmpl_init(&rd->tmpl);
+	rd->tmpl.pkg.layer = layer;
+}
+
+static int apk_db_fdb_end_package(struct apk_db_fdb_reader *rd)
+{
+	struct apk_database *db = rd->db;
+
+	if (!rd->tmpl.pkg.name) return 0;
+	if (rd->diri) apk_db_dir_apply_diri_permissions(db, rd->diri);
+
+	if (rd->repo >= 0) {
+		rd->tmpl.pkg.repos |= BIT(rd->repo);
+	} else if (rd->repo == APK_REPO_CACHE_INSTALLED) {
+		rd->tmpl.pkg.cached_non_repository = 1;
+	} else if (rd->repo == APK_REPO_DB_INSTALLED && rd->ipkg == NULL) {
+		/* Installed package without files */
+		rd->ipkg = apk_db_ipkg_create(db, &rd->tmpl.pkg);
+	}
+	if (rd->ipkg) apk_db_ipkg_commit(db, rd->ipkg);
+	if (apk_db_pkg_add(db, &rd->tmpl) == NULL)
+		return -APKE_V2DB_FORMAT;
+
+	rd->tmpl.pkg.layer = rd->layer;
+	rd->ipkg = NULL;
+	rd->diri = NULL;
+	return 0;
+}
+
+static int apk_db_fdb_field(struct apk_db_fdb_reader *rd, char field, apk_blob_t l)
+{
+	struct apk_database *db = rd->db;
 	struct apk_out *out = &db->ctx->out;
-	struct apk_package_tmpl tmpl;
-	struct apk_installed_package *ipkg = NULL;
-	struct apk_db_dir_instance *diri = NULL;
-	struct apk_db_file *file = NULL;
+	struct apk_installed_package *ipkg;
 	struct apk_db_acl *acl;
 	struct apk_digest file_digest, xattr_digest;
-	apk_blob_t token = APK_BLOB_STR("\n"), l;
 	mode_t mode;
 	uid_t uid;
 	gid_t gid;
-	int field, r, lineno = 0;
+	int r;
 
-	if (IS_ERR(is)) return PTR_ERR(is);
+	/* Standard index line? */
+	r = apk_pkgtmpl_add_info(db, &rd->tmpl, field, l);
+	if (r == 0) return 0;
+	if (r == 1 && rd->repo == APK_REPO_DB_INSTALLED && rd->ipkg == NULL) {
+		/* Instert to installed database; this needs to
+		 * happen after package name has been read, but
+		 * before first FDB entry. */
+		rd->ipkg = apk_db_ipkg_create(db, &rd->tmpl.pkg);
+	}
+	ipkg = rd->ipkg;
+	if (rd->repo != APK_REPO_DB_INSTALLED || ipkg == NULL) return 0;
+
+	/* Check FDB special entries */
+	switch (field) {
+	case 'g':
+		apk_blob_foreach_word(tag, l)
+			apk_blobptr_array_add(&rd->tmpl.pkg.tags, apk_atomize_dup(&db->atoms, tag));
+		break;
+	case 'F':
+		if (rd->tmpl.pkg.name == NULL) goto bad_entry;
+		if (rd->diri) apk_db_dir_apply_diri_permissions(db, rd->diri);
+		rd->diri = apk_db_diri_get(db, l, &rd->tmpl.pkg);
+		break;
+	case 'a':
+		if (rd->file == NULL) goto bad_entry;
+	case 'M':
+		if (rd->diri == NULL) goto bad_entry;
+		uid = apk_blob_pull_uint(&l, 10);
+		apk_blob_pull_char(&l, ':');
+		gid = apk_blob_pull_uint(&l, 10);
+		apk_blob_pull_char(&l, ':');
+		mode = apk_blob_pull_uint(&l, 8);
+		if (apk_blob_pull_blob_match(&l, APK_BLOB_STR(":")))
+			apk_blob_pull_digest(&l, &xattr_digest);
+		else
+			apk_digest_reset(&xattr_digest);
 
-	apk_pkgtmpl_init(&tmpl);
-	tmpl.pkg.layer = layer;
+		acl = apk_db_acl_atomize_digest(db, mode, uid, gid, &xattr_digest);
+		if (field == 'M')
+			rd->diri->acl = acl;
+		else
+			rd->file->acl = acl;
+		break;
+	case 'R':
+		if (rd->diri == NULL) goto bad_entry;
+		rd->file = apk_db_file_get(db, rd->diri, l);
+		break;
+	case 'Z':
+		if (rd->file == NULL) goto bad_entry;
+		apk_blob_pull_digest(&l, &file_digest);
+		if (file_digest.alg == APK_DIGEST_SHA1 && ipkg->sha256_160)
+			apk_digest_set(&file_digest, APK_DIGEST_SHA256_160);
+		apk_dbf_digest_set(rd->file, file_digest.alg, file_digest.data);
+		break;
+	case 'r':
+		apk_blob_pull_deps(&l, db, &ipkg->replaces, false);
+		break;
+	case 'q':
+		ipkg->replaces_priority = apk_blob_pull_uint(&l, 10);
+		break;
+	case 's':
+		ipkg->repository_tag = apk_db_get_tag_id(db, l);
+		break;
+	case 'f':
+		for (r = 0; r < l.len; r++) {
+			switch (l.ptr[r]) {
+			case 'f': ipkg->broken_files = 1; break;
+			case 's': ipkg->broken_script = 1; break;
+			case 'x': ipkg->broken_xattr = 1; break;
+			case 'S': ipkg->sha256_160 = 1; break;
+			default:
+				if (!(db->ctx->force & APK_FORCE_OLD_APK))
+					goto old_apk_tools;
+			}
+		}
+		break;
+	default:
+		if (r != 0 && !(db->ctx->force & APK_FORCE_OLD_APK))
+			goto old_apk_tools;
+		/* Installed. So mark the package as installable. */
+		rd->tmpl.pkg.filename_ndx = 0;
+		return 0;
+	}
+	if (APK_BLOB_IS_NULL(l)) goto bad_entry;
+	return 0;
+
+old_apk_tools:
+	/* Installed db should not have unsupported fields */
+	apk_err(out, "This apk-tools is too old to handle installed packages");
+	return -APKE_V2DB_FORMAT;
+bad_entry:
+	apk_err(out, "FDB format error (line %d, entry '%c')", rd->lineno, field);
+	return -APKE_V2DB_FORMAT;
+}
+
+static int apk_db_fdb_read(struct apk_database *db, struct apk_istream *is, int repo, unsigned layer)
+{
+	struct apk_db_fdb_reader rd;
+	apk_blob_t token = APK_BLOB_STR("\n"), l;
+	int r = 0;
 
+	if (IS_ERR(is)) return PTR_ERR(is);
+
+	apk_db_fdb_reader_init(&rd, db, repo, layer);
 	while (apk_istream_get_delim(is, token, &l) == 0) {
-		lineno++;
+		rd.lineno++;
 
 		if (l.len < 2) {
-			if (!tmpl.pkg.name) continue;
-			if (diri) apk_db_dir_apply_diri_permissions(db, diri);
-
-			if (repo >= 0) {
-				tmpl.pkg.repos |= BIT(repo);
-			} else if (repo == APK_REPO_CACHE_INSTALLED) {
-				tmpl.pkg.cached_non_repository = 1;
-			} else if (repo == APK_REPO_DB_INSTALLED && ipkg == NULL) {
-				/* Installed package without files */
-				ipkg = apk_db_ipkg_create(db, &tmpl.pkg);
-			}
-			if (ipkg) apk_db_ipkg_commit(db, ipkg);
-			if (apk_db_pkg_add(db, &tmpl) == NULL)
-				goto err_fmt;
-
-			tmpl.pkg.layer = layer;
-			ipkg = NULL;
-			diri = NULL;
+			r = apk_db_fdb_end_package(&rd);
+			if (r < 0) break;
 			continue;
 		}
 
 		/* Get field */
-		field = l.ptr[0];
-		if (l.ptr[1] != ':') goto err_fmt;
-		l.ptr += 2;
-		l.len -= 2;
-
-		/* Standard index line? */
-		r = apk_pkgtmpl_add_info(db, &tmpl, field, l);
-		if (r == 0) continue;
-		if (r == 1 && repo == APK_REPO_DB_INSTALLED && ipkg == NULL) {
-			/* Instert to installed database; this needs to
-			 * happen after package name has been read, but
-			 * before first FDB entry. */
-			ipkg = apk_db_ipkg_create(db, &tmpl.pkg);
-		}
-		if (repo != APK_REPO_DB_INSTALLED || ipkg == NULL) continue;
-
-		/* Check FDB special entries */
-		switch (field) {
-		case 'g':
-			apk_blob_foreach_word(tag, l)
-				apk_blobptr_array_add(&tmpl.pkg.tags, apk_atomize_dup(&db->atoms, tag));
-			break;
-		case 'F':
-			if (tmpl.pkg.name == NULL) goto bad_entry;
-			if (diri) apk_db_dir_apply_diri_permissions(db, diri);
-			diri = apk_db_diri_get(db, l, &tmpl.pkg);
-			break;
-		case 'a':
-			if (file == NULL) goto bad_entry;
-		case 'M':
-			if (diri == NULL) goto bad_entry;
-			uid = apk_blob_pull_uint(&l, 10);
-			apk_blob_pull_char(&l, ':');
-			gid = apk_blob_pull_uint(&l, 10);
-			apk_blob_pull_char(&l, ':');
-			mode = apk_blob_pull_uint(&l, 8);
-			if (apk_blob_pull_blob_match(&l, APK_BLOB_STR(":")))
-				apk_blob_pull_digest(&l, &xattr_digest);
-			else
-				apk_digest_reset(&xattr_digest);
-
-			acl = apk_db_acl_atomize_digest(db, mode, uid, gid, &xattr_digest);
-			if (field == 'M')
-				diri->acl = acl;
-			else
-				file->acl = acl;
+		if (l.ptr[1] != ':') {
+			r = -APKE_V2DB_FORMAT;
 			break;
-		case 'R':
-			if (diri == NULL) goto bad_entry;
-			file = apk_db_file_get(db, diri, l);
-			break;
-		case 'Z':
-			if (file == NULL) goto bad_entry;
-			apk_blob_pull_digest(&l, &file_digest);
-			if (file_digest.alg == APK_DIGEST_SHA1 && ipkg->sha256_160)
-				apk_digest_set(&file_digest, APK_DIGEST_SHA256_160);
-			apk_dbf_digest_set(file, file_digest.alg, file_digest.data);
-			break;
-		case 'r':
-			apk_blob_pull_deps(&l, db, &ipkg->replaces, false);
-			break;
-		case 'q':
-			ipkg->replaces_priority = apk_blob_pull_uint(&l, 10);
-			break;
-		case 's':
-			ipkg->repository_tag = apk_db_get_tag_id(db, l);
-			break;
-		case 'f':
-			for (r = 0; r < l.len; r++) {
-				switch (l.ptr[r]) {
-				case 'f': ipkg->broken_files = 1; break;
-				case 's': ipkg->broken_script = 1; break;
-				case 'x': ipkg->broken_xattr = 1; break;
-				case 'S': ipkg->sha256_160 = 1; break;
-				default:
-					if (!(db->ctx->force & APK_FORCE_OLD_APK))
-						goto old_apk_tools;
-				}
-			}
-			break;
-		default:
-			if (r != 0 && !(db->ctx->force & APK_FORCE_OLD_APK))
-				goto old_apk_tools;
-			/* Installed. So mark the package as installable. */
-			tmpl.pkg.filename_ndx = 0;
-			continue;
 		}
-		if (APK_BLOB_IS_NULL(l)) goto bad_entry;
+		r = apk_db_fdb_field(&rd, l.ptr[0], APK_BLOB_PTR_LEN(l.ptr + 2, l.len - 2));
+		if (r < 0) break;
 	}
-	goto done;
-
-old_apk_tools:
-	/* Installed db should not have unsupported fields */
-	apk_err(out, "This apk-tools is too old to handle installed packages");
-	goto err_fmt;
-bad_entry:
-	apk_err(out, "FDB format error (line %d, entry '%c')", lineno, field);
-err_fmt:
-	is->err = -APKE_V2DB_FORMAT;
-done:
-	apk_pkgtmpl_free(&tmpl);
+	if (r < 0) is->err = r;
+	apk_pkgtmpl_free(&rd.tmpl);
 	return apk_istream_close(is);
 }
 
@@ -1086,20 +1153,18 @@ err:
 	return apk_ostream_error(os);
 }
 
-static int apk_db_fdb_write(struct apk_database *db, struct apk_installed_package *ipkg, struct apk_ostream *os)
+static int apk_db_fdb_write_header(struct apk_database *db, struct apk_installed_package *ipkg, struct apk_ostream *os)
 {
 	struct apk_package *pkg = ipkg->pkg;
 	char buf[1024+PATH_MAX];
 	apk_blob_t bbuf = APK_BLOB_BUF(buf);
-	int r = 0;
-
-	if (IS_ERR(os)) return PTR_ERR(os);
+	int r;
 
 	r = apk_pkg_write_index_header(pkg, os);
-	if (r < 0) goto err;
+	if (r < 0) return r;
 
 	r = write_blobs(os, "g:", pkg->tags);
-	if (r < 0) goto err;
+	if (r < 0) return r;
 
 	if (apk_array_len(ipkg->replaces) != 0) {
 		apk_blob_push_blob(&bbuf, APK_BLOB_STR("r:"));
@@ -1128,6 +1193,23 @@ static int apk_db_fdb_write(struct apk_database *db, struct apk_installed_packag
 			apk_blob_push_blob(&bbuf, APK_BLOB_STR("S"));
 		apk_blob_push_blob(&bbuf, APK_BLOB_STR("\n"));
 	}
+
+	bbuf = apk_blob_pushed(APK_BLOB_BUF(buf), bbuf);
+	if (APK_BLOB_IS_NULL(bbuf)) return -ENOBUFS;
+	return apk_ostream_write(os, bbuf.ptr, bbuf.len);
+}
+
+static int apk_db_fdb_write(struct apk_database *db, struct apk_installed_package *ipkg, struct apk_ostream *os)
+{
+	char buf[1024+PATH_MAX];
+	apk_blob_t bbuf = APK_BLOB_BUF(buf);
+	int r = 0;
+
+	if (IS_ERR(os)) return PTR_ERR(os);
+
+	r = apk_db_fdb_write_header(db, ipkg, os);
+	if (r < 0) goto err;
+
 	apk_array_foreach_item(diri, ipkg->diris) {
 		apk_blob_push_blob(&bbuf, APK_BLOB_STR("F:"));
 		apk_blob_push_blob(&bbuf, APK_BLOB_PTR_LEN(diri->dir->name, diri->dir->namelen));
@@ -1175,6 +1257,289 @@ err:
 	return r;
 }
 
+/* The installed database snapshot is a binary copy of the file lists of
+ * 'installed' with the directory and file entries pre-parsed. It is only
+ * used if the size and mtime recorded in its trailer match the current
+ * 'installed' file, and the payload digest is valid. */
+#define APK_DB_SNAPSHOT_MAGIC		0x70616e73	// snap
+#define APK_DB_SNAPSHOT_VERSION		1
+
+struct apk_db_snapshot_trailer {
+	uint64_t installed_size;
+	int64_t installed_mtime_sec;
+	uint32_t installed_mtime_nsec;
+	uint8_t payload_digest[APK_DIGEST_LENGTH_SHA256];
+	uint32_t version;
+	uint32_t magic;
+} __attribute__((packed));
+
+struct apk_db_snapshot_acl {
+	uint32_t mode, uid, gid;
+	uint8_t xattr_hash_len;
+} __attribute__((packed));
+
+struct apk_db_snapshot_ostream {
+	struct apk_ostream os;
+	struct apk_ostream *output;
+	struct apk_digest_ctx dctx;
+	int dirfd;
+};
+
+static int snapshot_os_write(struct apk_ostream *os, const void *ptr, size_t size)
+{
+	struct apk_db_snapshot_ostream *sos = container_of(os, struct apk_db_snapshot_ostream, os);
+
+	apk_digest_ctx_update(&sos->dctx, ptr, size);
+	return apk_ostream_write(sos->output, ptr, size);
+}
+
+static int snapshot_os_close(struct apk_ostream *os)
+{
+	struct apk_db_snapshot_ostream *sos = container_of(os, struct apk_db_snapshot_ostream, os);
+	struct apk_db_snapshot_trailer trl = {
+		.version = APK_DB_SNAPSHOT_VERSION,
+		.magic = APK_DB_SNAPSHOT_MAGIC,
+	};
+	struct apk_digest d;
+	struct stat st;
+	int r = os->rc;
+
+	/* Must be closed after 'installed' so its final size and mtime are recorded */
+	if (!r && fstatat(sos->dirfd, "installed", &st, 0) != 0) r = -errno;
+	if (!r) r = apk_digest_ctx_final(&sos->dctx, &d);
+	if (!r) {
+		trl.installed_size = st.st_size;
+		trl.installed_mtime_sec = st.st_mtim.tv_sec;
+		trl.installed_mtime_nsec = st.st_mtim.tv_nsec;
+		memcpy(trl.payload_digest, d.data, sizeof trl.payload_digest);
+		apk_ostream_write(sos->output, &trl, sizeof trl);
+	}
+	r = apk_ostream_close_error(sos->output, r);
+	if (r) unlinkat(sos->dirfd, apk_db_snapshot_file, 0);
+	apk_digest_ctx_free(&sos->dctx);
+	free(sos);
+	return r;
+}
+
+static const struct apk_ostream_ops snapshot_ostream_ops = {
+	.write = snapshot_os_write,
+	.close = snapshot_os_close,
+};
+
+static struct apk_ostream *apk_db_snapshot_ostream(int dirfd)
+{
+	struct apk_db_snapshot_ostream *sos;
+	struct apk_ostream *output;
+
+	output = apk_ostream_to_file(dirfd, apk_db_snapshot_file, 0644);
+	if (IS_ERR(output)) return output;
+
+	sos = malloc(sizeof *sos);
+	if (!sos) return ERR_PTR(apk_ostream_close_error(output, -ENOMEM));
+
+	*sos = (struct apk_db_snapshot_ostream) {
+		.os.ops = &snapshot_ostream_ops,
+		.output = output,
+		.dirfd = dirfd,
+	};
+	if (apk_digest_ctx_init(&sos->dctx, APK_DIGEST_SHA256) != 0)
+		apk_ostream_cancel(&sos->os, -APKE_CRYPTO_ERROR);
+	return &sos->os;
+}
+
+static void apk_blob_push_snapshot_acl(apk_blob_t *b, struct apk_db_acl *acl, struct apk_db_acl *default_acl)
+{
+	struct apk_db_snapshot_acl sacl;
+
+	if (acl == default_acl) {
+		apk_blob_push_blob(b, APK_BLOB_STRLIT("\0"));
+		return;
+	}
+	sacl = (struct apk_db_snapshot_acl) {
+		.mode = acl->mode,
+		.uid = acl->uid,
+		.gid = acl->gid,
+		.xattr_hash_len = acl->xattr_hash_len,
+	};
+	apk_blob_push_blob(b, APK_BLOB_STRLIT("\1"));
+	apk_blob_push_blob(b, APK_BLOB_STRUCT(sacl));
+	apk_blob_push_blob(b, apk_acl_digest_blob(acl));
+}
+
+static int apk_db_snapshot_write(struct apk_database *db, struct apk_installed_package *ipkg, struct apk_ostream *os)
+{
+	char buf[1024+PATH_MAX];
+	apk_blob_t bbuf;
+	uint16_t dirlen;
+	uint8_t namelen;
+	int r;
+
+	if (IS_ERR(os)) return PTR_ERR(os);
+
+	/* Package header as text, terminated with an empty line */
+	apk_ostream_write(os, "P", 1);
+	r = apk_db_fdb_write_header(db, ipkg, os);
+	if (r < 0) goto err;
+	apk_ostream_write(os, "\n", 1);
+
+	apk_array_foreach_item(diri, ipkg->diris) {
+		bbuf = APK_BLOB_BUF(buf);
+		dirlen = diri->dir->namelen;
+		apk_blob_push_blob(&bbuf, APK_BLOB_STRLIT("F"));
+		apk_blob_push_blob(&bbuf, APK_BLOB_STRUCT(dirlen));
+		apk_blob_push_blob(&bbuf, APK_BLOB_PTR_LEN(diri->dir->name, dirlen));
+		apk_blob_push_snapshot_acl(&bbuf, diri->acl, apk_default_acl_dir);
+
+		apk_array_foreach_item(file, diri->files) {
+			namelen = file->namelen;
+			apk_blob_push_blob(&bbuf, APK_BLOB_STRLIT("R"));
+			apk_blob_push_blob(&bbuf, APK_BLOB_STRUCT(namelen));
+			apk_blob_push_blob(&bbuf, APK_BLOB_PTR_LEN(file->name, namelen));
+			apk_blob_push_snapshot_acl(&bbuf, file->acl, apk_default_acl_file);
+			apk_blob_push_blob(&bbuf, APK_BLOB_PTR_LEN((char *) &(uint8_t){file->digest_alg}, 1));
+			apk_blob_push_blob(&bbuf, apk_dbf_digest_blob(file));
+
+			if (bbuf.len < sizeof buf / 2) {
+				bbuf = apk_blob_pushed(APK_BLOB_BUF(buf), bbuf);
+				r = apk_ostream_write(os, bbuf.ptr, bbuf.len);
+				if (r < 0) goto err;
+				bbuf = APK_BLOB_BUF(buf);
+			}
+		}
+		bbuf = apk_blob_pushed(APK_BLOB_BUF(buf), bbuf);
+		if (APK_BLOB_IS_NULL(bbuf)) {
+			r = -ENOBUFS;
+			goto err;
+		}
+		r = apk_ostream_write(os, bbuf.ptr, bbuf.len);
+		if (r < 0) goto err;
+	}
+	r = apk_ostream_write(os, "E", 1);
+err:
+	if (r < 0) apk_ostream_cancel(os, r);
+	return r;
+}
+
+static bool snapshot_pull(apk_blob_t *b, void *ptr, size_t len)
+{
+	if (b->len < len) {
+		*b = APK_BLOB_NULL;
+		return false;
+	}
+	memcpy(ptr, b->ptr, len);
+	b->ptr += len;
+	b->len -= len;
+	return true;
+}
+
+static apk_blob_t snapshot_pull_blob(apk_blob_t *b, size_t len)
+{
+	apk_blob_t r;
+
+	if (b->len < len) return *b = APK_BLOB_NULL;
+	r = APK_BLOB_PTR_LEN(b->ptr, len);
+	b->ptr += len;
+	b->len -= len;
+	return r;
+}
+
+static struct apk_db_acl *snapshot_pull_acl(struct apk_database *db, apk_blob_t *b, struct apk_db_acl *default_acl)
+{
+	struct apk_db_snapshot_acl sacl;
+	apk_blob_t xattr_hash;
+	uint8_t explicit = 0;
+
+	if (!snapshot_pull(b, &explicit, 1) || !explicit) return default_acl;
+	if (!snapshot_pull(b, &sacl, sizeof sacl)) return default_acl;
+	xattr_hash = snapshot_pull_blob(b, sacl.xattr_hash_len);
+	if (APK_BLOB_IS_NULL(xattr_hash)) return default_acl;
+	return __apk_db_acl_atomize(db, sacl.mode, sacl.uid, sacl.gid, xattr_hash.len, (const uint8_t *) xattr_hash.ptr);
+}
+
+static int apk_db_snapshot_parse(struct apk_database *db, apk_blob_t b, unsigned layer)
+{
+	struct apk_db_fdb_reader rd;
+	struct apk_db_acl *acl;
+	apk_blob_t l, name;
+	uint16_t dirlen;
+	uint8_t op, namelen, alg;
+	int r = 0;
+
+	apk_db_fdb_reader_init(&rd, db, APK_REPO_DB_INSTALLED, layer);
+	while (r == 0 && snapshot_pull(&b, &op, 1)) {
+		rd.lineno++;
+		switch (op) {
+		case 'P':
+			while (r == 0) {
+				if (!apk_blob_split(b, APK_BLOB_STRLIT("\n"), &l, &b)) r = -APKE_V2DB_FORMAT;
+				else if (l.len == 0) break;
+				else if (l.len < 2 || l.ptr[1] != ':') r = -APKE_V2DB_FORMAT;
+				else r = apk_db_fdb_field(&rd, l.ptr[0], APK_BLOB_PTR_LEN(l.ptr + 2, l.len - 2));
+			}
+			break;
+		case 'F':
+			if (!snapshot_pull(&b, &dirlen, sizeof dirlen)) break;
+			name = snapshot_pull_blob(&b, dirlen);
+			if (APK_BLOB_IS_NULL(name)) break;
+			r = apk_db_fdb_field(&rd, 'F', name);
+			acl = snapshot_pull_acl(db, &b, apk_default_acl_dir);
+			if (r == 0 && rd.diri) rd.diri->acl = acl;
+			break;
+		case 'R':
+			if (!snapshot_pull(&b, &namelen, sizeof namelen)) break;
+			name = snapshot_pull_blob(&b, namelen);
+			if (APK_BLOB_IS_NULL(name)) break;
+			r = apk_db_fdb_field(&rd, 'R', name);
+			if (r < 0) break;
+			rd.file->acl = snapshot_pull_acl(db, &b, apk_default_acl_file);
+			if (!snapshot_pull(&b, &alg, sizeof alg)) break;
+			l = snapshot_pull_blob(&b, apk_digest_alg_len(alg));
+			if (!APK_BLOB_IS_NULL(l)) apk_dbf_digest_set(rd.file, alg, (const uint8_t *) l.ptr);
+			break;
+		case 'E':
+			r = apk_db_fdb_end_package(&rd);
+			break;
+		default:
+			r = -APKE_V2DB_FORMAT;
+			break;
+		}
+		if (APK_BLOB_IS_NULL(b)) r = -APKE_V2DB_FORMAT;
+	}
+	apk_pkgtmpl_free(&rd.tmpl);
+	return r;
+}
+
+static int apk_db_snapshot_read(struct apk_database *db, int dirfd, unsigned layer)
+{
+	struct apk_db_snapshot_trailer trl;
+	struct apk_istream *is;
+	struct apk_digest d;
+	struct stat st;
+	apk_blob_t b;
+	int r = -ESTALE;
+
+	if (fstatat(dirfd, "installed", &st, 0) != 0) return -errno;
+
+	is = apk_istream_from_file_mmap(dirfd, apk_db_snapshot_file);
+	if (IS_ERR(is)) return PTR_ERR(is);
+
+	b = apk_istream_mmap(is);
+	if (b.len < sizeof trl) goto done;
+	memcpy(&trl, b.ptr + b.len - sizeof trl, sizeof trl);
+	b.len -= sizeof trl;
+	if (trl.magic != APK_DB_SNAPSHOT_MAGIC || trl.version != APK_DB_SNAPSHOT_VERSION) goto done;
+	if (trl.installed_size != st.st_size ||
+	    trl.installed_mtime_sec != st.st_mtim.tv_sec ||
+	    trl.installed_mtime_nsec != st.st_mtim.tv_nsec) goto done;
+	if (apk_digest_calc(&d, APK_DIGEST_SHA256, b.ptr, b.len) != 0 ||
+	    memcmp(d.data, trl.payload_digest, sizeof trl.payload_digest) != 0) goto done;
+
+	r = apk_db_snapshot_parse(db, b, layer);
+done:
+	apk_istream_close(is);
+	return r;
+}
+
 static int apk_db_scriptdb_write(struct apk_database *db, struct apk_installed_package *ipkg, struct apk_ostream *os)
 {
 	struct apk_package *pkg = ipkg->pkg;
@@ -1331,7 +1696,9 @@ static int apk_db_read_layer(struct apk_database *db, unsigned layer)
 	}
 
 	if (!(flags & APK_OPENF_NO_INSTALLED)) {
-		r = apk_db_fdb_read(db, apk_istream_from_file(fd, "installed"), APK_REPO_DB_INSTALLED, layer);
+		r = apk_db_snapshot_read(db, fd, layer);
+		if (r == -ENOENT || r == -ESTALE)
+			r = apk_db_fdb_read(db, apk_istream_from_file(fd, "installed"), APK_REPO_DB_INSTALLED, layer);
 		if (!ret && r != -ENOENT) ret = r;
 		r = apk_db_parse_istream(db, apk_istream_from_file(fd, "triggers"), apk_db_add_trigger);
 		if (!ret && r != -ENOENT) ret = r;
@@ -1439,21 +1806,211 @@ static void mark_in_cache(struct apk_database *db, int static_cache, int dirfd,
 	pkg->cached = 1;
 }
 
+/* Repository indexes are decompressed and verified in parallel, but the
+ * packages are added to the database strictly in repository order so that
+ * the resulting database is identical to a sequential load. */
+struct apk_repo_loader {
+	struct apk_database *db;
+	struct apk_repo_job *jobs;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int num_jobs, next_job, turn;
+};
+
+static void apk_repo_loader_wait_turn(struct apk_repo_loader *l, int repo)
+{
+	if (!l) return;
+	pthread_mutex_lock(&l->mutex);
+	while (l->turn != repo) pthread_cond_wait(&l->cond, &l->mutex);
+	pthread_mutex_unlock(&l->mutex);
+}
+
 struct apkindex_ctx {
 	struct apk_database *db;
 	struct apk_extract_ctx ectx;
+	struct apk_repo_loader *loader;
 	int repo, found;
 };
 
+static int read_index_blob(struct apk_istream *is, apk_blob_t *b)
+{
+	apk_blob_t chunk;
+	size_t alloc = 0;
+	char *ptr;
+	int r;
+
+	*b = APK_BLOB_NULL;
+	while ((r = apk_istream_get_all(is, &chunk)) == 0) {
+		if (b->len + chunk.len > alloc) {
+			alloc = max(max(alloc * 2, b->len + chunk.len), (size_t)(128*1024));
+			ptr = realloc(b->ptr, alloc);
+			if (!ptr) {
+				r = -ENOMEM;
+				break;
+			}
+			b->ptr = ptr;
+		}
+		memcpy(&b->ptr[b->len], chunk.ptr, chunk.len);
+		b->len += chunk.len;
+	}
+	if (r == -APKE_EOF) r = 0;
+	r = apk_istream_close_error(is, r);
+	if (r < 0) {
+		free(b->ptr);
+		*b = APK_BLOB_NULL;
+	}
+	return r;
+}
+
 static int load_v2index(struct apk_extract_ctx *ectx, apk_blob_t *desc, struct apk_istream *is)
 {
 	struct apkindex_ctx *ctx = container_of(ectx, struct apkindex_ctx, ectx);
+	struct apk_istream bis;
+	apk_blob_t b = APK_BLOB_NULL;
+	int r;
+
+	if (ctx->repo >= 0 && !ctx->db->repos[ctx->repo].v2_allowed) return -APKE_FORMAT_INVALID;
+	if (ctx->loader) {
+		r = read_index_blob(is, &b);
+		apk_repo_loader_wait_turn(ctx->loader, ctx->repo);
+		if (r < 0) return r;
+		is = apk_istream_from_blob(&bis, b);
+	}
 	if (ctx->repo >= 0) {
 		struct apk_repository *repo = &ctx->db->repos[ctx->repo];
-		if (!repo->v2_allowed) return -APKE_FORMAT_INVALID;
 		repo->description = *apk_atomize_dup(&ctx->db->atoms, *desc);
 	}
-	return apk_db_index_read(ctx->db, is, ctx->repo);
+	r = apk_db_index_read(ctx->db, is, ctx->repo);
+	free(b.ptr);
+	return r;
+}
+
+static void lazy_add_deps(struct apk_database *db, struct adb_obj *pkginfo, int field, struct apk_lazy_pkg lp)
+{
+	struct adb_obj deps, dep;
+
+	adb_ro_obj(pkginfo, field, &deps);
+	for (int i = ADBI_FIRST; i <= adb_ra_num(&deps); i++) {
+		adb_ro_obj(&deps, i, &dep);
+		apk_lazy_pkg_array_add(&apk_db_get_name(db, adb_ro_blob(&dep, ADBI_DEP_NAME))->lazy_pkgs, lp);
+	}
+}
+
+static int load_v3index_lazy(struct apk_database *db, struct adb_obj *ndx, int repo_num)
+{
+	struct apk_repository *repo = &db->repos[repo_num];
+	struct apk_package *pkg;
+	struct apk_lazy_id *lid;
+	struct apk_name *name;
+	struct adb_obj root, pkginfo;
+	apk_blob_t id;
+	unsigned long hash;
+	int i, num_broken = 0;
+
+	repo->lazy_ndx = *ndx->db;
+	adb_init(ndx->db);
+	adb_r_rootobj(&repo->lazy_ndx, &root, &schema_index);
+	adb_ro_obj(&root, ADBI_NDX_PACKAGES, &repo->lazy_pkgs);
+	repo->lazy_loaded = calloc(adb_ra_num(&repo->lazy_pkgs) / 8 + 1, 1);
+	if (!repo->lazy_loaded) return -ENOMEM;
+	db->lazy_index = 1;
+
+	// Index only the names through which the package can be reached,
+	// the package itself is loaded by apk_db_name_load_lazy()
+	for (i = ADBI_FIRST; i <= adb_ra_num(&repo->lazy_pkgs); i++) {
+		struct apk_lazy_pkg lp = { .repo = repo_num, .index = i };
+
+		adb_ro_obj(&repo->lazy_pkgs, i, &pkginfo);
+		id = adb_ro_blob(&pkginfo, ADBI_PI_HASHES);
+		if (id.len < APK_DIGEST_LENGTH_SHA1) {
+			num_broken++;
+			continue;
+		}
+
+		// A package seen earlier with the same identity absorbs this
+		// entry when loaded, exactly as apk_db_pkg_add() would merge it
+		id.len = APK_DIGEST_LENGTH_SHA1;
+		hash = apk_hash_from_key(&db->available.lazy_ids, id);
+		if ((pkg = apk_hash_get(&db->available.packages, id)) != NULL) {
+			apk_lazy_pkg_array_add(&pkg->name->lazy_pkgs, lp);
+			continue;
+		}
+		if ((lid = apk_hash_get_hashed(&db->available.lazy_ids, id, hash)) != NULL) {
+			apk_lazy_pkg_array_add(&lid->name->lazy_pkgs, lp);
+			continue;
+		}
+
+		name = apk_db_get_name(db, adb_ro_blob(&pkginfo, ADBI_PI_NAME));
+		lid = malloc(sizeof *lid);
+		if (!name || !lid) {
+			free(lid);
+			return -ENOMEM;
+		}
+		*lid = (struct apk_lazy_id) { .id = id, .name = name };
+		apk_hash_insert_hashed(&db->available.lazy_ids, lid, hash);
+
+		apk_lazy_pkg_array_add(&name->lazy_pkgs, lp);
+		lazy_add_deps(db, &pkginfo, ADBI_PI_PROVIDES, lp);
+		lazy_add_deps(db, &pkginfo, ADBI_PI_INSTALL_IF, lp);
+	}
+	return num_broken;
+}
+
+void apk_db_name_load_lazy(struct apk_database *db, struct apk_name *name)
+{
+	struct apk_package_tmpl tmpl;
+	struct adb_obj pkginfo;
+
+	if (apk_array_len(name->lazy_pkgs) == 0) return;
+
+	apk_pkgtmpl_init(&tmpl);
+	apk_array_foreach(lp, name->lazy_pkgs) {
+		struct apk_repository *repo = &db->repos[lp->repo];
+		unsigned char bit = BIT(lp->index % 8);
+
+		if (repo->lazy_loaded[lp->index / 8] & bit) continue;
+		repo->lazy_loaded[lp->index / 8] |= bit;
+
+		adb_ro_obj(&repo->lazy_pkgs, lp->index, &pkginfo);
+		apk_pkgtmpl_from_adb(db, &tmpl, &pkginfo);
+		tmpl.pkg.repos |= BIT(lp->repo);
+		if (!apk_db_pkg_add(db, &tmpl)) apk_pkgtmpl_reset(&tmpl);
+	}
+	apk_pkgtmpl_free(&tmpl);
+	apk_lazy_pkg_array_free(&name->lazy_pkgs);
+}
+
+static void lazy_queue_name(struct apk_name_array **queue, struct apk_name *name)
+{
+	if (name->lazy_seen) return;
+	name->lazy_seen = 1;
+	apk_name_array_add(queue, name);
+}
+
+void apk_db_deps_load_lazy(struct apk_database *db, struct apk_dependency_array *deps)
+{
+	struct apk_name_array *queue;
+
+	if (!db->lazy_index) return;
+
+	// Load everything the solver can discover starting from 'deps'
+	apk_name_array_init(&queue);
+	apk_array_foreach(d, deps) lazy_queue_name(&queue, d->name);
+	for (int i = 0; i < apk_array_len(queue); i++) {
+		struct apk_name *name = queue->item[i];
+
+		apk_db_name_load_lazy(db, name);
+		apk_array_foreach_item(name0, name->rinstall_if)
+			lazy_queue_name(&queue, name0);
+		apk_array_foreach(p, name->providers) {
+			lazy_queue_name(&queue, p->pkg->name);
+			apk_array_foreach(dep, p->pkg->depends) lazy_queue_name(&queue, dep->name);
+			apk_array_foreach(dep, p->pkg->provides) lazy_queue_name(&queue, dep->name);
+			apk_array_foreach(dep, p->pkg->install_if) lazy_queue_name(&queue, dep->name);
+		}
+	}
+	apk_array_foreach_item(name, queue) name->lazy_seen = 0;
+	apk_name_array_free(&queue);
 }
 
 static int load_v3index(struct apk_extract_ctx *ectx, struct adb_obj *ndx)
@@ -1464,11 +2021,20 @@ static int load_v3index(struct apk_extract_ctx *ectx, struct adb_obj *ndx)
 	struct apk_repository *repo = &db->repos[ctx->repo];
 	struct apk_package_tmpl tmpl;
 	struct adb_obj pkgs, pkginfo;
-	apk_blob_t pkgname_spec;
+	apk_blob_t pkgname_spec, dict;
 	int i, r = 0, num_broken = 0;
 
+	apk_repo_loader_wait_turn(ctx->loader, ctx->repo);
 	apk_pkgtmpl_init(&tmpl);
 
+	// The packages of the repository may be compressed with its dictionary
+	dict = adb_ro_blob(ndx, ADBI_NDX_COMP_DICT);
+	if (dict.len && (r = adb_load_compression_dict(dict)) < 0) {
+		apk_warn(out, "Repository " BLOB_FMT " compression dictionary: %s",
+			BLOB_PRINTF(repo->url_index_printable), apk_error_str(r));
+		r = 0;
+	}
+
 	repo->description = *apk_atomize_dup(&db->atoms, adb_ro_blob(ndx, ADBI_NDX_DESCRIPTION));
 	pkgname_spec = adb_ro_blob(ndx, ADBI_NDX_PKGNAME_SPEC);
 	if (!APK_BLOB_IS_NULL(pkgname_spec)) {
@@ -1476,6 +2042,15 @@ static int load_v3index(struct apk_extract_ctx *ectx, struct adb_obj *ndx)
 		repo->absolute_pkgname = apk_blob_contains(pkgname_spec, APK_BLOB_STRLIT("://")) >= 0;
 	}
 
+	if ((db->ctx->open_flags & APK_OPENF_LAZY_INDEX) && ctx->repo >= 0) {
+		r = load_v3index_lazy(db, ndx, ctx->repo);
+		if (r >= 0) {
+			num_broken = r;
+			r = 0;
+		}
+		goto done;
+	}
+
 	adb_ro_obj(ndx, ADBI_NDX_PACKAGES, &pkgs);
 	for (i = ADBI_FIRST; i <= adb_ra_num(&pkgs); i++) {
 		adb_ro_obj(&pkgs, i, &pkginfo);
@@ -1493,6 +2068,7 @@ static int load_v3index(struct apk_extract_ctx *ectx, struct adb_obj *ndx)
 		}
 	}
 
+done:
 	apk_pkgtmpl_free(&tmpl);
 	if (num_broken) apk_warn(out, "Repository " BLOB_FMT " has %d packages without hash",
 		BLOB_PRINTF(repo->url_index_printable), num_broken);
@@ -1504,10 +2080,11 @@ static const struct apk_extract_ops extract_index = {
 	.v3index = load_v3index,
 };
 
-static int load_index(struct apk_database *db, struct apk_istream *is, int repo)
+static int load_index(struct apk_database *db, struct apk_repo_loader *loader, struct apk_istream *is, int repo)
 {
 	struct apkindex_ctx ctx = {
 		.db = db,
+		.loader = loader,
 		.repo = repo,
 	};
 	if (IS_ERR(is)) return PTR_ERR(is);
@@ -1593,47 +2170,74 @@ static const struct apk_repoparser_ops db_repoparser_ops = {
 	.repository = add_repository_component,
 };
 
-static void open_repository(struct apk_database *db, int repo_num)
+struct apk_repo_job {
+	const char *error_action;
+	unsigned int available_repos;
+	int open_fd, update_error, r;
+	bool fetch;
+	char open_url[NAME_MAX];
+};
+
+static void open_repository_prepare(struct apk_database *db, int repo_num, struct apk_repo_job *job)
 {
-	struct apk_out *out = &db->ctx->out;
 	struct apk_repository *repo = &db->repos[repo_num];
-	const char *error_action = "constructing url";
 	unsigned int repo_mask = BIT(repo_num);
-	unsigned int available_repos = 0;
-	char open_url[NAME_MAX];
-	int r, update_error = 0, open_fd = AT_FDCWD;
 
-	error_action = "opening";
-	if (!(db->ctx->flags & APK_NO_NETWORK)) available_repos = repo_mask;
+	*job = (struct apk_repo_job) {
+		.error_action = "opening",
+		.open_fd = AT_FDCWD,
+	};
+	if (!(db->ctx->flags & APK_NO_NETWORK)) job->available_repos = repo_mask;
 
 	if (repo->is_remote && !(db->ctx->flags & APK_NO_CACHE)) {
-		error_action = "opening from cache";
+		job->error_action = "opening from cache";
 		if (repo->stale) {
-			update_error = apk_cache_download(db, repo, NULL, NULL);
-			switch (update_error) {
+			job->update_error = apk_cache_download(db, repo, NULL, NULL);
+			switch (job->update_error) {
 			case 0:
 				db->repositories.updated++;
 				// Fallthrough
 			case -APKE_FILE_UNCHANGED:
-				update_error = 0;
+				job->update_error = 0;
 				repo->stale = 0;
 				break;
 			}
 		}
-		r = apk_repo_index_cache_url(db, repo, &open_fd, open_url, sizeof open_url);
+		job->r = apk_repo_index_cache_url(db, repo, &job->open_fd, job->open_url, sizeof job->open_url);
 	} else {
 		if (repo->is_remote) {
-			error_action = "fetching";
-			apk_out_progress_note(out, "fetch " BLOB_FMT, BLOB_PRINTF(repo->url_index_printable));
+			job->error_action = "fetching";
+			job->fetch = true;
 		} else {
-			available_repos = repo_mask;
+			job->available_repos = repo_mask;
 			db->local_repos |= repo_mask;
 		}
-		r = apk_fmt(open_url, sizeof open_url, BLOB_FMT, BLOB_PRINTF(repo->url_index));
+		job->r = apk_fmt(job->open_url, sizeof job->open_url, BLOB_FMT, BLOB_PRINTF(repo->url_index));
 	}
-	if (r < 0) goto err;
-	r = load_index(db, apk_istream_from_fd_url(open_fd, open_url, apk_db_url_since(db, 0)), repo_num);
-err:
+	if (job->r > 0) job->r = 0;
+}
+
+static int open_repository_load(struct apk_database *db, struct apk_repo_loader *loader, int repo_num, struct apk_repo_job *job)
+{
+	struct apk_repository *repo = &db->repos[repo_num];
+
+	if (job->r < 0) return job->r;
+	if (job->fetch) {
+		// Network fetches are not thread safe, do them in turn
+		apk_repo_loader_wait_turn(loader, repo_num);
+		apk_out_progress_note(&db->ctx->out, "fetch " BLOB_FMT, BLOB_PRINTF(repo->url_index_printable));
+	}
+	return load_index(db, loader, apk_istream_from_fd_url(job->open_fd, job->open_url, apk_db_url_since(db, 0)), repo_num);
+}
+
+static void open_repository_finish(struct apk_database *db, int repo_num, struct apk_repo_job *job)
+{
+	struct apk_out *out = &db->ctx->out;
+	struct apk_repository *repo = &db->repos[repo_num];
+	const char *error_action = job->error_action;
+	unsigned int repo_mask = BIT(repo_num);
+	int r = job->r, update_error = job->update_error;
+
 	if (r || update_error) {
 		if (repo->is_remote) {
 			if (r) db->repositories.unavailable++;
@@ -1648,12 +2252,74 @@ err:
 	}
 	if (r == 0) {
 		repo->available = 1;
-		db->available_repos |= available_repos;
+		db->available_repos |= job->available_repos;
 		for (unsigned int tag_id = 0, mask = repo->tag_mask; mask; mask >>= 1, tag_id++)
 			if (mask & 1) db->repo_tags[tag_id].allowed_repos |= repo_mask;
 	}
 }
 
+static void *apk_repo_loader_worker(void *arg)
+{
+	struct apk_repo_loader *l = arg;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&l->mutex);
+		i = l->next_job++;
+		pthread_mutex_unlock(&l->mutex);
+		if (i >= l->num_jobs) break;
+
+		l->jobs[i].r = open_repository_load(l->db, l, i, &l->jobs[i]);
+
+		apk_repo_loader_wait_turn(l, i);
+		pthread_mutex_lock(&l->mutex);
+		l->turn++;
+		pthread_cond_broadcast(&l->cond);
+		pthread_mutex_unlock(&l->mutex);
+	}
+	return NULL;
+}
+
+static void open_repositories(struct apk_database *db)
+{
+	struct apk_ctx *ac = db->ctx;
+	struct apk_repo_job jobs[APK_MAX_REPOS];
+	struct apk_repo_loader l = {
+		.db = db,
+		.jobs = jobs,
+		.num_jobs = db->num_repos,
+	};
+	pthread_t threads[APK_MAX_REPOS];
+	int i, nthreads;
+
+	for (i = 0; i < db->num_repos; i++) open_repository_prepare(db, i, &jobs[i]);
+	if (db->num_repos && db->cache_fd >= 0)
+		apk_trust_verified_load(apk_ctx_get_trust(ac), db->cache_fd, "verified");
+
+	nthreads = min(apk_get_nproc(), db->num_repos) - 1;
+	if (nthreads <= 0) {
+		for (i = 0; i < db->num_repos; i++)
+			jobs[i].r = open_repository_load(db, NULL, i, &jobs[i]);
+	} else {
+		// Load the lazily initialized shared state before starting the workers
+		apk_ctx_get_trust(ac);
+		apk_id_cache_resolve_uid(apk_ctx_get_id_cache(ac), APK_BLOB_STRLIT("root"), 0);
+		apk_id_cache_resolve_gid(apk_ctx_get_id_cache(ac), APK_BLOB_STRLIT("root"), 0);
+
+		pthread_mutex_init(&l.mutex, NULL);
+		pthread_cond_init(&l.cond, NULL);
+		for (i = 0; i < nthreads; i++)
+			if (pthread_create(&threads[i], NULL, apk_repo_loader_worker, &l) != 0) break;
+		nthreads = i;
+		apk_repo_loader_worker(&l);
+		for (i = 0; i < nthreads; i++) pthread_join(threads[i], NULL);
+		pthread_cond_destroy(&l.cond);
+		pthread_mutex_destroy(&l.mutex);
+	}
+
+	for (i = 0; i < db->num_repos; i++) open_repository_finish(db, i, &jobs[i]);
+}
+
 static int add_repository(struct apk_database *db, apk_blob_t line)
 {
 	return apk_repoparser_parse(&db->repoparser, line, true);
@@ -1963,6 +2629,7 @@ void apk_db_init(struct apk_database *db, struct apk_ctx *ac)
 	apk_blobptr_array_init(&db->arches);
 	apk_name_array_init(&db->available.sorted_names);
 	apk_package_array_init(&db->installed.sorted_packages);
+	apk_db_fingerprint_array_init(&db->fingerprints);
 	apk_repoparser_init(&db->repoparser, &ac->out, &db_repoparser_ops);
 	db->permanent = 1;
 	db->root_fd = -1;
@@ -2048,6 +2715,7 @@ int apk_db_open(struct apk_database *db)
 			alarm(0);
 			sigaction(SIGALRM, &old_sa, NULL);
 		}
+		db->fingerprint_journal = faccessat(db->root_fd, apk_fingerprints_file, F_OK, 0) == 0;
 	}
 
 	if (ac->protected_paths) {
@@ -2123,17 +2791,29 @@ int apk_db_open(struct apk_database *db)
 			add_repos_from_file(db, AT_FDCWD, NULL, ac->repositories_file);
 		}
 	}
-	for (i = 0; i < db->num_repos; i++) open_repository(db, i);
+	if (ac->open_flags & APK_OPENF_LAZY_INDEX) {
+		apk_hash_init(&db->available.lazy_ids, &lazy_id_hash_ops, 10000);
+		open_repositories(db);
+		apk_hash_free(&db->available.lazy_ids);
+	} else {
+		open_repositories(db);
+	}
 	apk_out_progress_note(out, NULL);
 
+	if (db->lazy_index) {
+		struct apk_installed_package *ipkg;
+		list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list)
+			apk_db_name_load_lazy(db, ipkg->pkg->name);
+	}
+
 	if (!(ac->open_flags & APK_OPENF_NO_SYS_REPOS) && db->repositories.updated > 0)
 		apk_db_index_write_nr_cache(db);
 
-	apk_hash_foreach(&db->available.names, apk_db_name_rdepends, db);
-
 	if (apk_db_cache_active(db) && (ac->open_flags & (APK_OPENF_NO_REPOS|APK_OPENF_NO_INSTALLED)) == 0)
 		apk_db_cache_foreach_item(db, mark_in_cache);
 
+	apk_hash_foreach(&db->available.names, apk_db_name_rdepends, db);
+
 	db->open_complete = 1;
 
 	if (db->compat_newfeatures) {
@@ -2169,7 +2849,7 @@ static int apk_db_write_layers(struct apk_database *db)
 {
 	struct layer_data {
 		int fd;
-		struct apk_ostream *installed, *scripts, *triggers;
+		struct apk_ostream *installed, *scripts, *triggers, *snapshot;
 	} layers[APK_DB_LAYER_NUM] = {0};
 	struct apk_ostream *os;
 	struct apk_package_array *pkgs;
@@ -2186,6 +2866,8 @@ static int apk_db_write_layers(struct apk_database *db)
 		}
 		ld->installed = apk_ostream_to_file(ld->fd, "installed", 0644);
 		ld->triggers  = apk_ostream_to_file(ld->fd, "triggers", 0644);
+		if (db->ctx->db_snapshot) ld->snapshot = apk_db_snapshot_ostream(ld->fd);
+		else unlinkat(ld->fd, apk_db_snapshot_file, 0);
 		if (db->scripts_tar) ld->scripts = apk_ostream_to_file(ld->fd, "scripts.tar", 0644);
 		else ld->scripts = apk_ostream_gzip(apk_ostream_to_file(ld->fd, "scripts.tar.gz", 0644));
 
@@ -2208,6 +2890,7 @@ static int apk_db_write_layers(struct apk_database *db)
 		struct layer_data *ld = &layers[pkg->layer];
 		if (!ld->fd) continue;
 		apk_db_fdb_write(db, pkg->ipkg, ld->installed);
+		if (ld->snapshot) apk_db_snapshot_write(db, pkg->ipkg, ld->snapshot);
 		apk_db_scriptdb_write(db, pkg->ipkg, ld->scripts);
 		apk_db_triggers_write(db, pkg->ipkg, ld->triggers);
 	}
@@ -2221,6 +2904,10 @@ static int apk_db_write_layers(struct apk_database *db)
 		else	r = PTR_ERR(ld->installed);
 		if (!rr) rr = r;
 
+		/* The snapshot is optional, and is dropped on any error */
+		if (ld->snapshot && !IS_ERR(ld->snapshot))
+			apk_ostream_close_error(ld->snapshot, r);
+
 		if (!IS_ERR(ld->scripts)) {
 			apk_tar_write_entry(ld->scripts, NULL, NULL);
 			r = apk_ostream_close(ld->scripts);
@@ -2251,6 +2938,239 @@ static int apk_db_write_arch(struct apk_database *db)
 	return apk_ostream_close(os);
 }
 
+#define APK_DB_SYNC_MAX_FS	16
+
+struct sync_fs_ctx {
+	struct apk_database *db;
+	unsigned int num;
+	bool overflow;
+	dev_t dev[APK_DB_SYNC_MAX_FS];
+	int fd[APK_DB_SYNC_MAX_FS];
+};
+
+static void sync_fs_add(struct sync_fs_ctx *ctx, const char *path)
+{
+	struct stat st;
+	int fd;
+
+	if (fstatat(ctx->db->root_fd, path, &st, 0) != 0) return;
+	for (unsigned int i = 0; i < ctx->num; i++)
+		if (ctx->dev[i] == st.st_dev) return;
+	if (ctx->num >= ARRAY_SIZE(ctx->dev)) {
+		ctx->overflow = true;
+		return;
+	}
+	fd = openat(ctx->db->root_fd, path, O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return;
+	ctx->dev[ctx->num] = st.st_dev;
+	ctx->fd[ctx->num++] = fd;
+}
+
+static int sync_fs_add_dir(apk_hash_item item, void *pctx)
+{
+	struct apk_db_dir *dir = (struct apk_db_dir *) item;
+	if (dir->modified) sync_fs_add(pctx, dir->namelen ? dir->name : ".");
+	return 0;
+}
+
+static int sync_fs(int fd)
+{
+#ifdef __linux__
+	if (syncfs(fd) != 0) return -errno;
+#else
+	sync();
+#endif
+	return 0;
+}
+
+/* Flushes each filesystem holding the database, and with 'files' also
+ * the ones with directories modified in this transaction, once. */
+int apk_db_sync(struct apk_database *db, bool files)
+{
+	struct sync_fs_ctx ctx = { .db = db };
+	int r = 0, rr;
+
+	if (!db->ctx->fs_sync || (db->ctx->flags & APK_SIMULATE) || db->root_fd < 0) return 0;
+
+	if (files) apk_hash_foreach(&db->installed.dirs, sync_fs_add_dir, &ctx);
+	for (int i = 0; i < APK_DB_LAYER_NUM; i++)
+		if (db->active_layers & BIT(i)) sync_fs_add(&ctx, apk_db_layer_name(i));
+	if (ctx.overflow) sync();
+	for (unsigned int i = 0; i < ctx.num; i++) {
+		rr = sync_fs(ctx.fd[i]);
+		if (rr && !r) r = rr;
+		close(ctx.fd[i]);
+	}
+	if (r) apk_err(&db->ctx->out, "Failed to sync filesystem: %s", apk_error_str(r));
+	return r;
+}
+
+#define APK_FINGERPRINTS_MAGIC	"APKFPJ01"
+
+void apk_db_fingerprint_set(struct apk_db_fingerprint *fp, const struct stat *st, struct apk_db_file *dbf)
+{
+	*fp = (struct apk_db_fingerprint) {
+		.dev = st->st_dev,
+		.ino = st->st_ino,
+		.size = st->st_size,
+		.mtime_ns = (int64_t) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec,
+		.ctime_ns = (int64_t) st->st_ctim.tv_sec * 1000000000 + st->st_ctim.tv_nsec,
+		.digest_alg = dbf->digest_alg,
+	};
+	memcpy(fp->digest, dbf->digest, min(apk_digest_alg_len(dbf->digest_alg), sizeof fp->digest));
+}
+
+static int fingerprint_cmp(const void *p1, const void *p2)
+{
+	const struct apk_db_fingerprint *a = p1, *b = p2;
+	if (a->dev != b->dev) return a->dev < b->dev ? -1 : 1;
+	if (a->ino != b->ino) return a->ino < b->ino ? -1 : 1;
+	return 0;
+}
+
+bool apk_db_fingerprint_match(struct apk_db_fingerprint_array *fps, const struct apk_db_fingerprint *fp)
+{
+	struct apk_db_fingerprint *f, *end = &fps->item[apk_array_len(fps)];
+
+	// The journal is appended to, so an inode may have several records
+	f = apk_array_bsearch(fps, fingerprint_cmp, fp);
+	if (!f) return false;
+	while (f > &fps->item[0] && fingerprint_cmp(f - 1, fp) == 0) f--;
+	for (; f < end && fingerprint_cmp(f, fp) == 0; f++)
+		if (memcmp(f, fp, sizeof *f) == 0) return true;
+	return false;
+}
+
+static int fingerprints_load(struct apk_database *db, struct apk_db_fingerprint_array **fps)
+{
+	apk_blob_t b;
+	size_t n;
+	int r;
+
+	r = apk_blob_from_file(db->root_fd, apk_fingerprints_file, &b);
+	if (r < 0) return r;
+	if (b.len < 8 || memcmp(b.ptr, APK_FINGERPRINTS_MAGIC, 8) != 0 ||
+	    (b.len - 8) % sizeof(struct apk_db_fingerprint) != 0) {
+		r = -APKE_FORMAT_INVALID;
+		goto err;
+	}
+	n = (b.len - 8) / sizeof(struct apk_db_fingerprint);
+	apk_db_fingerprint_array_resize(fps, n, n);
+	if (n) memcpy((*fps)->item, &b.ptr[8], n * sizeof(struct apk_db_fingerprint));
+err:
+	free(b.ptr);
+	return r;
+}
+
+int apk_db_fingerprints_read(struct apk_database *db, struct apk_db_fingerprint_array **fps)
+{
+	int r = fingerprints_load(db, fps);
+	if (r == 0) apk_array_qsort(*fps, fingerprint_cmp);
+	return r;
+}
+
+static int fingerprints_write(struct apk_database *db, struct apk_db_fingerprint_array *fps)
+{
+	struct apk_ostream *os;
+
+	os = apk_ostream_to_file(db->root_fd, apk_fingerprints_file, 0644);
+	if (IS_ERR(os)) return PTR_ERR(os);
+	apk_array_qsort(fps, fingerprint_cmp);
+	apk_ostream_write(os, APK_FINGERPRINTS_MAGIC, 8);
+	apk_ostream_write(os, fps->item, apk_array_len(fps) * sizeof(struct apk_db_fingerprint));
+	return apk_ostream_close(os);
+}
+
+// Orders the records of an inode by age. The status change time of an
+// inode only moves forward, so the last record is the current one.
+static int fingerprint_cmp_age(const void *p1, const void *p2)
+{
+	const struct apk_db_fingerprint *a = p1, *b = p2;
+	int r = fingerprint_cmp(a, b);
+	if (r) return r;
+	if (a->ctime_ns != b->ctime_ns) return a->ctime_ns < b->ctime_ns ? -1 : 1;
+	return (a->digest_alg == APK_DIGEST_NONE) - (b->digest_alg == APK_DIGEST_NONE);
+}
+
+static int fingerprint_cmp_newest(const void *p1, const void *p2)
+{
+	const struct apk_db_fingerprint *a = p1, *b = p2;
+	if (a->ctime_ns != b->ctime_ns) return a->ctime_ns > b->ctime_ns ? -1 : 1;
+	return 0;
+}
+
+/* Writes the journal with the records merged into it. Only the newest
+ * record of each inode is kept, and one without digest drops the inode.
+ * The records of removed files are never superseded, so the journal is
+ * limited to the newest records, one per installed file. */
+int apk_db_fingerprints_merge(struct apk_database *db, struct apk_db_fingerprint_array *fps)
+{
+	struct apk_db_fingerprint_array *all;
+	size_t n = 0, limit = db->installed.stats.files;
+	int r;
+
+	apk_db_fingerprint_array_init(&all);
+	r = fingerprints_load(db, &all);
+	if (r < 0 && r != -ENOENT && r != -APKE_FORMAT_INVALID) goto err;
+	apk_array_foreach(fp, fps) apk_db_fingerprint_array_add(&all, *fp);
+
+	apk_array_qsort(all, fingerprint_cmp_age);
+	for (size_t i = 0; i < apk_array_len(all); i++) {
+		struct apk_db_fingerprint *fp = &all->item[i];
+		if (i + 1 < apk_array_len(all) && fingerprint_cmp(fp, fp + 1) == 0) continue;
+		if (fp->digest_alg == APK_DIGEST_NONE) continue;
+		all->item[n++] = *fp;
+	}
+	apk_array_truncate(all, n);
+	if (n > limit) {
+		apk_array_qsort(all, fingerprint_cmp_newest);
+		apk_array_truncate(all, limit);
+	}
+	r = fingerprints_write(db, all);
+err:
+	apk_db_fingerprint_array_free(&all);
+	return r;
+}
+
+static void apk_db_fingerprint_record(struct apk_database *db, struct apk_db_dir *dir, struct apk_db_file *file)
+{
+	struct apk_db_fingerprint fp;
+	struct stat st;
+	char path[PATH_MAX];
+
+	if (file->digest_alg == APK_DIGEST_NONE) return;
+	if (apk_fmt(path, sizeof path, DIR_FILE_FMT, DIR_FILE_PRINTF(dir, file)) < 0) return;
+	if (fstatat(apk_ctx_fd_dest(db->ctx), path, &st, AT_SYMLINK_NOFOLLOW) != 0) return;
+	if (!S_ISREG(st.st_mode)) return;
+	apk_db_fingerprint_set(&fp, &st, file);
+	apk_db_fingerprint_array_add(&db->fingerprints, fp);
+}
+
+static void apk_db_fingerprints_append(struct apk_database *db)
+{
+	struct stat st;
+	int fd;
+
+	if (!apk_array_len(db->fingerprints)) return;
+
+	// Best effort, without the records the files are just hashed again.
+	// Once the journal has grown to twice the installed files, rewrite
+	// it without the superseded records instead of appending.
+	if (fstatat(db->root_fd, apk_fingerprints_file, &st, 0) == 0 &&
+	    st.st_size / sizeof(struct apk_db_fingerprint) > 2 * db->installed.stats.files) {
+		apk_db_fingerprints_merge(db, db->fingerprints);
+		goto done;
+	}
+	fd = openat(db->root_fd, apk_fingerprints_file, O_WRONLY | O_APPEND | O_CLOEXEC);
+	if (fd >= 0) {
+		apk_write_fully(fd, db->fingerprints->item,
+			apk_array_len(db->fingerprints) * sizeof(struct apk_db_fingerprint));
+		close(fd);
+	}
+done:
+	apk_array_truncate(db->fingerprints, 0);
+}
+
 int apk_db_write_config(struct apk_database *db)
 {
 	struct apk_out *out = &db->ctx->out;
@@ -2275,9 +3195,14 @@ int apk_db_write_config(struct apk_database *db)
 	r = apk_db_write_layers(db);
 	if (!rr) rr = r;
 
+	apk_db_fingerprints_append(db);
+
 	r = apk_db_index_write_nr_cache(db);
 	if (r < 0 && !rr) rr = r;
 
+	r = apk_db_sync(db, false);
+	if (!rr) rr = r;
+
 	if (rr) {
 		apk_err(out, "System state may be inconsistent: failed to write database: %s",
 			apk_error_str(rr));
@@ -2289,6 +3214,10 @@ void apk_db_close(struct apk_database *db)
 {
 	struct apk_installed_package *ipkg, *ipkgn;
 
+	if (db->cache_fd >= 0 && (db->ctx->open_flags & APK_OPENF_WRITE) &&
+	    !(db->ctx->flags & APK_SIMULATE))
+		apk_trust_verified_save(&db->ctx->trust, db->cache_fd, "verified");
+
 	list_for_each_entry_safe(ipkg, ipkgn, &db->installed.packages, installed_pkgs_list)
 		apk_pkg_uninstall(NULL, ipkg->pkg);
 	apk_protected_path_array_free(&db->protected_paths);
@@ -2300,9 +3229,15 @@ void apk_db_close(struct apk_database *db)
 	apk_protected_path_array_free(&db->ic.ppaths);
 	apk_dependency_array_free(&db->world);
 
+	for (int i = 0; i < db->num_repos; i++) {
+		adb_free(&db->repos[i].lazy_ndx);
+		free(db->repos[i].lazy_loaded);
+	}
 	apk_repoparser_free(&db->repoparser);
+	apk_solver_cache_free(db);
 	apk_name_array_free(&db->available.sorted_names);
 	apk_package_array_free(&db->installed.sorted_packages);
+	apk_db_fingerprint_array_free(&db->fingerprints);
 	apk_hash_free(&db->available.packages);
 	apk_hash_free(&db->available.names);
 	apk_hash_free(&db->installed.files);
@@ -2555,6 +3490,7 @@ struct apk_package *apk_db_get_pkg_by_name(struct apk_database *db, apk_blob_t f
 		name = apk_db_get_name(db, APK_BLOB_PTR_LEN(filename.ptr, i));
 		if (!name) continue;
 
+		apk_db_name_load_lazy(db, name);
 		apk_array_foreach(p, name->providers) {
 			struct apk_package *pkg = p->pkg;
 
@@ -2617,7 +3553,7 @@ struct apk_repository *apk_db_select_repo(struct apk_database *db,
 
 int apk_db_index_read_file(struct apk_database *db, const char *file, int repo)
 {
-	return load_index(db, apk_istream_from_file(AT_FDCWD, file), repo);
+	return load_index(db, NULL, apk_istream_from_file(AT_FDCWD, file), repo);
 }
 
 int apk_db_repository_check(struct apk_database *db)
@@ -2630,6 +3566,9 @@ int apk_db_repository_check(struct apk_database *db)
 	return -1;
 }
 
+/* Packages at least this large write their files with a thread pool */
+#define APK_DB_WRITER_MIN_SIZE		(8*1024*1024)
+
 struct install_ctx {
 	struct apk_database *db;
 	struct apk_package *pkg;
@@ -2640,8 +3579,10 @@ struct install_ctx {
 	unsigned int script_pending : 1;
 
 	struct apk_extract_ctx ectx;
+	struct apk_fs_writer *writer;
 
 	uint64_t installed_size;
+	int extract_error;
 };
 
 static void apk_db_run_pending_script(struct install_ctx *ctx)
@@ -2750,6 +3691,46 @@ static int apk_db_install_script(struct apk_extract_ctx *ectx, unsigned int type
 	return 0;
 }
 
+/* Files in protected paths are often edited in place, which would change
+ * every root sharing the object, so they are never linked. */
+static bool apk_db_link_objects(struct apk_database *db, struct apk_db_dir *dir)
+{
+	return db->ctx->object_cache_link && apk_protect_mode_none(dir->protect_mode);
+}
+
+static int apk_db_install_file_result(struct install_ctx *ctx, struct apk_db_file *file, const char *name, int r)
+{
+	struct apk_out *out = &ctx->db->ctx->out;
+	struct apk_package *pkg = ctx->pkg;
+	struct apk_installed_package *ipkg = pkg->ipkg;
+
+	if (r > 0) {
+		char buf[APK_EXTRACTW_BUFSZ];
+		if (r & APK_EXTRACTW_XATTR) ipkg->broken_xattr = 1;
+		else ipkg->broken_files = 1;
+		apk_warn(out, PKG_VER_FMT ": failed to preserve %s: %s",
+			PKG_VER_PRINTF(pkg), name, apk_extract_warning_str(r, buf, sizeof buf));
+		r = 0;
+	}
+	switch (r) {
+	case 0:
+		break;
+	case -APKE_NOT_EXTRACTED:
+		file->broken = 1;
+		break;
+	case -ENOSPC:
+		ctx->extract_error = r;
+	case -APKE_UVOL_ROOT:
+	case -APKE_UVOL_NOT_AVAILABLE:
+	default:
+		ipkg->broken_files = file->broken = 1;
+		apk_err(out, PKG_VER_FMT ": failed to extract %s: %s",
+			PKG_VER_PRINTF(pkg), name, apk_error_str(r));
+		break;
+	}
+	return r;
+}
+
 static int apk_db_install_file(struct apk_extract_ctx *ectx, const struct apk_file_info *ae, struct apk_istream *is)
 {
 	struct install_ctx *ctx = container_of(ectx, struct install_ctx, ectx);
@@ -2762,7 +3743,8 @@ static int apk_db_install_file(struct apk_extract_ctx *ectx, const struct apk_fi
 	struct apk_db_dir_instance *diri;
 	apk_blob_t name = APK_BLOB_STR(ae->name), bdir, bfile;
 	struct apk_db_file *file, *link_target_file = NULL;
-	int ret = 0, r;
+	unsigned int extract_flags;
+	int r;
 
 	apk_db_run_pending_script(ctx);
 
@@ -2838,17 +3820,19 @@ static int apk_db_install_file(struct apk_extract_ctx *ectx, const struct apk_fi
 		apk_dbg2(out, "%s", ae->name);
 
 		file->acl = apk_db_acl_atomize_digest(db, ae->mode, ae->uid, ae->gid, &ae->xattr_digest);
-		r = apk_fs_extract(ac, ae, is, db->extract_flags, apk_pkg_ctx(pkg));
-		if (r > 0) {
-			char buf[APK_EXTRACTW_BUFSZ];
-			if (r & APK_EXTRACTW_XATTR) ipkg->broken_xattr = 1;
-			else ipkg->broken_files = 1;
-			apk_warn(out, PKG_VER_FMT ": failed to preserve %s: %s",
-				PKG_VER_PRINTF(pkg), ae->name, apk_extract_warning_str(r, buf, sizeof buf));
-			r = 0;
+		extract_flags = db->extract_flags;
+		if (apk_db_link_objects(db, diri->dir)) extract_flags |= APK_FSEXTRACTF_LINK_OBJECTS;
+		if (ctx->writer) {
+			// A repeated entry reuses the temporary name of a queued one
+			if (opkg == pkg) apk_fs_writer_flush(ctx->writer);
+			r = apk_fs_writer_extract(ctx->writer, ae, is, extract_flags, apk_pkg_ctx(pkg), file);
+			// Failures of queued files are reported by apk_db_install_file_written()
+			if (r == -EINPROGRESS) r = 0;
+		} else {
+			r = apk_fs_extract(ac, ae, is, extract_flags, apk_pkg_ctx(pkg));
 		}
-		switch (r) {
-		case 0:
+		r = apk_db_install_file_result(ctx, file, ae->name, r);
+		if (r == 0) {
 			// Hardlinks need special care for checksum
 			if (!ipkg->sha256_160 && link_target_file)
 				apk_dbf_digest_set(file, link_target_file->digest_alg, link_target_file->digest);
@@ -2863,19 +3847,6 @@ static int apk_db_install_file(struct apk_extract_ctx *ectx, const struct apk_fi
 			} else if (file->digest_alg == APK_DIGEST_NONE && ae->digest.alg == APK_DIGEST_SHA256) {
 				apk_dbf_digest_set(file, APK_DIGEST_SHA256_160, ae->digest.data);
 			}
-			break;
-		case -APKE_NOT_EXTRACTED:
-			file->broken = 1;
-			break;
-		case -ENOSPC:
-			ret = r;
-		case -APKE_UVOL_ROOT:
-		case -APKE_UVOL_NOT_AVAILABLE:
-		default:
-			ipkg->broken_files = file->broken = 1;
-			apk_err(out, PKG_VER_FMT ": failed to extract %s: %s",
-				PKG_VER_PRINTF(pkg), ae->name, apk_error_str(r));
-			break;
 		}
 	} else {
 		struct apk_db_acl *expected_acl;
@@ -2889,7 +3860,12 @@ static int apk_db_install_file(struct apk_extract_ctx *ectx, const struct apk_fi
 		apk_db_dir_prepare(db, diri->dir, expected_acl, diri->dir->owner->acl);
 	}
 	ctx->installed_size += apk_calc_installed_size(ae->size);
-	return ret;
+	return ctx->extract_error;
+}
+
+static void apk_db_install_file_written(void *pctx, void *cookie, const char *name, int r)
+{
+	apk_db_install_file_result(pctx, cookie, name, r);
 }
 
 static const struct apk_extract_ops extract_installer = {
@@ -3054,12 +4030,19 @@ static uint8_t apk_db_migrate_files_for_priority(struct apk_database *db,
 						DIR_FILE_PRINTF(diri->dir, file),
 						apk_error_str(r));
 					ipkg->broken_files = 1;
-				} else if (inetc && ctrl == APK_FS_CTRL_COMMIT) {
+				} else if (ctrl == APK_FS_CTRL_COMMIT) {
+					// Best effort, the installed file is correct either way
+					apk_fs_object_store(&d, key.filename, file->digest_alg, file->digest,
+							    apk_db_link_objects(db, diri->dir));
+					if (db->fingerprint_journal && priority == APK_FS_PRIO_DISK)
+						apk_db_fingerprint_record(db, diri->dir, file);
+
 					// This is called when we successfully migrated the files
 					// in the filesystem; we explicitly do not care about apk-new
 					// or cancel cases, as that does not change the original file
-					if (!apk_blob_compare(key.filename, APK_BLOB_STRLIT("passwd")) ||
-					    !apk_blob_compare(key.filename, APK_BLOB_STRLIT("group"))) {
+					if (inetc &&
+					    (!apk_blob_compare(key.filename, APK_BLOB_STRLIT("passwd")) ||
+					     !apk_blob_compare(key.filename, APK_BLOB_STRLIT("group")))) {
 						// Reset the idcache because we have a new passwd/group
 						apk_id_cache_reset(db->id_cache);
 					}
@@ -3116,7 +4099,8 @@ static int apk_db_unpack_pkg(struct apk_database *db,
 	if (r < 0) goto err_msg;
 	if (apk_db_cache_active(db) && !pkg->cached && !(pkg->repos & db->local_repos)) need_copy = true;
 
-	is = apk_istream_from_fd_url(file_fd, file_url, apk_db_url_since(db, 0));
+	is = apk_prefetch_take(db->prefetch, pkg);
+	if (!is) is = apk_istream_from_fd_url(file_fd, file_url, apk_db_url_since(db, 0));
 	if (IS_ERR(is)) {
 		r = PTR_ERR(is);
 		if (r == -ENOENT && !pkg->filename_ndx)
@@ -3143,9 +4127,13 @@ static int apk_db_unpack_pkg(struct apk_database *db,
 			APK_SCRIPT_PRE_UPGRADE : APK_SCRIPT_PRE_INSTALL,
 		.script_args = script_args,
 	};
+	if (pkg->installed_size >= APK_DB_WRITER_MIN_SIZE)
+		ctx.writer = apk_fs_writer_create(db->ctx, apk_db_install_file_written, &ctx);
 	apk_extract_init(&ctx.ectx, db->ctx, &extract_installer);
 	apk_extract_verify_identity(&ctx.ectx, pkg->digest_alg, apk_pkg_digest_blob(pkg));
 	r = apk_extract(&ctx.ectx, is);
+	apk_fs_writer_free(ctx.writer);
+	if (r == 0) r = ctx.extract_error;
 	if (need_copy && r == 0) pkg->cached = 1;
 	if (r != 0) goto err_msg;
 	apk_db_run_pending_script(&ctx);
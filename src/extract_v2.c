@@ -31,6 +31,7 @@ struct apk_sign_ctx {
 	unsigned char allow_untrusted : 1;
 	unsigned char end_seen : 1;
 	uint8_t alg;
+	struct apk_istream *readahead_is;
 	struct apk_digest data_hash;
 	struct apk_digest_ctx digest_ctx;
 	struct apk_digest_ctx identity_ctx;
@@ -208,6 +209,11 @@ static int apk_sign_ctx_mpart_cb(void *ctx, int part, apk_blob_t data)
 	end_of_control = (sctx->data_started == 0);
 	sctx->data_started = 1;
 
+	/* Nothing but the data digest is needed from the callbacks
+	 * until the end, so the data can be inflated ahead */
+	if (end_of_control && part == APK_MPART_BOUNDARY && sctx->readahead_is)
+		apk_istream_gunzip_readahead(sctx->readahead_is);
+
 	/* End of control-block and control does not have data checksum? */
 	if (sctx->has_data_checksum == 0 && end_of_control && part != APK_MPART_END)
 		return 0;
@@ -344,9 +350,9 @@ int apk_extract_v2(struct apk_extract_ctx *ectx, struct apk_istream *is)
 	if (!ectx->ops) ectx->ops = &extract_v2verify_ops;
 	ectx->pctx = &sctx;
 	apk_sign_ctx_init(&sctx, action, ectx, trust);
-	r = apk_tar_parse(
-		apk_istream_gunzip_mpart(is, apk_sign_ctx_mpart_cb, &sctx),
-		apk_extract_v2_entry, ectx, apk_ctx_get_id_cache(ac));
+	is = apk_istream_gunzip_mpart(is, apk_sign_ctx_mpart_cb, &sctx);
+	if (!IS_ERR(is) && ac->threaded_inflate) sctx.readahead_is = is;
+	r = apk_tar_parse(is, apk_extract_v2_entry, ectx, apk_ctx_get_id_cache(ac));
 	if ((r == 0 || r == -ECANCELED || r == -APKE_EOF) && !ectx->is_package && !ectx->is_index)
 		r = -APKE_FORMAT_INVALID;
 	if (r == 0 && (!sctx.data_verified || !sctx.end_seen)) r = -APKE_V2PKG_INTEGRITY;
@@ -268,6 +268,7 @@ int apk_extract_v3(struct apk_extract_ctx *ectx, struct apk_istream *is)
 	ectx->pctx = &ctx;
 	r = adb_m_process(&ctx.db, adb_decompress(is, 0),
 		ADB_SCHEMA_ANY, trust, ectx, apk_extract_v3_data_block);
+	if (r == 0 && !ctx.db.adb.len) r = -APKE_ADB_BLOCK;
 	if (r == 0) {
 		switch (ctx.db.schema) {
 		case ADB_SCHEMA_PACKAGE:
@@ -289,7 +290,6 @@ int apk_extract_v3(struct apk_extract_ctx *ectx, struct apk_istream *is)
 		}
 	}
 	if (r == -ECANCELED) r = 0;
-	if (r == 0 && !ctx.db.adb.len) r = -APKE_ADB_BLOCK;
 	adb_free(&ctx.db);
 	apk_extract_reset(ectx);
 
@@ -7,16 +7,26 @@
  * SPDX-License-Identifier: GPL-2.0-only
  */
 
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
 
 #include "apk_fs.h"
 #include "apk_xattr.h"
 #include "apk_extract.h"
 #include "apk_database.h" // for db->atoms
 #include "apk_shim.h"
+#include "apk_nproc.h"
+#include "apk_io_uring.h"
 
 #define TMPNAME_MAX (PATH_MAX + 64)
+#define OBJNAME_MAX 128
 
 static int fsys_dir_create(struct apk_fsdir *d, mode_t mode, uid_t uid, gid_t gid)
 {
@@ -88,15 +98,191 @@ static apk_blob_t get_dirname(const char *fullname)
 	return APK_BLOB_PTR_PTR((char*)fullname, slash);
 }
 
+/* Objects are keyed by the file digest in the form stored in the
+ * installed database, so both extraction and commit can find them. */
+static const char *format_objname(uint8_t alg, const uint8_t *data, char objname[static OBJNAME_MAX])
+{
+	apk_blob_t b = APK_BLOB_PTR_LEN(objname, OBJNAME_MAX);
+
+	if (alg == APK_DIGEST_SHA256) alg = APK_DIGEST_SHA256_160;
+	apk_blob_push_blob(&b, APK_BLOB_STR(apk_digest_alg_str(alg)));
+	apk_blob_push_blob(&b, APK_BLOB_STRLIT("-"));
+	apk_blob_push_hexdump(&b, APK_BLOB_PTR_LEN((char *)data, apk_digest_alg_len(alg)));
+	apk_blob_push_blob(&b, APK_BLOB_PTR_LEN("", 1));
+	if (APK_BLOB_IS_NULL(b)) return NULL;
+	return objname;
+}
+
+static int clone_fd(int src_fd, int dst_fd, uint64_t size)
+{
+#ifdef __linux__
+#ifdef FICLONE
+	if (ioctl(dst_fd, FICLONE, src_fd) == 0) return 0;
+#endif
+	while (size) {
+		ssize_t n = copy_file_range(src_fd, NULL, dst_fd, NULL, size, 0);
+		if (n < 0) return -errno;
+		if (n == 0) return -APKE_EOF;
+		size -= n;
+	}
+	return 0;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+static bool fsys_object_exists(struct apk_ctx *ac, const struct apk_file_info *fi)
+{
+	char objname[OBJNAME_MAX];
+	struct stat st;
+
+	if (ac->object_cache_fd < 0 || fi->digest.alg == APK_DIGEST_NONE) return false;
+	if (!format_objname(fi->digest.alg, fi->digest.data, objname)) return false;
+	return fstatat(ac->object_cache_fd, objname, &st, AT_SYMLINK_NOFOLLOW) == 0;
+}
+
+/* Objects are found by their digest, but the content can be modified
+ * after the object is stored, so it is hashed before it is used. */
+static bool fsys_object_verify(int fd, const struct apk_file_info *fi)
+{
+	struct apk_digest_ctx dctx;
+	struct apk_digest d;
+	char buf[16*1024];
+	uint64_t off = 0;
+	ssize_t n;
+
+	if (apk_digest_ctx_init(&dctx, fi->digest.alg) != 0) return false;
+	while (off < fi->size) {
+		n = pread(fd, buf, min(sizeof buf, fi->size - off), off);
+		if (n <= 0) break;
+		apk_digest_ctx_update(&dctx, buf, n);
+		off += n;
+	}
+	apk_digest_ctx_final(&dctx, &d);
+	apk_digest_ctx_free(&dctx);
+	return off == fi->size && apk_digest_cmp_blob(&d, fi->digest.alg, APK_DIGEST_BLOB(fi->digest)) == 0;
+}
+
+/* Fills the new file from the object cache. On failure the file is left
+ * empty so it can be extracted from the archive instead. A damaged object
+ * is removed, so the commit stores the extracted file in its place. */
+static int fsys_object_extract(struct apk_ctx *ac, const struct apk_file_info *fi, int fd)
+{
+	char objname[OBJNAME_MAX];
+	struct stat st;
+	int objfd, r;
+
+	if (ac->object_cache_fd < 0 || fi->digest.alg == APK_DIGEST_NONE) return -ENOENT;
+	if (!format_objname(fi->digest.alg, fi->digest.data, objname)) return -ENAMETOOLONG;
+
+	objfd = openat(ac->object_cache_fd, objname, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (objfd < 0) return -errno;
+	if (fstat(objfd, &st) != 0) r = -errno;
+	else if (!S_ISREG(st.st_mode) || st.st_size != fi->size) r = -APKE_FILE_INTEGRITY;
+	else if ((r = clone_fd(objfd, fd, fi->size)) == 0 && !fsys_object_verify(fd, fi)) r = -APKE_FILE_INTEGRITY;
+	close(objfd);
+	if (r == -APKE_FILE_INTEGRITY) unlinkat(ac->object_cache_fd, objname, 0);
+	if (r < 0 && (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0)) return -EIO;
+	return r;
+}
+
 static int is_system_xattr(const char *name)
 {
 	return strncmp(name, "user.", 5) != 0;
 }
 
+static bool fsys_object_xattrs_match(int fd, const struct apk_file_info *fi, unsigned int extract_flags)
+{
+	char names[1024], value[256];
+	ssize_t len, vlen;
+	int n = 0, m = 0;
+
+	len = apk_flistxattr(fd, names, sizeof names);
+	if (len < 0) return false;
+	for (char *name = names; name < names + len; name += strlen(name) + 1) m++;
+
+	if (fi->xattrs) apk_array_foreach(xattr, fi->xattrs) {
+		if ((extract_flags & APK_FSEXTRACTF_NO_SYS_XATTRS) && is_system_xattr(xattr->name))
+			continue;
+		vlen = apk_fgetxattr(fd, xattr->name, value, sizeof value);
+		if (vlen < 0 || apk_blob_compare(APK_BLOB_PTR_LEN(value, vlen), xattr->value) != 0)
+			return false;
+		n++;
+	}
+	return n == m;
+}
+
+/* Hardlinks the object into place if it already has the metadata the
+ * extracted file would get, as all links share it. An object that cannot
+ * be linked is removed, so the commit stores the extracted file as the
+ * new object. */
+static int fsys_object_link(struct apk_ctx *ac, const struct apk_file_info *fi, unsigned int extract_flags, int atfd, const char *fn)
+{
+	char objname[OBJNAME_MAX];
+	struct stat st;
+	int objfd, r = -APKE_NOT_EXTRACTED;
+
+	if (ac->object_cache_fd < 0 || fi->digest.alg == APK_DIGEST_NONE) return -ENOENT;
+	if (!format_objname(fi->digest.alg, fi->digest.data, objname)) return -ENAMETOOLONG;
+
+	objfd = openat(ac->object_cache_fd, objname, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (objfd < 0) return -errno;
+	if (fstat(objfd, &st) != 0) goto err;
+	if (!S_ISREG(st.st_mode) || st.st_size != fi->size) goto err;
+	if ((st.st_mode & 07777) != (fi->mode & 07777) || st.st_mtime != fi->mtime) goto err;
+	if (!(extract_flags & APK_FSEXTRACTF_NO_CHOWN) && (st.st_uid != fi->uid || st.st_gid != fi->gid)) goto err;
+	if (!fsys_object_xattrs_match(objfd, fi, extract_flags)) goto err;
+	if (!fsys_object_verify(objfd, fi)) goto err;
+	r = linkat(ac->object_cache_fd, objname, atfd, fn, 0) == 0 ? 0 : -errno;
+err:
+	close(objfd);
+	if (r == -APKE_NOT_EXTRACTED) unlinkat(ac->object_cache_fd, objname, 0);
+	return r;
+}
+
+static int fsys_file_finalize(int atfd, const char *fn, const struct apk_file_info *fi, unsigned int extract_flags, int atflags)
+{
+	int fd, ret = 0;
+
+	if (!(extract_flags & APK_FSEXTRACTF_NO_CHOWN)) {
+		if (fchownat(atfd, fn, fi->uid, fi->gid, atflags) != 0)
+			ret |= APK_EXTRACTW_OWNER;
+		/* chown resets suid bit so we need set it again */
+		if ((fi->mode & 07000) && fchmodat(atfd, fn, fi->mode, atflags) != 0)
+			ret |= APK_EXTRACTW_PERMISSION;
+	}
+
+	/* extract xattrs */
+	if (!S_ISLNK(fi->mode) && fi->xattrs && apk_array_len(fi->xattrs) != 0) {
+		fd = openat(atfd, fn, O_RDWR | O_CLOEXEC);
+		if (fd >= 0) {
+			apk_array_foreach(xattr, fi->xattrs) {
+				if ((extract_flags & APK_FSEXTRACTF_NO_SYS_XATTRS) && is_system_xattr(xattr->name))
+					continue;
+				if (apk_fsetxattr(fd, xattr->name, xattr->value.ptr, xattr->value.len) < 0)
+					ret |= APK_EXTRACTW_XATTR;
+			}
+			close(fd);
+		} else {
+			ret |= APK_EXTRACTW_XATTR;
+		}
+	}
+
+	if (!S_ISLNK(fi->mode)) {
+		/* preserve modification time */
+		struct timespec times[2];
+		times[0].tv_sec  = times[1].tv_sec  = fi->mtime;
+		times[0].tv_nsec = times[1].tv_nsec = 0;
+		if (utimensat(atfd, fn, times, atflags) != 0) ret |= APK_EXTRACTW_MTIME;
+	}
+
+	return ret;
+}
+
 static int fsys_file_extract(struct apk_ctx *ac, const struct apk_file_info *fi, struct apk_istream *is, unsigned int extract_flags, apk_blob_t pkgctx)
 {
 	char tmpname_file[TMPNAME_MAX], tmpname_linktarget[TMPNAME_MAX];
-	int fd, r = -1, atflags = 0, ret = 0;
+	int r = -1, atflags = 0;
 	int atfd = apk_ctx_fd_dest(ac);
 	const char *fn = fi->name, *link_target = fi->link_target;
 
@@ -114,10 +300,25 @@ static int fsys_file_extract(struct apk_ctx *ac, const struct apk_file_info *fi,
 		break;
 	case S_IFREG:
 		if (!link_target) {
+			if ((extract_flags & APK_FSEXTRACTF_LINK_OBJECTS) &&
+			    fsys_object_link(ac, fi, extract_flags, atfd, fn) == 0)
+				return 0;
+
 			int flags = O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC | O_EXCL;
 			int fd = openat(atfd, fn, flags, fi->mode & 07777);
 			if (fd < 0) return -errno;
 
+			r = fsys_object_extract(ac, fi, fd);
+			if (r == 0) {
+				close(fd);
+				break;
+			}
+			if (r == -EIO) {
+				close(fd);
+				unlinkat(atfd, fn, 0);
+				return r;
+			}
+
 			struct apk_ostream *os = apk_ostream_to_fd(fd);
 			if (IS_ERR(os)) return PTR_ERR(os);
 			apk_stream_copy(is, os, fi->size, 0);
@@ -146,40 +347,7 @@ static int fsys_file_extract(struct apk_ctx *ac, const struct apk_file_info *fi,
 		break;
 	}
 
-	if (!(extract_flags & APK_FSEXTRACTF_NO_CHOWN)) {
-		if (fchownat(atfd, fn, fi->uid, fi->gid, atflags) != 0)
-			ret |= APK_EXTRACTW_OWNER;
-		/* chown resets suid bit so we need set it again */
-		if ((fi->mode & 07000) && fchmodat(atfd, fn, fi->mode, atflags) != 0)
-			ret |= APK_EXTRACTW_PERMISSION;
-	}
-
-	/* extract xattrs */
-	if (!S_ISLNK(fi->mode) && fi->xattrs && apk_array_len(fi->xattrs) != 0) {
-		r = 0;
-		fd = openat(atfd, fn, O_RDWR | O_CLOEXEC);
-		if (fd >= 0) {
-			apk_array_foreach(xattr, fi->xattrs) {
-				if ((extract_flags & APK_FSEXTRACTF_NO_SYS_XATTRS) && is_system_xattr(xattr->name))
-					continue;
-				if (apk_fsetxattr(fd, xattr->name, xattr->value.ptr, xattr->value.len) < 0)
-					ret |= APK_EXTRACTW_XATTR;
-			}
-			close(fd);
-		} else {
-			ret |= APK_EXTRACTW_XATTR;
-		}
-	}
-
-	if (!S_ISLNK(fi->mode)) {
-		/* preserve modification time */
-		struct timespec times[2];
-		times[0].tv_sec  = times[1].tv_sec  = fi->mtime;
-		times[0].tv_nsec = times[1].tv_nsec = 0;
-		if (utimensat(atfd, fn, times, atflags) != 0) ret |= APK_EXTRACTW_MTIME;
-	}
-
-	return ret;
+	return fsys_file_finalize(atfd, fn, fi, extract_flags, atflags);
 }
 
 static int fsys_file_control(struct apk_fsdir *d, apk_blob_t filename, int ctrl)
@@ -308,3 +476,421 @@ void apk_fsdir_get(struct apk_fsdir *d, apk_blob_t dir, unsigned int extract_fla
 	d->ops = apk_fsops_get(dir);
 	apk_pathbuilder_setb(&d->pb, dir);
 }
+
+/* Regular files of large packages are written by a small thread pool.
+ * The payload is read from the archive stream by the calling thread, so
+ * decompression and digest verification stay inline, and a writer
+ * thread does the file creation, data write and metadata updates on the
+ * temporary name. The final rename is done later by file_control as
+ * usual, after apk_fs_writer_flush(). Directories, links and devices are
+ * still created by the caller in archive order.
+ *
+ * Where io_uring is available, each writer thread takes a batch of jobs
+ * at once and submits their unlink, open, write and close requests
+ * together. There are no io_uring operations for the ownership, mode
+ * and time updates, so those are still done with one system call each. */
+#define FS_WRITER_MAX_THREADS	4
+#define FS_WRITER_MAX_FILE	(4*1024*1024)
+#define FS_WRITER_MAX_BUFFERED	(32*1024*1024)
+#define FS_WRITER_BATCH		32
+
+struct fs_write_job {
+	struct fs_write_job *next;
+	struct apk_file_info fi;
+	unsigned int extract_flags;
+	void *cookie;
+	char *data;
+	int r, fd;
+	bool closed;
+	char tmpname[TMPNAME_MAX];
+};
+
+struct apk_fs_writer {
+	struct apk_ctx *ac;
+	apk_fs_writer_cb cb;
+	void *cb_ctx;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond, done_cond;
+	struct fs_write_job *queue, **queue_tail, *done;
+	size_t buffered;
+	unsigned int pending, num_threads;
+	bool stop;
+	pthread_t threads[FS_WRITER_MAX_THREADS];
+};
+
+static void fs_write_job_free(struct fs_write_job *job)
+{
+	if (job->fi.xattrs) {
+		apk_array_foreach(xattr, job->fi.xattrs) {
+			free((void *) xattr->name);
+			free(xattr->value.ptr);
+		}
+		apk_xattr_array_free(&job->fi.xattrs);
+	}
+	free((void *) job->fi.name);
+	free(job->data);
+	free(job);
+}
+
+static int fs_write_job_run(struct apk_ctx *ac, struct fs_write_job *job)
+{
+	int atfd = apk_ctx_fd_dest(ac), fd;
+	const char *fn = job->tmpname;
+	ssize_t r;
+
+	if (!(job->extract_flags & APK_FSEXTRACTF_NO_OVERWRITE)) {
+		if (unlinkat(atfd, fn, 0) != 0 && errno != ENOENT) return -errno;
+	}
+	fd = openat(atfd, fn, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC | O_EXCL, job->fi.mode & 07777);
+	if (fd < 0) return -errno;
+	r = apk_write_fully(fd, job->data, job->fi.size);
+	if (r >= 0 && r != job->fi.size) r = -ENOSPC;
+	if (close(fd) < 0 && r >= 0) r = -errno;
+	if (r < 0) {
+		unlinkat(atfd, fn, 0);
+		return r;
+	}
+	return fsys_file_finalize(atfd, fn, &job->fi, job->extract_flags, 0);
+}
+
+#define FS_URING_UNLINK	0
+#define FS_URING_OPEN	1
+#define FS_URING_WRITE	2
+#define FS_URING_CLOSE	3
+
+static void fs_write_batch_result(void *ctx, uint64_t user_data, int res)
+{
+	struct fs_write_job **jobs = ctx;
+	struct fs_write_job *job = jobs[user_data >> 2];
+
+	switch (user_data & 3) {
+	case FS_URING_UNLINK:
+		if (res < 0 && res != -ENOENT) job->r = res;
+		break;
+	case FS_URING_OPEN:
+		if (res >= 0) job->fd = res;
+		else if (job->r == 0) job->r = res;
+		break;
+	case FS_URING_WRITE:
+		if (res < 0) job->r = res;
+		else if (res != job->fi.size) job->r = -ENOSPC;
+		break;
+	case FS_URING_CLOSE:
+		// A cancelled close means the write failed and the fd is still open
+		if (res == -ECANCELED) break;
+		job->closed = true;
+		if (res < 0 && job->r == 0) job->r = res;
+		break;
+	}
+}
+
+/* Completes the jobs of a batch. If the ring failed, the jobs whose
+ * requests did not all complete are redone without it, after removing
+ * the file if it was created. Descriptors still used by requests in flight
+ * are returned in busy_fds, to be closed once the ring is freed, rather than
+ * risk closing one reused by another thread. Returns the number of them. */
+static unsigned int fs_write_batch_finish(struct apk_ctx *ac, struct fs_write_job **jobs, unsigned int n, int *busy_fds)
+{
+	int atfd = apk_ctx_fd_dest(ac);
+	unsigned int i, num_busy = 0;
+
+	for (i = 0; i < n; i++) {
+		struct fs_write_job *job = jobs[i];
+		if (job->fd >= 0 && !job->closed) {
+			if (busy_fds) busy_fds[num_busy++] = job->fd;
+			else close(job->fd);
+		}
+		if (job->r == 0 && job->closed) {
+			job->r = fsys_file_finalize(atfd, job->tmpname, &job->fi, job->extract_flags, 0);
+			continue;
+		}
+		if (job->fd >= 0) unlinkat(atfd, job->tmpname, 0);
+		if (job->r == 0) job->r = fs_write_job_run(ac, job);
+	}
+	return num_busy;
+}
+
+/* Returns an error if the ring failed, all jobs are completed anyway. */
+static int fs_write_batch_run(struct apk_ctx *ac, struct apk_io_uring *ring, struct fs_write_job **jobs, unsigned int n,
+			      int *busy_fds, unsigned int *num_busy)
+{
+	int atfd = apk_ctx_fd_dest(ac), r;
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		struct fs_write_job *job = jobs[i];
+		job->r = 0;
+		job->fd = -1;
+		job->closed = false;
+		if (!(job->extract_flags & APK_FSEXTRACTF_NO_OVERWRITE))
+			apk_io_uring_unlinkat(ring, atfd, job->tmpname, 0, APK_IO_URING_HARDLINK, i << 2 | FS_URING_UNLINK);
+		apk_io_uring_openat(ring, atfd, job->tmpname, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC | O_EXCL,
+				    job->fi.mode & 07777, 0, i << 2 | FS_URING_OPEN);
+	}
+	r = apk_io_uring_run(ring, fs_write_batch_result, jobs);
+	if (r < 0) {
+		// no request using the descriptors was submitted yet
+		*num_busy = fs_write_batch_finish(ac, jobs, n, NULL);
+		return r;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct fs_write_job *job = jobs[i];
+		if (job->fd < 0 || job->r < 0) continue;
+		if (job->fi.size)
+			apk_io_uring_write(ring, job->fd, job->data, job->fi.size, APK_IO_URING_LINK, i << 2 | FS_URING_WRITE);
+		apk_io_uring_close(ring, job->fd, 0, i << 2 | FS_URING_CLOSE);
+	}
+	r = apk_io_uring_run(ring, fs_write_batch_result, jobs);
+	*num_busy = fs_write_batch_finish(ac, jobs, n, r < 0 ? busy_fds : NULL);
+	return r;
+}
+
+static void *fs_writer_thread(void *ctx)
+{
+	struct apk_fs_writer *w = ctx;
+	struct apk_io_uring *ring;
+	struct fs_write_job *job, *jobs[FS_WRITER_BATCH];
+	int busy_fds[FS_WRITER_BATCH];
+	unsigned int i, n, num_busy, max_batch = FS_WRITER_BATCH;
+
+	// Each job needs up to four requests
+	ring = apk_io_uring_create(FS_WRITER_BATCH * 4);
+	if (IS_ERR(ring)) {
+		ring = NULL;
+		max_batch = 1;
+	}
+
+	pthread_mutex_lock(&w->mutex);
+	for (;;) {
+		while (!w->queue && !w->stop)
+			pthread_cond_wait(&w->work_cond, &w->mutex);
+		if (!w->queue) break;
+		for (n = 0; n < max_batch && w->queue; n++) {
+			jobs[n] = w->queue;
+			w->queue = jobs[n]->next;
+		}
+		if (!w->queue) w->queue_tail = &w->queue;
+		pthread_mutex_unlock(&w->mutex);
+
+		if (ring) {
+			if (fs_write_batch_run(w->ac, ring, jobs, n, busy_fds, &num_busy) < 0) {
+				// requests still in flight are cancelled with the ring
+				apk_io_uring_free(ring);
+				for (i = 0; i < num_busy; i++) close(busy_fds[i]);
+				ring = NULL;
+				max_batch = 1;
+			}
+		} else {
+			for (i = 0; i < n; i++) jobs[i]->r = fs_write_job_run(w->ac, jobs[i]);
+		}
+		for (i = 0; i < n; i++) {
+			free(jobs[i]->data);
+			jobs[i]->data = NULL;
+		}
+
+		pthread_mutex_lock(&w->mutex);
+		for (i = 0; i < n; i++) {
+			job = jobs[i];
+			w->buffered -= job->fi.size;
+			w->pending--;
+			job->next = w->done;
+			w->done = job;
+		}
+		pthread_cond_signal(&w->done_cond);
+	}
+	pthread_mutex_unlock(&w->mutex);
+	apk_io_uring_free(ring);
+	return NULL;
+}
+
+/* Waits until the queue is within the given limits, and reports the
+ * completed jobs on the calling thread. */
+static void fs_writer_reap(struct apk_fs_writer *w, size_t max_buffered, unsigned int max_pending)
+{
+	struct fs_write_job *done, *job, *next, *list = NULL;
+
+	pthread_mutex_lock(&w->mutex);
+	while (w->buffered > max_buffered || w->pending > max_pending)
+		pthread_cond_wait(&w->done_cond, &w->mutex);
+	done = w->done;
+	w->done = NULL;
+	pthread_mutex_unlock(&w->mutex);
+
+	for (job = done; job; job = next) {
+		next = job->next;
+		job->next = list;
+		list = job;
+	}
+	for (job = list; job; job = next) {
+		next = job->next;
+		w->cb(w->cb_ctx, job->cookie, job->fi.name, job->r);
+		fs_write_job_free(job);
+	}
+}
+
+struct apk_fs_writer *apk_fs_writer_create(struct apk_ctx *ac, apk_fs_writer_cb cb, void *cb_ctx)
+{
+	struct apk_fs_writer *w;
+	int num_threads = apk_get_nproc();
+
+	if (num_threads < 2) num_threads = 2;
+	if (num_threads > FS_WRITER_MAX_THREADS) num_threads = FS_WRITER_MAX_THREADS;
+
+	w = calloc(1, sizeof *w);
+	if (!w) return NULL;
+	*w = (struct apk_fs_writer) {
+		.ac = ac,
+		.cb = cb,
+		.cb_ctx = cb_ctx,
+		.queue_tail = &w->queue,
+	};
+	pthread_mutex_init(&w->mutex, NULL);
+	pthread_cond_init(&w->work_cond, NULL);
+	pthread_cond_init(&w->done_cond, NULL);
+	for (int i = 0; i < num_threads; i++) {
+		if (pthread_create(&w->threads[w->num_threads], NULL, fs_writer_thread, w) != 0) break;
+		w->num_threads++;
+	}
+	if (!w->num_threads) {
+		apk_fs_writer_free(w);
+		return NULL;
+	}
+	return w;
+}
+
+void apk_fs_writer_flush(struct apk_fs_writer *w)
+{
+	fs_writer_reap(w, 0, 0);
+}
+
+void apk_fs_writer_free(struct apk_fs_writer *w)
+{
+	if (!w) return;
+
+	apk_fs_writer_flush(w);
+	pthread_mutex_lock(&w->mutex);
+	w->stop = true;
+	pthread_cond_broadcast(&w->work_cond);
+	pthread_mutex_unlock(&w->mutex);
+	for (unsigned int i = 0; i < w->num_threads; i++)
+		pthread_join(w->threads[i], NULL);
+	pthread_cond_destroy(&w->done_cond);
+	pthread_cond_destroy(&w->work_cond);
+	pthread_mutex_destroy(&w->mutex);
+	free(w);
+}
+
+static bool fs_writer_can_defer(struct apk_ctx *ac, const struct apk_file_info *fi, apk_blob_t pkgctx)
+{
+	if (!S_ISREG(fi->mode) || fi->link_target || !pkgctx.ptr) return false;
+	if (fi->size > FS_WRITER_MAX_FILE || fi->digest.alg == APK_DIGEST_NONE) return false;
+	// Cloning from the object cache is cheaper than buffering
+	if (fsys_object_exists(ac, fi)) return false;
+	return apk_fsops_get(APK_BLOB_PTR_LEN((char*)fi->name, strnlen(fi->name, 5))) == &fsdir_ops_fsys;
+}
+
+/* Returns -EINPROGRESS if the file was queued, and its result is then
+ * passed to the callback by a later apk_fs_writer_extract() or
+ * apk_fs_writer_flush() call. Otherwise the file was extracted
+ * synchronously and the apk_fs_extract() result is returned. */
+int apk_fs_writer_extract(struct apk_fs_writer *w, const struct apk_file_info *fi, struct apk_istream *is, unsigned int extract_flags, apk_blob_t pkgctx, void *cookie)
+{
+	struct apk_ctx *ac = w->ac;
+	struct fs_write_job *job;
+	int r;
+
+	if (!fs_writer_can_defer(ac, fi, pkgctx)) {
+		// Hard link target may still be queued
+		if (fi->link_target) apk_fs_writer_flush(w);
+		return apk_fs_extract(ac, fi, is, extract_flags, pkgctx);
+	}
+
+	fs_writer_reap(w, FS_WRITER_MAX_BUFFERED - fi->size, UINT_MAX);
+
+	job = calloc(1, sizeof *job);
+	if (!job) return apk_fs_extract(ac, fi, is, extract_flags, pkgctx);
+	job->fi = (struct apk_file_info) {
+		.name = strdup(fi->name),
+		.mode = fi->mode,
+		.uid = fi->uid,
+		.gid = fi->gid,
+		.size = fi->size,
+		.mtime = fi->mtime,
+	};
+	job->extract_flags = extract_flags;
+	job->cookie = cookie;
+	job->data = malloc(fi->size ?: 1);
+	if (!job->fi.name || !job->data) {
+		fs_write_job_free(job);
+		return apk_fs_extract(ac, fi, is, extract_flags, pkgctx);
+	}
+	if (fi->xattrs && apk_array_len(fi->xattrs) != 0) {
+		apk_xattr_array_init(&job->fi.xattrs);
+		apk_array_foreach(xattr, fi->xattrs) {
+			struct apk_xattr copy = {
+				.name = strdup(xattr->name),
+				.value = apk_blob_dup(xattr->value),
+			};
+			apk_xattr_array_add(&job->fi.xattrs, copy);
+		}
+	}
+	r = fi->size ? apk_istream_read(is, job->data, fi->size) : 0;
+	if (r < 0) {
+		fs_write_job_free(job);
+		return r;
+	}
+	format_tmpname(&ac->dctx, pkgctx, get_dirname(fi->name), APK_BLOB_STR(fi->name), job->tmpname);
+
+	pthread_mutex_lock(&w->mutex);
+	*w->queue_tail = job;
+	w->queue_tail = &job->next;
+	w->buffered += fi->size;
+	w->pending++;
+	pthread_cond_signal(&w->work_cond);
+	pthread_mutex_unlock(&w->mutex);
+	return -EINPROGRESS;
+}
+
+/* Adds a committed regular file to the object cache, if it is not there
+ * yet. The file has been verified as part of its package by now. With
+ * link, the file itself becomes the object so it can be linked later. */
+int apk_fs_object_store(struct apk_fsdir *d, apk_blob_t filename, uint8_t alg, const uint8_t *digest, bool link)
+{
+	struct apk_ctx *ac = d->ac;
+	char objname[OBJNAME_MAX], tmpname[OBJNAME_MAX + 32];
+	struct stat st;
+	int n, src_fd, dst_fd, r, cache_fd = ac->object_cache_fd;
+
+	if (cache_fd < 0 || d->ops != &fsdir_ops_fsys || alg == APK_DIGEST_NONE) return 0;
+	if (!format_objname(alg, digest, objname)) return -ENAMETOOLONG;
+	if (fstatat(cache_fd, objname, &st, AT_SYMLINK_NOFOLLOW) == 0) return 0;
+
+	n = apk_pathbuilder_pushb(&d->pb, filename);
+	r = fstatat(apk_ctx_fd_dest(ac), apk_pathbuilder_cstr(&d->pb), &st, AT_SYMLINK_NOFOLLOW);
+	if (r == 0 && S_ISREG(st.st_mode)) {
+		if (link && linkat(apk_ctx_fd_dest(ac), apk_pathbuilder_cstr(&d->pb), cache_fd, objname, 0) == 0)
+			src_fd = -1;
+		else
+			src_fd = openat(apk_ctx_fd_dest(ac), apk_pathbuilder_cstr(&d->pb), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	} else {
+		src_fd = -1;
+	}
+	apk_pathbuilder_pop(&d->pb, n);
+	if (src_fd < 0) return 0;
+
+	r = apk_fmt(tmpname, sizeof tmpname, ".%s.%d", objname, getpid());
+	if (r < 0) goto err_src;
+	dst_fd = openat(cache_fd, tmpname, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0444);
+	if (dst_fd < 0) {
+		r = -errno;
+		goto err_src;
+	}
+	r = clone_fd(src_fd, dst_fd, st.st_size);
+	close(dst_fd);
+	if (r == 0 && renameat(cache_fd, tmpname, cache_fd, objname) != 0) r = -errno;
+	if (r < 0) unlinkat(cache_fd, tmpname, 0);
+err_src:
+	close(src_fd);
+	return r;
+}
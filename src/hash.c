@@ -7,6 +7,7 @@
  * SPDX-License-Identifier: GPL-2.0-only
  */
 
+#include <limits.h>
 #include "apk_defines.h"
 #include "apk_hash.h"
 
@@ -16,9 +17,189 @@ void apk_hash_init(struct apk_hash *h, const struct apk_hash_ops *ops,
 	h->ops = ops;
 	apk_hash_array_init(&h->buckets);
 	apk_hash_array_resize(&h->buckets, num_buckets, num_buckets);
+	h->table = h->old = h->retired = NULL;
+	h->migrate_pos = h->iterating = 0;
 	h->num_items = 0;
 }
 
+/* Open addressing mode. Each table is a power of two sized array of slots
+ * holding the full 32-bit hash as a fingerprint, probed linearly from a
+ * Fibonacci hashed start index. Deleted slots are marked with a tombstone.
+ * Growing allocates a new table and moves the previous one aside; its
+ * entries are migrated a few slots at a time by subsequent modifications
+ * so that no single insert pays for rehashing the whole table. */
+
+#define APK_HASH_OPEN_MIN_SIZE		16
+#define APK_HASH_OPEN_MIGRATE_STEP	8
+
+static char apk_hash_tombstone;
+#define TOMBSTONE ((apk_hash_item) &apk_hash_tombstone)
+
+static inline int slot_live(const struct apk_hash_slot *s)
+{
+	return s->item != NULL && s->item != TOMBSTONE;
+}
+
+static inline unsigned int slot_index(const struct apk_hash_table *t, uint32_t hash)
+{
+	return (uint32_t)(hash * 2654435769U) >> t->shift;
+}
+
+static inline unsigned int table_size(const struct apk_hash_table *t)
+{
+	return t->mask + 1;
+}
+
+static struct apk_hash_table *table_alloc(unsigned int num_items)
+{
+	struct apk_hash_table *t;
+	unsigned int size = APK_HASH_OPEN_MIN_SIZE, shift = 28;
+
+	while (size < num_items + num_items / 2) size <<= 1, shift--;
+	t = calloc(1, sizeof *t + size * sizeof t->slot[0]);
+	if (!t) abort();
+	t->mask = size - 1;
+	t->shift = shift;
+	return t;
+}
+
+static void table_insert(struct apk_hash_table *t, apk_hash_item item, uint32_t hash)
+{
+	struct apk_hash_slot *s;
+	unsigned int i = slot_index(t, hash);
+
+	for (;; i = (i + 1) & t->mask) {
+		s = &t->slot[i];
+		if (s->item == NULL) t->used++;
+		else if (s->item != TOMBSTONE) continue;
+		s->hash = hash;
+		s->item = item;
+		return;
+	}
+}
+
+static struct apk_hash_slot *table_find(struct apk_hash *h, struct apk_hash_table *t, apk_blob_t key, uint32_t hash)
+{
+	const struct apk_hash_ops *ops = h->ops;
+	struct apk_hash_slot *s;
+	unsigned int i = slot_index(t, hash);
+
+	for (;; i = (i + 1) & t->mask) {
+		s = &t->slot[i];
+		if (s->item == NULL) return NULL;
+		if (s->hash != hash || s->item == TOMBSTONE) continue;
+		if (ops->compare_item) {
+			if (ops->compare_item(s->item, key) == 0) return s;
+		} else {
+			if (ops->compare(key, ops->get_key(s->item)) == 0) return s;
+		}
+	}
+}
+
+static void hash_migrate(struct apk_hash *h, unsigned int steps)
+{
+	struct apk_hash_table *old = h->old;
+	struct apk_hash_slot *s;
+
+	if (!old) return;
+	for (; steps && h->migrate_pos < table_size(old); steps--, h->migrate_pos++) {
+		s = &old->slot[h->migrate_pos];
+		if (!slot_live(s)) continue;
+		table_insert(h->table, s->item, s->hash);
+		s->item = TOMBSTONE;
+	}
+	if (h->migrate_pos >= table_size(old)) {
+		free(old);
+		h->old = NULL;
+		h->migrate_pos = 0;
+	}
+}
+
+/* The tables being iterated must not change. When one fills up during
+ * foreach, all items are copied to a new table and the previous ones are
+ * kept unmodified until the outermost foreach returns. */
+static void hash_grow_iterating(struct apk_hash *h)
+{
+	struct apk_hash_table *t = table_alloc(2 * (h->num_items + 1));
+	struct apk_hash_table *prev[] = { h->table, h->old };
+
+	for (unsigned int n = 0; n < ARRAY_SIZE(prev); n++) {
+		if (!prev[n]) continue;
+		for (unsigned int i = 0; i < table_size(prev[n]); i++) {
+			struct apk_hash_slot *s = &prev[n]->slot[i];
+			if (slot_live(s)) table_insert(t, s->item, s->hash);
+		}
+		prev[n]->next_retired = h->retired;
+		h->retired = prev[n];
+	}
+	h->table = t;
+	h->old = NULL;
+	h->migrate_pos = 0;
+}
+
+static void hash_free_retired(struct apk_hash *h)
+{
+	struct apk_hash_table *t, *next;
+
+	for (t = h->retired; t; t = next) {
+		next = t->next_retired;
+		free(t);
+	}
+	h->retired = NULL;
+}
+
+static void hash_reserve(struct apk_hash *h)
+{
+	struct apk_hash_table *t = h->table;
+	unsigned int limit = table_size(t) - table_size(t) / 8;
+
+	/* Migration is paused during foreach so that every item is visited
+	 * exactly once. Growing is deferred then too unless the table is full. */
+	if (h->iterating) {
+		if (t->used + 1 >= table_size(t)) hash_grow_iterating(h);
+		return;
+	}
+	hash_migrate(h, APK_HASH_OPEN_MIGRATE_STEP);
+	if (t->used + 1 <= limit) return;
+	hash_migrate(h, UINT_MAX);
+	h->old = t;
+	h->migrate_pos = 0;
+	h->table = table_alloc(2 * (h->num_items + 1));
+}
+
+void apk_hash_init_open(struct apk_hash *h, const struct apk_hash_ops *ops,
+			int size_hint)
+{
+	h->ops = ops;
+	apk_hash_array_init(&h->buckets);
+	h->table = table_alloc(size_hint > 0 ? size_hint : 0);
+	h->old = h->retired = NULL;
+	h->migrate_pos = h->iterating = 0;
+	h->num_items = 0;
+}
+
+static int open_foreach(struct apk_hash *h, apk_hash_enumerator_f e, void *ctx)
+{
+	struct apk_hash_table *tables[] = { h->table, h->old }, *t;
+	apk_hash_item item;
+	unsigned int i, n;
+	int r = 0;
+
+	h->iterating++;
+	for (n = 0; n < ARRAY_SIZE(tables); n++) {
+		if (!(t = tables[n])) continue;
+		for (i = 0; i < table_size(t); i++) {
+			if (!slot_live(&t->slot[i])) continue;
+			item = t->slot[i].item;
+			r = e(item, ctx);
+			if (r != 0) goto done;
+		}
+	}
+done:
+	if (--h->iterating == 0) hash_free_retired(h);
+	return r;
+}
+
 static int apk_hash_free_item_enumerator(apk_hash_item item, void *ctx)
 {
 	((apk_hash_delete_f) ctx)(item);
@@ -29,6 +210,10 @@ void apk_hash_free(struct apk_hash *h)
 {
 	if (h->ops->delete_item) apk_hash_foreach(h, apk_hash_free_item_enumerator, h->ops->delete_item);
 	apk_hash_array_free(&h->buckets);
+	free(h->table);
+	free(h->old);
+	hash_free_retired(h);
+	h->table = h->old = NULL;
 }
 
 int apk_hash_foreach(struct apk_hash *h, apk_hash_enumerator_f e, void *ctx)
@@ -37,6 +222,7 @@ int apk_hash_foreach(struct apk_hash *h, apk_hash_enumerator_f e, void *ctx)
 	ptrdiff_t offset = h->ops->node_offset;
 	int r;
 
+	if (h->table) return open_foreach(h, e, ctx);
 	apk_array_foreach(bucket, h->buckets) {
 		hlist_for_each_safe(pos, n, bucket) {
 			r = e(((void *) pos) - offset, ctx);
@@ -54,6 +240,12 @@ apk_hash_item apk_hash_get_hashed(struct apk_hash *h, apk_blob_t key, unsigned l
 	apk_hash_item item;
 	apk_blob_t itemkey;
 
+	if (h->table) {
+		struct apk_hash_slot *s = table_find(h, h->table, key, hash);
+		if (!s && h->old) s = table_find(h, h->old, key, hash);
+		return s ? s->item : NULL;
+	}
+
 	hash %= apk_array_len(h->buckets);
 	if (h->ops->compare_item != NULL) {
 		hlist_for_each(pos, &h->buckets->item[hash]) {
@@ -77,6 +269,13 @@ void apk_hash_insert_hashed(struct apk_hash *h, apk_hash_item item, unsigned lon
 {
 	apk_hash_node *node;
 
+	if (h->table) {
+		hash_reserve(h);
+		table_insert(h->table, item, hash);
+		h->num_items++;
+		return;
+	}
+
 	hash %= apk_array_len(h->buckets);
 	node = (apk_hash_node *) (item + h->ops->node_offset);
 	hlist_add_head(node, &h->buckets->item[hash]);
@@ -91,6 +290,21 @@ void apk_hash_delete_hashed(struct apk_hash *h, apk_blob_t key, unsigned long ha
 
 	assert(h->ops->compare_item != NULL);
 
+	if (h->table) {
+		struct apk_hash_slot *s = table_find(h, h->table, key, hash);
+		if (!s && h->old) s = table_find(h, h->old, key, hash);
+		if (!s) return;
+		item = s->item;
+		s->item = TOMBSTONE;
+		/* the foreach still running must not see the item either */
+		for (struct apk_hash_table *t = h->retired; t; t = t->next_retired)
+			if ((s = table_find(h, t, key, hash)) != NULL) s->item = TOMBSTONE;
+		if (h->ops->delete_item) h->ops->delete_item(item);
+		h->num_items--;
+		if (!h->iterating) hash_migrate(h, APK_HASH_OPEN_MIGRATE_STEP);
+		return;
+	}
+
 	hash %= apk_array_len(h->buckets);
 	hlist_for_each(pos, &h->buckets->item[hash]) {
 		item = ((void *) pos) - offset;
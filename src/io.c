@@ -31,6 +31,7 @@
 #endif
 
 size_t apk_io_bufsize = 128*1024;
+bool apk_io_threaded_decompress;
 
 
 static inline int atfd_error(int atfd)
@@ -9,21 +9,52 @@
 #include <errno.h>
 #include <stdio.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <zlib.h>
 
 #include "apk_defines.h"
 #include "apk_io.h"
 
+/* With readahead, a helper thread inflates while the reader consumes
+ * the previous output. The reader still does all reads of the compressed
+ * input stream, so progress and tee streams below stay on its thread, and
+ * passes the data to the helper in copied chunks. The helper calls the
+ * APK_MPART_DATA callbacks, but at each member boundary it waits until
+ * the reader has consumed all output before it and is waiting for more,
+ * so the boundary and end callbacks run as they would without readahead. */
+#define GZI_RA_INPUT	4
+#define GZI_RA_OUTPUT	4
+
+struct gzi_readahead {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	uint8_t *in[GZI_RA_INPUT], *in_cur, *in_prev;
+	size_t in_len[GZI_RA_INPUT];
+	unsigned int in_head, in_tail;
+	uint8_t *out[GZI_RA_OUTPUT];
+	size_t out_len[GZI_RA_OUTPUT], out_pos;
+	unsigned int out_head, out_tail;
+	int in_err, eof_err, result;
+	bool in_done, done, stop, in_read;
+};
+
 struct apk_gzip_istream {
 	struct apk_istream is;
 	struct apk_istream *zis;
 	z_stream zs;
+	int err;
 
 	apk_multipart_cb cb;
 	void *cbctx;
 	void *cbprev;
 	apk_blob_t cbarg;
+
+	bool readahead;
+	struct gzi_readahead *ra;
 };
 
 static void gzi_get_meta(struct apk_istream *is, struct apk_file_meta *meta)
@@ -32,20 +63,79 @@ static void gzi_get_meta(struct apk_istream *is, struct apk_file_meta *meta)
 	apk_istream_get_meta(gis->zis, meta);
 }
 
+static int gzi_error(struct apk_gzip_istream *gis, int err)
+{
+	if (gis->err >= 0 && err) gis->err = err;
+	return gis->err < 0 ? gis->err : 0;
+}
+
+static int gzi_input_error(struct apk_gzip_istream *gis)
+{
+	return gis->ra ? gis->ra->eof_err : gis->zis->err;
+}
+
+static int gzi_ra_wait_reader(struct apk_gzip_istream *gis)
+{
+	struct gzi_readahead *ra = gis->ra;
+	int r;
+
+	pthread_mutex_lock(&ra->mutex);
+	while (!ra->stop && !(ra->out_head == ra->out_tail && ra->in_read))
+		pthread_cond_wait(&ra->cond, &ra->mutex);
+	r = ra->stop ? -ECANCELED : 0;
+	pthread_mutex_unlock(&ra->mutex);
+	return r;
+}
+
 static int gzi_boundary_change(struct apk_gzip_istream *gis)
 {
 	int r;
 
+	if (gis->ra && (r = gzi_ra_wait_reader(gis)) != 0) return gzi_error(gis, r);
+
 	if (gis->cb && !APK_BLOB_IS_NULL(gis->cbarg)) {
 		r = gis->cb(gis->cbctx, APK_MPART_DATA, gis->cbarg);
-		if (r) return apk_istream_error(&gis->is, r);
+		if (r) return gzi_error(gis, r);
 	}
 	gis->cbarg = APK_BLOB_NULL;
-	if (!gis->is.err && gis->zis->err && gis->zs.avail_in == 0) gis->is.err = gis->zis->err;
+	if (!gis->err && gzi_input_error(gis) && gis->zs.avail_in == 0) gis->err = gzi_input_error(gis);
 	if (!gis->cb) return 0;
-	r = gis->cb(gis->cbctx, gis->is.err ? APK_MPART_END : APK_MPART_BOUNDARY, APK_BLOB_NULL);
+	r = gis->cb(gis->cbctx, gis->err ? APK_MPART_END : APK_MPART_BOUNDARY, APK_BLOB_NULL);
 	if (r > 0) r = -ECANCELED;
-	return apk_istream_error(&gis->is, r);
+	return gzi_error(gis, r);
+}
+
+/* Runs on the helper thread. The previous chunk is kept as a pending
+ * boundary callback may still refer to it. */
+static int gzi_ra_read_more(struct apk_gzip_istream *gis)
+{
+	struct gzi_readahead *ra = gis->ra;
+	uint8_t *chunk;
+	size_t len;
+
+	pthread_mutex_lock(&ra->mutex);
+	while (!ra->stop && ra->in_head == ra->in_tail && !ra->in_done)
+		pthread_cond_wait(&ra->cond, &ra->mutex);
+	if (ra->stop || ra->in_head == ra->in_tail) {
+		int r = ra->stop ? -ECANCELED : ra->in_err;
+		pthread_mutex_unlock(&ra->mutex);
+		if (r < 0) return gzi_error(gis, r);
+		ra->eof_err = r;
+		return 0;
+	}
+	chunk = ra->in[ra->in_head % GZI_RA_INPUT];
+	len = ra->in_len[ra->in_head % GZI_RA_INPUT];
+	ra->in_head++;
+	free(ra->in_prev);
+	ra->in_prev = ra->in_cur;
+	ra->in_cur = chunk;
+	pthread_cond_broadcast(&ra->cond);
+	pthread_mutex_unlock(&ra->mutex);
+
+	gis->zs.avail_in = len;
+	gis->zs.next_in = chunk;
+	gis->cbprev = chunk;
+	return 0;
 }
 
 static int gzi_read_more(struct apk_gzip_istream *gis)
@@ -53,9 +143,11 @@ static int gzi_read_more(struct apk_gzip_istream *gis)
 	apk_blob_t blob;
 	int r;
 
+	if (gis->ra) return gzi_ra_read_more(gis);
+
 	r = apk_istream_get_all(gis->zis, &blob);
 	if (r < 0) {
-		if (r != -APKE_EOF) return apk_istream_error(&gis->is, r);
+		if (r != -APKE_EOF) return gzi_error(gis, r);
 		return 0;
 	}
 	gis->zs.avail_in = blob.len;
@@ -64,24 +156,23 @@ static int gzi_read_more(struct apk_gzip_istream *gis)
 	return 0;
 }
 
-static ssize_t gzi_read(struct apk_istream *is, void *ptr, size_t size)
+static ssize_t gzi_inflate(struct apk_gzip_istream *gis, void *ptr, size_t size)
 {
-	struct apk_gzip_istream *gis = container_of(is, struct apk_gzip_istream, is);
 	int r;
 
 	gis->zs.avail_out = size;
 	gis->zs.next_out  = ptr;
 
-	while (gis->zs.avail_out != 0 && gis->is.err >= 0) {
+	while (gis->zs.avail_out != 0 && gis->err >= 0) {
 		if (!APK_BLOB_IS_NULL(gis->cbarg)) {
 			r = gzi_boundary_change(gis);
 			if (r) return r;
 		}
-		if (gis->zs.avail_in == 0 && gis->is.err == 0) {
+		if (gis->zs.avail_in == 0 && gis->err == 0) {
 			if (gis->cb != NULL && gis->cbprev != NULL && gis->cbprev != gis->zs.next_in) {
 				r = gis->cb(gis->cbctx, APK_MPART_DATA,
 					APK_BLOB_PTR_LEN(gis->cbprev, (void *)gis->zs.next_in - gis->cbprev));
-				if (r < 0) return apk_istream_error(&gis->is, r);
+				if (r < 0) return gzi_error(gis, r);
 				gis->cbprev = gis->zs.next_in;
 			}
 			r = gzi_read_more(gis);
@@ -121,7 +212,7 @@ static ssize_t gzi_read(struct apk_istream *is, void *ptr, size_t size)
 			 * and we just tried reading a new header. */
 			goto ret;
 		default:
-			return apk_istream_error(&gis->is, -APKE_FORMAT_INVALID);
+			return gzi_error(gis, -APKE_FORMAT_INVALID);
 		}
 	}
 
@@ -129,12 +220,175 @@ ret:
 	return size - gis->zs.avail_out;
 }
 
+static void *gzi_ra_thread(void *ctx)
+{
+	struct apk_gzip_istream *gis = ctx;
+	struct gzi_readahead *ra = gis->ra;
+	ssize_t r;
+
+	pthread_mutex_lock(&ra->mutex);
+	for (;;) {
+		while (!ra->stop && ra->out_tail - ra->out_head == GZI_RA_OUTPUT)
+			pthread_cond_wait(&ra->cond, &ra->mutex);
+		if (ra->stop) break;
+		pthread_mutex_unlock(&ra->mutex);
+
+		r = gzi_inflate(gis, ra->out[ra->out_tail % GZI_RA_OUTPUT], apk_io_bufsize);
+
+		pthread_mutex_lock(&ra->mutex);
+		if (r <= 0) {
+			ra->result = r;
+			ra->done = true;
+			pthread_cond_broadcast(&ra->cond);
+			break;
+		}
+		ra->out_len[ra->out_tail % GZI_RA_OUTPUT] = r;
+		ra->out_tail++;
+		pthread_cond_broadcast(&ra->cond);
+	}
+	pthread_mutex_unlock(&ra->mutex);
+	return NULL;
+}
+
+static void gzi_ra_free(struct gzi_readahead *ra)
+{
+	for (unsigned int i = ra->in_head; i != ra->in_tail; i++)
+		free(ra->in[i % GZI_RA_INPUT]);
+	for (unsigned int i = 0; i < GZI_RA_OUTPUT; i++)
+		free(ra->out[i]);
+	free(ra->in_cur);
+	free(ra->in_prev);
+	pthread_cond_destroy(&ra->cond);
+	pthread_mutex_destroy(&ra->mutex);
+	free(ra);
+}
+
+/* The unconsumed input still points to the buffer of the compressed
+ * stream, which the reader will refill, so it is copied first. */
+static void gzi_ra_start(struct apk_gzip_istream *gis)
+{
+	struct gzi_readahead *ra;
+	uint8_t *start = gis->cbprev ?: gis->zs.next_in, *end = gis->zs.next_in + gis->zs.avail_in;
+
+	gis->readahead = false;
+	if (gis->err || !APK_BLOB_IS_NULL(gis->cbarg)) return;
+
+	ra = calloc(1, sizeof *ra);
+	if (!ra) return;
+	pthread_mutex_init(&ra->mutex, NULL);
+	pthread_cond_init(&ra->cond, NULL);
+	for (unsigned int i = 0; i < GZI_RA_OUTPUT; i++)
+		if (!(ra->out[i] = malloc(apk_io_bufsize))) goto err;
+	if (end != start) {
+		if (!(ra->in_cur = malloc(end - start))) goto err;
+		memcpy(ra->in_cur, start, end - start);
+		gis->zs.next_in = ra->in_cur + (gis->zs.next_in - start);
+		if (gis->cbprev) gis->cbprev = ra->in_cur;
+	}
+	gis->ra = ra;
+	if (pthread_create(&ra->thread, NULL, gzi_ra_thread, gis) != 0) {
+		gis->ra = NULL;
+		if (end != start) {
+			gis->zs.next_in = start + (gis->zs.next_in - ra->in_cur);
+			if (gis->cbprev) gis->cbprev = start;
+		}
+		goto err;
+	}
+	return;
+err:
+	gzi_ra_free(ra);
+}
+
+static ssize_t gzi_ra_read(struct apk_gzip_istream *gis, void *ptr, size_t size)
+{
+	struct gzi_readahead *ra = gis->ra;
+	apk_blob_t blob;
+	uint8_t *chunk;
+	ssize_t r;
+
+	pthread_mutex_lock(&ra->mutex);
+	ra->in_read = true;
+	pthread_cond_broadcast(&ra->cond);
+	for (;;) {
+		if (!ra->in_done && ra->in_tail - ra->in_head < GZI_RA_INPUT) {
+			pthread_mutex_unlock(&ra->mutex);
+			r = apk_istream_get_max(gis->zis, apk_io_bufsize, &blob);
+			chunk = r == 0 ? malloc(blob.len ?: 1) : NULL;
+			if (chunk) memcpy(chunk, blob.ptr, blob.len);
+			pthread_mutex_lock(&ra->mutex);
+			if (chunk) {
+				ra->in[ra->in_tail % GZI_RA_INPUT] = chunk;
+				ra->in_len[ra->in_tail % GZI_RA_INPUT] = blob.len;
+				ra->in_tail++;
+			} else {
+				ra->in_done = true;
+				ra->in_err = r == -APKE_EOF ? gis->zis->err : (r ?: -ENOMEM);
+			}
+			pthread_cond_broadcast(&ra->cond);
+			continue;
+		}
+		if (ra->out_head != ra->out_tail) {
+			unsigned int slot = ra->out_head % GZI_RA_OUTPUT;
+			r = ra->out_len[slot] - ra->out_pos;
+			if ((size_t) r > size) r = size;
+			pthread_mutex_unlock(&ra->mutex);
+			memcpy(ptr, ra->out[slot] + ra->out_pos, r);
+			pthread_mutex_lock(&ra->mutex);
+			ra->out_pos += r;
+			if (ra->out_pos == ra->out_len[slot]) {
+				ra->out_pos = 0;
+				ra->out_head++;
+				pthread_cond_broadcast(&ra->cond);
+			}
+			break;
+		}
+		if (ra->done) {
+			r = ra->result;
+			break;
+		}
+		pthread_cond_wait(&ra->cond, &ra->mutex);
+	}
+	ra->in_read = false;
+	pthread_mutex_unlock(&ra->mutex);
+	if (r < 0) return apk_istream_error(&gis->is, r);
+	return r;
+}
+
+static void gzi_ra_stop(struct apk_gzip_istream *gis)
+{
+	struct gzi_readahead *ra = gis->ra;
+
+	if (!ra) return;
+	pthread_mutex_lock(&ra->mutex);
+	ra->stop = true;
+	pthread_cond_broadcast(&ra->cond);
+	pthread_mutex_unlock(&ra->mutex);
+	pthread_join(ra->thread, NULL);
+	gis->ra = NULL;
+	gzi_ra_free(ra);
+}
+
+static ssize_t gzi_read(struct apk_istream *is, void *ptr, size_t size)
+{
+	struct apk_gzip_istream *gis = container_of(is, struct apk_gzip_istream, is);
+	ssize_t r;
+
+	if (gis->ra) return gzi_ra_read(gis, ptr, size);
+
+	r = gzi_inflate(gis, ptr, size);
+	if (gis->err) apk_istream_error(&gis->is, gis->err);
+	if (gis->readahead) gzi_ra_start(gis);
+	return r;
+}
+
 static int gzi_close(struct apk_istream *is)
 {
 	int r;
 	struct apk_gzip_istream *gis = container_of(is, struct apk_gzip_istream, is);
 
+	gzi_ra_stop(gis);
 	inflateEnd(&gis->zs);
+	if (gis->err < 0) apk_istream_error(&gis->is, gis->err);
 	r = apk_istream_close_error(gis->zis, gis->is.err);
 	free(gis);
 	return r;
@@ -146,6 +400,19 @@ static const struct apk_istream_ops gunzip_istream_ops = {
 	.close = gzi_close,
 };
 
+/* Requests the rest of the stream to be inflated on a helper thread,
+ * starting with the next read. After this, the APK_MPART_DATA callbacks
+ * may run concurrently with the reader, and must not use state the
+ * reader uses. It is typically called from the boundary callback
+ * before the last member. */
+void apk_istream_gunzip_readahead(struct apk_istream *is)
+{
+	struct apk_gzip_istream *gis = container_of(is, struct apk_gzip_istream, is);
+
+	if (IS_ERR(is) || is->ops != &gunzip_istream_ops || gis->ra) return;
+	gis->readahead = true;
+}
+
 static int window_bits(int window_bits, int raw)
 {
 	if (raw) return -window_bits;	// raw mode
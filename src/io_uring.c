@@ -0,0 +1,248 @@
+/* io_uring.c - Alpine Package Keeper (APK)
+ *
+ * A minimal io_uring submission ring using the raw system calls. It is
+ * only used to batch the file system requests of extraction, so it
+ * supports just the few operations needed, and always waits for all
+ * submitted requests to complete.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "apk_defines.h"
+#include "apk_io_uring.h"
+
+#ifdef HAVE_IO_URING
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+struct apk_io_uring {
+	int fd;
+	unsigned int sq_entries, sq_mask, cq_mask;
+	unsigned int sqe_tail, inflight;
+	unsigned int *sq_head, *sq_tail, *sq_array;
+	unsigned int *cq_head, *cq_tail;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+};
+
+static const uint8_t required_ops[] = {
+	IORING_OP_OPENAT,
+	IORING_OP_WRITE,
+	IORING_OP_CLOSE,
+	IORING_OP_UNLINKAT,
+};
+
+static int io_uring_supports_ops(int fd)
+{
+	const unsigned int nops = 256;
+	struct io_uring_probe *probe;
+	int r = 0;
+
+	probe = calloc(1, sizeof *probe + nops * sizeof probe->ops[0]);
+	if (!probe) return -ENOMEM;
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, nops) < 0) {
+		r = -errno;
+		goto done;
+	}
+	for (size_t i = 0; i < ARRAY_SIZE(required_ops); i++) {
+		uint8_t op = required_ops[i];
+		if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+			r = -ENOTSUP;
+			break;
+		}
+	}
+done:
+	free(probe);
+	return r;
+}
+
+struct apk_io_uring *apk_io_uring_create(unsigned int entries)
+{
+	struct io_uring_params p = {};
+	struct apk_io_uring *ring;
+	int r;
+
+	ring = calloc(1, sizeof *ring);
+	if (!ring) return ERR_PTR(-ENOMEM);
+
+	ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0) {
+		r = -errno;
+		free(ring);
+		return ERR_PTR(r);
+	}
+	r = io_uring_supports_ops(ring->fd);
+	if (r < 0) goto err;
+
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) goto err_errno;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ring = ring->sq_ring;
+	} else {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+				     MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED) goto err_errno;
+	}
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) goto err_errno;
+
+	ring->sq_entries = p.sq_entries;
+	ring->sq_mask = *(unsigned int *)((char *)ring->sq_ring + p.sq_off.ring_mask);
+	ring->sq_head = (unsigned int *)((char *)ring->sq_ring + p.sq_off.head);
+	ring->sq_tail = (unsigned int *)((char *)ring->sq_ring + p.sq_off.tail);
+	ring->sq_array = (unsigned int *)((char *)ring->sq_ring + p.sq_off.array);
+	ring->cq_mask = *(unsigned int *)((char *)ring->cq_ring + p.cq_off.ring_mask);
+	ring->cq_head = (unsigned int *)((char *)ring->cq_ring + p.cq_off.head);
+	ring->cq_tail = (unsigned int *)((char *)ring->cq_ring + p.cq_off.tail);
+	ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ring + p.cq_off.cqes);
+	ring->sqe_tail = *ring->sq_tail;
+	return ring;
+
+err_errno:
+	r = -errno;
+err:
+	apk_io_uring_free(ring);
+	return ERR_PTR(r);
+}
+
+void apk_io_uring_free(struct apk_io_uring *ring)
+{
+	if (!ring || IS_ERR(ring)) return;
+	if (ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring && ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+	free(ring);
+}
+
+static struct io_uring_sqe *io_uring_get_sqe(struct apk_io_uring *ring, unsigned int sqe_flags, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+	if (ring->sqe_tail - head >= ring->sq_entries) return NULL;
+	sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+	ring->sq_array[ring->sqe_tail & ring->sq_mask] = ring->sqe_tail & ring->sq_mask;
+	ring->sqe_tail++;
+
+	memset(sqe, 0, sizeof *sqe);
+	if (sqe_flags & APK_IO_URING_LINK) sqe->flags |= IOSQE_IO_LINK;
+	if (sqe_flags & APK_IO_URING_HARDLINK) sqe->flags |= IOSQE_IO_HARDLINK;
+	sqe->user_data = user_data;
+	return sqe;
+}
+
+int apk_io_uring_unlinkat(struct apk_io_uring *ring, int dirfd, const char *path, int flags, unsigned int sqe_flags, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(ring, sqe_flags, user_data);
+	if (!sqe) return -EBUSY;
+	sqe->opcode = IORING_OP_UNLINKAT;
+	sqe->fd = dirfd;
+	sqe->addr = (uintptr_t) path;
+	sqe->unlink_flags = flags;
+	return 0;
+}
+
+int apk_io_uring_openat(struct apk_io_uring *ring, int dirfd, const char *path, int flags, mode_t mode, unsigned int sqe_flags, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(ring, sqe_flags, user_data);
+	if (!sqe) return -EBUSY;
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = dirfd;
+	sqe->addr = (uintptr_t) path;
+	sqe->len = mode;
+	sqe->open_flags = flags;
+	return 0;
+}
+
+int apk_io_uring_write(struct apk_io_uring *ring, int fd, const void *buf, size_t len, unsigned int sqe_flags, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe;
+
+	if (len > UINT32_MAX) return -EINVAL;
+	sqe = io_uring_get_sqe(ring, sqe_flags, user_data);
+	if (!sqe) return -EBUSY;
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t) buf;
+	sqe->len = len;
+	sqe->off = 0;
+	return 0;
+}
+
+int apk_io_uring_close(struct apk_io_uring *ring, int fd, unsigned int sqe_flags, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(ring, sqe_flags, user_data);
+	if (!sqe) return -EBUSY;
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->fd = fd;
+	return 0;
+}
+
+static void io_uring_reap(struct apk_io_uring *ring, apk_io_uring_cb cb, void *ctx)
+{
+	unsigned int head = *ring->cq_head;
+	unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail; head++) {
+		struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+		cb(ctx, cqe->user_data, cqe->res);
+		ring->inflight--;
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Submits the queued requests and waits until all of them have
+ * completed, passing each result to the callback. On error, the
+ * requests without a completion have an unknown state. */
+int apk_io_uring_run(struct apk_io_uring *ring, apk_io_uring_cb cb, void *ctx)
+{
+	unsigned int to_submit;
+	int r;
+
+	__atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+	for (;;) {
+		io_uring_reap(ring, cb, ctx);
+		to_submit = ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+		if (!to_submit && !ring->inflight) return 0;
+
+		r = syscall(__NR_io_uring_enter, ring->fd, to_submit, ring->inflight || !to_submit ? 1 : 0,
+			    IORING_ENTER_GETEVENTS, NULL, 0);
+		if (r < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+			return -errno;
+		}
+		ring->inflight += r;
+	}
+}
+
+#else
+
+struct apk_io_uring *apk_io_uring_create(unsigned int entries) { return ERR_PTR(-ENOSYS); }
+void apk_io_uring_free(struct apk_io_uring *ring) { }
+int apk_io_uring_unlinkat(struct apk_io_uring *ring, int dirfd, const char *path, int flags, unsigned int sqe_flags, uint64_t user_data) { return -ENOSYS; }
+int apk_io_uring_openat(struct apk_io_uring *ring, int dirfd, const char *path, int flags, mode_t mode, unsigned int sqe_flags, uint64_t user_data) { return -ENOSYS; }
+int apk_io_uring_write(struct apk_io_uring *ring, int fd, const void *buf, size_t len, unsigned int sqe_flags, uint64_t user_data) { return -ENOSYS; }
+int apk_io_uring_close(struct apk_io_uring *ring, int fd, unsigned int sqe_flags, uint64_t user_data) { return -ENOSYS; }
+int apk_io_uring_run(struct apk_io_uring *ring, apk_io_uring_cb cb, void *ctx) { return -ENOSYS; }
+
+#endif
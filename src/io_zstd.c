@@ -10,21 +10,126 @@
 #include <errno.h>
 #include <stdio.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#define ZSTD_STATIC_LINKING_ONLY
 #include <zstd.h>
+#include <zdict.h>
 
 #include "apk_defines.h"
 #include "apk_io.h"
 #include "apk_nproc.h"
 
+/* Dictionaries are loaded once per process, and found by the ID that
+ * zstd stores in the header of each frame compressed with one. */
+struct zstd_dict {
+	unsigned int id;
+	ZSTD_DDict *ddict;
+};
+
+static pthread_mutex_t zstd_dicts_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct zstd_dict *zstd_dicts;
+static unsigned int zstd_num_dicts;
+
+static const ZSTD_DDict *zstd_dict_find(unsigned int id)
+{
+	const ZSTD_DDict *ddict = NULL;
+
+	pthread_mutex_lock(&zstd_dicts_lock);
+	for (unsigned int i = 0; i < zstd_num_dicts; i++) {
+		if (zstd_dicts[i].id != id) continue;
+		ddict = zstd_dicts[i].ddict;
+		break;
+	}
+	pthread_mutex_unlock(&zstd_dicts_lock);
+	return ddict;
+}
+
+int apk_zstd_dict_load(apk_blob_t dict)
+{
+	struct zstd_dict *dicts;
+	unsigned int id;
+	int r = 0;
+
+	id = ZSTD_getDictID_fromDict(dict.ptr, dict.len);
+	if (!id) return -APKE_FORMAT_INVALID;
+
+	pthread_mutex_lock(&zstd_dicts_lock);
+	for (unsigned int i = 0; i < zstd_num_dicts; i++)
+		if (zstd_dicts[i].id == id) goto done;
+	dicts = realloc(zstd_dicts, (zstd_num_dicts + 1) * sizeof *dicts);
+	if (!dicts) {
+		r = -ENOMEM;
+		goto done;
+	}
+	zstd_dicts = dicts;
+	dicts[zstd_num_dicts].id = id;
+	dicts[zstd_num_dicts].ddict = ZSTD_createDDict(dict.ptr, dict.len);
+	if (!dicts[zstd_num_dicts].ddict) {
+		r = -ENOMEM;
+		goto done;
+	}
+	zstd_num_dicts++;
+done:
+	pthread_mutex_unlock(&zstd_dicts_lock);
+	return r;
+}
+
+/* The samples are concatenated in one buffer. The dictionary size is
+ * the default of the zstd command line tool. */
+int apk_zstd_dict_train(apk_blob_t samples, const size_t *sample_sizes, unsigned int num_samples, apk_blob_t *dict)
+{
+	const size_t dict_size = 112640;
+	void *buf;
+	size_t r;
+
+	buf = malloc(dict_size);
+	if (!buf) return -ENOMEM;
+	r = ZDICT_trainFromBuffer(buf, dict_size, samples.ptr, sample_sizes, num_samples);
+	if (ZDICT_isError(r)) {
+		free(buf);
+		return -APKE_ADB_DICTIONARY;
+	}
+	*dict = APK_BLOB_PTR_LEN(buf, r);
+	return 0;
+}
+
+/* With threaded decompression, frames are decompressed ahead on a
+ * helper thread while the reader consumes the previous output. The reader
+ * still does all reads of the input stream, so progress streams below stay
+ * on its thread, and keeps a few chunks of input queued for the helper. */
+#define ZI_RA_INPUT	4
+#define ZI_RA_OUTPUT	4
+
+struct zi_readahead {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	uint8_t *in[ZI_RA_INPUT], *in_cur;
+	size_t in_len[ZI_RA_INPUT];
+	unsigned int in_head, in_tail;
+	uint8_t *out[ZI_RA_OUTPUT];
+	size_t out_len[ZI_RA_OUTPUT], out_pos;
+	unsigned int out_head, out_tail;
+	int in_err, result;
+	bool in_done, done, stop;
+};
+
 struct apk_zstd_istream {
 	struct apk_istream is;
 	struct apk_istream *input;
 	ZSTD_DCtx *ctx;
 	void *buf_in;
 	size_t buf_insize;
-	ZSTD_inBuffer inp;
+	ZSTD_inBuffer inp, hdr;
+	uint8_t hdr_buf[ZSTD_FRAMEHEADERSIZE_MAX];
 	int flush;
+	int err;
+	bool dict_checked;
+	bool readahead;
+	struct zi_readahead *ra;
 };
 
 static void zi_get_meta(struct apk_istream *input, struct apk_file_meta *meta)
@@ -33,9 +138,66 @@ static void zi_get_meta(struct apk_istream *input, struct apk_file_meta *meta)
 	apk_istream_get_meta(is->input, meta);
 }
 
-static ssize_t zi_read(struct apk_istream *input, void *ptr, size_t size)
+/* Runs on the helper thread, and returns the next queued input chunk. */
+static ssize_t zi_ra_read_more(struct apk_zstd_istream *is)
+{
+	struct zi_readahead *ra = is->ra;
+	ssize_t rs;
+
+	pthread_mutex_lock(&ra->mutex);
+	while (!ra->stop && ra->in_head == ra->in_tail && !ra->in_done)
+		pthread_cond_wait(&ra->cond, &ra->mutex);
+	if (ra->stop) {
+		rs = -ECANCELED;
+	} else if (ra->in_head == ra->in_tail) {
+		rs = ra->in_err;
+	} else {
+		free(ra->in_cur);
+		ra->in_cur = ra->in[ra->in_head % ZI_RA_INPUT];
+		rs = ra->in_len[ra->in_head % ZI_RA_INPUT];
+		ra->in_head++;
+		is->inp.src = ra->in_cur;
+		pthread_cond_broadcast(&ra->cond);
+	}
+	pthread_mutex_unlock(&ra->mutex);
+	return rs;
+}
+
+static ssize_t zi_read_more(struct apk_zstd_istream *is)
+{
+	if (is->ra) return zi_ra_read_more(is);
+	return apk_istream_read_max(is->input, is->buf_in, is->buf_insize);
+}
+
+/* The dictionary is selected from the frame header, which can arrive split
+ * over several reads. The part consumed while waiting for the rest of the
+ * header is kept in hdr, and fed to the decompressor before inp.
+ * Returns 1 if more input is needed. */
+static int zi_check_dict(struct apk_zstd_istream *is)
+{
+	ZSTD_frameHeader zfh;
+	size_t n, zr;
+
+	n = min(sizeof is->hdr_buf - is->hdr.size, is->inp.size - is->inp.pos);
+	memcpy(&is->hdr_buf[is->hdr.size], (const uint8_t *) is->inp.src + is->inp.pos, n);
+	zr = ZSTD_getFrameHeader(&zfh, is->hdr_buf, is->hdr.size + n);
+	if (!ZSTD_isError(zr) && zr > 0) {
+		is->hdr.size += n;
+		is->inp.pos += n;
+		return 1;
+	}
+	/* invalid headers are reported by the decompressor */
+	if (!ZSTD_isError(zr) && zfh.dictID) {
+		const ZSTD_DDict *ddict = zstd_dict_find(zfh.dictID);
+		if (!ddict) return -APKE_ADB_DICTIONARY;
+		ZSTD_DCtx_refDDict(is->ctx, ddict);
+	}
+	is->dict_checked = true;
+	return 0;
+}
+
+static ssize_t zi_decompress(struct apk_zstd_istream *is, void *ptr, size_t size)
 {
-	struct apk_zstd_istream *is = container_of(input, struct apk_zstd_istream, is);
 	ZSTD_outBuffer outp;
 
 	outp.dst = ptr;
@@ -44,14 +206,16 @@ static ssize_t zi_read(struct apk_istream *input, void *ptr, size_t size)
 
 	while (outp.pos < outp.size) {
 		size_t zr;
-		if (is->inp.pos >= is->inp.size) {
-			ssize_t rs = apk_istream_read_max(is->input, is->buf_in, is->buf_insize);
+		int r;
+		if (is->inp.pos >= is->inp.size &&
+		    (!is->dict_checked || is->hdr.pos >= is->hdr.size)) {
+			ssize_t rs = zi_read_more(is);
 			if (rs < 0) {
-				is->is.err = rs;
+				is->err = rs;
 				return outp.pos;
 			} else if (rs == 0 && is->flush == 0) {
 				/* eof but only if we haven't read anything */
-				if (outp.pos == 0) is->is.err = 1;
+				if (outp.pos == 0) is->err = 1;
 				return outp.pos;
 			} else if (rs) {
 				/* got proper input, disregard flush case */
@@ -60,15 +224,26 @@ static ssize_t zi_read(struct apk_istream *input, void *ptr, size_t size)
 			is->inp.size = rs;
 			is->inp.pos = 0;
 		}
-		zr = ZSTD_decompressStream(is->ctx, &outp, &is->inp);
+		if (!is->dict_checked) {
+			r = zi_check_dict(is);
+			if (r < 0) {
+				is->err = r;
+				return outp.pos;
+			}
+			if (r > 0) continue;
+		}
+		if (is->hdr.pos < is->hdr.size)
+			zr = ZSTD_decompressStream(is->ctx, &outp, &is->hdr);
+		else
+			zr = ZSTD_decompressStream(is->ctx, &outp, &is->inp);
 		if (ZSTD_isError(zr)) {
-			is->is.err = -EIO;
+			is->err = -EIO;
 			return outp.pos;
 		}
 		if (is->flush != 0) {
 			is->flush = 0;
 			/* set EOF if there wasn't antyhing left */
-			if (outp.pos == 0) is->is.err = 1;
+			if (outp.pos == 0) is->err = 1;
 			break;
 		}
 	}
@@ -81,11 +256,155 @@ static ssize_t zi_read(struct apk_istream *input, void *ptr, size_t size)
 	return outp.pos;
 }
 
+static void *zi_ra_thread(void *ctx)
+{
+	struct apk_zstd_istream *is = ctx;
+	struct zi_readahead *ra = is->ra;
+	ssize_t r;
+
+	pthread_mutex_lock(&ra->mutex);
+	while (!ra->stop && !ra->done) {
+		if (ra->out_tail - ra->out_head == ZI_RA_OUTPUT) {
+			pthread_cond_wait(&ra->cond, &ra->mutex);
+			continue;
+		}
+		pthread_mutex_unlock(&ra->mutex);
+
+		r = zi_decompress(is, ra->out[ra->out_tail % ZI_RA_OUTPUT], apk_io_bufsize);
+
+		pthread_mutex_lock(&ra->mutex);
+		if (r > 0) {
+			ra->out_len[ra->out_tail % ZI_RA_OUTPUT] = r;
+			ra->out_tail++;
+		}
+		if (is->err) {
+			ra->result = is->err;
+			ra->done = true;
+		}
+		pthread_cond_broadcast(&ra->cond);
+	}
+	pthread_mutex_unlock(&ra->mutex);
+	return NULL;
+}
+
+static void zi_ra_free(struct zi_readahead *ra)
+{
+	for (unsigned int i = ra->in_head; i != ra->in_tail; i++)
+		free(ra->in[i % ZI_RA_INPUT]);
+	for (unsigned int i = 0; i < ZI_RA_OUTPUT; i++)
+		free(ra->out[i]);
+	free(ra->in_cur);
+	pthread_cond_destroy(&ra->cond);
+	pthread_mutex_destroy(&ra->mutex);
+	free(ra);
+}
+
+static void zi_ra_start(struct apk_zstd_istream *is)
+{
+	struct zi_readahead *ra;
+
+	is->readahead = false;
+	ra = calloc(1, sizeof *ra);
+	if (!ra) return;
+	pthread_mutex_init(&ra->mutex, NULL);
+	pthread_cond_init(&ra->cond, NULL);
+	for (unsigned int i = 0; i < ZI_RA_OUTPUT; i++)
+		if (!(ra->out[i] = malloc(apk_io_bufsize))) goto err;
+	is->ra = ra;
+	if (pthread_create(&ra->thread, NULL, zi_ra_thread, is) != 0) {
+		is->ra = NULL;
+		goto err;
+	}
+	return;
+err:
+	zi_ra_free(ra);
+}
+
+static ssize_t zi_ra_read(struct apk_zstd_istream *is, void *ptr, size_t size)
+{
+	struct zi_readahead *ra = is->ra;
+	apk_blob_t blob;
+	uint8_t *chunk;
+	ssize_t r;
+
+	pthread_mutex_lock(&ra->mutex);
+	for (;;) {
+		if (!ra->in_done && ra->in_tail - ra->in_head < ZI_RA_INPUT) {
+			pthread_mutex_unlock(&ra->mutex);
+			r = apk_istream_get_max(is->input, is->buf_insize, &blob);
+			chunk = r == 0 ? malloc(blob.len ?: 1) : NULL;
+			if (chunk) memcpy(chunk, blob.ptr, blob.len);
+			pthread_mutex_lock(&ra->mutex);
+			if (chunk) {
+				ra->in[ra->in_tail % ZI_RA_INPUT] = chunk;
+				ra->in_len[ra->in_tail % ZI_RA_INPUT] = blob.len;
+				ra->in_tail++;
+			} else {
+				ra->in_done = true;
+				ra->in_err = r == -APKE_EOF ? 0 : (r ?: -ENOMEM);
+			}
+			pthread_cond_broadcast(&ra->cond);
+			continue;
+		}
+		if (ra->out_head != ra->out_tail) {
+			unsigned int slot = ra->out_head % ZI_RA_OUTPUT;
+			r = ra->out_len[slot] - ra->out_pos;
+			if ((size_t) r > size) r = size;
+			pthread_mutex_unlock(&ra->mutex);
+			memcpy(ptr, ra->out[slot] + ra->out_pos, r);
+			pthread_mutex_lock(&ra->mutex);
+			ra->out_pos += r;
+			if (ra->out_pos == ra->out_len[slot]) {
+				ra->out_pos = 0;
+				ra->out_head++;
+				pthread_cond_broadcast(&ra->cond);
+			}
+			break;
+		}
+		if (ra->done) {
+			is->is.err = ra->result;
+			r = 0;
+			break;
+		}
+		pthread_cond_wait(&ra->cond, &ra->mutex);
+	}
+	pthread_mutex_unlock(&ra->mutex);
+	return r;
+}
+
+static void zi_ra_stop(struct apk_zstd_istream *is)
+{
+	struct zi_readahead *ra = is->ra;
+
+	if (!ra) return;
+	pthread_mutex_lock(&ra->mutex);
+	ra->stop = true;
+	pthread_cond_broadcast(&ra->cond);
+	pthread_mutex_unlock(&ra->mutex);
+	pthread_join(ra->thread, NULL);
+	is->ra = NULL;
+	zi_ra_free(ra);
+}
+
+static ssize_t zi_read(struct apk_istream *input, void *ptr, size_t size)
+{
+	struct apk_zstd_istream *is = container_of(input, struct apk_zstd_istream, is);
+	ssize_t r;
+
+	if (is->readahead) zi_ra_start(is);
+	if (is->ra) return zi_ra_read(is, ptr, size);
+
+	r = zi_decompress(is, ptr, size);
+	if (is->err) is->is.err = is->err;
+	return r;
+}
+
 static int zi_close(struct apk_istream *input)
 {
 	int r;
 	struct apk_zstd_istream *is = container_of(input, struct apk_zstd_istream, is);
 
+	zi_ra_stop(is);
 	ZSTD_freeDCtx(is->ctx);
 	r = apk_istream_close_error(is->input, is->is.err);
 	free(is);
@@ -114,13 +433,22 @@ struct apk_istream *apk_istream_zstd(struct apk_istream *input)
 	is->buf_insize = buf_insize;
 	is->inp.size = is->inp.pos = 0;
 	is->inp.src = is->buf_in;
+	is->hdr.size = is->hdr.pos = 0;
+	is->hdr.src = is->hdr_buf;
 	is->flush = 0;
+	is->err = 0;
+	is->dict_checked = false;
+	is->readahead = apk_io_threaded_decompress;
+	is->ra = NULL;
 
 	if ((is->ctx = ZSTD_createDCtx()) == NULL) {
 		free(is);
 		goto err;
 	}
 
+	/* accept the long windows the compressor may be asked to use */
+	ZSTD_DCtx_setParameter(is->ctx, ZSTD_d_windowLogMax, APK_ZSTD_WINDOWLOG_MAX);
+
 	memset(&is->is, 0, sizeof(is->is));
 
 	is->is.ops = &zstd_istream_ops;
@@ -195,7 +523,7 @@ static const struct apk_ostream_ops zstd_ostream_ops = {
 	.close = zo_close,
 };
 
-struct apk_ostream *apk_ostream_zstd(struct apk_ostream *output, uint8_t level)
+struct apk_ostream *apk_ostream_zstd(struct apk_ostream *output, uint8_t level, uint8_t window, apk_blob_t dict)
 {
 	struct apk_zstd_ostream *os;
 	size_t errc, buf_outsize;
@@ -246,6 +574,26 @@ struct apk_ostream *apk_ostream_zstd(struct apk_ostream *output, uint8_t level)
 		goto err;
 	}
 
+	/* a larger window finds matches across files in big packages, like
+	 * the --long mode of zstd; the decompressor accepts up to the max */
+	if (window) {
+		errc = ZSTD_CCtx_setParameter(os->ctx, ZSTD_c_windowLog, window);
+		if (!ZSTD_isError(errc))
+			errc = ZSTD_CCtx_setParameter(os->ctx, ZSTD_c_enableLongDistanceMatching, 1);
+		if (ZSTD_isError(errc)) {
+			free(os);
+			goto err;
+		}
+	}
+
+	if (dict.len) {
+		errc = ZSTD_CCtx_loadDictionary(os->ctx, dict.ptr, dict.len);
+		if (ZSTD_isError(errc)) {
+			free(os);
+			goto err;
+		}
+	}
+
 	memset(&os->os, 0, sizeof(os->os));
 
 	os->os.ops = &zstd_ostream_ops;
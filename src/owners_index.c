@@ -0,0 +1,403 @@
+/* owners_index.c - Alpine Package Keeper (APK)
+ *
+ * Side index mapping the file paths of repository packages to the
+ * package identities. It is generated by 'apk mkndx --owners' and
+ * published next to the repository index with '.owners' appended to
+ * the index file name. The owner queries use it for files that are not
+ * installed, without loading the file lists into the database.
+ *
+ * The paths are sorted and front coded: each path stores the length of
+ * the prefix shared with the previous path and the remaining suffix.
+ * Every block of paths starts with a full path, and the block offset
+ * table allows binary searching the blocks. All integers in the file
+ * are little endian.
+ *
+ * The side index is not signed. It only refers to packages by their
+ * identity, and the owner is reported only if a package with that
+ * identity is in the loaded signed index.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include "apk_database.h"
+#include "apk_package.h"
+#include "apk_query.h"
+#include "apk_print.h"
+
+#define OWNERS_INDEX_MAGIC	"APKOWNR1"
+#define OWNERS_BLOCK_PATHS	32
+
+struct owners_index_header {
+	char magic[8];
+	uint32_t num_packages;
+	uint32_t num_paths;
+	uint32_t num_blocks;
+	uint32_t data_size;
+};
+
+struct owners_repo {
+	apk_blob_t file;
+	uint32_t num_packages, num_blocks;
+	const uint8_t *ids, *offsets, *data, *end;
+};
+
+struct apk_owners_index {
+	struct apk_database *db;
+	unsigned int num_repos;
+	struct owners_repo repos[APK_MAX_REPOS];
+};
+
+static int owners_path_cmp(const void *p1, const void *p2)
+{
+	const struct apk_owners_path *a = p1, *b = p2;
+	int r = apk_blob_sort(a->path, b->path);
+	if (r) return r;
+	return (a->pkg > b->pkg) - (a->pkg < b->pkg);
+}
+
+static size_t owners_put_varint(uint8_t *p, uint32_t v)
+{
+	size_t n = 0;
+
+	do {
+		p[n] = v & 0x7f;
+		v >>= 7;
+		if (v) p[n] |= 0x80;
+		n++;
+	} while (v);
+	return n;
+}
+
+static bool owners_get_varint(const uint8_t **p, const uint8_t *end, uint32_t *v)
+{
+	uint32_t val = 0;
+
+	for (int shift = 0; shift < 32 && *p < end; shift += 7) {
+		uint8_t b = *(*p)++;
+		val |= (uint32_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			*v = val;
+			return true;
+		}
+	}
+	return false;
+}
+
+static uint32_t owners_le32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof v);
+	return le32toh(v);
+}
+
+void apk_owners_builder_init(struct apk_owners_builder *ob)
+{
+	*ob = (struct apk_owners_builder) {};
+	apk_balloc_init(&ob->ba, 64*1024);
+	apk_owners_path_array_init(&ob->paths);
+}
+
+void apk_owners_builder_free(struct apk_owners_builder *ob)
+{
+	apk_owners_path_array_free(&ob->paths);
+	apk_balloc_destroy(&ob->ba);
+	free(ob->ids);
+}
+
+/* Add a package owning the paths added since the previous package. */
+int apk_owners_builder_package(struct apk_owners_builder *ob, apk_blob_t id)
+{
+	uint8_t *ids;
+
+	if (id.len < APK_DIGEST_LENGTH_SHA1) return -APKE_FORMAT_INVALID;
+	ids = realloc(ob->ids, (ob->num_packages + 1) * APK_DIGEST_LENGTH_SHA1);
+	if (!ids) return -ENOMEM;
+	ob->ids = ids;
+	memcpy(&ids[ob->num_packages * APK_DIGEST_LENGTH_SHA1], id.ptr, APK_DIGEST_LENGTH_SHA1);
+	ob->num_packages++;
+	return 0;
+}
+
+void apk_owners_builder_path(struct apk_owners_builder *ob, apk_blob_t dir, apk_blob_t name)
+{
+	char buf[PATH_MAX];
+	apk_blob_t path;
+
+	if (dir.len) path = apk_blob_fmt(buf, sizeof buf, BLOB_FMT "/" BLOB_FMT, BLOB_PRINTF(dir), BLOB_PRINTF(name));
+	else path = name;
+	apk_blob_pull_blob_match(&path, APK_BLOB_STRLIT("/"));
+	if (APK_BLOB_IS_NULL(path) || path.len == 0) return;
+
+	apk_owners_path_array_add(&ob->paths, (struct apk_owners_path) {
+		.path = apk_balloc_dup(&ob->ba, path),
+		.pkg = ob->num_packages,
+	});
+}
+
+static size_t owners_encode(uint8_t *buf, apk_blob_t prev, const struct apk_owners_path *e, bool block_start)
+{
+	uint32_t prefix = 0;
+	size_t n;
+
+	if (!block_start)
+		while (prefix < prev.len && prefix < e->path.len && prev.ptr[prefix] == e->path.ptr[prefix])
+			prefix++;
+	n = owners_put_varint(buf, prefix);
+	n += owners_put_varint(&buf[n], e->path.len - prefix);
+	memcpy(&buf[n], &e->path.ptr[prefix], e->path.len - prefix);
+	n += e->path.len - prefix;
+	n += owners_put_varint(&buf[n], e->pkg);
+	return n;
+}
+
+int apk_owners_builder_write(struct apk_owners_builder *ob, struct apk_ostream *os)
+{
+	struct owners_index_header hdr = { .magic = OWNERS_INDEX_MAGIC };
+	struct apk_owners_path *paths;
+	uint8_t buf[3*5 + PATH_MAX];
+	uint32_t *offsets, num_paths = 0, num_blocks, size = 0;
+
+	if (IS_ERR(os)) return PTR_ERR(os);
+
+	// sort and drop the duplicates of the same package
+	apk_array_qsort(ob->paths, owners_path_cmp);
+	paths = ob->paths->item;
+	apk_array_foreach(e, ob->paths) {
+		if (e->path.len >= PATH_MAX) return apk_ostream_close_error(os, -ENAMETOOLONG);
+		if (num_paths && owners_path_cmp(e, &paths[num_paths-1]) == 0) continue;
+		paths[num_paths++] = *e;
+	}
+	apk_array_truncate(ob->paths, num_paths);
+
+	num_blocks = (num_paths + OWNERS_BLOCK_PATHS - 1) / OWNERS_BLOCK_PATHS;
+	offsets = calloc(num_blocks + 1, sizeof *offsets);
+	if (!offsets) return apk_ostream_close_error(os, -ENOMEM);
+	for (uint32_t i = 0; i < num_paths; i++) {
+		if (i % OWNERS_BLOCK_PATHS == 0) offsets[i / OWNERS_BLOCK_PATHS] = htole32(size);
+		size += owners_encode(buf, i ? paths[i-1].path : APK_BLOB_NULL, &paths[i], i % OWNERS_BLOCK_PATHS == 0);
+	}
+
+	hdr.num_packages = htole32(ob->num_packages);
+	hdr.num_paths = htole32(num_paths);
+	hdr.num_blocks = htole32(num_blocks);
+	hdr.data_size = htole32(size);
+	apk_ostream_write(os, &hdr, sizeof hdr);
+	apk_ostream_write(os, ob->ids, ob->num_packages * APK_DIGEST_LENGTH_SHA1);
+	apk_ostream_write(os, offsets, num_blocks * sizeof *offsets);
+	for (uint32_t i = 0; i < num_paths; i++) {
+		size_t n = owners_encode(buf, i ? paths[i-1].path : APK_BLOB_NULL, &paths[i], i % OWNERS_BLOCK_PATHS == 0);
+		apk_ostream_write(os, buf, n);
+	}
+	free(offsets);
+	return apk_ostream_close(os);
+}
+
+static int owners_read(struct apk_istream *is, apk_blob_t *file)
+{
+	size_t size = 0, alloc = 0;
+	ssize_t n;
+	char *buf = NULL, *p;
+
+	if (IS_ERR(is)) return PTR_ERR(is);
+	do {
+		if (size == alloc) {
+			alloc = alloc ? alloc * 2 : 256*1024;
+			p = realloc(buf, alloc);
+			if (!p) {
+				n = -ENOMEM;
+				break;
+			}
+			buf = p;
+		}
+		n = apk_istream_read_max(is, &buf[size], alloc - size);
+		if (n > 0) size += n;
+	} while (n > 0);
+	n = apk_istream_close_error(is, n);
+	if (n < 0) {
+		free(buf);
+		return n;
+	}
+	*file = APK_BLOB_PTR_LEN(buf, size);
+	return 0;
+}
+
+static int owners_load(struct apk_database *db, struct apk_repository *repo, apk_blob_t *file)
+{
+	struct apk_ctx *ac = db->ctx;
+	struct apk_istream *is;
+	struct stat st, ndx_st;
+	char url[PATH_MAX], cache_url[NAME_MAX], index_url[NAME_MAX];
+	int cache_fd, r;
+	bool cached, fetch;
+
+	r = apk_fmt(url, sizeof url, BLOB_FMT ".owners", BLOB_PRINTF(repo->url_index));
+	if (r < 0) return r;
+	if (!repo->is_remote) return owners_read(apk_istream_from_url(url, 0), file);
+
+	if ((ac->flags & APK_NO_CACHE) ||
+	    apk_repo_owners_cache_url(db, repo, &cache_fd, cache_url, sizeof cache_url) < 0) {
+		if (ac->flags & APK_NO_NETWORK) return -APKE_REMOTE_IO;
+		return owners_read(apk_istream_from_url(url, apk_db_url_since(db, 0)), file);
+	}
+
+	// refetch the cached side index if the repository index is newer
+	cached = fstatat(cache_fd, cache_url, &st, 0) == 0;
+	fetch = !cached;
+	if (cached && apk_repo_index_cache_url(db, repo, NULL, index_url, sizeof index_url) >= 0 &&
+	    fstatat(cache_fd, index_url, &ndx_st, 0) == 0 && ndx_st.st_mtime > st.st_mtime)
+		fetch = true;
+	if (fetch && !(ac->flags & (APK_NO_NETWORK|APK_SIMULATE))) {
+		is = apk_istream_from_url(url, apk_db_url_since(db, cached ? st.st_mtime : 0));
+		r = owners_read(apk_istream_tee(is, apk_ostream_to_file(cache_fd, cache_url, 0644), 0), file);
+		if (r == 0 || !cached) return r;
+		if (r == -APKE_FILE_UNCHANGED) utimensat(cache_fd, cache_url, NULL, 0);
+	}
+	return owners_read(apk_istream_from_file(cache_fd, cache_url), file);
+}
+
+static int owners_repo_open(struct owners_repo *or, apk_blob_t file)
+{
+	const struct owners_index_header *hdr = (const void *) file.ptr;
+	size_t tables;
+
+	*or = (struct owners_repo) { .file = file };
+	if (file.len < sizeof *hdr) return -APKE_FORMAT_INVALID;
+	if (memcmp(hdr->magic, OWNERS_INDEX_MAGIC, sizeof hdr->magic) != 0) return -APKE_FORMAT_INVALID;
+	or->num_packages = le32toh(hdr->num_packages);
+	or->num_blocks = le32toh(hdr->num_blocks);
+	tables = (size_t) or->num_packages * APK_DIGEST_LENGTH_SHA1 + (size_t) or->num_blocks * sizeof(uint32_t);
+	if (file.len - sizeof *hdr < tables ||
+	    file.len - sizeof *hdr - tables != le32toh(hdr->data_size))
+		return -APKE_FORMAT_INVALID;
+	or->ids = (const uint8_t *) &hdr[1];
+	or->offsets = &or->ids[(size_t) or->num_packages * APK_DIGEST_LENGTH_SHA1];
+	or->data = &or->offsets[(size_t) or->num_blocks * sizeof(uint32_t)];
+	or->end = (const uint8_t *) file.ptr + file.len;
+	return 0;
+}
+
+struct apk_owners_index *apk_owners_index_open(struct apk_database *db)
+{
+	struct apk_out *out = &db->ctx->out;
+	struct apk_owners_index *oi;
+	apk_blob_t file;
+	int r;
+
+	oi = calloc(1, sizeof *oi);
+	if (!oi) return NULL;
+	oi->db = db;
+	apk_db_foreach_repository(repo, db) {
+		if (!repo->available) continue;
+		r = owners_load(db, repo, &file);
+		if (r == 0) {
+			r = owners_repo_open(&oi->repos[oi->num_repos], file);
+			if (r == 0) {
+				oi->num_repos++;
+				continue;
+			}
+			free(file.ptr);
+			apk_warn(out, BLOB_FMT ".owners: %s", BLOB_PRINTF(repo->url_index_printable), apk_error_str(r));
+			continue;
+		}
+		apk_dbg(out, BLOB_FMT ".owners: %s", BLOB_PRINTF(repo->url_index_printable), apk_error_str(r));
+	}
+	return oi;
+}
+
+struct owners_cursor {
+	const uint8_t *p, *end;
+	uint32_t pkg;
+	apk_blob_t path;
+	char buf[PATH_MAX];
+};
+
+static bool owners_next(struct owners_cursor *c)
+{
+	uint32_t prefix, len;
+
+	if (c->p >= c->end) return false;
+	if (!owners_get_varint(&c->p, c->end, &prefix) ||
+	    !owners_get_varint(&c->p, c->end, &len) ||
+	    prefix > c->path.len || len > sizeof c->buf - prefix || len > c->end - c->p)
+		return false;
+	memcpy(&c->buf[prefix], c->p, len);
+	c->p += len;
+	c->path = APK_BLOB_PTR_LEN(c->buf, prefix + len);
+	return owners_get_varint(&c->p, c->end, &c->pkg);
+}
+
+static bool owners_seek(struct owners_repo *or, struct owners_cursor *c, uint32_t block)
+{
+	uint32_t offset = owners_le32(&or->offsets[block * sizeof(uint32_t)]);
+
+	if (offset >= or->end - or->data) return false;
+	c->p = &or->data[offset];
+	c->end = or->end;
+	c->path = APK_BLOB_PTR_LEN(c->buf, 0);
+	return owners_next(c);
+}
+
+static int owners_repo_foreach(struct apk_database *db, struct owners_repo *or, apk_blob_t path,
+			       int (*cb)(void *ctx, struct apk_package *pkg), void *ctx)
+{
+	struct owners_cursor c;
+	struct apk_digest id = { .alg = APK_DIGEST_SHA1, .len = APK_DIGEST_LENGTH_SHA1 };
+	struct apk_package *pkg;
+	uint32_t lo = 0, hi = or->num_blocks;
+	int r;
+
+	// find the first block starting after the path; the matches start
+	// in the block before it as the same path can span blocks. A damaged
+	// side index is treated as not having the path.
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (!owners_seek(or, &c, mid)) return 0;
+		if (apk_blob_sort(c.path, path) <= 0) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo == 0) return 0;
+	if (!owners_seek(or, &c, lo - 1)) return 0;
+	while (lo > 1 && apk_blob_compare(c.path, path) == 0)
+		if (!owners_seek(or, &c, --lo - 1)) return 0;
+
+	do {
+		r = apk_blob_sort(c.path, path);
+		if (r > 0) break;
+		if (r < 0 || c.pkg >= or->num_packages) continue;
+		memcpy(id.data, &or->ids[(size_t) c.pkg * APK_DIGEST_LENGTH_SHA1], APK_DIGEST_LENGTH_SHA1);
+		pkg = apk_db_get_pkg(db, &id);
+		if (!pkg) continue;
+		r = cb(ctx, pkg);
+		if (r) return r;
+	} while (owners_next(&c));
+	return 0;
+}
+
+/* Call 'cb' for the packages shipping 'path' according to the side
+ * indexes. The packages not in the loaded indexes are skipped. */
+int apk_owners_index_foreach(struct apk_owners_index *oi, apk_blob_t path,
+			     int (*cb)(void *ctx, struct apk_package *pkg), void *ctx)
+{
+	int r;
+
+	if (!oi) return 0;
+	apk_blob_pull_blob_match(&path, APK_BLOB_STRLIT("/"));
+	path = apk_blob_trim_end(path, '/');
+	if (!path.len) return 0;
+
+	for (unsigned int i = 0; i < oi->num_repos; i++) {
+		r = owners_repo_foreach(oi->db, &oi->repos[i], path, cb, ctx);
+		if (r) return r;
+	}
+	return 0;
+}
+
+void apk_owners_index_close(struct apk_owners_index *oi)
+{
+	if (!oi) return;
+	for (unsigned int i = 0; i < oi->num_repos; i++)
+		free(oi->repos[i].file.ptr);
+	free(oi);
+}
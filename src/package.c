@@ -214,7 +214,7 @@ void apk_blob_pull_dep(apk_blob_t *b, struct apk_database *db, struct apk_depend
 
 	*dep = (struct apk_dependency){
 		.name = name,
-		.version = apk_atomize_dup(&db->atoms, bver),
+		.version = apk_atomize_version(&db->atoms, bver),
 		.repository_tag = tag,
 		.op = op,
 		.broken = broken,
@@ -273,14 +273,14 @@ int apk_dep_is_provided(const struct apk_package *deppkg, const struct apk_depen
 	if (p == NULL || p->pkg == NULL) return apk_dep_conflict(dep);
 	if (apk_dep_conflict(dep) && deppkg == p->pkg) return 1;
 	if (dep->op == APK_DEPMASK_CHECKSUM) return apk_dep_match_checksum(dep, p->pkg);
-	return apk_version_match(*p->version, dep->op, *dep->version);
+	return apk_version_match_atom(p->version, dep->op, dep->version);
 }
 
 int apk_dep_is_materialized(const struct apk_dependency *dep, const struct apk_package *pkg)
 {
 	if (pkg == NULL || dep->name != pkg->name) return apk_dep_conflict(dep);
 	if (dep->op == APK_DEPMASK_CHECKSUM) return apk_dep_match_checksum(dep, pkg);
-	return apk_version_match(*pkg->version, dep->op, *dep->version);
+	return apk_version_match_atom(pkg->version, dep->op, dep->version);
 }
 
 int apk_dep_analyze(const struct apk_package *deppkg, struct apk_dependency *dep, struct apk_package *pkg)
@@ -362,7 +362,7 @@ void apk_dep_from_adb(struct apk_dependency *dep, struct apk_database *db, struc
 
 	*dep = (struct apk_dependency) {
 		.name = apk_db_get_name(db, adb_ro_blob(d, ADBI_DEP_NAME)),
-		.version = apk_atomize_dup(&db->atoms, ver),
+		.version = apk_atomize_version(&db->atoms, ver),
 		.op = op,
 	};
 }
@@ -459,7 +459,7 @@ int apk_pkgtmpl_add_info(struct apk_database *db, struct apk_package_tmpl *tmpl,
 		pkg->name = apk_db_get_name(db, value);
 		break;
 	case 'V':
-		pkg->version = apk_atomize_dup(&db->atoms, value);
+		pkg->version = apk_atomize_version(&db->atoms, value);
 		break;
 	case 'T':
 		pkg->description = apk_atomize_dup(&db->atoms, value);
@@ -561,7 +561,7 @@ void apk_pkgtmpl_from_adb(struct apk_database *db, struct apk_package_tmpl *tmpl
 	if (uid.len >= APK_DIGEST_LENGTH_SHA1) apk_digest_from_blob(&tmpl->id, uid);
 
 	pkg->name = apk_db_get_name(db, adb_ro_blob(pkginfo, ADBI_PI_NAME));
-	pkg->version = apk_atomize_dup(&db->atoms, adb_ro_blob(pkginfo, ADBI_PI_VERSION));
+	pkg->version = apk_atomize_version(&db->atoms, adb_ro_blob(pkginfo, ADBI_PI_VERSION));
 	pkg->description = apk_atomize_dup(&db->atoms, apk_blob_truncate(adb_ro_blob(pkginfo, ADBI_PI_DESCRIPTION), 512));
 	pkg->url = apk_atomize_dup(&db->atoms, adb_ro_blob(pkginfo, ADBI_PI_URL));
 	pkg->license = apk_atomize_dup(&db->atoms, adb_ro_blob(pkginfo, ADBI_PI_LICENSE));
@@ -865,7 +865,7 @@ int apk_pkg_write_index_entry(struct apk_package *pkg, struct apk_ostream *os)
 int apk_pkg_version_compare(const struct apk_package *a, const struct apk_package *b)
 {
 	if (a->version == b->version) return APK_VERSION_EQUAL;
-	return apk_version_compare(*a->version, *b->version);
+	return apk_version_compare_atom(a->version, b->version);
 }
 
 int apk_pkg_cmp_display(const struct apk_package *a, const struct apk_package *b)
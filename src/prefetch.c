@@ -0,0 +1,230 @@
+/* prefetch.c - Alpine Package Keeper (APK)
+ *
+ * Downloads the packages of a commit ahead of their installation so the
+ * transfer of the next packages overlaps with extracting the current one.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "apk_database.h"
+
+#define PREFETCH_MAX_DEPTH	16
+
+enum {
+	PREFETCH_PENDING = 0,
+	PREFETCH_DONE,
+	PREFETCH_FAILED,
+};
+
+struct apk_prefetch_item {
+	struct apk_package *pkg;
+	struct apk_repository *repo;
+	int fd, state;
+};
+
+struct apk_prefetch {
+	struct apk_database *db;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	unsigned int num_items, next, consumed, depth;
+	bool stop;
+	struct apk_prefetch_item items[];
+};
+
+static int prefetch_tmpfile(void)
+{
+	const char *tmpdir = getenv("TMPDIR") ?: "/tmp";
+	char tmpl[PATH_MAX];
+	int fd;
+
+#ifdef O_TMPFILE
+	fd = open(tmpdir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+	if (fd >= 0) return fd;
+#endif
+	if (apk_fmt(tmpl, sizeof tmpl, "%s/apk-prefetch.XXXXXX", tmpdir) < 0) return -ENAMETOOLONG;
+	fd = mkostemp(tmpl, O_CLOEXEC);
+	if (fd < 0) return -errno;
+	unlink(tmpl);
+	return fd;
+}
+
+/* The package is only copied here. It is verified by the installer when
+ * extracting, exactly as if it was streamed from the repository. */
+static int prefetch_download(struct apk_database *db, struct apk_prefetch_item *item)
+{
+	struct apk_istream *is;
+	struct apk_ostream *os;
+	char url[PATH_MAX];
+	int r, url_fd, fd;
+
+	r = apk_repo_package_url(db, item->repo, item->pkg, &url_fd, url, sizeof url);
+	if (r < 0) return r;
+
+	fd = prefetch_tmpfile();
+	if (fd < 0) return fd;
+
+	is = apk_istream_from_fd_url(url_fd, url, apk_db_url_since(db, 0));
+	if (IS_ERR(is)) {
+		close(fd);
+		return PTR_ERR(is);
+	}
+	r = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	if (r < 0) {
+		r = -errno;
+		apk_istream_close(is);
+		close(fd);
+		return r;
+	}
+	os = apk_ostream_to_fd(r);
+	if (IS_ERR(os)) {
+		apk_istream_close(is);
+		close(fd);
+		return PTR_ERR(os);
+	}
+	apk_stream_copy(is, os, APK_IO_ALL, NULL);
+	apk_ostream_copy_meta(os, is);
+	r = apk_istream_close(is);
+	r = apk_ostream_close_error(os, r);
+	if (r == 0 && lseek(fd, 0, SEEK_SET) != 0) r = -errno;
+	if (r < 0) {
+		close(fd);
+		return r;
+	}
+	return fd;
+}
+
+static void *prefetch_thread(void *ctx)
+{
+	struct apk_prefetch *pf = ctx;
+	struct apk_prefetch_item *item;
+	unsigned int i;
+	int fd;
+
+	pthread_mutex_lock(&pf->mutex);
+	while (!pf->stop && pf->next < pf->num_items) {
+		if (pf->next < pf->consumed) {
+			pf->next = pf->consumed;
+			continue;
+		}
+		if (pf->next - pf->consumed >= pf->depth) {
+			pthread_cond_wait(&pf->cond, &pf->mutex);
+			continue;
+		}
+		i = pf->next;
+		item = &pf->items[i];
+		pthread_mutex_unlock(&pf->mutex);
+
+		fd = prefetch_download(pf->db, item);
+
+		pthread_mutex_lock(&pf->mutex);
+		if (i < pf->consumed && fd >= 0) {
+			// skipped while downloading
+			close(fd);
+			fd = -1;
+		}
+		item->fd = fd;
+		item->state = fd >= 0 ? PREFETCH_DONE : PREFETCH_FAILED;
+		pf->next++;
+		pthread_cond_broadcast(&pf->cond);
+	}
+	pthread_mutex_unlock(&pf->mutex);
+	return NULL;
+}
+
+struct apk_prefetch *apk_prefetch_start(struct apk_database *db, struct apk_package_array *pkgs, unsigned int depth)
+{
+	struct apk_prefetch *pf;
+	struct apk_repository *repo;
+	unsigned int n = 0;
+
+	if (depth == 0 || apk_array_len(pkgs) < 2) return NULL;
+	if (depth > PREFETCH_MAX_DEPTH) depth = PREFETCH_MAX_DEPTH;
+
+	pf = calloc(1, sizeof *pf + apk_array_len(pkgs) * sizeof pf->items[0]);
+	if (!pf) return NULL;
+	apk_array_foreach_item(pkg, pkgs) {
+		if (!(repo = apk_db_select_repo(db, pkg))) continue;
+		pf->items[n++] = (struct apk_prefetch_item) {
+			.pkg = pkg,
+			.repo = repo,
+			.fd = -1,
+		};
+	}
+	pf->db = db;
+	pf->num_items = n;
+	pf->depth = depth;
+	pthread_mutex_init(&pf->mutex, NULL);
+	pthread_cond_init(&pf->cond, NULL);
+	if (pthread_create(&pf->thread, NULL, prefetch_thread, pf) != 0) {
+		pthread_cond_destroy(&pf->cond);
+		pthread_mutex_destroy(&pf->mutex);
+		free(pf);
+		return NULL;
+	}
+	return pf;
+}
+
+/* Packages are taken in the order they were given. Taking a package
+ * releases the prefetched data of the packages before it. Returns NULL
+ * if the package was not prefetched or its download failed, and the
+ * caller should then fetch it directly. */
+struct apk_istream *apk_prefetch_take(struct apk_prefetch *pf, struct apk_package *pkg)
+{
+	struct apk_prefetch_item *item = NULL;
+	unsigned int i;
+	int fd;
+
+	if (!pf) return NULL;
+
+	pthread_mutex_lock(&pf->mutex);
+	for (i = pf->consumed; i < pf->num_items; i++) {
+		if (pf->items[i].pkg != pkg) continue;
+		item = &pf->items[i];
+		break;
+	}
+	if (!item) {
+		pthread_mutex_unlock(&pf->mutex);
+		return NULL;
+	}
+	for (; pf->consumed < i; pf->consumed++) {
+		struct apk_prefetch_item *skipped = &pf->items[pf->consumed];
+		if (skipped->fd >= 0) close(skipped->fd);
+		skipped->fd = -1;
+	}
+	pthread_cond_broadcast(&pf->cond);
+	while (item->state == PREFETCH_PENDING)
+		pthread_cond_wait(&pf->cond, &pf->mutex);
+	fd = item->fd;
+	item->fd = -1;
+	pf->consumed = i + 1;
+	pthread_cond_broadcast(&pf->cond);
+	pthread_mutex_unlock(&pf->mutex);
+
+	if (fd < 0) return NULL;
+	return apk_istream_from_fd(fd);
+}
+
+void apk_prefetch_stop(struct apk_prefetch *pf)
+{
+	if (!pf) return;
+
+	pthread_mutex_lock(&pf->mutex);
+	pf->stop = true;
+	pthread_cond_broadcast(&pf->cond);
+	pthread_mutex_unlock(&pf->mutex);
+	pthread_join(pf->thread, NULL);
+
+	for (unsigned int i = 0; i < pf->num_items; i++)
+		if (pf->items[i].fd >= 0) close(pf->items[i].fd);
+	pthread_cond_destroy(&pf->cond);
+	pthread_mutex_destroy(&pf->mutex);
+	free(pf);
+}
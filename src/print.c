@@ -68,6 +68,7 @@
 	func(APKE_ADB_NO_FROMSTRING,	"ADB schema error (no fromstring)") \
 	func(APKE_ADB_LIMIT,		"ADB schema limit reached") \
 	func(APKE_ADB_PACKAGE_FORMAT,	"ADB package format") \
+	func(APKE_ADB_DICTIONARY,	"ADB compression dictionary not available") \
 	func(APKE_V2DB_FORMAT,		"v2 database format error") \
 	func(APKE_V2PKG_FORMAT,		"v2 package format error") \
 	func(APKE_V2PKG_INTEGRITY,	"v2 package integrity error") \
@@ -139,6 +139,7 @@ apk_blob_t apk_query_printable_field(apk_blob_t f)
 
 #define QUERY_OPTIONS(OPT) \
 	OPT(OPT_QUERY_all_matches,	"all-matches") \
+	OPT(OPT_QUERY_args_from_stdin,	"args-from-stdin") \
 	OPT(OPT_QUERY_available,	"available") \
 	OPT(OPT_QUERY_fields,		APK_OPT_ARG APK_OPT_SH("F") "fields") \
 	OPT(OPT_QUERY_format,		APK_OPT_ARG "format") \
@@ -180,6 +181,9 @@ int apk_query_parse_option(struct apk_ctx *ac, int opt, const char *optarg)
 	case OPT_QUERY_all_matches:
 		qs->filter.all_matches = 1;
 		break;
+	case OPT_QUERY_args_from_stdin:
+		qs->mode.args_from_stdin = 1;
+		break;
 	case OPT_QUERY_available:
 		qs->filter.available = 1;
 		break;
@@ -586,6 +590,97 @@ int apk_query_who_owns(struct apk_database *db, const char *path, struct apk_que
 	return 0;
 }
 
+struct who_owns_path {
+	const char *path;
+	apk_blob_t dir, name;
+	struct apk_package *pkg;
+};
+
+static int who_owns_path_cmp(const void *p1, const void *p2)
+{
+	const struct who_owns_path *a = p1, *b = p2;
+	return apk_blob_sort(a->dir, b->dir) ?: apk_blob_sort(a->name, b->name);
+}
+
+/* Resolve the owners of many paths at once. The paths are sorted by
+ * directory, and the names in each directory are merged with the sorted
+ * file lists of the directory. Only the paths without an owning file are
+ * looked up individually, including the symlink resolution. The matches
+ * are reported in the sorted order. */
+int apk_query_who_owns_batch(struct apk_database *db, struct apk_string_array *paths, apk_query_match_cb match, void *pctx)
+{
+	struct who_owns_path *p;
+	struct apk_db_dir_instance *diri;
+	size_t n = apk_array_len(paths), i, j;
+	char buf[PATH_MAX];
+	int r = 0;
+
+	if (!n) return 0;
+	p = calloc(n, sizeof *p);
+	if (!p) return -ENOMEM;
+	for (i = 0; i < n; i++) {
+		apk_blob_t fn = APK_BLOB_STR(paths->item[i]);
+
+		apk_blob_pull_blob_match(&fn, APK_BLOB_STRLIT("/"));
+		fn = apk_blob_trim_end(fn, '/');
+		p[i].path = paths->item[i];
+		if (!apk_blob_rsplit(fn, '/', &p[i].dir, &p[i].name)) {
+			p[i].dir = APK_BLOB_PTR_LEN(fn.ptr, 0);
+			p[i].name = fn;
+		}
+	}
+	qsort(p, n, sizeof *p, who_owns_path_cmp);
+
+	for (i = 0; i < n; i = j) {
+		struct apk_db_dir *dir = apk_db_dir_query(db, p[i].dir);
+
+		for (j = i + 1; j < n && apk_blob_compare(p[j].dir, p[i].dir) == 0; j++);
+		if (!dir) continue;
+		list_for_each_entry(diri, &dir->diris, dir_diri_list) {
+			struct apk_db_file_array *files = diri->files;
+			size_t k = i, f = 0;
+
+			while (k < j && f < apk_array_len(files)) {
+				struct apk_db_file *dbf = files->item[f];
+				int c = apk_blob_sort(p[k].name, APK_BLOB_PTR_LEN(dbf->name, dbf->namelen));
+				if (c > 0) {
+					f++;
+					continue;
+				}
+				if (c == 0 && !p[k].pkg) p[k].pkg = dbf->diri->pkg;
+				k++;
+			}
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		struct apk_query_match qm = {
+			.query = APK_BLOB_STR(p[i].path),
+			.pkg = p[i].pkg,
+		};
+		if (!qm.pkg) apk_query_who_owns(db, p[i].path, &qm, buf, sizeof buf);
+		r = match(pctx, &qm);
+		if (r) break;
+	}
+	free(p);
+	return r;
+}
+
+/* Append the lines of the standard input to the arguments. */
+int apk_query_args_from_stdin(struct apk_ctx *ac, struct apk_string_array **args)
+{
+	struct apk_istream *is = apk_istream_from_fd(STDIN_FILENO);
+	apk_blob_t line;
+	int r;
+
+	if (IS_ERR(is)) return PTR_ERR(is);
+	while ((r = apk_istream_get_delim(is, APK_BLOB_STRLIT("\n"), &line)) == 0) {
+		if (!line.len) continue;
+		apk_string_array_add(args, apk_balloc_cstr(&ac->ba, line));
+	}
+	return apk_istream_close_error(is, r == -APKE_EOF ? 0 : r);
+}
+
 struct match_ctx {
 	struct apk_database *db;
 	struct apk_query_spec *qs;
@@ -594,7 +689,8 @@ struct match_ctx {
 	struct apk_dependency dep;
 	struct apk_serializer ser;
 	struct apk_package *best;
-	int match_mode;
+	struct apk_owners_index *oi;
+	int match_mode, no_matches;
 	apk_query_match_cb cb, ser_cb;
 	void *cb_ctx, *ser_cb_ctx;
 	bool has_matches, done_matching;
@@ -752,6 +848,66 @@ static int match_name(apk_hash_item item, void *pctx)
 	return r;
 }
 
+struct owner_match_ctx {
+	struct match_ctx *m;
+	struct apk_query_match qm;
+};
+
+static int match_indexed_owner(void *pctx, struct apk_package *pkg)
+{
+	struct owner_match_ctx *om = pctx;
+	struct match_ctx *m = om->m;
+
+	if (m->qs->filter.upgradable && !apk_db_pkg_upgradable(m->db, pkg)) return 0;
+	if (!m->qs->filter.all_matches) {
+		if (!om->qm.pkg || apk_version_compare(*pkg->version, *om->qm.pkg->version) == APK_VERSION_GREATER)
+			om->qm.pkg = pkg;
+		return 0;
+	}
+	om->qm.pkg = pkg;
+	return m->ser_cb(m->ser_cb_ctx, &om->qm);
+}
+
+static int match_owner(struct match_ctx *m, struct apk_query_match *qm)
+{
+	struct apk_query_spec *qs = m->qs;
+	int r;
+
+	if (!qm->pkg && !qs->filter.installed) {
+		// not installed, look up the repository side indexes
+		struct owner_match_ctx om = { .m = m, .qm.query = qm->query };
+		if (!m->oi) m->oi = apk_owners_index_open(m->db);
+		r = apk_owners_index_foreach(m->oi, qm->query, match_indexed_owner, &om);
+		if (r) return r;
+		if (om.qm.pkg) m->has_matches = true;
+		if (!qs->filter.all_matches) qm->pkg = om.qm.pkg;
+	}
+	if (!qm->pkg) return 0;
+	m->has_matches = true;
+	return m->ser_cb(m->ser_cb_ctx, qm);
+}
+
+static int match_owner_batch(void *pctx, struct apk_query_match *qm)
+{
+	struct match_ctx *m = pctx;
+	int r;
+
+	m->has_matches = false;
+	if (qm->query.ptr[0] == '/') {
+		r = match_owner(m, qm);
+		if (r || m->has_matches) return r;
+	}
+	m->no_matches++;
+	return m->ser_cb(m->ser_cb_ctx, &(struct apk_query_match) { .query = qm->query });
+}
+
+static int match_selected_name(apk_hash_item item, void *pctx)
+{
+	struct apk_name *name = item;
+	if (!name->search_selected) return 0;
+	return match_name(item, pctx);
+}
+
 int apk_query_matches(struct apk_ctx *ac, struct apk_query_spec *qs, struct apk_string_array *args, apk_query_match_cb match, void *pctx)
 {
 	char buf[PATH_MAX];
@@ -765,7 +921,8 @@ int apk_query_matches(struct apk_ctx *ac, struct apk_query_spec *qs, struct apk_
 		.ser_cb_ctx = pctx,
 		.ser.ops = &serialize_match,
 	};
-	int r, no_matches = 0;
+	struct apk_search_index *si = NULL;
+	int r;
 
 	if (!qs->match) qs->match = BIT(APK_Q_FIELD_NAME);
 	if (qs->match & ~APK_Q_FIELDS_MATCHABLE) return -ENOTSUP;
@@ -775,12 +932,20 @@ int apk_query_matches(struct apk_ctx *ac, struct apk_query_spec *qs, struct apk_
 		return apk_hash_foreach(&db->available.names, match_name, &m);
 	}
 	if (qs->mode.recursive) return apk_query_recursive(ac, qs, args, match, pctx);
+	if (qs->mode.args_from_stdin && qs->match == BIT(APK_Q_FIELD_OWNER)) {
+		// resolve the paths in one pass instead of scanning the names for each
+		apk_query_who_owns_batch(db, args, match_owner_batch, &m);
+		apk_owners_index_close(m.oi);
+		return m.no_matches;
+	}
 
 	// Instead of reporting all matches, report only best
 	if (!qs->filter.all_matches) {
 		m.cb = update_best_match;
 		m.cb_ctx = &m;
 	}
+	if (qs->mode.search && !(qs->match & ~APK_Q_FIELDS_SEARCH_INDEX))
+		si = apk_search_index_open(db);
 
 	apk_array_foreach_item(arg, args) {
 		apk_blob_t bname, bvers;
@@ -790,11 +955,8 @@ int apk_query_matches(struct apk_ctx *ac, struct apk_query_spec *qs, struct apk_
 		if ((qs->match & BIT(APK_Q_FIELD_OWNER)) && arg[0] == '/') {
 			struct apk_query_match qm;
 			apk_query_who_owns(db, arg, &qm, buf, sizeof buf);
-			if (qm.pkg) {
-				r = match(pctx, &qm);
-				if (r) break;
-				m.has_matches = true;
-			}
+			r = match_owner(&m, &qm);
+			if (r) break;
 		}
 
 		if (qs->mode.search) {
@@ -813,7 +975,7 @@ int apk_query_matches(struct apk_ctx *ac, struct apk_query_spec *qs, struct apk_
 
 			m.q = bname;
 			m.dep = (struct apk_dependency) {
-				.version = apk_atomize_dup(&db->atoms, bvers),
+				.version = apk_atomize_version(&db->atoms, bvers),
 				.op = op,
 			};
 		}
@@ -821,6 +983,11 @@ int apk_query_matches(struct apk_ctx *ac, struct apk_query_spec *qs, struct apk_
 		if (qs->match == BIT(APK_Q_FIELD_NAME) && m.match_mode == MATCH_EXACT) {
 			m.dep.name = apk_db_query_name(db, bname);
 			if (m.dep.name) r = match_name(m.dep.name, &m);
+		} else if (si && apk_search_index_select(si, arg) == 0) {
+			// scan only the names selected by the search index
+			r = apk_hash_foreach(&db->available.names, match_selected_name, &m);
+			apk_search_index_reset(si);
+			if (r) break;
 		} else {
 			// do full scan
 			r = apk_hash_foreach(&db->available.names, match_name, &m);
@@ -830,10 +997,12 @@ int apk_query_matches(struct apk_ctx *ac, struct apk_query_spec *qs, struct apk_
 			// report no match
 			r = match(pctx, &(struct apk_query_match) { .query = m.q });
 			if (r) break;
-			if (m.match_mode == MATCH_EXACT) no_matches++;
+			if (m.match_mode == MATCH_EXACT) m.no_matches++;
 		}
 	}
-	return no_matches;
+	apk_search_index_close(si);
+	apk_owners_index_close(m.oi);
+	return m.no_matches;
 }
 
 static int select_package(void *pctx, struct apk_query_match *qm)
@@ -0,0 +1,311 @@
+/* search_index.c - Alpine Package Keeper (APK)
+ *
+ * Trigram index of the repository package names, provided names and
+ * descriptions. It is written to the cache by 'apk update' and used by
+ * the substring search to select the names that can match at all, which
+ * are then matched as usual. The index is used only if it was built
+ * from exactly the set of repository packages currently loaded. Names
+ * of packages not from a repository are always matched.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <stdlib.h>
+#include "apk_database.h"
+#include "apk_package.h"
+#include "apk_query.h"
+#include "apk_print.h"
+
+#define SEARCH_INDEX_FILE	"search.idx"
+#define SEARCH_INDEX_MAGIC	"APKSRCH1"
+
+struct search_index_key {
+	uint64_t num_packages;
+	uint64_t sum[2];
+};
+
+struct search_index_header {
+	char magic[8];
+	struct search_index_key key;
+	uint32_t num_names, num_trigrams;
+};
+
+struct search_index_trigram {
+	uint32_t trigram, start;
+};
+
+struct apk_search_index {
+	struct apk_database *db;
+	struct apk_istream *is;
+	const struct search_index_header *hdr;
+	const uint32_t *name_offsets;
+	const struct search_index_trigram *trigrams;
+	const uint32_t *postings;
+	const char *strings;
+	size_t strings_len, num_postings;
+	struct apk_name_array *unindexed, *selected;
+};
+
+APK_ARRAY(search_entry_array, uint64_t);
+
+struct search_index_ctx {
+	struct apk_database *db;
+	struct search_index_key key;
+	struct apk_name_array *names;
+	struct search_entry_array *entries;
+};
+
+static inline uint8_t search_fold(uint8_t c)
+{
+	// fnmatch(FNM_CASEFOLD) in the C locale folds only ASCII
+	return (c >= 'A' && c <= 'Z') ? c + 'a' - 'A' : c;
+}
+
+static inline uint32_t search_trigram(const uint8_t *p)
+{
+	return search_fold(p[0]) << 16 | search_fold(p[1]) << 8 | search_fold(p[2]);
+}
+
+static void search_add_trigrams(struct search_index_ctx *ctx, uint32_t name_idx, apk_blob_t b)
+{
+	const uint8_t *p = (const uint8_t *) b.ptr;
+
+	for (long i = 0; i + 3 <= b.len; i++)
+		search_entry_array_add(&ctx->entries, (uint64_t) search_trigram(&p[i]) << 32 | name_idx);
+}
+
+static int search_index_key_pkg(apk_hash_item item, void *pctx)
+{
+	struct search_index_ctx *ctx = pctx;
+	struct apk_package *pkg = item;
+	uint64_t v[2];
+
+	if (!pkg->repos) {
+		if (ctx->names) apk_name_array_add(&ctx->names, pkg->name);
+		return 0;
+	}
+	memcpy(v, pkg->digest, sizeof v);
+	ctx->key.num_packages++;
+	ctx->key.sum[0] += v[0];
+	ctx->key.sum[1] += v[1];
+	return 0;
+}
+
+static int search_index_add_name(apk_hash_item item, void *pctx)
+{
+	struct search_index_ctx *ctx = pctx;
+	struct apk_name *name = item;
+	uint32_t name_idx = apk_array_len(ctx->names);
+	bool indexed = false;
+
+	apk_array_foreach(p, name->providers) {
+		struct apk_package *pkg = p->pkg;
+		if (pkg->name != name || !pkg->repos) continue;
+		indexed = true;
+		apk_array_foreach(dep, pkg->provides)
+			search_add_trigrams(ctx, name_idx, APK_BLOB_STR(dep->name->name));
+		if (pkg->description) search_add_trigrams(ctx, name_idx, *pkg->description);
+	}
+	if (!indexed) return 0;
+	search_add_trigrams(ctx, name_idx, APK_BLOB_STR(name->name));
+	apk_name_array_add(&ctx->names, name);
+	return 0;
+}
+
+static int search_entry_cmp(const void *p1, const void *p2)
+{
+	uint64_t a = *(const uint64_t *) p1, b = *(const uint64_t *) p2;
+	return (a > b) - (a < b);
+}
+
+int apk_search_index_write(struct apk_database *db)
+{
+	struct search_index_ctx ctx = { .db = db };
+	struct search_index_header hdr = { .magic = SEARCH_INDEX_MAGIC };
+	struct search_index_trigram tg;
+	struct apk_ostream *os;
+	uint32_t offset, num_postings = 0;
+	uint64_t prev = UINT64_MAX;
+
+	if (db->cache_fd < 0) return db->cache_fd;
+
+	apk_hash_foreach(&db->available.packages, search_index_key_pkg, &ctx);
+	apk_name_array_init(&ctx.names);
+	search_entry_array_init(&ctx.entries);
+	apk_hash_foreach(&db->available.names, search_index_add_name, &ctx);
+	apk_array_qsort(ctx.entries, search_entry_cmp);
+
+	hdr.key = ctx.key;
+	hdr.num_names = apk_array_len(ctx.names);
+	apk_array_foreach_item(e, ctx.entries) {
+		if ((e >> 32) != (prev >> 32)) hdr.num_trigrams++;
+		prev = e;
+	}
+
+	os = apk_ostream_to_file(db->cache_fd, SEARCH_INDEX_FILE, 0644);
+	if (IS_ERR(os)) goto err;
+	apk_ostream_write(os, &hdr, sizeof hdr);
+	offset = 0;
+	apk_array_foreach_item(name, ctx.names) {
+		apk_ostream_write(os, &offset, sizeof offset);
+		offset += strlen(name->name) + 1;
+	}
+	prev = UINT64_MAX;
+	apk_array_foreach_item(e, ctx.entries) {
+		if (e == prev) continue;
+		if ((e >> 32) != (prev >> 32)) {
+			tg = (struct search_index_trigram) { .trigram = e >> 32, .start = num_postings };
+			apk_ostream_write(os, &tg, sizeof tg);
+		}
+		num_postings++;
+		prev = e;
+	}
+	tg = (struct search_index_trigram) { .trigram = UINT32_MAX, .start = num_postings };
+	apk_ostream_write(os, &tg, sizeof tg);
+	prev = UINT64_MAX;
+	apk_array_foreach_item(e, ctx.entries) {
+		uint32_t name_idx = e;
+		if (e != prev) apk_ostream_write(os, &name_idx, sizeof name_idx);
+		prev = e;
+	}
+	apk_array_foreach_item(name, ctx.names)
+		apk_ostream_write(os, name->name, strlen(name->name) + 1);
+	os = ERR_PTR(apk_ostream_close(os));
+err:
+	search_entry_array_free(&ctx.entries);
+	apk_name_array_free(&ctx.names);
+	return PTR_ERR(os);
+}
+
+struct apk_search_index *apk_search_index_open(struct apk_database *db)
+{
+	struct search_index_ctx ctx = { .db = db };
+	struct apk_search_index *si;
+	const struct search_index_header *hdr;
+	apk_blob_t b;
+	size_t tables;
+
+	if (db->cache_fd < 0) return NULL;
+
+	si = calloc(1, sizeof *si);
+	if (!si) return NULL;
+	si->db = db;
+	apk_name_array_init(&si->unindexed);
+	apk_name_array_init(&si->selected);
+	si->is = apk_istream_from_file_mmap(db->cache_fd, SEARCH_INDEX_FILE);
+	if (IS_ERR(si->is)) {
+		si->is = NULL;
+		goto err;
+	}
+	b = apk_istream_mmap(si->is);
+	if (b.len < sizeof *hdr) goto err;
+	hdr = (const struct search_index_header *) b.ptr;
+	if (memcmp(hdr->magic, SEARCH_INDEX_MAGIC, sizeof hdr->magic) != 0) goto err;
+	tables = sizeof *hdr + (size_t) hdr->num_names * sizeof(uint32_t) +
+		((size_t) hdr->num_trigrams + 1) * sizeof(struct search_index_trigram);
+	if (b.len < tables) goto err;
+	si->hdr = hdr;
+	si->name_offsets = (const uint32_t *) &hdr[1];
+	si->trigrams = (const struct search_index_trigram *) &si->name_offsets[hdr->num_names];
+	si->postings = (const uint32_t *) &si->trigrams[hdr->num_trigrams + 1];
+	si->num_postings = si->trigrams[hdr->num_trigrams].start;
+	if (b.len - tables < si->num_postings * sizeof(uint32_t)) goto err;
+	si->strings = (const char *) &si->postings[si->num_postings];
+	si->strings_len = b.ptr + b.len - si->strings;
+	if (si->strings_len == 0 || si->strings[si->strings_len - 1] != 0) goto err;
+
+	// The index must describe exactly the loaded repository packages
+	ctx.names = si->unindexed;
+	apk_hash_foreach(&db->available.packages, search_index_key_pkg, &ctx);
+	si->unindexed = ctx.names;
+	if (memcmp(&ctx.key, &hdr->key, sizeof ctx.key) != 0) {
+		apk_dbg(&db->ctx->out, "search index is stale");
+		goto err;
+	}
+	return si;
+err:
+	apk_search_index_close(si);
+	return NULL;
+}
+
+static bool search_posting_range(struct apk_search_index *si, uint32_t trigram, const uint32_t **begin, const uint32_t **end)
+{
+	const struct search_index_trigram *tg = si->trigrams;
+	size_t lo = 0, hi = si->hdr->num_trigrams;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (tg[mid].trigram < trigram) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo >= si->hdr->num_trigrams || tg[lo].trigram != trigram) return false;
+	if (tg[lo].start > tg[lo + 1].start || tg[lo + 1].start > si->num_postings) return false;
+	*begin = &si->postings[tg[lo].start];
+	*end = &si->postings[tg[lo + 1].start];
+	return true;
+}
+
+static bool search_posting_contains(const uint32_t *begin, const uint32_t *end, uint32_t name_idx)
+{
+	while (begin < end) {
+		const uint32_t *mid = begin + (end - begin) / 2;
+		if (*mid == name_idx) return true;
+		if (*mid < name_idx) begin = mid + 1;
+		else end = mid;
+	}
+	return false;
+}
+
+static void search_select(struct apk_search_index *si, struct apk_name *name)
+{
+	if (!name || name->search_selected) return;
+	name->search_selected = 1;
+	apk_name_array_add(&si->selected, name);
+}
+
+/* Select the names that may have 'pattern' as a case-insensitive substring
+ * of the indexed fields. Patterns with wildcards or shorter than a trigram
+ * are not supported. */
+int apk_search_index_select(struct apk_search_index *si, const char *pattern)
+{
+	const uint8_t *p = (const uint8_t *) pattern;
+	const uint32_t *b[64], *e[64], *best_b, *best_e;
+	size_t len = strlen(pattern), n = 0;
+
+	if (len < 3 || strpbrk(pattern, "*?[\\")) return -ENOTSUP;
+
+	for (size_t i = 0; i + 3 <= len && n < ARRAY_SIZE(b); i++, n++)
+		if (!search_posting_range(si, search_trigram(&p[i]), &b[n], &e[n])) goto done;
+	best_b = b[0], best_e = e[0];
+	for (size_t i = 1; i < n; i++)
+		if (e[i] - b[i] < best_e - best_b) best_b = b[i], best_e = e[i];
+
+	for (const uint32_t *ni = best_b; ni < best_e; ni++) {
+		size_t i;
+		if (*ni >= si->hdr->num_names) continue;
+		for (i = 0; i < n; i++)
+			if (!search_posting_contains(b[i], e[i], *ni)) break;
+		if (i < n) continue;
+		if (si->name_offsets[*ni] >= si->strings_len) continue;
+		search_select(si, apk_db_query_name(si->db, APK_BLOB_STR(&si->strings[si->name_offsets[*ni]])));
+	}
+done:
+	apk_array_foreach_item(name, si->unindexed) search_select(si, name);
+	return 0;
+}
+
+void apk_search_index_reset(struct apk_search_index *si)
+{
+	apk_array_foreach_item(name, si->selected) name->search_selected = 0;
+	apk_array_truncate(si->selected, 0);
+}
+
+void apk_search_index_close(struct apk_search_index *si)
+{
+	if (!si) return;
+	apk_search_index_reset(si);
+	apk_name_array_free(&si->selected);
+	apk_name_array_free(&si->unindexed);
+	if (si->is) apk_istream_close(si->is);
+	free(si);
+}
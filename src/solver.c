@@ -10,6 +10,7 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <strings.h>
+#include <time.h>
 #include "apk_defines.h"
 #include "apk_database.h"
 #include "apk_package.h"
@@ -28,6 +29,33 @@
 
 #define ASSERT(cond, fmt...)	if (!(cond)) { apk_error(fmt); *(char*)NULL = 0; }
 
+/* The solver cache stores the solution of each connected component of the
+ * discovered name graph keyed by a digest of everything the solver looks at
+ * while resolving it. Components do not interact during solving, so the
+ * stored solution of an unchanged component equals what a full solve gives. */
+struct solver_cache_entry {
+	struct apk_name *name;
+	unsigned short chosen;		/* provider index + 1, zero if none */
+	unsigned short pinning_allowed;
+	unsigned short solver_flags;
+	unsigned short seen;
+};
+APK_ARRAY(solver_cache_entry_array, struct solver_cache_entry);
+
+struct solver_cache_component {
+	struct apk_digest key;
+	unsigned int first, num;
+	unsigned valid : 1;
+};
+APK_ARRAY(solver_cache_component_array, struct solver_cache_component);
+
+struct apk_solver_cache {
+	struct solver_cache_component_array *comps;
+	struct solver_cache_entry_array *entries;
+};
+
+static const char * const apk_solver_cache_file = "lib/apk/db/solver.cache";
+
 struct apk_solver_state {
 	struct apk_database *db;
 	struct apk_changeset *changeset;
@@ -38,9 +66,12 @@ struct apk_solver_state {
 	unsigned int errors;
 	unsigned int solver_flags_inherit;
 	unsigned int pinning_inherit;
-	unsigned int default_repos;
 	unsigned int order_id;
+	struct apk_solver_cache *cache;
+	struct apk_name_array *cache_nodes;
+	struct apk_solver_cache new_cache;
 	unsigned ignore_conflict : 1;
+	unsigned cache_conflict : 1;
 };
 
 static struct apk_provider provider_none = {
@@ -62,22 +93,27 @@ void apk_solver_set_name_flags(struct apk_name *name,
 	}
 }
 
-static int get_tag(struct apk_database *db, unsigned int pinning_mask, unsigned int repos)
+static unsigned int get_pkg_repos(struct apk_database *db, struct apk_package *pkg)
 {
-	int i;
+	return pkg->repos | (pkg->ipkg ? db->repo_tags[pkg->ipkg->repository_tag].allowed_repos : 0);
+}
 
-	for (i = 0; i < db->num_repo_tags; i++) {
-		if (!(BIT(i) & pinning_mask))
-			continue;
-		if (db->repo_tags[i].allowed_repos & repos)
-			return i;
-	}
-	return APK_DEFAULT_REPOSITORY_TAG;
+/* The pinning tags whose repositories have the package. Pinning mask
+ * checks of the package are then a single AND with this mask. */
+static unsigned short get_pkg_tag_mask(struct apk_database *db, struct apk_package *pkg)
+{
+	unsigned int repos = get_pkg_repos(db, pkg);
+	unsigned short mask = 0;
+
+	for (int i = 0; i < db->num_repo_tags; i++)
+		if (db->repo_tags[i].allowed_repos & repos) mask |= BIT(i);
+	return mask;
 }
 
-static unsigned int get_pkg_repos(struct apk_database *db, struct apk_package *pkg)
+static int get_tag(unsigned short pinning_mask, unsigned short tag_mask)
 {
-	return pkg->repos | (pkg->ipkg ? db->repo_tags[pkg->ipkg->repository_tag].allowed_repos : 0);
+	int tag = ffs(pinning_mask & tag_mask);
+	return tag ? tag - 1 : APK_DEFAULT_REPOSITORY_TAG;
 }
 
 static void mark_error(struct apk_solver_state *ss, struct apk_package *pkg, const char *reason)
@@ -196,11 +232,21 @@ static bool dependency_satisfiable(struct apk_solver_state *ss, const struct apk
 static void discover_name(struct apk_solver_state *ss, struct apk_name *name)
 {
 	struct apk_database *db = ss->db;
-	unsigned int repos, num_virtual = 0;
+	unsigned int num_virtual = 0;
 
+	if (name->ss.reused) {
+		/* The reused component is connected to this one after all */
+		ss->cache->comps->item[name->ss.cache_id - 1].valid = 0;
+		ss->cache_conflict = 1;
+		return;
+	}
 	if (name->ss.seen) return;
 
 	name->ss.seen = 1;
+	if (ss->cache) {
+		apk_name_array_add(&ss->cache_nodes, name);
+		name->ss.cache_id = apk_array_len(ss->cache_nodes);
+	}
 	name->ss.no_iif = 1;
 	apk_array_foreach(p, name->providers) {
 		struct apk_package *pkg = p->pkg;
@@ -226,10 +272,10 @@ static void discover_name(struct apk_solver_state *ss, struct apk_name *name)
 				((ss->solver_flags_inherit & APK_SOLVERF_AVAILABLE) &&
 				 !pkg->ss.pkg_available);
 
-			repos = get_pkg_repos(db, pkg);
+			pkg->ss.tag_mask = get_pkg_tag_mask(db, pkg);
 			pkg->ss.tag_preferred = pkg->filename_ndx ||
 				(pkg->installed_size == 0) ||
-				(repos & ss->default_repos);
+				(pkg->ss.tag_mask & APK_DEFAULT_PINNING_MASK);
 			pkg->ss.tag_ok =
 				pkg->ss.tag_preferred ||
 				pkg->cached_non_repository ||
@@ -281,8 +327,6 @@ static void name_requirers_changed(struct apk_solver_state *ss, struct apk_name
 static void inherit_pinning_and_flags(
 	struct apk_solver_state *ss, struct apk_package *pkg, struct apk_package *ppkg)
 {
-	unsigned int repos = get_pkg_repos(ss->db, pkg);
-
 	if (ppkg != NULL) {
 		/* inherited */
 		pkg->ss.solver_flags |= ppkg->ss.solver_flags_inheritable;
@@ -295,9 +339,9 @@ static void inherit_pinning_and_flags(
 		pkg->ss.pinning_allowed |= ss->pinning_inherit;
 		/* also prefer main pinnings */
 		pkg->ss.pinning_preferred = ss->pinning_inherit;
-		pkg->ss.tag_preferred = !!(repos & apk_db_get_pinning_mask_repos(ss->db, pkg->ss.pinning_preferred));
+		pkg->ss.tag_preferred = !!(pkg->ss.tag_mask & pkg->ss.pinning_preferred);
 	}
-	pkg->ss.tag_ok |= !!(repos & apk_db_get_pinning_mask_repos(ss->db, pkg->ss.pinning_allowed));
+	pkg->ss.tag_ok |= !!(pkg->ss.tag_mask & pkg->ss.pinning_allowed);
 
 	dbg_printf(PKG_VER_FMT ": tag_ok=%d, tag_pref=%d\n",
 		PKG_VER_PRINTF(pkg), pkg->ss.tag_ok, pkg->ss.tag_preferred);
@@ -635,7 +679,7 @@ static int compare_providers(struct apk_solver_state *ss,
 	}
 
 	/* Select latest by requested name */
-	switch (apk_version_compare(*pA->version, *pB->version)) {
+	switch (apk_version_compare_atom(pA->version, pB->version)) {
 	case APK_VERSION_LESS:
 		dbg_printf("    select latest by requested name (less)\n");
 		return -1;
@@ -646,7 +690,7 @@ static int compare_providers(struct apk_solver_state *ss,
 
 	/* Select latest by principal name */
 	if (pkgA->name == pkgB->name) {
-		switch (apk_version_compare(*pkgA->version, *pkgB->version)) {
+		switch (apk_version_compare_atom(pkgA->version, pkgB->version)) {
 		case APK_VERSION_LESS:
 			dbg_printf("    select latest by principal name (less)\n");
 			return -1;
@@ -799,7 +843,7 @@ static void record_change(struct apk_solver_state *ss, struct apk_package *opkg,
 		.old_pkg = opkg,
 		.old_repository_tag = opkg ? opkg->ipkg->repository_tag : 0,
 		.new_pkg = npkg,
-		.new_repository_tag = npkg ? get_tag(ss->db, npkg->ss.pinning_allowed, get_pkg_repos(ss->db, npkg)) : 0,
+		.new_repository_tag = npkg ? get_tag(npkg->ss.pinning_allowed, npkg->ss.tag_mask) : 0,
 		.reinstall = npkg ? !!(npkg->ss.solver_flags & APK_SOLVERF_REINSTALL) : 0,
 	});
 	if (npkg == NULL)
@@ -1067,6 +1111,478 @@ static struct apk_name *dequeue_next_name(struct apk_solver_state *ss)
 	return NULL;
 }
 
+static uint64_t solver_clock(struct apk_database *db)
+{
+	struct timespec ts;
+
+	if (!db->solver_stats) return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void solver_cache_reset(struct apk_solver_cache *cache)
+{
+	solver_cache_component_array_free(&cache->comps);
+	solver_cache_entry_array_free(&cache->entries);
+}
+
+static int solver_cache_parse(struct apk_database *db, struct apk_solver_cache *cache, apk_blob_t l)
+{
+	struct solver_cache_component *comp;
+	struct solver_cache_entry e;
+
+	if (l.len == 0) return 0;
+	if (l.len < 2 || l.ptr[1] != ':') return -APKE_FORMAT_INVALID;
+	switch (l.ptr[0]) {
+	case 'K':
+		l = APK_BLOB_PTR_LEN(l.ptr + 2, l.len - 2);
+		comp = solver_cache_component_array_add(&cache->comps, (struct solver_cache_component) {
+			.first = apk_array_len(cache->entries),
+		});
+		apk_digest_set(&comp->key, APK_DIGEST_SHA256);
+		apk_blob_pull_hexdump(&l, APK_DIGEST_BLOB(comp->key));
+		if (APK_BLOB_IS_NULL(l) || l.len != 0) return -APKE_FORMAT_INVALID;
+		break;
+	case 'N':
+		if (apk_array_len(cache->comps) == 0) return -APKE_FORMAT_INVALID;
+		l = APK_BLOB_PTR_LEN(l.ptr + 2, l.len - 2);
+		e.seen = apk_blob_pull_uint(&l, 10);
+		apk_blob_pull_char(&l, ':');
+		e.chosen = apk_blob_pull_uint(&l, 10);
+		apk_blob_pull_char(&l, ':');
+		e.pinning_allowed = apk_blob_pull_uint(&l, 10);
+		apk_blob_pull_char(&l, ':');
+		e.solver_flags = apk_blob_pull_uint(&l, 10);
+		apk_blob_pull_char(&l, ':');
+		if (APK_BLOB_IS_NULL(l) || l.len == 0) return -APKE_FORMAT_INVALID;
+		e.name = apk_db_get_name(db, l);
+		if (!e.name) return -ENOMEM;
+		solver_cache_entry_array_add(&cache->entries, e);
+		cache->comps->item[apk_array_len(cache->comps) - 1].num++;
+		break;
+	default:
+		return -APKE_FORMAT_INVALID;
+	}
+	return 0;
+}
+
+static struct apk_solver_cache *solver_cache_get(struct apk_database *db)
+{
+	struct apk_solver_cache *cache = db->solver_cache;
+	struct apk_istream *is;
+	apk_blob_t l, token = APK_BLOB_STR("\n");
+
+	if (!db->ctx->solver_cache || (db->ctx->force & APK_FORCE_BROKEN_WORLD)) return NULL;
+	if (cache) return cache;
+
+	cache = calloc(1, sizeof *cache);
+	if (!cache) return NULL;
+	solver_cache_component_array_init(&cache->comps);
+	solver_cache_entry_array_init(&cache->entries);
+	db->solver_cache = cache;
+
+	is = apk_istream_from_file(db->root_fd, apk_solver_cache_file);
+	if (IS_ERR(is)) return cache;
+	while (apk_istream_get_delim(is, token, &l) == 0) {
+		int r = solver_cache_parse(db, cache, l);
+		if (r < 0) {
+			apk_istream_error(is, r);
+			break;
+		}
+	}
+	if (apk_istream_close(is) < 0) solver_cache_reset(cache);
+	return cache;
+}
+
+void apk_solver_cache_free(struct apk_database *db)
+{
+	if (!db->solver_cache) return;
+	solver_cache_reset(db->solver_cache);
+	free(db->solver_cache);
+	db->solver_cache = NULL;
+}
+
+static void key_u32(struct apk_digest_ctx *dctx, uint32_t v)
+{
+	apk_digest_ctx_update(dctx, &v, sizeof v);
+}
+
+static void key_blob(struct apk_digest_ctx *dctx, apk_blob_t b)
+{
+	key_u32(dctx, b.len);
+	apk_digest_ctx_update(dctx, b.ptr, b.len);
+}
+
+static void key_dep(struct apk_digest_ctx *dctx, struct apk_dependency *dep)
+{
+	key_blob(dctx, APK_BLOB_STR(dep->name->name));
+	key_blob(dctx, *dep->version);
+	key_u32(dctx, dep->op | (dep->repository_tag << 8) | (dep->broken << 16));
+}
+
+static void key_deps(struct apk_digest_ctx *dctx, struct apk_dependency_array *deps)
+{
+	key_u32(dctx, apk_array_len(deps));
+	apk_array_foreach(d, deps) key_dep(dctx, d);
+}
+
+static void key_names(struct apk_digest_ctx *dctx, struct apk_name_array *names)
+{
+	key_u32(dctx, apk_array_len(names));
+	apk_array_foreach_item(name, names) key_blob(dctx, APK_BLOB_STR(name->name));
+}
+
+static void key_begin(struct apk_database *db, struct apk_digest_ctx *dctx, unsigned short solver_flags)
+{
+	apk_digest_ctx_reset(dctx);
+	key_u32(dctx, solver_flags);
+	key_u32(dctx, db->performing_self_upgrade);
+	key_u32(dctx, db->active_layers);
+	key_u32(dctx, db->available_repos);
+	key_u32(dctx, apk_db_get_pinning_mask_repos(db, APK_DEFAULT_PINNING_MASK));
+	key_u32(dctx, db->num_repos);
+	key_u32(dctx, db->num_repo_tags);
+	for (int i = 0; i < db->num_repo_tags; i++)
+		key_u32(dctx, db->repo_tags[i].allowed_repos);
+}
+
+static void key_name(struct apk_database *db, struct apk_digest_ctx *dctx, struct apk_name *name, bool seen)
+{
+	key_blob(dctx, APK_BLOB_STR(name->name));
+	key_u32(dctx, seen | (name->solver_flags_set << 1));
+	key_names(dctx, name->rinstall_if);
+	key_u32(dctx, apk_array_len(name->providers));
+	apk_array_foreach(p, name->providers) {
+		struct apk_package *pkg = p->pkg;
+
+		key_blob(dctx, *p->version);
+		key_blob(dctx, apk_pkg_digest_blob(pkg));
+		key_blob(dctx, APK_BLOB_STR(pkg->name->name));
+		key_blob(dctx, *pkg->version);
+		key_u32(dctx, pkg->repos);
+		key_u32(dctx, pkg->provider_priority);
+		key_u32(dctx, pkg->layer |
+			(pkg->uninstallable << 4) |
+			(pkg->cached << 5) |
+			(pkg->cached_non_repository << 6) |
+			((pkg->filename_ndx != 0) << 7) |
+			((pkg->installed_size == 0) << 8) |
+			(apk_db_pkg_available(db, pkg) << 9) |
+			(pkg->ipkg ? (pkg->ipkg->repository_tag + 1) << 10 : 0));
+		key_u32(dctx, pkg->ss.solver_flags | (pkg->ss.solver_flags_inheritable << 16));
+		key_deps(dctx, pkg->depends);
+		key_deps(dctx, pkg->provides);
+		key_deps(dctx, pkg->install_if);
+		key_names(dctx, pkg->name->rinstall_if);
+	}
+}
+
+static int cmp_world_ptr(const void *p1, const void *p2)
+{
+	const struct apk_dependency *d1 = *(const struct apk_dependency **) p1, *d2 = *(const struct apk_dependency **) p2;
+
+	if (d1->name->ss.cache_id != d2->name->ss.cache_id)
+		return d1->name->ss.cache_id < d2->name->ss.cache_id ? -1 : 1;
+	return (d1 > d2) - (d1 < d2);
+}
+
+/* World dependencies of the marked names sorted by component, in world order */
+static struct apk_dependency **solver_cache_world(struct apk_dependency_array *world, unsigned int *num)
+{
+	struct apk_dependency **deps;
+	unsigned int n = 0;
+
+	deps = malloc((apk_array_len(world) + 1) * sizeof *deps);
+	if (!deps) return NULL;
+	apk_array_foreach(d, world) {
+		if (!d->name->ss.cache_id || d->name->ss.reused) continue;
+		deps[n++] = d;
+	}
+	qsort(deps, n, sizeof *deps, cmp_world_ptr);
+	*num = n;
+	return deps;
+}
+
+static void key_world(struct apk_digest_ctx *dctx, struct apk_dependency **deps, unsigned int num, unsigned int *pos, unsigned int cache_id)
+{
+	unsigned int i = *pos;
+
+	while (i < num && deps[i]->name->ss.cache_id < cache_id) i++;
+	for (; i < num && deps[i]->name->ss.cache_id == cache_id; i++)
+		key_dep(dctx, deps[i]);
+	*pos = i;
+}
+
+static void solver_cache_validate(struct apk_database *db, struct apk_solver_cache *cache,
+				  unsigned short solver_flags, struct apk_dependency_array *world)
+{
+	struct apk_digest_ctx dctx;
+	struct apk_digest key;
+	struct apk_dependency **deps = NULL;
+	unsigned int num_deps = 0, pos = 0;
+
+	apk_array_foreach(comp, cache->comps) {
+		struct solver_cache_entry *e = &cache->entries->item[comp->first];
+		unsigned int cache_id = comp - &cache->comps->item[0] + 1;
+
+		comp->valid = 1;
+		for (unsigned int i = 0; i < comp->num; i++) {
+			apk_db_name_load_lazy(db, e[i].name);
+			if (e[i].name->ss.cache_id || e[i].chosen > apk_array_len(e[i].name->providers))
+				comp->valid = 0;
+			e[i].name->ss.cache_id = cache_id;
+		}
+	}
+
+	if (apk_digest_ctx_init(&dctx, APK_DIGEST_SHA256) < 0) goto invalidate;
+	deps = solver_cache_world(world, &num_deps);
+	if (!deps) goto invalidate;
+	apk_array_foreach(comp, cache->comps) {
+		struct solver_cache_entry *e = &cache->entries->item[comp->first];
+
+		if (!comp->valid) continue;
+		key_begin(db, &dctx, solver_flags);
+		key_world(&dctx, deps, num_deps, &pos, comp - &cache->comps->item[0] + 1);
+		for (unsigned int i = 0; i < comp->num; i++)
+			key_name(db, &dctx, e[i].name, e[i].seen);
+		apk_digest_ctx_final(&dctx, &key);
+		comp->valid = apk_digest_cmp(&key, &comp->key) == 0;
+	}
+	goto done;
+
+invalidate:
+	apk_array_foreach(comp, cache->comps) comp->valid = 0;
+done:
+	free(deps);
+	apk_digest_ctx_free(&dctx);
+	apk_array_foreach(e, cache->entries) e->name->ss.cache_id = 0;
+}
+
+static void solver_cache_restore_names(struct apk_solver_state *ss)
+{
+	struct apk_solver_cache *cache = ss->cache;
+
+	apk_array_foreach(comp, cache->comps) {
+		struct solver_cache_entry *e = &cache->entries->item[comp->first];
+
+		if (!comp->valid) continue;
+		for (unsigned int i = 0; i < comp->num; i++) {
+			struct apk_name *name = e[i].name;
+			name->ss.reused = 1;
+			name->ss.seen = e[i].seen;
+			name->ss.cache_id = comp - &cache->comps->item[0] + 1;
+			if (e[i].chosen) {
+				name->ss.locked = 1;
+				name->ss.chosen = name->providers->item[e[i].chosen - 1];
+			}
+		}
+	}
+}
+
+static void solver_cache_restore_packages(struct apk_solver_state *ss)
+{
+	struct apk_solver_cache *cache = ss->cache;
+
+	apk_array_foreach(comp, cache->comps) {
+		struct solver_cache_entry *e = &cache->entries->item[comp->first];
+
+		if (!comp->valid) continue;
+		for (unsigned int i = 0; i < comp->num; i++) {
+			struct apk_package *pkg = e[i].name->ss.chosen.pkg;
+			if (!pkg) continue;
+			pkg->ss.pinning_allowed = e[i].pinning_allowed;
+			pkg->ss.solver_flags = e[i].solver_flags;
+			pkg->ss.tag_mask = get_pkg_tag_mask(ss->db, pkg);
+		}
+	}
+}
+
+static unsigned int cache_node(struct apk_solver_state *ss, struct apk_name *name)
+{
+	if (name->ss.reused) {
+		ss->cache->comps->item[name->ss.cache_id - 1].valid = 0;
+		ss->cache_conflict = 1;
+		return 0;
+	}
+	if (!name->ss.cache_id) {
+		apk_name_array_add(&ss->cache_nodes, name);
+		name->ss.cache_id = apk_array_len(ss->cache_nodes);
+	}
+	return name->ss.cache_id - 1;
+}
+
+static unsigned int uf_find(unsigned int *parent, unsigned int i)
+{
+	while (parent[i] != i) i = parent[i] = parent[parent[i]];
+	return i;
+}
+
+static void uf_union(unsigned int *parent, unsigned int a, struct apk_name *name)
+{
+	unsigned int b = uf_find(parent, name->ss.cache_id - 1);
+
+	a = uf_find(parent, a);
+	if (a < b) parent[b] = a;
+	else parent[a] = b;
+}
+
+static int cmp_cache_node(const void *p1, const void *p2)
+{
+	const struct apk_name *n1 = *(const struct apk_name **) p1, *n2 = *(const struct apk_name **) p2;
+
+	if (n1->ss.cache_id != n2->ss.cache_id)
+		return n1->ss.cache_id < n2->ss.cache_id ? -1 : 1;
+	return strcmp(n1->name, n2->name);
+}
+
+/* Split the discovered names into connected components and compute
+ * their keys. Names are linked by everything discover_name() follows,
+ * and to the names of their providers which may get assigned. */
+static void solver_cache_build(struct apk_solver_state *ss, unsigned short solver_flags, struct apk_dependency_array *world)
+{
+	struct apk_database *db = ss->db;
+	struct apk_solver_cache *nc = &ss->new_cache;
+	struct apk_dependency **deps = NULL;
+	struct apk_digest_ctx dctx;
+	unsigned int *parent, num_deps, pos = 0, id, prev_id = 0;
+
+	for (unsigned int i = 0; i < apk_array_len(ss->cache_nodes); i++) {
+		struct apk_name *name = ss->cache_nodes->item[i];
+		if (!name->ss.seen) continue;
+		apk_array_foreach(p, name->providers) cache_node(ss, p->pkg->name);
+	}
+	if (ss->cache_conflict) return;
+
+	parent = malloc(apk_array_len(ss->cache_nodes) * sizeof *parent);
+	if (!parent) goto err;
+	for (unsigned int i = 0; i < apk_array_len(ss->cache_nodes); i++) parent[i] = i;
+	for (unsigned int i = 0; i < apk_array_len(ss->cache_nodes); i++) {
+		struct apk_name *name = ss->cache_nodes->item[i];
+		if (!name->ss.seen) continue;
+		apk_array_foreach_item(name0, name->rinstall_if) uf_union(parent, i, name0);
+		apk_array_foreach(p, name->providers) {
+			struct apk_package *pkg = p->pkg;
+			uf_union(parent, i, pkg->name);
+			apk_array_foreach_item(name0, pkg->name->rinstall_if) uf_union(parent, i, name0);
+			apk_array_foreach(d, pkg->depends) uf_union(parent, i, d->name);
+			apk_array_foreach(d, pkg->provides) uf_union(parent, i, d->name);
+			apk_array_foreach(d, pkg->install_if) uf_union(parent, i, d->name);
+		}
+	}
+	for (unsigned int i = 0; i < apk_array_len(ss->cache_nodes); i++)
+		ss->cache_nodes->item[i]->ss.cache_id = uf_find(parent, i) + 1;
+	free(parent);
+
+	apk_array_qsort(ss->cache_nodes, cmp_cache_node);
+	apk_array_foreach_item(name, ss->cache_nodes) {
+		id = name->ss.cache_id;
+		if (id != prev_id) {
+			solver_cache_component_array_add(&nc->comps, (struct solver_cache_component) {
+				.first = apk_array_len(nc->entries),
+				.valid = 1,
+			});
+			prev_id = id;
+		}
+		nc->comps->item[apk_array_len(nc->comps) - 1].num++;
+		name->ss.cache_id = apk_array_len(nc->comps);
+		solver_cache_entry_array_add(&nc->entries, (struct solver_cache_entry) {
+			.name = name,
+			.seen = name->ss.seen,
+		});
+	}
+
+	if (apk_digest_ctx_init(&dctx, APK_DIGEST_SHA256) < 0) goto err;
+	deps = solver_cache_world(world, &num_deps);
+	if (deps) {
+		apk_array_foreach(comp, nc->comps) {
+			struct solver_cache_entry *e = &nc->entries->item[comp->first];
+
+			key_begin(db, &dctx, solver_flags);
+			key_world(&dctx, deps, num_deps, &pos, comp - &nc->comps->item[0] + 1);
+			for (unsigned int i = 0; i < comp->num; i++)
+				key_name(db, &dctx, e[i].name, e[i].seen);
+			apk_digest_ctx_final(&dctx, &comp->key);
+		}
+		free(deps);
+	}
+	apk_digest_ctx_free(&dctx);
+	if (deps) return;
+err:
+	solver_cache_reset(nc);
+}
+
+static int solver_cache_write(struct apk_database *db, struct apk_solver_cache *cache)
+{
+	struct apk_ostream *os;
+	char buf[128];
+	apk_blob_t b;
+
+	os = apk_ostream_to_file(db->root_fd, apk_solver_cache_file, 0644);
+	if (IS_ERR(os)) return PTR_ERR(os);
+	apk_array_foreach(comp, cache->comps) {
+		b = APK_BLOB_BUF(buf);
+		apk_blob_push_blob(&b, APK_BLOB_STRLIT("K:"));
+		apk_blob_push_hexdump(&b, APK_DIGEST_BLOB(comp->key));
+		apk_blob_push_blob(&b, APK_BLOB_STRLIT("\n"));
+		apk_ostream_write_blob(os, apk_blob_pushed(APK_BLOB_BUF(buf), b));
+
+		for (unsigned int i = comp->first; i < comp->first + comp->num; i++) {
+			struct solver_cache_entry *e = &cache->entries->item[i];
+
+			apk_ostream_fmt(os, "N:%u:%u:%u:%u:%s\n",
+				e->seen, e->chosen, e->pinning_allowed, e->solver_flags, e->name->name);
+		}
+	}
+	return apk_ostream_close(os);
+}
+
+/* Replace the cache with the reused and the freshly solved components */
+static void solver_cache_update(struct apk_solver_state *ss)
+{
+	struct apk_database *db = ss->db;
+	struct apk_solver_cache *cache = ss->cache, *nc = &ss->new_cache, result;
+
+	solver_cache_component_array_init(&result.comps);
+	solver_cache_entry_array_init(&result.entries);
+	apk_array_foreach(comp, cache->comps) {
+		if (!comp->valid) continue;
+		solver_cache_component_array_add(&result.comps, (struct solver_cache_component) {
+			.key = comp->key,
+			.first = apk_array_len(result.entries),
+			.num = comp->num,
+		});
+		for (unsigned int i = comp->first; i < comp->first + comp->num; i++)
+			solver_cache_entry_array_add(&result.entries, cache->entries->item[i]);
+	}
+	apk_array_foreach(comp, nc->comps) {
+		solver_cache_component_array_add(&result.comps, (struct solver_cache_component) {
+			.key = comp->key,
+			.first = apk_array_len(result.entries),
+			.num = comp->num,
+		});
+		for (unsigned int i = comp->first; i < comp->first + comp->num; i++) {
+			struct solver_cache_entry e = nc->entries->item[i];
+			struct apk_provider *chosen = &e.name->ss.chosen;
+
+			if (chosen->pkg) {
+				apk_array_foreach(p, e.name->providers) {
+					if (p->pkg != chosen->pkg || p->version != chosen->version) continue;
+					e.chosen = p - &e.name->providers->item[0] + 1;
+					break;
+				}
+				e.pinning_allowed = chosen->pkg->ss.pinning_allowed;
+				e.solver_flags = chosen->pkg->ss.solver_flags;
+			}
+			solver_cache_entry_array_add(&result.entries, e);
+		}
+	}
+	solver_cache_reset(cache);
+	*cache = result;
+
+	if ((db->ctx->open_flags & APK_OPENF_WRITE) && !(db->ctx->flags & APK_SIMULATE))
+		solver_cache_write(db, cache);
+}
+
 int apk_solver_solve(struct apk_database *db,
 		     unsigned short solver_flags,
 		     struct apk_dependency_array *world,
@@ -1075,29 +1591,56 @@ int apk_solver_solve(struct apk_database *db,
 	struct apk_name *name;
 	struct apk_package *pkg;
 	struct apk_solver_state ss_data, *ss = &ss_data;
+	struct apk_solver_stats *stats = db->solver_stats;
+	struct apk_solver_cache *cache;
+	uint64_t t0, t1, t2, t3;
 
+	t0 = solver_clock(db);
 	apk_array_qsort(world, cmp_pkgname);
+	apk_db_deps_load_lazy(db, world);
+	cache = solver_cache_get(db);
+	if (cache) solver_cache_validate(db, cache, solver_flags, world);
 
 restart:
 	memset(ss, 0, sizeof(*ss));
 	ss->db = db;
 	ss->changeset = changeset;
-	ss->default_repos = apk_db_get_pinning_mask_repos(db, APK_DEFAULT_PINNING_MASK);
 	ss->ignore_conflict = !!(solver_flags & APK_SOLVERF_IGNORE_CONFLICT);
+	ss->cache = cache;
+	apk_name_array_init(&ss->cache_nodes);
+	solver_cache_component_array_init(&ss->new_cache.comps);
+	solver_cache_entry_array_init(&ss->new_cache.entries);
 	list_init(&ss->dirty_head);
 	list_init(&ss->unresolved_head);
 	list_init(&ss->selectable_head);
 	list_init(&ss->resolvenow_head);
+	if (cache) solver_cache_restore_names(ss);
 
 	dbg_printf("discovering world\n");
 	ss->solver_flags_inherit = solver_flags;
 	apk_array_foreach(d, world) {
-		if (!d->broken)
+		if (!d->broken && !d->name->ss.reused)
 			discover_name(ss, d->name);
 	}
+	if (cache) {
+		solver_cache_build(ss, solver_flags, world);
+		if (ss->cache_conflict) {
+			/* Only discovery has run, restart with the conflicting
+			 * components dropped from reuse */
+			apk_array_foreach_item(name, ss->cache_nodes)
+				if (name->ss.seen)
+					apk_array_foreach(p, name->providers) p->pkg->ss.seen = 0;
+			apk_hash_foreach(&db->available.names, free_name, NULL);
+			apk_name_array_free(&ss->cache_nodes);
+			solver_cache_reset(&ss->new_cache);
+			if (stats) stats->restarts++;
+			goto restart;
+		}
+		solver_cache_restore_packages(ss);
+	}
 	dbg_printf("applying world\n");
 	apk_array_foreach(d, world) {
-		if (!d->broken) {
+		if (!d->broken && !d->name->ss.reused) {
 			ss->pinning_inherit = BIT(d->repository_tag);
 			apply_constraint(ss, NULL, d);
 		}
@@ -1105,6 +1648,7 @@ restart:
 	ss->solver_flags_inherit = 0;
 	ss->pinning_inherit = 0;
 	dbg_printf("applying world [finished]\n");
+	t1 = solver_clock(db);
 
 	do {
 		while (!list_empty(&ss->dirty_head)) {
@@ -1116,8 +1660,15 @@ restart:
 			break;
 		select_package(ss, name);
 	} while (1);
+	t2 = solver_clock(db);
 
 	generate_changeset(ss, world);
+	t3 = solver_clock(db);
+	if (stats) {
+		stats->discover_ns += t1 - t0;
+		stats->resolve_ns += t2 - t1;
+		stats->changeset_ns += t3 - t2;
+	}
 
 	if (ss->errors && (db->ctx->force & APK_FORCE_BROKEN_WORLD)) {
 		apk_array_foreach(d, world) {
@@ -1130,6 +1681,8 @@ restart:
 		}
 		apk_hash_foreach(&db->available.names, free_name, NULL);
 		apk_hash_foreach(&db->available.packages, free_package, NULL);
+		if (stats) stats->restarts++;
+		t0 = solver_clock(db);
 		goto restart;
 	}
 
@@ -1137,9 +1690,13 @@ restart:
 		if (!d->name->ss.chosen.pkg) continue;
 		d->layer = d->name->ss.chosen.pkg->layer;
 	}
+	if (cache && !ss->errors) solver_cache_update(ss);
+	apk_name_array_free(&ss->cache_nodes);
+	solver_cache_reset(&ss->new_cache);
 
 	apk_hash_foreach(&db->available.names, free_name, NULL);
 	apk_hash_foreach(&db->available.packages, free_package, NULL);
+	if (stats) stats->solves++;
 	dbg_printf("solver done, errors=%d\n", ss->errors);
 
 	return ss->errors;
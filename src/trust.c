@@ -1,3 +1,7 @@
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
 #include "apk_defines.h"
 #include "apk_trust.h"
 #include "apk_io.h"
@@ -27,6 +31,8 @@ void apk_trust_init(struct apk_trust *trust)
 	apk_digest_ctx_init(&trust->dctx, APK_DIGEST_NONE);
 	list_init(&trust->trusted_key_list);
 	list_init(&trust->private_key_list);
+	pthread_mutex_init(&trust->verified_lock, NULL);
+	apk_trust_verified_array_init(&trust->verified);
 }
 
 static void __apk_trust_free_keys(struct list_head *h)
@@ -46,6 +52,8 @@ void apk_trust_free(struct apk_trust *trust)
 	__apk_trust_free_keys(&trust->trusted_key_list);
 	__apk_trust_free_keys(&trust->private_key_list);
 	apk_digest_ctx_free(&trust->dctx);
+	apk_trust_verified_array_free(&trust->verified);
+	pthread_mutex_destroy(&trust->verified_lock);
 }
 
 struct apk_pkey *apk_trust_key_by_name(struct apk_trust *trust, const char *filename)
@@ -57,3 +65,116 @@ struct apk_pkey *apk_trust_key_by_name(struct apk_trust *trust, const char *file
 			return &tkey->key;
 	return NULL;
 }
+
+/* The verification cache lists the IDs of signatures that have been
+ * successfully verified with the trusted keys. The cache is ignored if
+ * the set of trusted keys changes, or if the file could have been written
+ * by anyone else, as its entries are trusted like the keys. The entries
+ * used are written first, followed by the older ones, which keeps entries
+ * of repositories not loaded in this run. Entries past the limit expire. */
+#define APK_TRUST_VERIFIED_MAX	(4 * APK_MAX_REPOS)
+
+static void trust_keyset_digest(struct apk_trust *trust, struct apk_digest *d)
+{
+	struct apk_digest_ctx dctx;
+	struct apk_trust_key *tkey;
+
+	apk_digest_set(d, APK_DIGEST_NONE);
+	if (apk_digest_ctx_init(&dctx, APK_DIGEST_SHA256) != 0) return;
+	list_for_each_entry(tkey, &trust->trusted_key_list, key_node)
+		apk_digest_ctx_update(&dctx, tkey->key.id, sizeof tkey->key.id);
+	apk_digest_ctx_final(&dctx, d);
+	apk_digest_ctx_free(&dctx);
+}
+
+void apk_trust_verified_load(struct apk_trust *trust, int dirfd, const char *file)
+{
+	struct apk_trust_verified v = {};
+	struct apk_digest keyset;
+	struct apk_istream *is;
+	struct stat st;
+	apk_blob_t l, token = APK_BLOB_STRLIT("\n");
+
+	trust_keyset_digest(trust, &trust->keyset);
+	if (trust->keyset.alg == APK_DIGEST_NONE) return;
+	trust->verified_enabled = true;
+
+	if (fstatat(dirfd, file, &st, AT_SYMLINK_NOFOLLOW) != 0) return;
+	if (!S_ISREG(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 077)) return;
+
+	is = apk_istream_from_file(dirfd, file);
+	if (IS_ERR(is)) return;
+	if (apk_istream_get_delim(is, token, &l) != 0 || !apk_blob_pull_blob_match(&l, APK_BLOB_STRLIT("K:")))
+		goto done;
+	apk_digest_set(&keyset, APK_DIGEST_SHA256);
+	apk_blob_pull_hexdump(&l, APK_DIGEST_BLOB(keyset));
+	if (APK_BLOB_IS_NULL(l) || l.len || apk_digest_cmp(&keyset, &trust->keyset) != 0) goto done;
+
+	while (apk_istream_get_delim(is, token, &l) == 0) {
+		if (!apk_blob_pull_blob_match(&l, APK_BLOB_STRLIT("V:"))) continue;
+		apk_blob_pull_hexdump(&l, APK_BLOB_BUF(v.id));
+		if (APK_BLOB_IS_NULL(l) || l.len) continue;
+		apk_trust_verified_array_add(&trust->verified, v);
+	}
+done:
+	apk_istream_close(is);
+}
+
+int apk_trust_verified_save(struct apk_trust *trust, int dirfd, const char *file)
+{
+	struct apk_ostream *os;
+	char buf[128];
+	apk_blob_t b;
+	int n = 0;
+
+	if (!trust->verified_enabled || !trust->verified_dirty) return 0;
+
+	os = apk_ostream_to_file(dirfd, file, 0600);
+	if (IS_ERR(os)) return PTR_ERR(os);
+	b = APK_BLOB_BUF(buf);
+	apk_blob_push_blob(&b, APK_BLOB_STRLIT("K:"));
+	apk_blob_push_hexdump(&b, APK_DIGEST_BLOB(trust->keyset));
+	apk_blob_push_blob(&b, APK_BLOB_STRLIT("\n"));
+	apk_ostream_write_blob(os, apk_blob_pushed(APK_BLOB_BUF(buf), b));
+	for (int used = 1; used >= 0; used--) {
+		apk_array_foreach(v, trust->verified) {
+			if (v->used != used || n++ >= APK_TRUST_VERIFIED_MAX) continue;
+			b = APK_BLOB_BUF(buf);
+			apk_blob_push_blob(&b, APK_BLOB_STRLIT("V:"));
+			apk_blob_push_hexdump(&b, APK_BLOB_BUF(v->id));
+			apk_blob_push_blob(&b, APK_BLOB_STRLIT("\n"));
+			apk_ostream_write_blob(os, apk_blob_pushed(APK_BLOB_BUF(buf), b));
+		}
+	}
+	trust->verified_dirty = false;
+	return apk_ostream_close(os);
+}
+
+bool apk_trust_verified_lookup(struct apk_trust *trust, const struct apk_digest *id)
+{
+	bool found = false;
+
+	if (!trust->verified_enabled || id->len != APK_DIGEST_LENGTH_SHA256) return false;
+
+	pthread_mutex_lock(&trust->verified_lock);
+	apk_array_foreach(v, trust->verified) {
+		if (memcmp(v->id, id->data, sizeof v->id) != 0) continue;
+		v->used = found = true;
+		break;
+	}
+	pthread_mutex_unlock(&trust->verified_lock);
+	return found;
+}
+
+void apk_trust_verified_add(struct apk_trust *trust, const struct apk_digest *id)
+{
+	struct apk_trust_verified v = { .used = true };
+
+	if (!trust->verified_enabled || id->len != APK_DIGEST_LENGTH_SHA256) return;
+
+	memcpy(v.id, id->data, sizeof v.id);
+	pthread_mutex_lock(&trust->verified_lock);
+	apk_trust_verified_array_add(&trust->verified, v);
+	trust->verified_dirty = true;
+	pthread_mutex_unlock(&trust->verified_lock);
+}
@@ -11,6 +11,7 @@
 
 #include "apk_defines.h"
 #include "apk_version.h"
+#include "apk_atom.h"
 #include "apk_ctype.h"
 
 //#define DEBUG_PRINT
@@ -328,3 +329,118 @@ int apk_version_match(apk_blob_t a, int op, apk_blob_t b)
 	if (op & APK_VERSION_CONFLICT) ok = !ok;
 	return ok;
 }
+
+/* The sort key is the token stream of the version where each token is
+ * encoded as a type byte followed by a self delimiting value. The type
+ * bytes are ordered so that the first differing token type gives the
+ * same result as apk_version_compare_fuzzy(): pre-release suffixes sort
+ * first, and otherwise the higher token type sorts lower. The key ends
+ * with the END or INVALID token type. */
+#define KEY_PRERELEASE		0
+#define KEY_TYPE(token)		(1 + TOKEN_INVALID - (token))
+#define KEY_END			KEY_TYPE(TOKEN_END)
+
+static void key_push_u8(apk_blob_t *to, uint8_t v)
+{
+	apk_blob_push_blob(to, APK_BLOB_PTR_LEN((char *) &v, 1));
+}
+
+static void key_push_number(apk_blob_t *to, uint64_t v)
+{
+	uint8_t buf[9];
+	int n = 0;
+
+	for (uint64_t t = v; t; t >>= 8) n++;
+	buf[0] = n;
+	for (int i = n; i > 0; i--, v >>= 8) buf[i] = v & 0xff;
+	apk_blob_push_blob(to, APK_BLOB_PTR_LEN((char *) buf, n + 1));
+}
+
+static void key_push_string(apk_blob_t *to, apk_blob_t str)
+{
+	apk_blob_push_blob(to, str);
+	key_push_u8(to, 0);
+}
+
+bool apk_version_key(apk_blob_t ver, apk_blob_t *to)
+{
+	struct token_state t;
+
+	for (token_first(&t, &ver); ; token_next(&t, &ver)) {
+		if (t.token == TOKEN_SUFFIX && t.suffix < SUFFIX_NONE)
+			key_push_u8(to, KEY_PRERELEASE);
+		else
+			key_push_u8(to, KEY_TYPE(t.token));
+
+		switch (t.token) {
+		case TOKEN_DIGIT:
+			// leading zero uses string sort, and it sorts before
+			// any digit token without it
+			if (t.value.ptr[0] == '0') {
+				key_push_u8(to, 0);
+				key_push_string(to, t.value);
+				break;
+			}
+			key_push_u8(to, 1);
+			// fallthrough
+		case TOKEN_INITIAL_DIGIT:
+		case TOKEN_SUFFIX_NO:
+		case TOKEN_REVISION_NO:
+			key_push_number(to, t.number);
+			break;
+		case TOKEN_LETTER:
+			key_push_u8(to, t.value.ptr[0]);
+			break;
+		case TOKEN_SUFFIX:
+			key_push_u8(to, t.suffix);
+			break;
+		case TOKEN_COMMIT_HASH:
+			key_push_string(to, t.value);
+			break;
+		default:
+			return !APK_BLOB_IS_NULL(*to);
+		}
+	}
+}
+
+static int version_key_compare(apk_blob_t a, apk_blob_t b, bool fuzzy)
+{
+	int r;
+
+	// the key of 'b' without its END is a prefix of 'a'
+	if (fuzzy && b.ptr[b.len-1] == KEY_END && a.len >= b.len - 1 &&
+	    memcmp(a.ptr, b.ptr, b.len - 1) == 0)
+		return APK_VERSION_EQUAL;
+
+	r = memcmp(a.ptr, b.ptr, min(a.len, b.len));
+	if (r == 0) r = (int) a.len - (int) b.len;
+	if (r < 0) return APK_VERSION_LESS;
+	if (r > 0) return APK_VERSION_GREATER;
+	return APK_VERSION_EQUAL;
+}
+
+static int apk_version_compare_atom_fuzzy(const apk_blob_t *a, const apk_blob_t *b, bool fuzzy)
+{
+	apk_blob_t ka, kb;
+
+	if (a == b) return APK_VERSION_EQUAL;
+	ka = apk_atom_version_key(a);
+	kb = apk_atom_version_key(b);
+	if (APK_BLOB_IS_NULL(ka) || APK_BLOB_IS_NULL(kb))
+		return apk_version_compare_fuzzy(*a, *b, fuzzy);
+	return version_key_compare(ka, kb, fuzzy);
+}
+
+int apk_version_compare_atom(const apk_blob_t *a, const apk_blob_t *b)
+{
+	return apk_version_compare_atom_fuzzy(a, b, false);
+}
+
+int apk_version_match_atom(const apk_blob_t *a, int op, const apk_blob_t *b)
+{
+	int ok = 0;
+	if ((op & APK_DEPMASK_ANY) == APK_DEPMASK_ANY ||
+	    apk_version_compare_atom_fuzzy(a, b, (op & APK_VERSION_FUZZY) ? true : false) & op) ok = 1;
+	if (op & APK_VERSION_CONFLICT) ok = !ok;
+	return ok;
+}
@@ -0,0 +1,65 @@
+#!/bin/sh
+
+# commit_bench.sh - Alpine Package Keeper (APK)
+#
+# Installs a package with many small files into a root created in each
+# given directory, with and without --sync, and reports the wall clock
+# time of each install. Use directories on the filesystems to compare,
+# for example one on ext4 and one on tmpfs.
+#
+# usage: commit_bench.sh [-n files] DIR...
+#
+# SPDX-License-Identifier: GPL-2.0-only
+
+set -e
+
+[ "$APK" ] || { echo "APK environment variable not set"; exit 1; }
+
+num_files=20000
+while getopts "n:" opt; do
+	case "$opt" in
+	n) num_files="$OPTARG" ;;
+	*) exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+[ $# -gt 0 ] || set -- "${TMPDIR:-/tmp}"
+
+now_ms() {
+	echo $(($(date +%s%N) / 1000000))
+}
+
+WORK=$(mktemp -d -p "${TMPDIR:-/tmp}" apkbench.XXXXXXXX)
+# shellcheck disable=SC2064 # expand WORK here
+trap "rm -rf -- '$WORK'" EXIT
+
+i=0
+while [ "$i" -lt "$num_files" ]; do
+	d="$WORK/files/usr/share/bench/$((i / 500))"
+	[ -d "$d" ] || mkdir -p "$d"
+	echo "file $i" > "$d/file$i"
+	i=$((i + 1))
+done
+$APK --root "$WORK" mkpkg -I name:bench -I version:1.0 -F "$WORK/files" -o "$WORK/bench-1.0.apk"
+
+usermode=""
+[ "$(id -u)" = 0 ] || usermode="--usermode"
+
+printf "%-40s %-8s %8s %8s\n" "directory" "fstype" "nosync" "sync"
+for dir in "$@"; do
+	[ -d "$dir" ] || { echo "$dir: not a directory, skipping"; continue; }
+	fstype=$(stat -f -c %T "$dir" 2>/dev/null || echo "?")
+	printf "%-40s %-8s" "$dir" "$fstype"
+	for sync in --no-sync --sync; do
+		root=$(mktemp -d -p "$dir" apkbench-root.XXXXXXXX)
+		mkdir -p "$root/lib/apk/db" "$root/etc/apk" "$root/var/log"
+		ln -sf /dev/null "$root/var/log/apk.log"
+		start=$(now_ms)
+		$APK --root "$root" --allow-untrusted --no-interactive --no-cache --force-non-repository $sync \
+			add --initdb $usermode "$WORK/bench-1.0.apk" > /dev/null
+		end=$(now_ms)
+		rm -rf -- "$root"
+		printf " %6sms" "$((end - start))"
+	done
+	echo
+done
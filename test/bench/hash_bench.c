@@ -0,0 +1,192 @@
+/* hash_bench.c - Alpine Package Keeper (APK)
+ *
+ * Compares the chained and open addressing apk_hash modes using keys
+ * gathered from index or installed database files: package names (P:),
+ * directories (F:) and full file paths (F: + R:).
+ *
+ * usage: hash_bench [-r rounds] [-s synthetic-count] FILE...
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "apk_hash.h"
+#include "apk_print.h"
+#include "apk_balloc.h"
+#include "apk_io.h"
+
+struct bench_item {
+	apk_hash_node hash_node;
+	apk_blob_t key;
+};
+
+static apk_blob_t bench_get_key(apk_hash_item item)
+{
+	return ((struct bench_item *) item)->key;
+}
+
+static int bench_compare_item(apk_hash_item item, apk_blob_t key)
+{
+	return apk_blob_compare(((struct bench_item *) item)->key, key);
+}
+
+static const struct apk_hash_ops bench_ops = {
+	.node_offset = offsetof(struct bench_item, hash_node),
+	.get_key = bench_get_key,
+	.hash_key = apk_blob_hash,
+	.compare_item = bench_compare_item,
+};
+
+struct bench_keys {
+	struct apk_balloc ba;
+	struct bench_item *items;
+	size_t num, alloc;
+};
+
+static void add_key(struct bench_keys *k, apk_blob_t key)
+{
+	if (k->num >= k->alloc) {
+		k->alloc = k->alloc ? k->alloc * 2 : 4096;
+		k->items = realloc(k->items, k->alloc * sizeof k->items[0]);
+		if (!k->items) abort();
+	}
+	k->items[k->num++] = (struct bench_item) {
+		.key = apk_balloc_dup(&k->ba, key),
+	};
+}
+
+static int load_keys(struct bench_keys *k, const char *file)
+{
+	struct apk_istream *is = apk_istream_from_file(AT_FDCWD, file);
+	apk_blob_t l, dir = APK_BLOB_NULL;
+	char path[PATH_MAX];
+
+	if (IS_ERR(is)) return PTR_ERR(is);
+	while (apk_istream_get_delim(is, APK_BLOB_STR("\n"), &l) == 0) {
+		if (l.len < 2 || l.ptr[1] != ':') continue;
+		apk_blob_t v = APK_BLOB_PTR_LEN(l.ptr + 2, l.len - 2);
+		switch (l.ptr[0]) {
+		case 'P':
+			add_key(k, v);
+			break;
+		case 'F':
+			add_key(k, v);
+			dir = k->items[k->num-1].key;
+			break;
+		case 'R':
+			if (APK_BLOB_IS_NULL(dir) || dir.len + v.len + 2 > sizeof path) break;
+			add_key(k, APK_BLOB_PTR_LEN(path, apk_fmt(path, sizeof path, BLOB_FMT "/" BLOB_FMT, BLOB_PRINTF(dir), BLOB_PRINTF(v))));
+			break;
+		}
+	}
+	return apk_istream_close(is);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int count_item(apk_hash_item item, void *ctx)
+{
+	(*(size_t *) ctx)++;
+	return 0;
+}
+
+static void run(const char *mode, struct bench_keys *k, int open, int rounds)
+{
+	struct apk_hash h;
+	double t_insert = 0, t_hit = 0, t_miss = 0, t_iter = 0, t;
+	size_t found = 0, iterated = 0;
+	char miss[32];
+
+	for (int r = 0; r < rounds; r++) {
+		if (open) apk_hash_init_open(&h, &bench_ops, 0);
+		else apk_hash_init(&h, &bench_ops, 20000);
+
+		t = now();
+		for (size_t i = 0; i < k->num; i++)
+			apk_hash_insert(&h, &k->items[i]);
+		t_insert += now() - t;
+
+		t = now();
+		for (size_t i = 0; i < k->num; i++)
+			found += apk_hash_get(&h, k->items[i].key) != NULL;
+		t_hit += now() - t;
+
+		t = now();
+		for (size_t i = 0; i < k->num; i++)
+			found += apk_hash_get(&h, APK_BLOB_PTR_LEN(miss, apk_fmt(miss, sizeof miss, "miss-%zu", i))) != NULL;
+		t_miss += now() - t;
+
+		t = now();
+		apk_hash_foreach(&h, count_item, &iterated);
+		t_iter += now() - t;
+
+		apk_hash_free(&h);
+	}
+	if (found != k->num * rounds || iterated != k->num * rounds)
+		fprintf(stderr, "%s: inconsistent results\n", mode);
+
+	printf("%-8s insert %8.2f  hit %8.2f  miss %8.2f  foreach %8.2f  ns/key\n", mode,
+		t_insert * 1e9 / (k->num * rounds), t_hit * 1e9 / (k->num * rounds),
+		t_miss * 1e9 / (k->num * rounds), t_iter * 1e9 / (k->num * rounds));
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_keys k = {};
+	int opt, rounds = 5, synthetic = 0;
+	char buf[32];
+
+	while ((opt = getopt(argc, argv, "r:s:")) != -1) {
+		switch (opt) {
+		case 'r': rounds = atoi(optarg); break;
+		case 's': synthetic = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-r rounds] [-s synthetic-count] FILE...\n", argv[0]);
+			return 1;
+		}
+	}
+
+	apk_balloc_init(&k.ba, 64*1024);
+	for (int i = optind; i < argc; i++) {
+		int r = load_keys(&k, argv[i]);
+		if (r < 0) {
+			fprintf(stderr, "%s: %s\n", argv[i], apk_error_str(r));
+			return 1;
+		}
+	}
+	for (int i = 0; i < synthetic; i++)
+		add_key(&k, APK_BLOB_PTR_LEN(buf, apk_fmt(buf, sizeof buf, "synthetic-pkg-%d", i)));
+
+	/* Index files repeat names across providers; keep the first of each
+	 * so lookups and iteration counts are well defined. */
+	struct apk_hash uniq;
+	size_t n = 0;
+	apk_hash_init_open(&uniq, &bench_ops, k.num);
+	for (size_t i = 0; i < k.num; i++) {
+		if (apk_hash_get(&uniq, k.items[i].key)) continue;
+		k.items[n] = k.items[i];
+		apk_hash_insert(&uniq, &k.items[n++]);
+	}
+	apk_hash_free(&uniq);
+	k.num = n;
+	if (!k.num) {
+		fprintf(stderr, "no keys\n");
+		return 1;
+	}
+
+	printf("%zu keys, %d rounds\n", k.num, rounds);
+	run("chained", &k, 0, rounds);
+	run("open", &k, 1, rounds);
+
+	free(k.items);
+	apk_balloc_destroy(&k.ba);
+	return 0;
+}
@@ -0,0 +1,72 @@
+#!/bin/sh
+
+# inflate_bench.sh - Alpine Package Keeper (APK)
+#
+# Verifies each given v2 package with and without --threaded-inflate, and
+# reports the best wall clock time of the runs of each. Without packages,
+# a package with compressible data is generated.
+#
+# usage: inflate_bench.sh [-n runs] [PKG...]
+#
+# SPDX-License-Identifier: GPL-2.0-only
+
+set -e
+
+[ "$APK" ] || { echo "APK environment variable not set"; exit 1; }
+
+runs=5
+while getopts "n:" opt; do
+	case "$opt" in
+	n) runs="$OPTARG" ;;
+	*) exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+now_ms() {
+	echo $(($(date +%s%N) / 1000000))
+}
+
+WORK=$(mktemp -d -p "${TMPDIR:-/tmp}" apkbench.XXXXXXXX)
+# shellcheck disable=SC2064 # expand WORK here
+trap "rm -rf -- '$WORK'" EXIT
+
+if [ $# = 0 ]; then
+	mkdir -p "$WORK/data/usr/share/bench"
+	i=0
+	while [ "$i" -lt 64 ]; do
+		head -c 1000000 /dev/urandom | od -An -tx1 > "$WORK/data/usr/share/bench/file$i"
+		i=$((i + 1))
+	done
+	(cd "$WORK/data" && tar --format=posix -cf - usr) | gzip -6 > "$WORK/data.tar.gz"
+	cat > "$WORK/.PKGINFO" <<EOF
+pkgname = bench
+pkgver = 1.0-r0
+arch = noarch
+size = 1
+datahash = $(sha256sum "$WORK/data.tar.gz" | cut -d' ' -f1)
+EOF
+	(cd "$WORK" && tar --format=ustar -cf control.tar .PKGINFO)
+	sz=$(stat -c %s "$WORK/.PKGINFO")
+	head -c $((512 + (sz + 511) / 512 * 512)) "$WORK/control.tar" | gzip -6 > "$WORK/control.tar.gz"
+	cat "$WORK/control.tar.gz" "$WORK/data.tar.gz" > "$WORK/bench-1.0-r0.apk"
+	set -- "$WORK/bench-1.0-r0.apk"
+fi
+
+printf "%-40s %10s %10s\n" "package" "single" "threaded"
+for pkg in "$@"; do
+	printf "%-40s" "$(basename "$pkg")"
+	for opt in --no-threaded-inflate --threaded-inflate; do
+		best=
+		i=0
+		while [ "$i" -lt "$runs" ]; do
+			start=$(now_ms)
+			$APK --root "$WORK" --allow-untrusted --no-interactive $opt verify "$pkg" > /dev/null
+			t=$(($(now_ms) - start))
+			[ -z "$best" ] || [ "$t" -lt "$best" ] && best=$t
+			i=$((i + 1))
+		done
+		printf " %8sms" "$best"
+	done
+	echo
+done
@@ -0,0 +1,410 @@
+/* solver_bench.c - Alpine Package Keeper (APK)
+ *
+ * Runs apk_solver_solve() repeatedly on the test/solver fixtures and on
+ * synthetic repositories, and reports the time spent in each solver phase
+ * and the peak resident memory of each scenario.
+ *
+ * usage: solver_bench [-n iterations] [-s size[,size...]] [TEST...]
+ *
+ * Fixtures are interpreted at the world level: @WORLD, @INSTALLED, @REPO
+ * and the 'add' and 'upgrade' applets are supported, other tests are
+ * skipped. Synthetic repositories contain 'size' packages: two versions of
+ * each name, with deep dependency chains, shared library providers,
+ * prioritized virtual providers and install_if rules. Each size is solved
+ * both as a fresh install and as an upgrade of the older versions.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "apk_context.h"
+#include "apk_database.h"
+#include "apk_solver.h"
+#include "apk_tar.h"
+
+struct scenario {
+	char name[64];
+	char root[PATH_MAX];
+	struct apk_string_array *repos;
+	struct apk_string_array *args;
+	int num_repos;
+};
+
+struct result {
+	struct apk_solver_stats stats;
+	int packages, changes, errors;
+};
+
+struct totals {
+	struct apk_solver_stats stats;
+	int scenarios, skipped;
+	long maxrss;
+};
+
+static int iterations = 10;
+
+static int write_index(struct scenario *sc, apk_blob_t data, const char *tag)
+{
+	struct apk_ostream *os;
+	struct apk_file_info fi = {
+		.name = "APKINDEX",
+		.size = data.len,
+		.mode = S_IFREG | 0644,
+	};
+	char dir[PATH_MAX], file[PATH_MAX], line[PATH_MAX + 80];
+
+	if (apk_fmt(dir, sizeof dir, "%s/repo%d", sc->root, sc->num_repos++) < 0) return -ENOBUFS;
+	if (mkdir(dir, 0755) < 0) return -errno;
+	os = apk_ostream_gzip(apk_ostream_to_file(AT_FDCWD, apk_fmts(file, sizeof file, "%s/APKINDEX.tar.gz", dir), 0644));
+	if (IS_ERR(os)) return PTR_ERR(os);
+	apk_tar_write_entry(os, &fi, data.ptr);
+	apk_tar_write_entry(os, NULL, NULL);
+	apk_string_array_add(&sc->repos, strdup(apk_fmts(line, sizeof line, "ndx %s%s%s", tag ?: "", tag ? " " : "", file)));
+	return apk_ostream_close(os);
+}
+
+static int write_file(struct scenario *sc, const char *file, apk_blob_t data)
+{
+	struct apk_ostream *os;
+	char path[PATH_MAX];
+
+	os = apk_ostream_to_file(AT_FDCWD, apk_fmts(path, sizeof path, "%s/%s", sc->root, file), 0644);
+	if (IS_ERR(os)) return PTR_ERR(os);
+	apk_ostream_write_blob(os, data);
+	return apk_ostream_close(os);
+}
+
+static int scenario_init(struct scenario *sc, const char *name)
+{
+	char path[PATH_MAX];
+
+	*sc = (struct scenario) {};
+	apk_string_array_init(&sc->repos);
+	apk_string_array_init(&sc->args);
+	apk_fmt(sc->name, sizeof sc->name, "%s", name);
+	apk_fmt(sc->root, sizeof sc->root, "%s/apk-solver-bench.XXXXXX", getenv("TMPDIR") ?: "/tmp");
+	if (!mkdtemp(sc->root)) return -errno;
+	mkdir(apk_fmts(path, sizeof path, "%s/etc", sc->root), 0755);
+	mkdir(apk_fmts(path, sizeof path, "%s/etc/apk", sc->root), 0755);
+	mkdir(apk_fmts(path, sizeof path, "%s/lib", sc->root), 0755);
+	mkdir(apk_fmts(path, sizeof path, "%s/lib/apk", sc->root), 0755);
+	mkdir(apk_fmts(path, sizeof path, "%s/lib/apk/db", sc->root), 0755);
+	return write_file(sc, "etc/apk/world", APK_BLOB_NULL) ?:
+		write_file(sc, "lib/apk/db/installed", APK_BLOB_NULL);
+}
+
+static int rm_entry(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+	return remove(path);
+}
+
+static void scenario_free(struct scenario *sc)
+{
+	nftw(sc->root, rm_entry, 16, FTW_DEPTH | FTW_PHYS);
+	apk_array_foreach_item(s, sc->repos) free(s);
+	apk_array_foreach_item(s, sc->args) free(s);
+	apk_string_array_free(&sc->repos);
+	apk_string_array_free(&sc->args);
+}
+
+static int solve(struct scenario *sc, struct result *res)
+{
+	struct apk_ctx ctx;
+	struct apk_database db;
+	struct apk_dependency_array *world;
+	struct apk_changeset changeset;
+	unsigned short solver_flags = 0, name_flags = 0;
+	const char *applet = NULL;
+	int r;
+
+	apk_ctx_init(&ctx);
+	ctx.out.verbosity = 0;
+	ctx.root = sc->root;
+	ctx.flags |= APK_ALLOW_UNTRUSTED | APK_NO_CACHE | APK_NO_SCRIPTS | APK_NO_LOGFILE;
+	ctx.open_flags = APK_OPENF_READ | APK_OPENF_NO_SYS_REPOS | APK_OPENF_NO_AUTOUPDATE;
+	apk_array_foreach_item(repo, sc->repos)
+		apk_string_array_add(&ctx.repository_config_list, repo);
+
+	apk_array_foreach_item(arg, sc->args) {
+		if (arg[0] != '-') {
+			if (!applet) applet = arg;
+			continue;
+		}
+		if (!strcmp(arg, "--force-broken-world")) ctx.force |= APK_FORCE_BROKEN_WORLD;
+		else if (!strcmp(arg, "-u") || !strcmp(arg, "--upgrade")) name_flags |= APK_SOLVERF_UPGRADE;
+		else if (!strcmp(arg, "-a") || !strcmp(arg, "--available")) solver_flags |= APK_SOLVERF_AVAILABLE;
+		else if (!strcmp(arg, "-l") || !strcmp(arg, "--latest")) solver_flags |= APK_SOLVERF_LATEST;
+	}
+	if (applet && !strcmp(applet, "upgrade")) solver_flags |= APK_SOLVERF_UPGRADE;
+
+	apk_db_init(&db, &ctx);
+	r = apk_ctx_prepare(&ctx);
+	if (r == 0) r = apk_db_open(&db);
+	if (r != 0) goto err;
+
+	apk_dependency_array_init(&world);
+	apk_dependency_array_copy(&world, db.world);
+	if (applet && !strcmp(applet, "add")) {
+		bool seen_applet = false;
+		apk_array_foreach_item(arg, sc->args) {
+			struct apk_dependency dep;
+			apk_blob_t b = APK_BLOB_STR(arg);
+
+			if (arg[0] == '-') continue;
+			if (!seen_applet) {
+				seen_applet = true;
+				continue;
+			}
+			apk_blob_pull_dep(&b, &db, &dep, true);
+			if (APK_BLOB_IS_NULL(b) || b.len > 0 || dep.broken) continue;
+			apk_deps_add(&world, &dep);
+			apk_db_name_load_lazy(&db, dep.name);
+			apk_solver_set_name_flags(dep.name, name_flags, name_flags);
+		}
+	}
+
+	res->packages = db.available.packages.num_items;
+	db.solver_stats = &res->stats;
+	for (int i = 0; i < iterations; i++) {
+		changeset = (struct apk_changeset) {};
+		apk_change_array_init(&changeset.changes);
+		res->errors = apk_solver_solve(&db, solver_flags, world, &changeset);
+		res->changes = changeset.num_total_changes;
+		apk_change_array_free(&changeset.changes);
+	}
+	db.solver_stats = NULL;
+	apk_dependency_array_free(&world);
+err:
+	apk_db_close(&db);
+	apk_ctx_free(&ctx);
+	return r;
+}
+
+static void report(const char *name, const struct apk_solver_stats *st, long maxrss, const char *extra)
+{
+	unsigned int n = st->solves ?: 1;
+
+	printf("%-32s %6u solves  discover %9.3f  resolve %9.3f  changeset %9.3f  ms/solve  peak %7ld KiB%s\n",
+		name, st->solves, st->discover_ns / 1e6 / n, st->resolve_ns / 1e6 / n,
+		st->changeset_ns / 1e6 / n, maxrss, extra);
+}
+
+static void run_scenario(struct scenario *sc, struct totals *tot)
+{
+	struct result res = {};
+	struct rusage ru;
+	char extra[64];
+	int fd[2], status;
+	pid_t pid;
+
+	if (pipe(fd) < 0) return;
+	fflush(stdout);
+	pid = fork();
+	if (pid == 0) {
+		close(fd[0]);
+		if (solve(sc, &res) != 0) res.errors = -1;
+		if (write(fd[1], &res, sizeof res) != sizeof res) _exit(1);
+		_exit(0);
+	}
+	close(fd[1]);
+	if (pid < 0 || read(fd[0], &res, sizeof res) != sizeof res) res.errors = -1;
+	close(fd[0]);
+	if (pid > 0) wait4(pid, &status, 0, &ru);
+	else ru.ru_maxrss = 0;
+
+	if (res.errors < 0) {
+		printf("%-32s failed to open database\n", sc->name);
+		tot->skipped++;
+		return;
+	}
+	apk_fmt(extra, sizeof extra, "  (%d pkgs, %d changes%s)", res.packages, res.changes, res.errors ? ", errors" : "");
+	report(sc->name, &res.stats, ru.ru_maxrss, extra);
+
+	tot->scenarios++;
+	tot->stats.solves += res.stats.solves;
+	tot->stats.restarts += res.stats.restarts;
+	tot->stats.discover_ns += res.stats.discover_ns;
+	tot->stats.resolve_ns += res.stats.resolve_ns;
+	tot->stats.changeset_ns += res.stats.changeset_ns;
+	if (ru.ru_maxrss > tot->maxrss) tot->maxrss = ru.ru_maxrss;
+}
+
+static int load_fixture(struct scenario *sc, const char *test)
+{
+	char dir[PATH_MAX], path[PATH_MAX];
+	const char *base = strrchr(test, '/');
+	struct apk_istream *is;
+	apk_blob_t l, data;
+	int r = 0;
+
+	apk_fmt(dir, sizeof dir, "%.*s", base ? (int)(base - test) : 1, base ? test : ".");
+	if ((r = scenario_init(sc, base ? base + 1 : test)) < 0) return r;
+
+	is = apk_istream_from_file(AT_FDCWD, test);
+	if (IS_ERR(is)) return PTR_ERR(is);
+	while (r == 0 && apk_istream_get_delim(is, APK_BLOB_STR("\n"), &l) == 0) {
+		apk_blob_t cmd, arg, tag;
+		if (l.len == 0 || l.ptr[0] != '@') continue;
+		if (!apk_blob_split(l, APK_BLOB_STRLIT(" "), &cmd, &arg)) cmd = l, arg = APK_BLOB_NULL;
+		if (apk_blob_compare(cmd, APK_BLOB_STRLIT("@EXPECT")) == 0) {
+			break;
+		} else if (apk_blob_compare(cmd, APK_BLOB_STRLIT("@ARGS")) == 0) {
+			apk_blob_foreach_word(word, arg)
+				apk_string_array_add(&sc->args, strndup(word.ptr, word.len));
+		} else if (apk_blob_compare(cmd, APK_BLOB_STRLIT("@WORLD")) == 0) {
+			char world[1024];
+			apk_blob_t w = APK_BLOB_BUF(world);
+			apk_blob_foreach_word(word, arg) {
+				apk_blob_push_blob(&w, word);
+				apk_blob_push_blob(&w, APK_BLOB_STRLIT("\n"));
+			}
+			if (APK_BLOB_IS_NULL(w)) r = -ENOBUFS;
+			else r = write_file(sc, "etc/apk/world", APK_BLOB_PTR_PTR(world, w.ptr - 1));
+		} else if (apk_blob_compare(cmd, APK_BLOB_STRLIT("@INSTALLED")) == 0 ||
+			   apk_blob_compare(cmd, APK_BLOB_STRLIT("@REPO")) == 0) {
+			tag = APK_BLOB_NULL;
+			if (arg.len && arg.ptr[0] == '@') apk_blob_split(arg, APK_BLOB_STRLIT(" "), &tag, &arg);
+			r = apk_blob_from_file(AT_FDCWD, apk_fmts(path, sizeof path, "%s/" BLOB_FMT, dir, BLOB_PRINTF(arg)), &data);
+			if (r < 0) break;
+			if (cmd.ptr[1] == 'R') {
+				char tagbuf[64];
+				r = write_index(sc, data, tag.len ? apk_fmts(tagbuf, sizeof tagbuf, BLOB_FMT, BLOB_PRINTF(tag)) : NULL);
+			} else {
+				r = write_file(sc, "lib/apk/db/installed", data);
+			}
+			free(data.ptr);
+		} else {
+			/* @CACHE and unknown directives */
+			r = -ENOTSUP;
+		}
+	}
+	apk_istream_close(is);
+	if (r < 0) return r;
+
+	const char *applet = NULL;
+	apk_array_foreach_item(arg, sc->args) {
+		if (arg[0] == '-') {
+			if (!applet || !strcmp(arg, "-u") || !strcmp(arg, "--upgrade") ||
+			    !strcmp(arg, "-a") || !strcmp(arg, "--available") ||
+			    !strcmp(arg, "-l") || !strcmp(arg, "--latest")) continue;
+			return -ENOTSUP;
+		}
+		if (!applet) applet = arg;
+	}
+	if (!applet || (strcmp(applet, "add") && strcmp(applet, "upgrade"))) return -ENOTSUP;
+	return 0;
+}
+
+static void gen_pkg(FILE *f, int i, int ver, int names, bool installed)
+{
+	struct apk_digest d;
+	char id[64], csum[64];
+	apk_blob_t b = APK_BLOB_BUF(csum);
+	int libs = names / 16 ?: 1, tools = names / 8 ?: 1;
+
+	apk_fmt(id, sizeof id, "pkg%d-%d", i, ver);
+	apk_digest_calc(&d, APK_DIGEST_SHA1, id, strlen(id));
+	apk_blob_push_hash(&b, APK_DIGEST_BLOB(d));
+	fprintf(f, "C:%.*s\nP:pkg%d\nV:%d.0\nA:noarch\nS:1\nI:1\n", (int)(b.ptr - csum), csum, i, ver);
+
+	/* dependency chains 64 deep, one shared library and a virtual tool */
+	fprintf(f, "D:");
+	if ((i + 1) % 64 != 0 && i + 1 < names) fprintf(f, "pkg%d ", i + 1);
+	fprintf(f, "so:lib%d.so.1", (i * 31 + 7) % libs);
+	if (i % 8 == 2) fprintf(f, " cmd:tool%d", (i / 8) % tools);
+	fprintf(f, "\n");
+
+	if (i % 16 == 0 || i % 8 == 1) {
+		fprintf(f, "p:");
+		if (i % 16 == 0) fprintf(f, "so:lib%d.so.1=%d ", i / 16, ver);
+		if (i % 8 == 1) fprintf(f, "cmd:tool%d", (i / 8) % tools);
+		fprintf(f, "\n");
+		if (i % 8 == 1) fprintf(f, "k:%d\n", i % 5);
+	}
+	if (i % 32 == 5) fprintf(f, "i:pkg%d pkg%d\n", i - 1, (i * 13) % names);
+	if (installed) fprintf(f, "F:usr/share/pkg%d\nR:file\n", i);
+	fprintf(f, "\n");
+}
+
+static int load_synthetic(struct scenario *sc, int size, bool upgrade)
+{
+	char name[64], *buf = NULL;
+	size_t len = 0;
+	int names = size / 2 ?: 1, r;
+	FILE *f;
+
+	apk_fmt(name, sizeof name, "synthetic-%d-%s", size, upgrade ? "upgrade" : "install");
+	if ((r = scenario_init(sc, name)) < 0) return r;
+
+	f = open_memstream(&buf, &len);
+	for (int i = 0; i < names; i++) {
+		gen_pkg(f, i, 1, names, false);
+		gen_pkg(f, i, 2, names, false);
+	}
+	fclose(f);
+	r = write_index(sc, APK_BLOB_PTR_LEN(buf, len), NULL);
+	free(buf);
+	if (r < 0) return r;
+
+	f = open_memstream(&buf, &len);
+	for (int i = 0; i < names; i += 64) fprintf(f, "pkg%d\n", i);
+	fclose(f);
+	r = write_file(sc, "etc/apk/world", APK_BLOB_PTR_LEN(buf, len));
+	free(buf);
+	if (r < 0 || !upgrade) return r;
+
+	f = open_memstream(&buf, &len);
+	for (int i = 0; i < names; i++) gen_pkg(f, i, 1, names, true);
+	fclose(f);
+	r = write_file(sc, "lib/apk/db/installed", APK_BLOB_PTR_LEN(buf, len));
+	free(buf);
+	apk_string_array_add(&sc->args, strdup("upgrade"));
+	return r;
+}
+
+int main(int argc, char **argv)
+{
+	struct totals fixtures = {}, synthetic = {};
+	struct scenario sc;
+	char *sizes = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+		switch (opt) {
+		case 'n': iterations = atoi(optarg); break;
+		case 's': sizes = optarg; break;
+		default:
+			fprintf(stderr, "usage: %s [-n iterations] [-s size[,size...]] [TEST...]\n", argv[0]);
+			return 1;
+		}
+	}
+	apk_crypto_init();
+
+	for (int i = optind; i < argc; i++) {
+		if (load_fixture(&sc, argv[i]) == 0) run_scenario(&sc, &fixtures);
+		else fixtures.skipped++;
+		scenario_free(&sc);
+	}
+	if (fixtures.scenarios) {
+		char extra[64];
+		apk_fmt(extra, sizeof extra, "  (%d fixtures, %d skipped)", fixtures.scenarios, fixtures.skipped);
+		report("fixtures total", &fixtures.stats, fixtures.maxrss, extra);
+	}
+
+	apk_blob_foreach_token(size, APK_BLOB_STR(sizes ?: ""), APK_BLOB_STRLIT(",")) {
+		int n = apk_blob_pull_uint(&size, 10);
+		for (int upgrade = 0; upgrade < 2; upgrade++) {
+			if (load_synthetic(&sc, n, upgrade) == 0) run_scenario(&sc, &synthetic);
+			scenario_free(&sc);
+		}
+	}
+	return 0;
+}
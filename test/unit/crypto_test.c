@@ -0,0 +1,95 @@
+#include "apk_test.h"
+#include "apk_crypto.h"
+
+static const char *digest_impls[] = { "backend", "generic", "sha-ni", "armv8-ce" };
+
+static const struct {
+	uint8_t alg;
+	const char *data, *hex;
+} digest_vectors[] = {
+	{ APK_DIGEST_SHA1, "", "da39a3ee5e6b4b0d3255bfef95601890afd80709" },
+	{ APK_DIGEST_SHA1, "abc", "a9993e364706816aba3e25717850c26c9cd0d89d" },
+	{ APK_DIGEST_SHA1, "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+		"84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+	{ APK_DIGEST_SHA256, "", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+	{ APK_DIGEST_SHA256, "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+	{ APK_DIGEST_SHA256, "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+		"248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+	{ APK_DIGEST_SHA256_160, "abc", "ba7816bf8f01cfea414140de5dae2223b00361a3" },
+};
+
+static void crypto_setup(void)
+{
+	static bool initialized;
+	if (initialized) return;
+	apk_crypto_init();
+	initialized = true;
+}
+
+static void assert_digest_hex(struct apk_digest *d, const char *hex)
+{
+	char buf[APK_BLOB_DIGEST_BUF];
+	apk_blob_t b = APK_BLOB_BUF(buf);
+
+	apk_blob_push_hexdump(&b, APK_DIGEST_BLOB(*d));
+	assert_blob_equal(apk_blob_pushed(APK_BLOB_BUF(buf), b), APK_BLOB_STR(hex));
+}
+
+APK_TEST(crypto_digest_vectors) {
+	struct apk_digest_ctx dctx;
+	struct apk_digest d;
+	const char *impl;
+
+	crypto_setup();
+	impl = apk_digest_impl_name();
+	for (size_t i = 0; i < ARRAY_SIZE(digest_impls); i++) {
+		if (apk_digest_impl_select(digest_impls[i]) != 0) continue;
+		for (size_t j = 0; j < ARRAY_SIZE(digest_vectors); j++) {
+			const char *data = digest_vectors[j].data;
+
+			assert_int_equal(0, apk_digest_calc(&d, digest_vectors[j].alg, data, strlen(data)));
+			assert_digest_hex(&d, digest_vectors[j].hex);
+
+			assert_int_equal(0, apk_digest_ctx_init(&dctx, digest_vectors[j].alg));
+			for (const char *p = data; *p; p++)
+				assert_int_equal(0, apk_digest_ctx_update(&dctx, p, 1));
+			assert_int_equal(0, apk_digest_ctx_final(&dctx, &d));
+			assert_digest_hex(&d, digest_vectors[j].hex);
+			apk_digest_ctx_free(&dctx);
+		}
+	}
+	assert_int_equal(0, apk_digest_impl_select(impl));
+}
+
+APK_TEST(crypto_digest_impls_agree) {
+	static const uint8_t algs[] = { APK_DIGEST_SHA1, APK_DIGEST_SHA256 };
+	struct apk_digest_ctx dctx;
+	struct apk_digest ref, d;
+	uint8_t buf[4096 + 63];
+	const char *impl;
+
+	crypto_setup();
+	impl = apk_digest_impl_name();
+	for (size_t i = 0; i < sizeof buf; i++) buf[i] = i * 131 + (i >> 8);
+
+	for (size_t a = 0; a < ARRAY_SIZE(algs); a++) {
+		assert_int_equal(0, apk_digest_impl_select("backend"));
+		assert_int_equal(0, apk_digest_calc(&ref, algs[a], buf, sizeof buf));
+
+		for (size_t i = 0; i < ARRAY_SIZE(digest_impls); i++) {
+			if (apk_digest_impl_select(digest_impls[i]) != 0) continue;
+			assert_int_equal(0, apk_digest_ctx_init(&dctx, algs[a]));
+			for (size_t off = 0, n = 1; off < sizeof buf; off += n, n = n * 3 + 1)
+				assert_int_equal(0, apk_digest_ctx_update(&dctx, &buf[off], min(n, sizeof buf - off)));
+			assert_int_equal(0, apk_digest_ctx_final(&dctx, &d));
+			assert_int_equal(0, apk_digest_cmp(&ref, &d));
+
+			assert_int_equal(0, apk_digest_ctx_reset(&dctx));
+			assert_int_equal(0, apk_digest_ctx_update(&dctx, buf, sizeof buf));
+			assert_int_equal(0, apk_digest_ctx_final(&dctx, &d));
+			assert_int_equal(0, apk_digest_cmp(&ref, &d));
+			apk_digest_ctx_free(&dctx);
+		}
+	}
+	assert_int_equal(0, apk_digest_impl_select(impl));
+}
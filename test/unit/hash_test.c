@@ -0,0 +1,147 @@
+#include "apk_test.h"
+#include "apk_hash.h"
+
+struct test_item {
+	apk_hash_node hash_node;
+	apk_blob_t key;
+	char buf[16];
+};
+
+static apk_blob_t test_get_key(apk_hash_item item)
+{
+	return ((struct test_item *) item)->key;
+}
+
+static int test_compare_item(apk_hash_item item, apk_blob_t key)
+{
+	return apk_blob_compare(((struct test_item *) item)->key, key);
+}
+
+static const struct apk_hash_ops test_ops = {
+	.node_offset = offsetof(struct test_item, hash_node),
+	.get_key = test_get_key,
+	.hash_key = apk_blob_hash,
+	.compare_item = test_compare_item,
+};
+
+static int count_item(apk_hash_item item, void *ctx)
+{
+	(*(int *) ctx)++;
+	return 0;
+}
+
+static int delete_odd(apk_hash_item item, void *ctx)
+{
+	struct test_item *ti = item;
+	if ((ti->key.ptr[ti->key.len-1] - '0') & 1)
+		apk_hash_delete_hashed(ctx, ti->key, apk_hash_from_key(ctx, ti->key));
+	return 0;
+}
+
+static void hash_test(bool open)
+{
+	struct test_item items[1000];
+	struct apk_hash h;
+	char miss[16];
+	int i, n;
+
+	if (open) apk_hash_init_open(&h, &test_ops, 0);
+	else apk_hash_init(&h, &test_ops, 31);
+
+	for (i = 0; i < ARRAY_SIZE(items); i++) {
+		items[i].key = APK_BLOB_PTR_LEN(items[i].buf, apk_fmt(items[i].buf, sizeof items[i].buf, "item%d", i));
+		apk_hash_insert(&h, &items[i]);
+		/* lookups must keep working while the table is being resized */
+		assert_ptr_equal(apk_hash_get(&h, items[i/2].key), &items[i/2]);
+	}
+	assert_int_equal(h.num_items, ARRAY_SIZE(items));
+	for (i = 0; i < ARRAY_SIZE(items); i++) {
+		assert_ptr_equal(apk_hash_get(&h, items[i].key), &items[i]);
+		assert_null(apk_hash_get(&h, APK_BLOB_PTR_LEN(miss, apk_fmt(miss, sizeof miss, "miss%d", i))));
+	}
+
+	n = 0;
+	apk_hash_foreach(&h, count_item, &n);
+	assert_int_equal(n, ARRAY_SIZE(items));
+
+	apk_hash_foreach(&h, delete_odd, &h);
+	assert_int_equal(h.num_items, ARRAY_SIZE(items) / 2);
+	for (i = 0; i < ARRAY_SIZE(items); i++) {
+		if (i & 1) assert_null(apk_hash_get(&h, items[i].key));
+		else assert_ptr_equal(apk_hash_get(&h, items[i].key), &items[i]);
+	}
+
+	for (i = 1; i < ARRAY_SIZE(items); i += 2)
+		apk_hash_insert(&h, &items[i]);
+	n = 0;
+	apk_hash_foreach(&h, count_item, &n);
+	assert_int_equal(n, ARRAY_SIZE(items));
+	for (i = 0; i < ARRAY_SIZE(items); i++)
+		assert_ptr_equal(apk_hash_get(&h, items[i].key), &items[i]);
+
+	apk_hash_free(&h);
+}
+
+APK_TEST(hash_chained) { hash_test(false); }
+APK_TEST(hash_open) { hash_test(true); }
+
+struct grow_ctx {
+	struct apk_hash *h;
+	struct test_item *items;
+	int num_items, next;
+	int visits[1000];
+	bool deleted[1000];
+};
+
+static int grow_and_delete(apk_hash_item item, void *ctx)
+{
+	struct grow_ctx *g = ctx;
+	int i = (struct test_item *) item - g->items, j;
+
+	assert_false(g->deleted[i]);
+	g->visits[i]++;
+	/* grow the table several times, and delete some items not visited yet */
+	for (j = 0; j < 8 && g->next < g->num_items; j++)
+		apk_hash_insert(g->h, &g->items[g->next++]);
+	for (j = 0; j < 10; j++) {
+		if (g->visits[j] || g->deleted[j] || j == i) continue;
+		apk_hash_delete_hashed(g->h, g->items[j].key, apk_hash_from_key(g->h, g->items[j].key));
+		g->deleted[j] = true;
+		break;
+	}
+	return 0;
+}
+
+APK_TEST(hash_open_grow_in_foreach) {
+	struct test_item items[1000];
+	struct grow_ctx g = { .items = items, .num_items = ARRAY_SIZE(items) };
+	struct apk_hash h;
+	int i, n;
+
+	apk_hash_init_open(&h, &test_ops, 0);
+	g.h = &h;
+	for (i = 0; i < ARRAY_SIZE(items); i++)
+		items[i].key = APK_BLOB_PTR_LEN(items[i].buf, apk_fmt(items[i].buf, sizeof items[i].buf, "item%d", i));
+	for (g.next = 0; g.next < 20; g.next++)
+		apk_hash_insert(&h, &items[g.next]);
+
+	apk_hash_foreach(&h, grow_and_delete, &g);
+	assert_true(g.next > 100);
+	for (i = 0; i < 20; i++)
+		if (!g.deleted[i]) assert_int_equal(g.visits[i], 1);
+	for (i = 0, n = 0; i < g.next; i++) {
+		if (g.deleted[i]) {
+			assert_null(apk_hash_get(&h, items[i].key));
+		} else {
+			assert_ptr_equal(apk_hash_get(&h, items[i].key), &items[i]);
+			n++;
+		}
+	}
+	assert_int_equal(h.num_items, n);
+	assert_null(h.retired);
+
+	n = 0;
+	apk_hash_foreach(&h, count_item, &n);
+	assert_int_equal(n, h.num_items);
+	apk_hash_free(&h);
+}
@@ -1,5 +1,6 @@
 #include "apk_test.h"
 #include "apk_io.h"
+#include "apk_atom.h"
 #include "apk_version.h"
 
 static bool version_test_one(apk_blob_t arg)
@@ -45,3 +46,75 @@ APK_TEST(version_test) {
 	assert_int_equal(errors, 0);
 	assert_int_equal(apk_istream_close(is), 0);
 }
+
+static const char *version_test_token(unsigned int r)
+{
+	static const char *initial[] = {
+		"0", "1", "2", "10", "01", "007", "18446744073709551615", "99999999999999999999", "",
+	};
+	static const char *tokens[] = {
+		".0", ".1", ".2", ".10", ".01", ".007", ".00", "1", "0", "a", "b", "z",
+		"_alpha", "_beta", "_pre", "_rc", "_cvs", "_svn", "_git", "_hg", "_p",
+		"1", "2", "~0f", "~abc1", "~abc", "-r0", "-r1", "-r10", "-r", "_foo", "x", ".", "-", "~",
+	};
+	if (r & 0x10000) return initial[r % ARRAY_SIZE(initial)];
+	return tokens[r % ARRAY_SIZE(tokens)];
+}
+
+static apk_blob_t version_test_random(char *buf, size_t len)
+{
+	apk_blob_t b = APK_BLOB_PTR_LEN(buf, len);
+	int n = rand() % 6;
+
+	apk_blob_push_blob(&b, APK_BLOB_STR(version_test_token(rand() | 0x10000)));
+	while (n--) apk_blob_push_blob(&b, APK_BLOB_STR(version_test_token(rand() & 0xffff)));
+	return apk_blob_pushed(APK_BLOB_PTR_LEN(buf, len), b);
+}
+
+static void version_test_atoms(struct apk_atom_pool *atoms, apk_blob_t a, apk_blob_t b)
+{
+	apk_blob_t *aa = apk_atomize_version(atoms, a), *ab = apk_atomize_version(atoms, b);
+	int ops[] = {
+		APK_VERSION_LESS, APK_VERSION_EQUAL, APK_VERSION_GREATER,
+		APK_VERSION_EQUAL|APK_VERSION_FUZZY, APK_VERSION_GREATER|APK_VERSION_EQUAL|APK_VERSION_FUZZY,
+		APK_VERSION_LESS|APK_VERSION_EQUAL|APK_VERSION_FUZZY,
+	};
+
+	if (a.len) assert_false(APK_BLOB_IS_NULL(apk_atom_version_key(aa)));
+	if (apk_version_compare(a, b) != apk_version_compare_atom(aa, ab))
+		fail_msg("compare: " BLOB_FMT " " BLOB_FMT, BLOB_PRINTF(a), BLOB_PRINTF(b));
+	for (int i = 0; i < ARRAY_SIZE(ops); i++)
+		if (apk_version_match(a, ops[i], b) != apk_version_match_atom(aa, ops[i], ab))
+			fail_msg("match: " BLOB_FMT " %s " BLOB_FMT, BLOB_PRINTF(a), apk_version_op_string(ops[i]), BLOB_PRINTF(b));
+}
+
+APK_TEST(version_key_test) {
+	struct apk_balloc ba;
+	struct apk_atom_pool atoms;
+	apk_blob_t l, ver1, ver2, op;
+	struct apk_istream *is;
+	char buf1[128], buf2[128];
+
+	apk_balloc_init(&ba, 64*1024);
+	apk_atom_init(&atoms, &ba);
+
+	is  = apk_istream_from_file(AT_FDCWD, "version.data");
+	assert_ptr_ok(is);
+	while (apk_istream_get_delim(is, APK_BLOB_STR("\n"), &l) == 0) {
+		apk_blob_split(l, APK_BLOB_STRLIT("#"), &l, &op);
+		l = apk_blob_trim(l);
+		if (!apk_blob_split(l, APK_BLOB_STRLIT(" "), &ver1, &op) ||
+		    !apk_blob_split(op, APK_BLOB_STRLIT(" "), &op, &ver2)) continue;
+		version_test_atoms(&atoms, ver1, ver2);
+		version_test_atoms(&atoms, ver2, ver1);
+	}
+	assert_int_equal(apk_istream_close(is), 0);
+
+	// differential test against the tokenizer with random versions
+	srand(1);
+	for (int i = 0; i < 100000; i++)
+		version_test_atoms(&atoms, version_test_random(buf1, sizeof buf1), version_test_random(buf2, sizeof buf2));
+
+	apk_atom_free(&atoms);
+	apk_balloc_destroy(&ba);
+}
@@ -0,0 +1,60 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive"
+
+mkdir -p files/etc files/usr/bin files/usr/share/data
+echo "config" > files/etc/test.conf
+for i in $(seq 1 300); do
+	echo "data $i" > files/usr/share/data/file$i
+	echo "binary $i" > files/usr/bin/bin$i
+done
+$APK mkpkg -I name:test-a -I version:1.0 -F files -o test-a-1.0.apk
+$APK add --initdb $TEST_USERMODE test-a-1.0.apk > /dev/null
+
+$APK audit --system --jobs 4 | diff -u /dev/null - || assert "audit of clean system found changes"
+
+for i in 7 42 100 299; do
+	echo "modified" > "$TEST_ROOT"/usr/share/data/file$i
+	chmod 0700 "$TEST_ROOT"/usr/bin/bin$i
+done
+rm "$TEST_ROOT"/usr/share/data/file3
+echo "extra" > "$TEST_ROOT"/usr/share/data/extra
+
+# the report is in the same order regardless of the number of jobs
+$APK audit --system --check-permissions --jobs 1 > audit-1.log
+$APK audit --system --check-permissions --details -v --jobs 1 > details-1.log
+for jobs in 2 4 16; do
+	$APK audit --system --check-permissions --jobs $jobs | diff -u audit-1.log - || assert "audit with $jobs jobs differs"
+	$APK audit --system --check-permissions --details -v --jobs $jobs | diff -u details-1.log - || assert "detailed audit with $jobs jobs differs"
+done
+
+sort audit-1.log | diff -u - /dev/fd/4 4<<EOF || assert "wrong audit result"
+M usr/bin/bin100
+M usr/bin/bin299
+M usr/bin/bin42
+M usr/bin/bin7
+U usr/share/data/file100
+U usr/share/data/file299
+U usr/share/data/file42
+U usr/share/data/file7
+X usr/share/data/file3
+EOF
+
+$APK audit --system --packages --jobs 4 | diff -u - /dev/fd/4 4<<EOF || assert "wrong package audit result"
+test-a-1.0
+EOF
+
+! $APK audit --jobs 0 > /dev/null 2>&1 || assert "invalid number of jobs accepted"
+
+# more unowned files than the queue holds, mixed with files to check
+mkdir -p "$TEST_ROOT"/usr/share/unowned
+for i in $(seq 1 3000); do : > "$TEST_ROOT"/usr/share/unowned/f$i; done
+$APK audit --full -r --jobs 1 > full-1.log
+[ "$(grep -c "^A usr/share/unowned/" full-1.log)" = 3000 ] || assert "unowned files not reported"
+for jobs in 2 4; do
+	$APK audit --full -r --jobs $jobs | diff -u full-1.log - || assert "full audit with $jobs jobs differs"
+done
@@ -0,0 +1,92 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+journal_records() {
+	echo $(( ($(stat -c %s "$TEST_ROOT"/lib/apk/db/fingerprints) - 8) / 64 ))
+}
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive"
+
+mkdir -p files/usr/bin files/usr/share/data
+for i in $(seq 1 20); do
+	echo "data $i" > files/usr/share/data/file$i
+done
+echo "binary" > files/usr/bin/tool
+ln -s tool files/usr/bin/tool-link
+$APK mkpkg -I name:test-a -I version:1.0 -F files -o test-a-1.0.apk
+echo "binary 2" > files/usr/bin/tool
+$APK mkpkg -I name:test-a -I version:2.0 -F files -o test-a-2.0.apk
+
+mkdir -p files-b/usr/lib
+echo "library" > files-b/usr/lib/libb.so
+$APK mkpkg -I name:test-b -I version:1.0 -F files-b -o test-b-1.0.apk
+
+$APK add --initdb $TEST_USERMODE test-a-1.0.apk > /dev/null
+[ ! -e "$TEST_ROOT"/lib/apk/db/fingerprints ] || assert "journal created without opt-in"
+
+# the journal gets a record for each verified regular file
+$APK audit --system --journal | diff -u /dev/null - || assert "audit of clean system found changes"
+[ "$(journal_records)" = 21 ] || assert "wrong number of journal records: $(journal_records)"
+$APK audit --system | diff -u /dev/null - || assert "audit with journal found changes"
+
+# an audit of some files only keeps the records of the others
+$APK audit --journal /usr/share/data > /dev/null
+[ "$(journal_records)" = 21 ] || assert "partial audit replaced the journal: $(journal_records)"
+
+# modifications are detected even if size and mtime are kept
+touch -r "$TEST_ROOT"/usr/share/data/file1 ref
+echo "data X" > "$TEST_ROOT"/usr/share/data/file1
+touch -r ref "$TEST_ROOT"/usr/share/data/file1
+echo "extra" >> "$TEST_ROOT"/usr/share/data/file2
+$APK audit --system | sort | diff -u - /dev/fd/4 4<<EOF || assert "modifications not detected"
+U usr/share/data/file1
+U usr/share/data/file2
+EOF
+$APK audit --system --paranoid | sort | diff -u - /dev/fd/4 4<<EOF || assert "modifications not detected with --paranoid"
+U usr/share/data/file1
+U usr/share/data/file2
+EOF
+
+# modified files are not recorded when the journal is rewritten
+$APK audit --system --journal > /dev/null
+[ "$(journal_records)" = 19 ] || assert "modified files recorded: $(journal_records)"
+$APK audit --system | sort | diff -u - /dev/fd/4 4<<EOF || assert "modifications not detected after rewrite"
+U usr/share/data/file1
+U usr/share/data/file2
+EOF
+$APK fix test-a > /dev/null
+$APK audit --system | diff -u /dev/null - || assert "audit after fix found changes"
+
+# installing packages appends to the journal
+n=$(journal_records)
+$APK add test-b-1.0.apk > /dev/null
+[ "$(journal_records)" = $((n + 1)) ] || assert "install did not append to journal"
+$APK add test-a-2.0.apk > /dev/null
+[ "$(journal_records)" -gt $((n + 1)) ] || assert "upgrade did not append to journal"
+$APK audit --system | diff -u /dev/null - || assert "audit after upgrade found changes"
+echo "binary 3" > "$TEST_ROOT"/usr/bin/tool
+$APK audit --system | sort | diff -u - /dev/fd/4 4<<EOF || assert "modification after upgrade not detected"
+U usr/bin/tool
+EOF
+
+# repeated upgrades do not grow the journal without bound
+$APK fix test-a > /dev/null
+for i in 1 2 3 4 5; do
+	$APK add test-a-1.0.apk > /dev/null
+	$APK add test-a-2.0.apk > /dev/null
+done
+[ "$(journal_records)" -le 70 ] || assert "journal not compacted: $(journal_records)"
+$APK audit --system | diff -u /dev/null - || assert "audit after compaction found changes"
+echo "binary 4" > "$TEST_ROOT"/usr/bin/tool
+$APK audit --system | sort | diff -u - /dev/fd/4 4<<EOF || assert "modification after compaction not detected"
+U usr/bin/tool
+EOF
+
+# a damaged journal is ignored
+echo "garbage" > "$TEST_ROOT"/lib/apk/db/fingerprints
+$APK audit --system > audit.log 2>&1
+grep -q "fingerprint journal ignored" audit.log || assert "damaged journal not reported"
+grep -q "^U usr/bin/tool" audit.log || assert "modification not detected with damaged journal"
@@ -0,0 +1,52 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+setup_repo() {
+	local repo="$1" i
+
+	mkdir -p "$repo"
+	for i in 1 2 3 4 5; do
+		mkdir -p files-$i/data
+		head -c $((i * 20000)) /dev/urandom > files-$i/data/pkg$i
+		$APK mkpkg -I name:pkg$i -I version:1.0 -F files-$i -o "$repo"/pkg$i-1.0.apk
+	done
+	$APK mkpkg -I name:meta -I version:1.0 -I depends:"pkg1 pkg2 pkg3 pkg4 pkg5" -o "$repo"/meta-1.0.apk
+	$APK mkndx "$repo"/*.apk -o "$repo"/index.adb
+}
+
+APK="$APK --allow-untrusted --no-interactive --no-cache"
+setup_apkroot
+setup_repo "$PWD/repo"
+
+$APK add --initdb $TEST_USERMODE --parallel-downloads 2 --repository "test:/$PWD/repo/index.adb" meta 2>&1 | diff -u /dev/fd/4 4<<EOF - || assert "wrong add result"
+(1/6) Installing pkg1 (1.0)
+(2/6) Installing pkg2 (1.0)
+(3/6) Installing pkg3 (1.0)
+(4/6) Installing pkg4 (1.0)
+(5/6) Installing pkg5 (1.0)
+(6/6) Installing meta (1.0)
+OK: 0 MiB in 6 packages
+EOF
+for i in 1 2 3 4 5; do
+	cmp -s files-$i/data/pkg$i "$TEST_ROOT"/data/pkg$i || assert "pkg$i not installed correctly"
+done
+
+# a broken package is still detected and does not affect the others
+$APK del meta
+head -c 2000 repo/pkg3-1.0.apk > pkg3.tmp && mv pkg3.tmp repo/pkg3-1.0.apk
+! $APK add --parallel-downloads 3 --repository "test:/$PWD/repo/index.adb" meta > out.txt 2>&1 || assert "broken package installed"
+grep -q "ERROR: pkg3-1.0" out.txt || assert "pkg3 error not reported"
+for i in 1 2 4 5; do
+	cmp -s files-$i/data/pkg$i "$TEST_ROOT"/data/pkg$i || assert "pkg$i not installed correctly"
+done
+[ ! -e "$TEST_ROOT"/data/pkg3 ] || assert "broken pkg3 installed"
+
+# downloading ahead more packages than there are
+$APK del meta
+rm -rf repo && setup_repo "$PWD/repo"
+$APK add --parallel-downloads 64 --repository "test:/$PWD/repo/index.adb" meta > out.txt 2>&1 || assert "add with large prefetch depth failed"
+for i in 1 2 3 4 5; do
+	cmp -s files-$i/data/pkg$i "$TEST_ROOT"/data/pkg$i || assert "pkg$i not installed correctly"
+done
@@ -0,0 +1,45 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive --no-cache"
+
+# small documentation like packages sharing most of their content
+mkpkgs() {
+	for i in $(seq 1 60); do
+		rm -rf files && mkdir -p files/usr/share/doc/pkg$i
+		for j in 1 2 3; do
+			{
+				echo "This is the documentation of pkg$i, section $j."
+				seq 1 200 | sed "s/^/Common line of the documentation, item /"
+			} > files/usr/share/doc/pkg$i/README$j
+		done
+		$APK mkpkg "$@" -I name:pkg$i -I version:1.0 -F files -o pkg$i-1.0.apk
+	done
+}
+
+mkpkgs -c zstd:19 2>/dev/null || exit 77
+$APK mkndx -q --train-dict dict pkg*-1.0.apk
+[ -s dict ] || assert "dictionary not trained"
+plain_size=$(cat pkg*-1.0.apk | wc -c)
+
+mkpkgs -c zstd:19 --compression-dict dict
+dict_size=$(cat pkg*-1.0.apk | wc -c)
+[ "$dict_size" -lt "$plain_size" ] || assert "dictionary did not help ($dict_size >= $plain_size)"
+
+# the dictionary is embedded in the index, which is compressed without it
+$APK mkndx -q -c zstd:19 --compression-dict dict -o index.adb pkg*-1.0.apk
+$APK adbdump index.adb | grep -q "compression-dict:" || assert "dictionary not embedded"
+
+# and used to decompress the packages of the repository
+$APK add --initdb $TEST_USERMODE --repository "$PWD"/index.adb pkg1 pkg2 pkg60
+for i in 1 2 60; do
+	grep -q "documentation of pkg$i, section 3" "$TEST_ROOT"/usr/share/doc/pkg$i/README3 || assert "pkg$i not extracted"
+done
+
+# without the dictionary the package can not be decompressed
+mkdir out
+! $APK extract --destination out pkg3-1.0.apk 2> extract.log || assert "extracted without dictionary"
+grep -q "dictionary not available" extract.log || assert "wrong error without dictionary"
@@ -0,0 +1,63 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+create_pkg() {
+	local name="$1" ver="$2"
+	local pkgdir="files/${name}-${ver}"
+
+	mkdir -p "$pkgdir"/etc "$pkgdir"/usr/bin "$pkgdir"/usr/share/"$name"
+	echo "config ${name}" > "$pkgdir"/etc/"$name".conf
+	echo "binary ${name}" > "$pkgdir"/usr/bin/"$name"
+	echo "data ${name}" > "$pkgdir"/usr/share/"$name"/data
+	chmod 0755 "$pkgdir"/usr/bin/"$name"
+	chmod 0700 "$pkgdir"/usr/share/"$name"
+
+	$APK mkpkg -I "name:${name}" -I "version:${ver}" -F "$pkgdir" -o "${name}-${ver}.apk"
+}
+
+db_contents() {
+	$APK query --fields name,version,contents,replaces --format yaml --installed '*'
+}
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive"
+
+create_pkg test-a 1.0
+create_pkg test-b 1.0
+
+$APK add --initdb $TEST_USERMODE --db-snapshot test-a-1.0.apk test-b-1.0.apk
+[ -f "$TEST_ROOT"/lib/apk/db/installed.snapshot ] || assert "snapshot not written"
+
+with_snapshot="$(db_contents)"
+$APK audit --system --check-permissions | diff -u /dev/null - || assert "audit with snapshot failed"
+
+mv "$TEST_ROOT"/lib/apk/db/installed.snapshot snapshot.saved
+without_snapshot="$(db_contents)"
+[ "$with_snapshot" = "$without_snapshot" ] || assert "snapshot contents differ"
+
+# Database update without the option removes the snapshot
+mv snapshot.saved "$TEST_ROOT"/lib/apk/db/installed.snapshot
+$APK del test-b
+[ -e "$TEST_ROOT"/lib/apk/db/installed.snapshot ] && assert "snapshot not removed"
+
+# Stale snapshot still listing test-b is ignored, the live database wins
+$APK add --db-snapshot test-b-1.0.apk
+cp "$TEST_ROOT"/lib/apk/db/installed.snapshot snapshot.saved
+$APK del test-b
+cp snapshot.saved "$TEST_ROOT"/lib/apk/db/installed.snapshot
+db_contents > stale.yaml
+grep -q "test-b" stale.yaml && assert "stale snapshot used"
+[ "$(grep -c '^- name:' stale.yaml)" = 1 ] || assert "installed packages missing with stale snapshot"
+touch -r snapshot.saved "$TEST_ROOT"/lib/apk/db/installed
+db_contents | grep -q "test-b" && assert "stale snapshot used after mtime reset"
+rm "$TEST_ROOT"/lib/apk/db/installed.snapshot
+
+$APK add --db-snapshot test-b-1.0.apk
+[ -f "$TEST_ROOT"/lib/apk/db/installed.snapshot ] || assert "snapshot not written"
+[ "$(db_contents)" = "$without_snapshot" ] || assert "snapshot contents differ after update"
+$APK del --db-snapshot test-a
+[ "$(db_contents | grep -c '^- name:')" = 1 ] || assert "removal not reflected in snapshot"
+
+exit 0
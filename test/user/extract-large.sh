@@ -0,0 +1,37 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive"
+
+# large enough to be written by the writer pool
+mkdir -p files/usr/lib/big files/usr/share/big
+for i in $(seq 1 24); do
+	head -c 400000 /dev/urandom > files/usr/lib/big/file$i
+	chmod 0640 files/usr/lib/big/file$i
+done
+head -c 6000000 /dev/urandom > files/usr/share/big/huge
+ln files/usr/lib/big/file7 files/usr/share/big/link7
+ln -s ../../lib/big/file3 files/usr/share/big/sym3
+: > files/usr/share/big/empty
+touch -d "2020-01-02 03:04:05" files/usr/lib/big/file5
+# many small files, written in several batches
+mkdir -p files/usr/share/small
+for i in $(seq 1 150); do
+	echo "small $i" > files/usr/share/small/file$i
+done
+
+$APK mkpkg -I name:large -I version:1.0 -F files -o large-1.0.apk
+$APK add --initdb $TEST_USERMODE large-1.0.apk
+
+for f in $(cd files && find . -type f); do
+	cmp -s files/"$f" "$TEST_ROOT"/"$f" || assert "$f differs"
+done
+[ "$(stat -c %a "$TEST_ROOT"/usr/lib/big/file1)" = 640 ] || assert "wrong mode"
+[ "$(stat -c %Y "$TEST_ROOT"/usr/lib/big/file5)" = "$(stat -c %Y files/usr/lib/big/file5)" ] || assert "wrong mtime"
+[ "$(stat -c %i "$TEST_ROOT"/usr/lib/big/file7)" = "$(stat -c %i "$TEST_ROOT"/usr/share/big/link7)" ] || assert "hardlink broken"
+[ -L "$TEST_ROOT"/usr/share/big/sym3 ] || assert "symlink missing"
+! ls -a "$TEST_ROOT"/usr/lib/big | grep -q "^\.apk\." || assert "temporary files left"
+$APK audit --system | diff -u /dev/null - || assert "audit found changes"
@@ -0,0 +1,48 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+# Builds a v2 package without signature: a gzip member with the control
+# tar (without end of archive blocks) followed by a gzip member with data.
+build_v2pkg() {
+	local pkg="$1" datahash="${2:-}" sz
+
+	(cd data && tar --format=posix -cf - usr) | gzip -9 > data.tar.gz
+	[ -n "$datahash" ] || datahash=$(sha256sum data.tar.gz | cut -d' ' -f1)
+	cat > .PKGINFO <<EOF
+pkgname = test-a
+pkgver = 1.0-r0
+arch = noarch
+size = 1
+datahash = $datahash
+EOF
+	tar --format=ustar -cf control.tar .PKGINFO
+	sz=$(stat -c %s .PKGINFO)
+	head -c $((512 + (sz + 511) / 512 * 512)) control.tar | gzip -9 > control.tar.gz
+	cat control.tar.gz data.tar.gz > "$pkg"
+}
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive"
+
+mkdir -p data/usr/share/test-a
+for i in $(seq 1 40); do
+	head -c $((i * 5000)) /dev/urandom | base64 > data/usr/share/test-a/file$i
+done
+
+build_v2pkg test-a-1.0-r0.apk
+for opt in --threaded-inflate --no-threaded-inflate; do
+	$APK verify $opt test-a-1.0-r0.apk || assert "verify failed with $opt"
+done
+
+build_v2pkg bad-hash.apk 0000000000000000000000000000000000000000000000000000000000000000
+for opt in --threaded-inflate --no-threaded-inflate; do
+	! $APK verify $opt bad-hash.apk || assert "bad datahash verified with $opt"
+done
+
+size=$(stat -c %s test-a-1.0-r0.apk)
+head -c $((size - 100)) test-a-1.0-r0.apk > truncated.apk
+for opt in --threaded-inflate --no-threaded-inflate; do
+	! $APK verify $opt truncated.apk || assert "truncated package verified with $opt"
+done
@@ -0,0 +1,44 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive --no-cache"
+
+$APK mkpkg -I name:app -I version:1.0 -I depends:so:libfoo.so.1 -o app-1.0.apk
+$APK mkpkg -I name:libfoo -I version:1.0 -I provides:so:libfoo.so.1=1 -o libfoo-1.0.apk
+$APK mkpkg -I name:app-doc -I version:1.0 -I "install-if:app docs" -o app-doc-1.0.apk
+$APK mkpkg -I name:docs -I version:1.0 -o docs-1.0.apk
+$APK mkpkg -I name:unrelated -I version:1.0 -I depends:missing -o unrelated-1.0.apk
+$APK mkndx -q -o index.adb app-1.0.apk libfoo-1.0.apk app-doc-1.0.apk docs-1.0.apk unrelated-1.0.apk
+$APK mkpkg -I name:app -I version:2.0 -I depends:so:libfoo.so.1 -o app-2.0.apk
+$APK mkndx -q -o index2.adb app-2.0.apk libfoo-1.0.apk
+
+# add loads only the packages reachable from the world
+$APK add --simulate --repository index.adb app docs 2>&1 | diff -u /dev/fd/4 4<<EOF - || assert "wrong add result"
+(1/4) Installing libfoo (1.0)
+(2/4) Installing app (1.0)
+(3/4) Installing docs (1.0)
+(4/4) Installing app-doc (1.0)
+OK: 0 MiB in 4 packages
+EOF
+
+$APK add --simulate --repository index.adb --repository index2.adb app 2>&1 | diff -u /dev/fd/4 4<<EOF - || assert "wrong add result"
+(1/2) Installing libfoo (1.0)
+(2/2) Installing app (2.0)
+OK: 0 MiB in 2 packages
+EOF
+
+$APK add --simulate --repository index.adb nonexistent 2>&1 | diff -u /dev/fd/4 4<<EOF - && assert "add of missing package succeeded"
+ERROR: unable to select packages:
+  nonexistent (no such package):
+    required by: world[nonexistent]
+EOF
+
+# installed packages see their repository versions
+$APK add --repository index.adb app
+$APK add --simulate --repository index.adb --repository index2.adb --upgrade app 2>&1 | diff -u /dev/fd/4 4<<EOF - || assert "wrong upgrade result"
+(1/1) Upgrading app (1.0 -> 2.0)
+OK: 0 MiB in 2 packages
+EOF
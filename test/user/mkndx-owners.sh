@@ -0,0 +1,67 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+APK="$APK --allow-untrusted --no-interactive"
+
+setup_apkroot
+BASE_APK="$APK"
+mkdir -p repo files-a1/usr/bin files-a2/usr/bin files-b/usr/lib
+echo "foo 1" > files-a1/usr/bin/foo
+echo "foo 2" > files-a2/usr/bin/foo
+echo "foo2" > files-a2/usr/bin/foo2
+echo "libb" > files-b/usr/lib/libb.so
+ln -s libb.so files-b/usr/lib/libb.so.1
+$APK mkpkg -I name:owned-a -I version:1.0 -F files-a1 -o repo/owned-a-1.0.apk
+$APK mkpkg -I name:owned-a -I version:2.0 -F files-a2 -o repo/owned-a-2.0.apk
+$APK mkpkg -I name:owned-b -I version:1.0 -F files-b -o repo/owned-b-1.0.apk
+# many packages shipping the same paths span several path blocks
+for i in $(seq 1 40); do
+	mkdir -p files-$i/usr/share/common files-$i/usr/share/pkg$i
+	echo "common $i" > files-$i/usr/share/common/data
+	for j in $(seq 1 5); do echo "$i $j" > files-$i/usr/share/pkg$i/file$j; done
+	$APK mkpkg -I name:pkg$i -I version:1.$i -F files-$i -o repo/pkg$i-1.$i.apk
+done
+$APK mkndx --owners repo/index.adb.owners -o repo/index.adb repo/*.apk > /dev/null
+[ -f repo/index.adb.owners ] || assert "side index not created"
+
+owner() {
+	$APK query --fields name,version "$@" | sed -n 's/^\(Name\|Version\): //p' | paste -sd' '
+}
+
+APK="$APK --repository $PWD/repo/index.adb"
+[ "$(owner --match owner /usr/bin/foo)" = "owned-a 2.0" ] || assert "wrong owner of /usr/bin/foo"
+[ "$(owner --match owner --all-matches /usr/bin/foo)" = "owned-a 1.0 owned-a 2.0" ] || assert "wrong owners of /usr/bin/foo"
+[ "$(owner --match owner /usr/bin/foo2)" = "owned-a 2.0" ] || assert "wrong owner of /usr/bin/foo2"
+[ "$(owner --match owner /usr/lib/libb.so.1)" = "owned-b 1.0" ] || assert "wrong owner of symlink"
+[ "$(owner --match owner /usr/share/pkg33/file5)" = "pkg33 1.33" ] || assert "wrong owner of /usr/share/pkg33/file5"
+[ "$(owner --match owner --all-matches /usr/share/common/data | wc -w)" = 80 ] || assert "wrong owners of a path spanning blocks"
+[ -z "$(owner --match owner /usr/bin /usr/bin/fo /usr/bin/foo3 /usr/share/pkg99/file1 /zzz)" ] || assert "owner found for unknown paths"
+[ -z "$(owner --installed --match owner /usr/bin/foo)" ] || assert "side index used with --installed"
+
+# installed files are resolved from the database
+$APK add --initdb $TEST_USERMODE owned-a=1.0 > /dev/null
+[ "$(owner --match owner /usr/bin/foo)" = "owned-a 1.0" ] || assert "installed owner not preferred"
+[ "$(owner --match owner /usr/bin/foo2)" = "owned-a 2.0" ] || assert "wrong owner of not installed file"
+
+# reusing the old index gives the same side index
+cp repo/index.adb.owners owners.old
+$APK mkndx --owners repo/index.adb.owners -x repo/index.adb -o repo/index.adb repo/*.apk > /dev/null
+cmp -s owners.old repo/index.adb.owners || assert "side index differs when the old index is used"
+! $APK mkndx --owners owners.new --filter-spec '${name}-${version}' -x repo/index.adb -o filtered.adb repo/*.apk > /dev/null 2>&1 ||
+	assert "--owners accepted with --filter-spec"
+
+# remote repositories cache the side index
+APK="$BASE_APK --repository test:/$PWD/repo/index.adb"
+$APK update > /dev/null
+[ "$(owner --match owner /usr/bin/foo2)" = "owned-a 2.0" ] || assert "wrong owner from remote side index"
+ls "$TEST_ROOT"/etc/apk/cache/OWNERS.* > /dev/null 2>&1 || assert "side index not cached"
+$APK cache clean > /dev/null 2>&1 || true
+ls "$TEST_ROOT"/etc/apk/cache/OWNERS.* > /dev/null 2>&1 || assert "cache clean removed the side index"
+
+# a damaged side index is ignored
+for f in "$TEST_ROOT"/etc/apk/cache/OWNERS.*; do head -c 100 repo/index.adb.owners > "$f"; done
+$APK --no-network query --match owner /usr/bin/foo2 > query.log 2>&1
+grep -q "owners: " query.log || assert "damaged side index not reported"
+! grep -q "^Name:" query.log || assert "owner found from damaged side index"
@@ -0,0 +1,59 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+inode() {
+	stat -c %i "$1"
+}
+
+install_root() {
+	root="$1"
+	shift
+	rm -rf "$root" && mkdir -p "$root"/lib/apk/db "$root"/etc/apk
+	$APK --root "$TEST_ROOT/tmp/$root" add --initdb $TEST_USERMODE "$@" objs-1.0.apk
+}
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive --object-cache $TEST_ROOT/tmp/objects"
+
+mkdir -p files/usr/lib files/usr/bin files/etc
+head -c 100000 /dev/urandom > files/usr/lib/data
+echo "hello" > files/usr/bin/tool
+chmod 0755 files/usr/bin/tool
+echo "config" > files/etc/objs.conf
+
+$APK mkpkg -I name:objs -I version:1.0 -F files -o objs-1.0.apk
+
+install_root root1 --object-cache-link
+install_root root2 --object-cache-link
+for f in usr/lib/data usr/bin/tool; do
+	cmp -s files/$f root2/$f || assert "$f differs"
+	[ "$(inode root1/$f)" = "$(inode root2/$f)" ] || assert "$f not shared"
+done
+[ "$(stat -c %a root2/usr/bin/tool)" = 755 ] || assert "wrong mode"
+[ "$(inode root1/etc/objs.conf)" != "$(inode root2/etc/objs.conf)" ] || assert "protected file shared"
+
+# linking is off by default
+install_root root3
+[ "$(inode root1/usr/lib/data)" != "$(inode root3/usr/lib/data)" ] || assert "linked by default"
+cmp -s files/usr/lib/data root3/usr/lib/data || assert "data differs"
+
+# objects with different metadata are not linked
+chmod 0700 root1/usr/bin/tool
+install_root root4 --object-cache-link
+[ "$(inode root1/usr/bin/tool)" != "$(inode root4/usr/bin/tool)" ] || assert "mismatching object linked"
+[ "$(stat -c %a root4/usr/bin/tool)" = 755 ] || assert "wrong mode"
+[ "$(inode root1/usr/lib/data)" = "$(inode root4/usr/lib/data)" ] || assert "data not shared"
+
+# the object with different metadata was replaced by the file of root4
+install_root root5 --object-cache-link
+[ "$(inode root4/usr/bin/tool)" = "$(inode root5/usr/bin/tool)" ] || assert "replaced object not linked"
+
+# objects modified in place are not used
+mtime=$(stat -c %Y root5/usr/bin/tool)
+echo "HELLO" > root5/usr/bin/tool
+touch -d "@$mtime" root5/usr/bin/tool
+install_root root6 --object-cache-link
+[ "$(cat root6/usr/bin/tool)" = "hello" ] || assert "modified object used"
+[ "$(inode root5/usr/bin/tool)" != "$(inode root6/usr/bin/tool)" ] || assert "modified object linked"
@@ -0,0 +1,43 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive --object-cache $TEST_ROOT/tmp/objects"
+
+mkdir -p files/usr/lib files/usr/bin
+head -c 100000 /dev/urandom > files/usr/lib/data
+echo "hello" > files/usr/bin/tool
+chmod 0755 files/usr/bin/tool
+ln -s ../lib/data files/usr/bin/data
+: > files/usr/lib/empty
+
+$APK mkpkg -I name:objs -I version:1.0 -F files -o objs-1.0.apk
+$APK add --initdb $TEST_USERMODE objs-1.0.apk
+
+[ "$(find objects -type f | wc -l)" = 3 ] || assert "wrong number of objects"
+[ "$(find objects -name '.*' | wc -l)" = 0 ] || assert "temporary objects left"
+find objects -type f -exec cmp -s files/usr/lib/data {} \; -print | grep -q . || assert "data object missing"
+
+# a second root is populated from the objects
+mkdir -p root2/lib/apk/db root2/etc/apk
+$APK --root "$TEST_ROOT"/tmp/root2 add --initdb $TEST_USERMODE objs-1.0.apk
+[ "$(cat root2/usr/bin/tool)" = "hello" ] || assert "wrong content"
+[ "$(stat -c %a root2/usr/bin/tool)" = 755 ] || assert "wrong mode"
+cmp -s files/usr/lib/data root2/usr/lib/data || assert "data differs"
+[ -L root2/usr/bin/data ] || assert "symlink missing"
+
+# modified objects are not used, and are replaced by the extracted file
+obj=$(find objects -type f -size 6c)
+echo "HELLO" > "$obj"
+rm -rf root2 && mkdir -p root2/lib/apk/db root2/etc/apk
+$APK --root "$TEST_ROOT"/tmp/root2 add --initdb $TEST_USERMODE objs-1.0.apk
+[ "$(cat root2/usr/bin/tool)" = "hello" ] || assert "modified object used"
+[ "$(cat "$obj")" = "hello" ] || assert "modified object not replaced"
+
+# objects of a different size are ignored
+head -c 10 /dev/zero > "$obj"
+rm -rf root2 && mkdir -p root2/lib/apk/db root2/etc/apk
+$APK --root "$TEST_ROOT"/tmp/root2 add --initdb $TEST_USERMODE objs-1.0.apk
+[ "$(cat root2/usr/bin/tool)" = "hello" ] || assert "bad object used"
@@ -0,0 +1,49 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+setup_repo() {
+	local repo="$1" i
+
+	mkdir -p "$repo"
+	for i in 1 2 3 4 5; do
+		mkdir -p files-$i/data
+		head -c $((i * 20000)) /dev/urandom > files-$i/data/pkg$i
+		$APK mkpkg -I name:pkg$i -I version:1.0 -F files-$i -o "$repo"/pkg$i-1.0.apk
+	done
+	$APK mkpkg -I name:meta -I version:1.0 -I depends:"pkg1 pkg2 pkg3 pkg4 pkg5" -o "$repo"/meta-1.0.apk
+	$APK mkndx "$repo"/*.apk -o "$repo"/index.adb
+}
+
+APK="$APK --allow-untrusted --no-interactive"
+setup_apkroot
+setup_repo "$PWD/repo"
+mkdir -p "$TEST_ROOT"/etc/apk/cache
+
+$APK add --initdb $TEST_USERMODE --cache-predownload --parallel-downloads 3 --repository "test:/$PWD/repo/index.adb" meta > out.txt 2>&1 || assert "add failed"
+grep -q "^Downloading 5 packages" out.txt || assert "packages not predownloaded"
+grep "Downloading pkg" out.txt | sed 's/.*Downloading \(pkg[0-9]\).*/\1/' | xargs | diff -u /dev/fd/4 4<<EOF - || assert "not downloaded largest first"
+pkg5 pkg4 pkg3 pkg2 pkg1
+EOF
+for i in 1 2 3 4 5; do
+	ls "$TEST_ROOT"/etc/apk/cache/pkg$i-1.0.*.apk > /dev/null || assert "pkg$i not cached"
+	[ -f "$TEST_ROOT"/data/pkg$i ] || assert "pkg$i not installed"
+done
+
+# a failed transfer does not affect the others
+$APK del meta
+rm -f "$TEST_ROOT"/etc/apk/cache/*.apk
+: > repo/pkg3-1.0.apk
+! $APK cache download --parallel-downloads 4 --repository "test:/$PWD/repo/index.adb" meta > out.txt 2>&1 || assert "broken package not detected"
+grep -q "ERROR: pkg3-1.0" out.txt || assert "pkg3 error not reported"
+for i in 1 2 4 5; do
+	ls "$TEST_ROOT"/etc/apk/cache/pkg$i-1.0.*.apk > /dev/null || assert "pkg$i not cached"
+done
+! ls "$TEST_ROOT"/etc/apk/cache/pkg3-1.0.*.apk > /dev/null 2>&1 || assert "broken pkg3 cached"
+
+# invalid counts are rejected
+for n in -1 65 abc; do
+	! $APK cache download --parallel-downloads $n --repository "test:/$PWD/repo/index.adb" meta > out.txt 2>&1 || assert "count $n accepted"
+	grep -q "invalid number of parallel downloads: $n" out.txt || assert "count $n not reported"
+done
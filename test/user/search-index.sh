@@ -0,0 +1,73 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+APK="$APK --allow-untrusted --no-interactive"
+
+setup_apkroot
+mkdir -p repo
+for i in $(seq 1 40); do
+	$APK mkpkg -I name:pkg$i -I version:1.$i -I arch:noarch \
+		-I "description:Package number $i for the Widget Toolkit" \
+		-I provides:cmd:tool$((i % 7)) -o repo/pkg$i-1.$i.apk
+done
+$APK mkpkg -I name:libfoo -I version:1.0 -I arch:noarch -I "description:The FooBar library" \
+	-I provides:so:libfoo.so.1=1 -o repo/libfoo-1.0.apk
+$APK mkpkg -I name:libfoo -I version:2.0 -I arch:noarch -I "description:The FooBar library, version two" \
+	-I provides:so:libfoo.so.2=2 -o repo/libfoo-2.0.apk
+$APK mkpkg -I name:foobar-utils -I version:1.0 -I arch:noarch -I "description:Utilities" -o repo/foobar-utils-1.0.apk
+$APK mkndx -d "test repo" repo/*.apk -o repo/index.adb
+APK="$APK --repository test:/$PWD/repo/index.adb"
+
+$APK update > /dev/null
+[ -f "$TEST_ROOT"/etc/apk/cache/search.idx ] || assert "search index not written"
+
+run_searches() {
+	for p in foo FOO bar libfoo.so.2 tool3 widget toolkit "number 1" "Number 2 " "r 4" \
+		 xyz fo "f*o" "lib?oo" "version two" so.1 ary; do
+		echo "== $p"
+		$APK search "$p" || true
+		$APK search -d "$p" || true
+		$APK search -a -d "$p" || true
+		$APK query --search --fields name,version "$p" || true
+		$APK query --search --match name,description --fields name,version "$p" || true
+	done
+}
+
+# the results must be the same with and without the index
+run_searches > indexed.log 2>&1
+$APK search -d widget 2>&1 | grep -q "^pkg40-1.40" || assert "search with index failed"
+$APK search -a -d "version two" 2>&1 | diff -u - /dev/fd/4 4<<EOF || assert "description search with index failed"
+libfoo-2.0
+EOF
+$APK search -d foobar 2>&1 | sort | diff -u - /dev/fd/4 4<<EOF || assert "case-insensitive search with index failed"
+foobar-utils-1.0
+libfoo-1.0
+libfoo-2.0
+EOF
+
+cp "$TEST_ROOT"/etc/apk/cache/search.idx old-search.idx
+rm "$TEST_ROOT"/etc/apk/cache/search.idx
+run_searches > scan.log 2>&1
+diff -u scan.log indexed.log || assert "search index results differ from full scan"
+
+# a stale index is not used
+$APK mkpkg -I name:newpkg -I version:1.0 -I arch:noarch -I "description:Brand new widget" -o repo/newpkg-1.0.apk
+$APK mkndx -d "test repo" repo/*.apk -o repo/index.adb
+$APK update > /dev/null
+cp old-search.idx "$TEST_ROOT"/etc/apk/cache/search.idx
+$APK search -d "brand new" 2>&1 | diff -u - /dev/fd/4 4<<EOF || assert "stale search index used"
+newpkg-1.0
+EOF
+
+# a damaged index is not used
+head -c 100 old-search.idx > "$TEST_ROOT"/etc/apk/cache/search.idx
+$APK search foobar 2>&1 | diff -u - /dev/fd/4 4<<EOF || assert "damaged search index used"
+foobar-utils-1.0
+EOF
+
+$APK cache clean > /dev/null 2>&1 || true
+$APK update > /dev/null
+$APK cache clean > /dev/null 2>&1 || true
+[ -f "$TEST_ROOT"/etc/apk/cache/search.idx ] || assert "cache clean removed the search index"
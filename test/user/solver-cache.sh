@@ -0,0 +1,51 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+check_same() {
+	$APK --simulate "$@" > full.out 2>&1 || :
+	$APK --simulate --solver-cache "$@" > cached.out 2>&1 || :
+	diff -u full.out cached.out || assert "solver cache changed result: $*"
+}
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive --no-cache --repository index.adb"
+
+$APK mkpkg -I name:app -I version:1.0 -I depends:so:libfoo.so.1 -o app-1.0.apk
+$APK mkpkg -I name:libfoo -I version:1.0 -I provides:so:libfoo.so.1=1 -o libfoo-1.0.apk
+$APK mkpkg -I name:tool -I version:1.0 -o tool-1.0.apk
+$APK mkpkg -I name:tool-doc -I version:1.0 -I "install-if:tool docs" -o tool-doc-1.0.apk
+$APK mkpkg -I name:docs -I version:1.0 -o docs-1.0.apk
+$APK mkndx -q -o index.adb app-1.0.apk libfoo-1.0.apk tool-1.0.apk tool-doc-1.0.apk docs-1.0.apk
+
+$APK add --initdb $TEST_USERMODE --solver-cache app 2>&1 | diff -u /dev/fd/4 4<<EOF - || assert "wrong add result"
+(1/2) Installing libfoo (1.0)
+(2/2) Installing app (1.0)
+OK: 0 MiB in 2 packages
+EOF
+[ -f "$TEST_ROOT"/lib/apk/db/solver.cache ] || assert "solver cache not written"
+grep -q "^N:.*:app$" "$TEST_ROOT"/lib/apk/db/solver.cache || assert "app not cached"
+
+check_same add tool
+check_same add docs
+check_same del app
+check_same add !libfoo
+
+$APK add --solver-cache tool docs
+grep -q "^N:.*:tool-doc$" "$TEST_ROOT"/lib/apk/db/solver.cache || assert "tool-doc not cached"
+
+check_same add app
+check_same del docs
+check_same fix
+check_same upgrade
+
+# cached solutions are ignored when the repository changes
+$APK mkpkg -I name:app -I version:2.0 -I depends:so:libfoo.so.1 -o app-2.0.apk
+$APK mkndx -q -o index.adb app-2.0.apk libfoo-1.0.apk tool-1.0.apk tool-doc-1.0.apk docs-1.0.apk
+$APK upgrade --simulate --solver-cache 2>&1 | diff -u /dev/fd/4 4<<EOF - || assert "wrong upgrade result"
+(1/1) Upgrading app (1.0 -> 2.0)
+OK: 0 MiB in 5 packages
+EOF
+check_same upgrade
+check_same del tool
@@ -0,0 +1,19 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive"
+
+mkdir -p files/a files/b
+echo hello > files/a/hello
+echo world > files/b/world
+$APK mkpkg -I name:hello -I version:1.0 -F files -o hello-1.0.apk
+
+$APK add --initdb $TEST_USERMODE --sync hello-1.0.apk
+[ -f "$TEST_ROOT"/a/hello ] || assert "file not installed"
+grep -q "^P:hello$" "$TEST_ROOT"/lib/apk/db/installed || assert "database not written"
+
+$APK del --sync hello
+[ ! -e "$TEST_ROOT"/a/hello ] || assert "file not removed"
@@ -0,0 +1,54 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+command -v openssl > /dev/null || exit 77
+
+setup_apkroot
+APK="$APK --no-interactive"
+
+mkdir -p "$TEST_ROOT"/etc/apk/keys
+openssl genrsa -out test.rsa 2048 2> /dev/null
+openssl rsa -in test.rsa -pubout -out "$TEST_ROOT"/etc/apk/keys/test.rsa.pub 2> /dev/null
+openssl genrsa -out other.rsa 2048 2> /dev/null
+openssl rsa -in other.rsa -pubout -out other.rsa.pub 2> /dev/null
+
+$APK mkpkg --allow-untrusted -I name:foo -I version:1.0 -o foo-1.0.apk
+$APK mkpkg --allow-untrusted -I name:bar -I version:1.0 -o bar-1.0.apk
+$APK mkndx --allow-untrusted -q --sign-key test.rsa -o index.adb foo-1.0.apk
+$APK mkndx --allow-untrusted -q --sign-key test.rsa -o index2.adb bar-1.0.apk
+
+# read only commands do not write the cache
+$APK search --repository index.adb foo > /dev/null
+[ -e "$TEST_ROOT"/etc/apk/cache/verified ] && assert "verified cache written by search"
+
+# a successful verification is recorded in a private cache file
+$APK update --repository index.adb > /dev/null
+[ -f "$TEST_ROOT"/etc/apk/cache/verified ] || assert "verified cache not written"
+[ "$(stat -c %a "$TEST_ROOT"/etc/apk/cache/verified)" = 600 ] || assert "verified cache not private"
+[ "$(grep -c ^V: "$TEST_ROOT"/etc/apk/cache/verified)" = 1 ] || assert "wrong number of cache entries"
+
+# entries of repositories not loaded in a run are kept
+$APK update --repository index.adb --repository index2.adb > /dev/null
+[ "$(grep -c ^V: "$TEST_ROOT"/etc/apk/cache/verified)" = 2 ] || assert "new entry not cached"
+$APK update --repository index2.adb > /dev/null
+[ "$(grep -c ^V: "$TEST_ROOT"/etc/apk/cache/verified)" = 2 ] || assert "unused entry dropped"
+
+# cached results are dropped when the trusted keys change
+rm "$TEST_ROOT"/etc/apk/keys/test.rsa.pub
+cp other.rsa.pub "$TEST_ROOT"/etc/apk/keys/
+$APK search --repository index2.adb bar > search.log 2>&1 || true
+grep -q "UNTRUSTED signature" search.log || assert "untrusted index accepted"
+
+# a cache file writable by others is ignored
+rm "$TEST_ROOT"/etc/apk/keys/other.rsa.pub
+openssl rsa -in test.rsa -pubout -out "$TEST_ROOT"/etc/apk/keys/test.rsa.pub 2> /dev/null
+$APK update --repository index2.adb > /dev/null
+chmod 666 "$TEST_ROOT"/etc/apk/cache/verified
+$APK update --repository index2.adb > /dev/null
+[ "$(stat -c %a "$TEST_ROOT"/etc/apk/cache/verified)" = 600 ] || assert "insecure verified cache reused"
+
+# cache clean keeps the verification cache
+$APK cache clean
+[ -f "$TEST_ROOT"/etc/apk/cache/verified ] || assert "verified cache removed by cache clean"
@@ -0,0 +1,53 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+installed_db="$(realpath "$(dirname "$0")/query-installed.data")"
+setup_apkroot
+cp "$installed_db" "$TEST_ROOT"/lib/apk/db/installed
+
+APK="$APK --no-network"
+
+# all installed files, some directories and unknown paths
+$APK info -L $($APK info -q) 2>/dev/null | grep -v "contains:$" | grep . | sed 's,^,/,' > paths
+cat >> paths <<EOF
+/usr
+/etc/apk
+/usr/bin/scanelf
+/bin/not-found
+/not-found
+usr/lib/libapk.so.2.14.0
+/
+EOF
+[ "$(wc -l < paths)" -gt 1000 ] || assert "too few paths"
+
+! $APK info -W -v $(cat paths) > single.log 2> single.err || assert "unknown paths found"
+! $APK info -W -v --args-from-stdin < paths > batch.log 2> batch.err || assert "unknown paths found in batch"
+sort single.log > single.sorted
+sort batch.log | diff -u single.sorted - || assert "batch results differ"
+sort single.err > single-err.sorted
+sort batch.err | diff -u single-err.sorted - || assert "batch errors differ"
+grep -q "^ERROR: /not-found: Could not find owner package" batch.err || assert "unknown path not reported"
+
+! $APK info -W -q --args-from-stdin < paths > batch-q.log 2>/dev/null || assert "unknown paths found in batch"
+! $APK info -W -q $(cat paths) 2>/dev/null | diff -u - batch-q.log || assert "batch package list differs"
+
+$APK info -W --format json $(cat paths) | sort > single-json.sorted
+$APK info -W --format json --args-from-stdin < paths | sort | diff -u single-json.sorted - || assert "batch json differs"
+
+grep "^/" paths > abspaths
+$APK query --match owner --fields name,version $(cat abspaths) > query-single.log 2>/dev/null || true
+$APK query --match owner --fields name,version --args-from-stdin < abspaths > query-batch.log 2>/dev/null || true
+diff -u query-single.log query-batch.log || assert "batch query differs"
+$APK query --match owner --fields name --args-from-stdin /usr/bin/scanelf < /dev/null | diff -u - /dev/fd/4 4<<EOF || assert "command line argument not used"
+Name: scanelf
+EOF
+
+# applets sharing the query options read the arguments from stdin as well
+printf 'scanelf\napk-tools\n' > names
+$APK list --installed scanelf apk-tools > list-args.log
+[ "$(wc -l < list-args.log)" = 2 ] || assert "list output wrong"
+$APK list --installed --args-from-stdin < names | diff -u list-args.log - || assert "list ignores stdin arguments"
+$APK policy scanelf apk-tools > policy-args.log
+$APK policy --args-from-stdin < names | diff -u policy-args.log - || assert "policy ignores stdin arguments"
@@ -0,0 +1,40 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive"
+
+mkdir -p files/usr/share/test-a
+for i in $(seq 1 20); do
+	head -c $((i * 10000)) /dev/urandom | base64 > files/usr/share/test-a/file$i
+done
+# repeated content beyond the default window
+cat files/usr/share/test-a/* files/usr/share/test-a/* > files/usr/share/test-a/all
+
+# skip if built without zstd
+$APK mkpkg -c zstd:3 -I name:test-a -I version:1.0 -F files -o test-a-1.0.apk 2>/dev/null || exit 77
+$APK mkpkg -c zstd:3:27 -I name:test-b -I version:1.0 -F files -o test-b-1.0.apk
+
+! $APK mkpkg -c zstd:3:31 -I name:test-c -I version:1.0 -F files -o test-c-1.0.apk 2>/dev/null || assert "invalid window accepted"
+! $APK mkpkg -c deflate:6:20 -I name:test-c -I version:1.0 -F files -o test-c-1.0.apk 2>/dev/null || assert "deflate window accepted"
+
+for opt in --threaded-inflate --no-threaded-inflate; do
+	for pkg in test-a-1.0.apk test-b-1.0.apk; do
+		rm -rf out && mkdir out
+		$APK extract $opt --destination out "$pkg"
+		for f in $(cd files && find . -type f); do
+			cmp -s files/"$f" out/"$f" || assert "$pkg: $f differs with $opt"
+		done
+		$APK adbdump $opt "$pkg" | grep -q "name: test-" || assert "$pkg: adbdump failed with $opt"
+	done
+done
+
+# a truncated package must fail in both modes
+size=$(stat -c %s test-a-1.0.apk)
+head -c $((size / 2)) test-a-1.0.apk > truncated.apk
+for opt in --threaded-inflate --no-threaded-inflate; do
+	rm -rf out && mkdir out
+	! $APK extract $opt --destination out truncated.apk 2>/dev/null || assert "truncated package extracted with $opt"
+done